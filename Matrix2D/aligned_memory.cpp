@@ -0,0 +1,41 @@
+/**
+* @file aligned_memory.cpp
+* Contains implementations of the aligned buffer helpers.
+*/
+#include "stdafx.h"
+#include "aligned_memory.h"
+#include "profiler.h"
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		struct BlockHeader {
+			MatrixAllocator *allocator;
+			size_t bytes; /** Size of the whole block, header included. */
+		};
+		static_assert(sizeof(BlockHeader) <= kBufferAlignment, "The block header must fit in one alignment unit.");
+
+		double *AllocateBuffer(size_t count, MatrixAllocator *allocator) {
+			if (count == 0) return nullptr;
+			if (count > (SIZE_MAX - 2 * kBufferAlignment) / sizeof(double)) throw bad_alloc();
+			size_t bytes = kBufferAlignment + (count * sizeof(double) + kBufferAlignment - 1) / kBufferAlignment * kBufferAlignment;
+			if (!allocator) allocator = CurrentAllocator();
+			char *block = static_cast<char*>(allocator->allocate(bytes));
+			new (block) BlockHeader{ allocator, bytes };
+			double *buf = reinterpret_cast<double*>(block + kBufferAlignment);
+			memset(buf, 0, count * sizeof(double));
+			NoteBufferAllocation(count * sizeof(double));
+			return buf;
+		}
+		void FreeBuffer(double *buf) noexcept {
+			if (!buf) return;
+			char *block = reinterpret_cast<char*>(buf) - kBufferAlignment;
+			const BlockHeader *h = reinterpret_cast<const BlockHeader*>(block);
+			h->allocator->deallocate(block, h->bytes);
+		}
+	}
+}
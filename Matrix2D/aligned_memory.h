@@ -0,0 +1,49 @@
+/**
+ * @file aligned_memory.h
+ * Internal helpers for the cache-line aligned buffers backing Matrix2D storage.
+ * Not part of the public interface.
+ */
+
+#ifndef MATRIX2D_ALIGNED_MEMORY
+#define MATRIX2D_ALIGNED_MEMORY
+
+#include "matrix_allocator.h"
+#include <cstddef>
+
+namespace m2d {
+	namespace detail {
+		/** Alignment, in bytes, of every matrix buffer. One cache line, and enough for any SIMD load. */
+		constexpr size_t kBufferAlignment = 64;
+		/** Number of doubles in one aligned block. Padded row strides are a multiple of this. */
+		constexpr size_t kDoublesPerAlignment = kBufferAlignment / sizeof(double);
+
+		/** Rounds a column count up to the padded leading dimension used for storage.
+		* @param cols: Logical number of columns.
+		* @return The smallest multiple of kDoublesPerAlignment that is not smaller than cols.
+		*/
+		constexpr size_t PaddedStride(size_t cols) {
+			return (cols + kDoublesPerAlignment - 1) / kDoublesPerAlignment * kDoublesPerAlignment;
+		}
+		/** Leading dimension of a matrix with the given column count: PaddedStride(cols), except that a single column
+		* is stored densely, so that column vectors stream through whole cache lines instead of one line per element.
+		*/
+		constexpr size_t MatrixStride(size_t cols) {
+			return cols == 1 ? 1 : PaddedStride(cols);
+		}
+
+		/** Allocates an aligned, zero-initialised buffer of doubles. The block starts with a header, one alignment
+		* unit long, recording the allocator and block size, so that FreeBuffer() needs only the pointer.
+		* @param count: Number of doubles to allocate. A count of zero returns nullptr.
+		* @param allocator: Allocator to draw from; nullptr means CurrentAllocator().
+		* @return Pointer to the buffer, aligned to kBufferAlignment.
+		* @exception bad_alloc() if the allocation fails.
+		*/
+		double *AllocateBuffer(size_t count, MatrixAllocator *allocator = nullptr);
+		/** Releases a buffer obtained from AllocateBuffer() to the allocator it came from. Passing nullptr is a no-op.
+		* @param buf: The buffer to release.
+		*/
+		void FreeBuffer(double *buf) noexcept;
+	}
+}
+
+#endif // MATRIX2D_ALIGNED_MEMORY
@@ -0,0 +1,205 @@
+/**
+* @file basic_matrix.cpp
+* Contains implementations of the BasicMatrix class template and its explicit instantiations.
+*/
+#include "stdafx.h"
+#include "basic_matrix.h"
+#include "aligned_memory.h"
+#include "gemm_kernel.h"
+#include "factor_kernels.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		// Rows are padded to whole 64-byte blocks, whatever the element size, so every row starts on a cache line.
+		// As with Matrix2D, a single column is stored densely.
+		template <class T>
+		static size_t PaddedStrideOf(size_t cols) {
+			constexpr size_t per_block = kBufferAlignment / sizeof(T);
+			return cols == 1 ? 1 : (cols + per_block - 1) / per_block * per_block;
+		}
+	}
+
+	// Constructor and destructor
+	template <class T>
+	BasicMatrix<T>::BasicMatrix(size_t size_x, size_t size_y) :
+		size_x(size_x), size_y(size_y), stride(detail::PaddedStrideOf<T>(size_y)) {
+		// The buffer comes from the double allocator: the same zero-filled bytes, counted in doubles and rounded up,
+		// since an unpadded single column of floats need not fill a whole number of them.
+		elem = reinterpret_cast<T*>(detail::AllocateBuffer((size_x * stride * sizeof(T) + sizeof(double) - 1) / sizeof(double)));
+	}
+	template <class T>
+	BasicMatrix<T>::BasicMatrix(const BasicMatrix& src) :
+		BasicMatrix(src.size_x, src.size_y) {
+		if (elem) memcpy(elem, src.elem, size_x * stride * sizeof(T));
+	}
+	template <class T>
+	BasicMatrix<T>::BasicMatrix(BasicMatrix&& src) noexcept :
+		elem(src.elem), size_x(src.size_x), size_y(src.size_y), stride(src.stride) {
+		src.elem = nullptr;
+		src.size_x = src.size_y = src.stride = 0;
+	}
+	template <class T>
+	BasicMatrix<T>& BasicMatrix<T>::operator=(const BasicMatrix& src) {
+		if (this == &src) return *this;
+		if (size_x == src.size_x && size_y == src.size_y) {
+			if (elem) memcpy(elem, src.elem, size_x * stride * sizeof(T));
+			return *this;
+		}
+		return *this = BasicMatrix(src);
+	}
+	template <class T>
+	BasicMatrix<T>& BasicMatrix<T>::operator=(BasicMatrix&& src) noexcept {
+		swap(elem, src.elem);
+		swap(size_x, src.size_x);
+		swap(size_y, src.size_y);
+		swap(stride, src.stride);
+		return *this;
+	}
+	template <class T>
+	BasicMatrix<T>::~BasicMatrix() {
+		detail::FreeBuffer(reinterpret_cast<double*>(elem));
+	}
+
+	// Getter and setter
+	template <class T>
+	T BasicMatrix<T>::getAt(size_t pos_x, size_t pos_y) const {
+		if (pos_x >= size_x || pos_y >= size_y) throw out_of_range("Indices exceeded BasicMatrix range.");
+		return elem[pos_x * stride + pos_y];
+	}
+	template <class T>
+	void BasicMatrix<T>::setAt(size_t pos_x, size_t pos_y, T val) {
+		if (pos_x >= size_x || pos_y >= size_y) throw out_of_range("Indices exceeded BasicMatrix range.");
+		elem[pos_x * stride + pos_y] = val;
+	}
+
+	// Display
+	template <class T>
+	void BasicMatrix<T>::print() const {
+		for (size_t x = 0; x < size_x; x++) {
+			for (size_t y = 0; y < size_y; y++) {
+				cout << coeff(x, y) << ' ';
+			}
+			cout << endl;
+		}
+	}
+
+	// Arithmetic
+	template <class T>
+	BasicMatrix<T>& BasicMatrix<T>::operator+=(const BasicMatrix& other) {
+		if (size_x != other.size_x || size_y != other.size_y)
+			throw invalid_argument("Cannot add matrices of different sizes.");
+		for (size_t x = 0; x < size_x; x++) {
+			T *r = row(x);
+			const T *o = other.row(x);
+			for (size_t y = 0; y < size_y; y++) r[y] += o[y];
+		}
+		return *this;
+	}
+	template <class T>
+	BasicMatrix<T>& BasicMatrix<T>::operator-=(const BasicMatrix& other) {
+		if (size_x != other.size_x || size_y != other.size_y)
+			throw invalid_argument("Cannot subtract matrices of different sizes.");
+		for (size_t x = 0; x < size_x; x++) {
+			T *r = row(x);
+			const T *o = other.row(x);
+			for (size_t y = 0; y < size_y; y++) r[y] -= o[y];
+		}
+		return *this;
+	}
+	template <class T>
+	BasicMatrix<T>& BasicMatrix<T>::operator*=(T factor) {
+		for (size_t x = 0; x < size_x; x++) {
+			T *r = row(x);
+			for (size_t y = 0; y < size_y; y++) r[y] *= factor;
+		}
+		return *this;
+	}
+	template <class T>
+	BasicMatrix<T> BasicMatrix<T>::operator*(const BasicMatrix& other) const {
+		if (size_y != other.size_x)
+			throw invalid_argument("Cannot multiply these matrices: incompatible dimensions.");
+		BasicMatrix result(size_x, other.size_y);
+		detail::Gemm<T>(false, false, size_x, other.size_y, size_y, T(1), elem, stride,
+			other.elem, other.stride, T(0), result.elem, result.stride);
+		return result;
+	}
+	template <class T>
+	void BasicMatrix<T>::transpose() {
+		BasicMatrix result(size_y, size_x);
+		for (size_t x = 0; x < size_x; x++) {
+			const T *r = row(x);
+			for (size_t y = 0; y < size_y; y++) result.elem[y * result.stride + x] = r[y];
+		}
+		*this = move(result);
+	}
+
+	// Determinant and inverse
+	template <class T>
+	T BasicMatrix<T>::det() const {
+		if (!isSquare()) throw invalid_argument("Cannot compute determinant of non-square matrices.");
+		BasicMatrix LU(*this);
+		vector<size_t> piv = LUFactorize(LU);
+		T result = T(detail::PivotSign(piv.data(), piv.size()));
+		for (size_t i = 0; i < size_x; i++) result *= LU.row(i)[i];
+		return result;
+	}
+	template <class T>
+	void BasicMatrix<T>::invert() {
+		if (!isSquare()) throw invalid_argument("Cannot invert non-square matrices.");
+		BasicMatrix LU(*this);
+		vector<size_t> piv = LUFactorize(LU);
+		BasicMatrix inverse(size_x, size_x);
+		for (size_t i = 0; i < size_x; i++) inverse.row(i)[i] = T(1);
+		LUSolve(LU, piv, inverse);
+		*this = move(inverse);
+	}
+
+	// LU factorisation and solvers, shared by every element type.
+	template <class T>
+	static vector<size_t> FactorizeImpl(BasicMatrix<T>& A) {
+		if (!A.isSquare()) throw invalid_argument("Cannot factorize non-square matrices.");
+		vector<size_t> piv(A.getSizeX());
+		detail::Getrf<T>(A.getSizeX(), A.getSizeY(), A.data(), A.getStride(), piv.data());
+		return piv;
+	}
+	template <class T>
+	static void SolveImpl(const BasicMatrix<T>& LU, const vector<size_t> &piv, BasicMatrix<T>& B) {
+		size_t n = LU.getSizeX();
+		if (!LU.isSquare() || piv.size() != n || B.getSizeX() != n)
+			throw invalid_argument("Cannot solve: the factorisation must be square and match the pivots and right-hand sides.");
+		for (size_t i = 0; i < n; i++) {
+			if (LU.coeff(i, i) == T()) throw range_error("Cannot solve: the matrix is singular.");
+		}
+		size_t r = B.getSizeY();
+		detail::Laswp<T>(B.data(), B.getStride(), 0, r, piv.data(), 0, n);
+		detail::TrsmLowerUnit<T>(n, r, LU.data(), LU.getStride(), B.data(), B.getStride());
+		detail::TrsmUpper<T>(n, r, LU.data(), LU.getStride(), B.data(), B.getStride());
+	}
+	template <class T>
+	static BasicMatrix<T> SolveCopyImpl(const BasicMatrix<T>& A, const BasicMatrix<T>& B) {
+		if (!A.isSquare()) throw invalid_argument("Cannot solve: the matrix must be square.");
+		if (A.getSizeX() != B.getSizeX()) throw invalid_argument("Cannot solve: A and B must have the same row count.");
+		BasicMatrix<T> LU(A), X(B);
+		vector<size_t> piv = FactorizeImpl(LU);
+		SolveImpl(LU, piv, X);
+		return X;
+	}
+
+	vector<size_t> LUFactorize(MatrixF& A) { return FactorizeImpl(A); }
+	vector<size_t> LUFactorize(MatrixCF& A) { return FactorizeImpl(A); }
+	vector<size_t> LUFactorize(MatrixCD& A) { return FactorizeImpl(A); }
+	void LUSolve(const MatrixF& LU, const vector<size_t> &piv, MatrixF& B) { SolveImpl(LU, piv, B); }
+	void LUSolve(const MatrixCF& LU, const vector<size_t> &piv, MatrixCF& B) { SolveImpl(LU, piv, B); }
+	void LUSolve(const MatrixCD& LU, const vector<size_t> &piv, MatrixCD& B) { SolveImpl(LU, piv, B); }
+	MatrixF solve(const MatrixF& A, const MatrixF& B) { return SolveCopyImpl(A, B); }
+	MatrixCF solve(const MatrixCF& A, const MatrixCF& B) { return SolveCopyImpl(A, B); }
+	MatrixCD solve(const MatrixCD& A, const MatrixCD& B) { return SolveCopyImpl(A, B); }
+
+	template class MATRIX2D_LIB_INSTANTIATION BasicMatrix<float>;
+	template class MATRIX2D_LIB_INSTANTIATION BasicMatrix<complex<float>>;
+	template class MATRIX2D_LIB_INSTANTIATION BasicMatrix<complex<double>>;
+}
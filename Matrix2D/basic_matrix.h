@@ -0,0 +1,141 @@
+/**
+ * @file basic_matrix.h
+ * Interface to 2D matrices of any supported element type: float, double, complex<float> and complex<double>.
+ * BasicMatrix<double> is Matrix2D itself, declared in matrix_2d.h with views, expression templates and the rest of
+ * the library built around it. The other element types get the general template below: the same storage layout,
+ * arithmetic, and the GEMM and LU engines, instantiated for that type.
+ */
+
+#ifndef MATRIX2D_BASIC_MATRIX
+#define MATRIX2D_BASIC_MATRIX
+
+#include "matrix_2d.h"
+#include <complex>
+#include <type_traits>
+
+namespace m2d {
+	/** General 2D matrix of element type T, for T in float, complex<float> and complex<double>.
+	* Storage is a single row-major buffer, as for Matrix2D: the buffer is 64-byte aligned; rows are padded to 64
+	* bytes except when there is one column. Products run on the packed GEMM engine (AVX2 for float) and det() and
+	* invert() on the blocked LU.
+	*/
+	template <class T>
+	class BasicMatrix {
+		static_assert(std::is_same<T, float>::value || std::is_same<T, std::complex<float>>::value ||
+			std::is_same<T, std::complex<double>>::value, "BasicMatrix supports float, double, complex<float> and complex<double> only.");
+		T *elem; /** Contiguous row-major buffer of size_x rows of stride elements each. The buffer is 64-byte aligned; rows are padded to 64 bytes except when there is one column. */
+		size_t size_x, size_y; /** Size of this matrix. */
+		size_t stride; /** Leading dimension: distance, in elements, between the starts of two consecutive rows. */
+	public:
+		typedef T value_type;
+		/** Creates a zero matrix.
+		* @param size_x: Row count.
+		* @param size_y: Column count.
+		*/
+		BasicMatrix(size_t size_x, size_t size_y);
+		BasicMatrix(const BasicMatrix& src);
+		/** Move constructor. The source is left as an empty 0 x 0 matrix. */
+		BasicMatrix(BasicMatrix&& src) noexcept;
+		/** Copy assignment. Reuses the existing buffer when the sizes match. */
+		BasicMatrix& operator=(const BasicMatrix& src);
+		BasicMatrix& operator=(BasicMatrix&& src) noexcept;
+		~BasicMatrix();
+
+		/** Unchecked element access, for kernels. */
+		T coeff(size_t pos_x, size_t pos_y) const { return elem[pos_x * stride + pos_y]; }
+		T &coeffRef(size_t pos_x, size_t pos_y) { return elem[pos_x * stride + pos_y]; }
+		/** Range-checked getter.
+		* @exception out_of_range() if the indices are out of range.
+		*/
+		T getAt(size_t pos_x, size_t pos_y) const;
+		/** Range-checked setter.
+		* @exception out_of_range() if the indices are out of range.
+		*/
+		void setAt(size_t pos_x, size_t pos_y, T val);
+		size_t getSizeX() const { return size_x; }
+		size_t getSizeY() const { return size_y; }
+		/** Distance, in elements, between row i and row i + 1. Always >= getSizeY(). */
+		size_t getStride() const { return stride; }
+		/** Raw access to the underlying row-major buffer, for kernels. No range checking is done. */
+		T *data() { return elem; }
+		const T *data() const { return elem; }
+		T *row(size_t i) { return elem + i * stride; }
+		const T *row(size_t i) const { return elem + i * stride; }
+		bool isSquare() const { return size_x == size_y; }
+		/** Prints the matrix, space-separated, one row per line. */
+		void print() const;
+
+		/** Element-wise arithmetic.
+		* @exception invalid_argument() if the sizes of the matrices do not match.
+		*/
+		BasicMatrix& operator+=(const BasicMatrix& other);
+		BasicMatrix& operator-=(const BasicMatrix& other);
+		BasicMatrix& operator*=(T factor);
+		BasicMatrix& operator/=(T divisor) { return *this *= T(1) / divisor; }
+		BasicMatrix operator+(const BasicMatrix& other) const { return BasicMatrix(*this) += other; }
+		BasicMatrix operator-(const BasicMatrix& other) const { return BasicMatrix(*this) -= other; }
+		BasicMatrix operator*(T factor) const { return BasicMatrix(*this) *= factor; }
+		BasicMatrix operator/(T divisor) const { return BasicMatrix(*this) /= divisor; }
+		friend BasicMatrix operator*(T factor, const BasicMatrix& m) { return m * factor; }
+		/** Multiplies two matrices on the packed, cache-blocked GEMM engine.
+		* @exception invalid_argument() if this matrix's column count differs from the other's row count.
+		*/
+		BasicMatrix operator*(const BasicMatrix& other) const;
+		/** Transposes this matrix in place. Complex elements are not conjugated. */
+		void transpose();
+		/** Computes the determinant by LU factorisation with partial pivoting.
+		* @exception invalid_argument() if this matrix isn't square.
+		*/
+		T det() const;
+		/** Inverts this matrix in place by LU factorisation with partial pivoting.
+		* @exception invalid_argument() if this matrix isn't square; range_error() if it is singular.
+		*/
+		void invert();
+	};
+
+	typedef BasicMatrix<float> MatrixF;
+	typedef BasicMatrix<std::complex<float>> MatrixCF;
+	typedef BasicMatrix<std::complex<double>> MatrixCD;
+
+	// Instantiated once, in basic_matrix.cpp.
+	extern template class MATRIX2D_LIB BasicMatrix<float>;
+	extern template class MATRIX2D_LIB BasicMatrix<std::complex<float>>;
+	extern template class MATRIX2D_LIB BasicMatrix<std::complex<double>>;
+
+	/** Converts a matrix to another element type, element by element, e.g. MatrixCast<float>(A) for a Matrix2D A.
+	* @return A new matrix of the same size.
+	*/
+	template <class To, class From>
+	BasicMatrix<To> MatrixCast(const BasicMatrix<From>& src) {
+		BasicMatrix<To> result(src.getSizeX(), src.getSizeY());
+		for (size_t x = 0; x < src.getSizeX(); x++) {
+			const From *s = src.row(x);
+			To *d = result.row(x);
+			for (size_t y = 0; y < src.getSizeY(); y++) d[y] = static_cast<To>(s[y]);
+		}
+		return result;
+	}
+
+	/** LU-factorises A in place with partial pivoting, as LUFactorize(MatrixView) does for Matrix2D.
+	* @return The pivot vector: at step i, row i was interchanged with row piv[i].
+	* @exception invalid_argument() if A is not square.
+	*/
+	MATRIX2D_LIB vector<size_t> LUFactorize(MatrixF& A);
+	MATRIX2D_LIB vector<size_t> LUFactorize(MatrixCF& A);
+	MATRIX2D_LIB vector<size_t> LUFactorize(MatrixCD& A);
+	/** Solves A * X = B in place for all the columns of B, given the output of LUFactorize().
+	* @exception invalid_argument() if the sizes do not match; range_error() if A is singular.
+	*/
+	MATRIX2D_LIB void LUSolve(const MatrixF& LU, const vector<size_t> &piv, MatrixF& B);
+	MATRIX2D_LIB void LUSolve(const MatrixCF& LU, const vector<size_t> &piv, MatrixCF& B);
+	MATRIX2D_LIB void LUSolve(const MatrixCD& LU, const vector<size_t> &piv, MatrixCD& B);
+	/** Solves A * X = B, factorising A once for all the columns of B.
+	* @return The solutions X, one per column.
+	* @exception invalid_argument() if A is not square or the row counts differ; range_error() if A is singular.
+	*/
+	MATRIX2D_LIB MatrixF solve(const MatrixF& A, const MatrixF& B);
+	MATRIX2D_LIB MatrixCF solve(const MatrixCF& A, const MatrixCF& B);
+	MATRIX2D_LIB MatrixCD solve(const MatrixCD& A, const MatrixCD& B);
+}
+
+#endif // MATRIX2D_BASIC_MATRIX
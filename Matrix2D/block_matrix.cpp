@@ -0,0 +1,324 @@
+/**
+* @file block_matrix.cpp
+* Contains the implementation of BlockMatrix and its block-wise product and solver.
+*/
+#include "stdafx.h"
+#include "block_matrix.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+
+using namespace std;
+
+namespace m2d {
+	namespace {
+		// Index of the block that contains position pos, given the partition's offsets.
+		size_t BlockIndex(const vector<size_t> &offsets, size_t pos) {
+			return upper_bound(offsets.begin(), offsets.end(), pos) - offsets.begin() - 1;
+		}
+
+		// Overwrites a block of a dense matrix with a zero, identity or dense block.
+		void CopyBlock(BlockKind kind, double scale, ConstMatrixView view, MatrixView dst) {
+			for (size_t x = 0; x < dst.getSizeX(); x++)
+				for (size_t y = 0; y < dst.getSizeY(); y++) dst.coeffRef(x, y) = 0;
+			if (kind == BlockKind::Identity) {
+				for (size_t x = 0; x < dst.getSizeX(); x++) dst.coeffRef(x, x) = scale;
+			}
+			if (kind == BlockKind::Dense) dst = view;
+			else dst.markModified();
+		}
+
+		// C = beta * C, without reading C when beta is zero.
+		void ScaleInPlace(double beta, MatrixView C) {
+			if (beta == 0) {
+				for (size_t x = 0; x < C.getSizeX(); x++)
+					for (size_t y = 0; y < C.getSizeY(); y++) C.coeffRef(x, y) = 0;
+				C.markModified();
+			}
+			else if (beta != 1) C *= beta;
+		}
+	}
+
+	// Construction and access
+	BlockMatrix::BlockMatrix(const vector<size_t> &row_sizes, const vector<size_t> &col_sizes) :
+		row_offsets(row_sizes.size() + 1, 0), col_offsets(col_sizes.size() + 1, 0) {
+		partial_sum(row_sizes.begin(), row_sizes.end(), row_offsets.begin() + 1);
+		partial_sum(col_sizes.begin(), col_sizes.end(), col_offsets.begin() + 1);
+		blocks.reserve(row_sizes.size() * col_sizes.size());
+		for (size_t i = 0; i < row_sizes.size(); i++) {
+			for (size_t j = 0; j < col_sizes.size(); j++)
+				blocks.push_back({ BlockKind::Zero, 0, ConstMatrixView(nullptr, row_sizes[i], col_sizes[j], col_sizes[j]) });
+		}
+	}
+	BlockMatrix::Block &BlockMatrix::at(size_t i, size_t j) {
+		if (i >= getBlockRowCount() || j >= getBlockColCount()) throw out_of_range("Block indices are out of range.");
+		return blocks[i * getBlockColCount() + j];
+	}
+	const BlockMatrix::Block &BlockMatrix::at(size_t i, size_t j) const {
+		return const_cast<BlockMatrix*>(this)->at(i, j);
+	}
+	void BlockMatrix::setBlock(size_t i, size_t j, ConstMatrixView m) {
+		Block &block = at(i, j);
+		if (m.getSizeX() != block.view.getSizeX() || m.getSizeY() != block.view.getSizeY())
+			throw invalid_argument("Cannot set a block: the matrix does not match the block's size.");
+		block.kind = BlockKind::Dense;
+		block.view = m;
+	}
+	void BlockMatrix::setIdentity(size_t i, size_t j, double scale) {
+		Block &block = at(i, j);
+		if (!block.view.isSquare()) throw invalid_argument("Cannot set an identity on a non-square block.");
+		block.kind = BlockKind::Identity;
+		block.scale = scale;
+	}
+	void BlockMatrix::setZero(size_t i, size_t j) {
+		at(i, j).kind = BlockKind::Zero;
+	}
+	BlockKind BlockMatrix::getBlockKind(size_t i, size_t j) const {
+		return at(i, j).kind;
+	}
+	ConstMatrixView BlockMatrix::getBlock(size_t i, size_t j) const {
+		const Block &block = at(i, j);
+		if (block.kind != BlockKind::Dense) throw invalid_argument("Cannot view a zero or identity block.");
+		return block.view;
+	}
+	double BlockMatrix::getIdentityScale(size_t i, size_t j) const {
+		const Block &block = at(i, j);
+		if (block.kind != BlockKind::Identity) throw invalid_argument("Cannot get the scale of a block that is not an identity.");
+		return block.scale;
+	}
+	double BlockMatrix::coeff(size_t pos_x, size_t pos_y) const {
+		size_t i = BlockIndex(row_offsets, pos_x), j = BlockIndex(col_offsets, pos_y);
+		const Block &block = blocks[i * getBlockColCount() + j];
+		size_t x = pos_x - row_offsets[i], y = pos_y - col_offsets[j];
+		switch (block.kind) {
+		case BlockKind::Identity: return x == y ? block.scale : 0;
+		case BlockKind::Dense: return block.view.coeff(x, y);
+		default: return 0;
+		}
+	}
+	double BlockMatrix::getAt(size_t pos_x, size_t pos_y) const {
+		if (pos_x >= getSizeX() || pos_y >= getSizeY()) throw out_of_range("Indices exceeded BlockMatrix range.");
+		return coeff(pos_x, pos_y);
+	}
+	bool BlockMatrix::hasSquarePartition() const {
+		return row_offsets == col_offsets;
+	}
+
+	Matrix2D BlockMatrix::toDense() const {
+		size_t rows = getSizeX(), cols = getSizeY(), block_cols = getBlockColCount();
+		detail::ProfileScope profile(detail::ProfiledOp::Concatenate, 0, 2.0 * rows * cols * sizeof(double));
+		Matrix2D result(rows, cols); // zero blocks are left as they come
+		detail::ParallelFor(0, rows, detail::RowGrain(cols), [&](size_t lo, size_t hi) {
+			size_t i = BlockIndex(row_offsets, lo);
+			for (size_t x = lo; x < hi; x++) {
+				while (x >= row_offsets[i + 1]) i++;
+				size_t local_x = x - row_offsets[i];
+				double *dst = result.row(x);
+				for (size_t j = 0; j < block_cols; j++) {
+					const Block &block = blocks[i * block_cols + j];
+					double *d = dst + col_offsets[j];
+					size_t width = col_offsets[j + 1] - col_offsets[j];
+					if (block.kind == BlockKind::Identity) d[local_x] = block.scale;
+					else if (block.kind == BlockKind::Dense) {
+						const ConstMatrixView &v = block.view;
+						if (v.isStrided()) memcpy(d, v.data() + local_x * v.getStride(), width * sizeof(double));
+						else {
+							for (size_t y = 0; y < width; y++) d[y] = v.coeff(local_x, y);
+						}
+					}
+				}
+			}
+		});
+		return result;
+	}
+
+	BlockMatrix ComposeHorizontally(ConstMatrixView left, ConstMatrixView right) {
+		if (left.getSizeX() != right.getSizeX())
+			throw range_error("Cannot horizontally compose two matrices with different row counts.");
+		BlockMatrix result({ left.getSizeX() }, { left.getSizeY(), right.getSizeY() });
+		result.setBlock(0, 0, left);
+		result.setBlock(0, 1, right);
+		return result;
+	}
+	BlockMatrix ComposeVertically(ConstMatrixView top, ConstMatrixView bottom) {
+		if (top.getSizeY() != bottom.getSizeY())
+			throw range_error("Cannot vertically compose two matrices with different column counts.");
+		BlockMatrix result({ top.getSizeX(), bottom.getSizeX() }, { top.getSizeY() });
+		result.setBlock(0, 0, top);
+		result.setBlock(1, 0, bottom);
+		return result;
+	}
+
+	// Product
+	void gemm(double alpha, const BlockMatrix &A, ConstMatrixView B, double beta, MatrixView C) {
+		if (A.getSizeY() != B.getSizeX() || C.getSizeX() != A.getSizeX() || C.getSizeY() != B.getSizeY())
+			throw invalid_argument("Cannot multiply these matrices: incompatible dimensions.");
+		size_t r = B.getSizeY();
+		double dense = 0;
+		for (size_t i = 0; i < A.getBlockRowCount(); i++) {
+			for (size_t j = 0; j < A.getBlockColCount(); j++) {
+				if (A.getBlockKind(i, j) == BlockKind::Dense)
+					dense += (double)(A.getBlockRowOffset(i + 1) - A.getBlockRowOffset(i)) * (A.getBlockColOffset(j + 1) - A.getBlockColOffset(j));
+			}
+		}
+		detail::ProfileScope profile(detail::ProfiledOp::BlockProduct, 2.0 * dense * r,
+			(dense + (double)(B.getSizeX() + 2 * C.getSizeX()) * r) * sizeof(double));
+		ScaleInPlace(beta, C);
+		if (alpha == 0) return;
+		for (size_t i = 0; i < A.getBlockRowCount(); i++) {
+			size_t row = A.getBlockRowOffset(i), rows = A.getBlockRowOffset(i + 1) - row;
+			MatrixView Ci = C.subView(row, 0, rows, r);
+			for (size_t j = 0; j < A.getBlockColCount(); j++) {
+				size_t col = A.getBlockColOffset(j), cols = A.getBlockColOffset(j + 1) - col;
+				ConstMatrixView Bj = B.subView(col, 0, cols, r);
+				switch (A.getBlockKind(i, j)) {
+				case BlockKind::Identity:
+					Ci += (alpha * A.getIdentityScale(i, j)) * Bj;
+					break;
+				case BlockKind::Dense:
+					gemm(alpha, A.getBlock(i, j), Bj, 1.0, Ci);
+					break;
+				default:
+					break;
+				}
+			}
+		}
+	}
+	Matrix2D operator*(const BlockMatrix &A, ConstMatrixView B) {
+		if (A.getSizeY() != B.getSizeX())
+			throw invalid_argument("Cannot multiply these matrices: incompatible dimensions.");
+		Matrix2D result(A.getSizeX(), B.getSizeY());
+		gemm(1.0, A, B, 0.0, result);
+		return result;
+	}
+
+	// Solver
+	namespace {
+		// Block forward or backward substitution. Only the diagonal blocks are factorised.
+		Matrix2D SolveBlockTriangular(const BlockMatrix &A, ConstMatrixView B, bool lower) {
+			size_t nb = A.getBlockRowCount(), r = B.getSizeY();
+			Matrix2D X(B);
+			for (size_t step = 0; step < nb; step++) {
+				size_t i = lower ? step : nb - 1 - step;
+				size_t row = A.getBlockRowOffset(i), rows = A.getBlockRowOffset(i + 1) - row;
+				MatrixView Xi = MatrixView(X).subView(row, 0, rows, r);
+				for (size_t j = lower ? 0 : i + 1; j < (lower ? i : nb); j++) {
+					size_t col = A.getBlockColOffset(j), cols = A.getBlockColOffset(j + 1) - col;
+					ConstMatrixView Xj = ConstMatrixView(X).subView(col, 0, cols, r);
+					if (A.getBlockKind(i, j) == BlockKind::Identity) Xi -= A.getIdentityScale(i, j) * Xj;
+					else if (A.getBlockKind(i, j) == BlockKind::Dense) gemm(-1.0, A.getBlock(i, j), Xj, 1.0, Xi);
+				}
+				if (rows == 0) continue;
+				switch (A.getBlockKind(i, i)) {
+				case BlockKind::Dense:
+					Matrix2D(A.getBlock(i, i)).solveInPlace(Xi);
+					break;
+				case BlockKind::Identity:
+					if (A.getIdentityScale(i, i) == 0) throw range_error("Cannot solve: the matrix is singular.");
+					Xi *= 1 / A.getIdentityScale(i, i);
+					break;
+				default:
+					throw range_error("Cannot solve: the matrix is singular.");
+				}
+			}
+			return X;
+		}
+
+		// Largest magnitude in block (i, j).
+		double MaxAbs(const BlockMatrix &A, size_t i, size_t j) {
+			switch (A.getBlockKind(i, j)) {
+			case BlockKind::Identity:
+				return fabs(A.getIdentityScale(i, j));
+			case BlockKind::Dense: {
+				ConstMatrixView v = A.getBlock(i, j);
+				double m = 0;
+				for (size_t x = 0; x < v.getSizeX(); x++)
+					for (size_t y = 0; y < v.getSizeY(); y++) m = max(m, fabs(v.coeff(x, y)));
+				return m;
+			}
+			default:
+				return 0;
+			}
+		}
+
+		// Schur complement solve of [A11 A12; A21 A22] [X1; X2] = [B1; B2]:
+		// (A22 - A21 A11^-1 A12) X2 = B2 - A21 A11^-1 B1, then X1 = A11^-1 (B1 - A12 X2).
+		// Eliminating A11 first is a block pivot that nothing else checks, so it must be safe on its own: as in
+		// adjugate(), every pivot of A11 must exceed sqrt(eps) times the largest one, and also times the largest
+		// coupling entry, or A11^-1 grows the Schur complement past what A22 can absorb.
+		// Returns false, leaving X alone, if A11 is singular or fails that test.
+		bool SolveSchur(const BlockMatrix &A, ConstMatrixView B, Matrix2D &X) {
+			size_t n1 = A.getBlockRowOffset(1), n2 = A.getSizeX() - n1, r = B.getSizeY();
+			auto block = [&](size_t i, size_t j, MatrixView dst) {
+				BlockKind kind = A.getBlockKind(i, j);
+				CopyBlock(kind, kind == BlockKind::Identity ? A.getIdentityScale(i, j) : 0,
+					kind == BlockKind::Dense ? A.getBlock(i, j) : ConstMatrixView(nullptr, 0, 0, 0), dst);
+			};
+			// W = A11^-1 [A12 | B1], in one solve.
+			Matrix2D W(n1, n2 + r);
+			block(0, 1, MatrixView(W).subView(0, 0, n1, n2));
+			MatrixView(W).subView(0, n2, n1, r) = B.subView(0, 0, n1, r);
+			double coupling = max(MaxAbs(A, 0, 1), MaxAbs(A, 1, 0)), tolerance = sqrt(numeric_limits<double>::epsilon());
+			if (A.getBlockKind(0, 0) == BlockKind::Identity) {
+				double scale = A.getIdentityScale(0, 0);
+				if (!(fabs(scale) > tolerance * coupling)) return false;
+				W *= 1 / scale;
+			}
+			else {
+				Matrix2D LU(A.getBlock(0, 0));
+				vector<size_t> piv = LUFactorize(LU);
+				double lo = numeric_limits<double>::infinity(), hi = coupling;
+				for (size_t i = 0; i < n1; i++) {
+					lo = min(lo, fabs(LU.coeff(i, i)));
+					hi = max(hi, fabs(LU.coeff(i, i)));
+				}
+				if (!(lo > tolerance * hi)) return false;
+				LUSolve(LU, piv, W);
+			}
+			// T = [A22 | B2] - A21 W = [S | B2 - A21 A11^-1 B1].
+			Matrix2D T(n2, n2 + r);
+			block(1, 1, MatrixView(T).subView(0, 0, n2, n2));
+			MatrixView(T).subView(0, n2, n2, r) = B.subView(n1, 0, n2, r);
+			if (A.getBlockKind(1, 0) == BlockKind::Identity) T -= A.getIdentityScale(1, 0) * W;
+			else if (A.getBlockKind(1, 0) == BlockKind::Dense) gemm(-1.0, A.getBlock(1, 0), W, 1.0, T);
+			Matrix2D X2 = solve(ConstMatrixView(T).subView(0, 0, n2, n2), ConstMatrixView(T).subView(0, n2, n2, r));
+			// X1 = A11^-1 B1 - (A11^-1 A12) X2.
+			Matrix2D X1(ConstMatrixView(W).subView(0, n2, n1, r));
+			gemm(-1.0, ConstMatrixView(W).subView(0, 0, n1, n2), X2, 1.0, X1);
+			Matrix2D result(n1 + n2, r);
+			MatrixView(result).subView(0, 0, n1, r) = X1;
+			MatrixView(result).subView(n1, 0, n2, r) = X2;
+			X = move(result);
+			return true;
+		}
+	}
+
+	Matrix2D solve(const BlockMatrix &A, ConstMatrixView B) {
+		if (A.getSizeX() != A.getSizeY()) throw invalid_argument("Cannot solve: the matrix must be square.");
+		if (A.getSizeX() != B.getSizeX()) throw invalid_argument("Cannot solve: A and B must have the same row count.");
+		detail::ProfileScope profile(detail::ProfiledOp::BlockSolve, 0, 0);
+		if (A.hasSquarePartition()) {
+			size_t nb = A.getBlockRowCount();
+			bool lower = true, upper = true;
+			for (size_t i = 0; i < nb; i++) {
+				for (size_t j = 0; j < nb; j++) {
+					if (A.getBlockKind(i, j) == BlockKind::Zero) continue;
+					if (j > i) lower = false;
+					if (j < i) upper = false;
+				}
+			}
+			if (lower || upper) return SolveBlockTriangular(A, B, lower);
+		}
+		if (A.getBlockRowCount() == 2 && A.getBlockColCount() == 2 && A.getBlockRowOffset(1) == A.getBlockColOffset(1)
+			&& A.getBlockKind(0, 0) != BlockKind::Zero) {
+			Matrix2D X(0, 0);
+			if (SolveSchur(A, B, X)) return X;
+		}
+		Matrix2D dense = A.toDense();
+		return solve(ConstMatrixView(dense), B);
+	}
+}
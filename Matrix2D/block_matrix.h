@@ -0,0 +1,125 @@
+/**
+ * @file block_matrix.h
+ * Interface to block matrices composed of views, zero blocks and scaled identities, without copying any of them.
+ * Products and solves work block by block and skip zero blocks; toDense() assembles a contiguous Matrix2D only
+ * when one is needed.
+ */
+
+#ifndef MATRIX2D_BLOCK
+#define MATRIX2D_BLOCK
+
+#include "matrix_2d.h"
+
+namespace m2d {
+	/** What a block of a BlockMatrix holds. */
+	enum class BlockKind {
+		Zero, /** All zeros. Nothing is stored, and products skip the block. */
+		Identity, /** A multiple of the identity. Only square blocks can hold one. */
+		Dense /** A view of a matrix owned elsewhere. */
+	};
+
+	/** Matrix partitioned into a grid of blocks, such as the saddle-point system [A B^T; B 0] or the augmented
+	* matrix [A | b]. Dense blocks are views: the matrices they refer to must outlive the BlockMatrix and stay
+	* unchanged while it is in use. Every block starts as a zero block.
+	*/
+	class MATRIX2D_LIB BlockMatrix {
+		struct Block {
+			BlockKind kind;
+			double scale; /** For Identity. */
+			ConstMatrixView view; /** For Dense. */
+		};
+		vector<size_t> row_offsets; /** Block row i spans rows [row_offsets[i], row_offsets[i + 1]). */
+		vector<size_t> col_offsets; /** Block column j spans columns [col_offsets[j], col_offsets[j + 1]). */
+		vector<Block> blocks; /** Row-major, getBlockRowCount() x getBlockColCount(). */
+
+		Block &at(size_t i, size_t j);
+		const Block &at(size_t i, size_t j) const;
+	public:
+		/** Creates an all-zero block matrix with the given partition.
+		* @param row_sizes: Row count of each block row.
+		* @param col_sizes: Column count of each block column.
+		*/
+		BlockMatrix(const vector<size_t> &row_sizes, const vector<size_t> &col_sizes);
+
+		size_t getSizeX() const { return row_offsets.back(); }
+		size_t getSizeY() const { return col_offsets.back(); }
+		size_t getBlockRowCount() const { return row_offsets.size() - 1; }
+		size_t getBlockColCount() const { return col_offsets.size() - 1; }
+		/** @return First row of block row i; getBlockRowOffset(getBlockRowCount()) is getSizeX(). */
+		size_t getBlockRowOffset(size_t i) const { return row_offsets[i]; }
+		/** @return First column of block column j; getBlockColOffset(getBlockColCount()) is getSizeY(). */
+		size_t getBlockColOffset(size_t j) const { return col_offsets[j]; }
+
+		/** Makes block (i, j) refer to a matrix, without copying it.
+		* @exception out_of_range() if the block indices are out of range; invalid_argument() if the view's size does
+		* not match the block's.
+		*/
+		void setBlock(size_t i, size_t j, ConstMatrixView m);
+		/** Makes block (i, j) a multiple of the identity.
+		* @exception out_of_range() if the block indices are out of range; invalid_argument() if the block is not square.
+		*/
+		void setIdentity(size_t i, size_t j, double scale = 1);
+		/** Makes block (i, j) zero.
+		* @exception out_of_range() if the block indices are out of range.
+		*/
+		void setZero(size_t i, size_t j);
+		/** @exception out_of_range() if the block indices are out of range. */
+		BlockKind getBlockKind(size_t i, size_t j) const;
+		/** @return The view a Dense block refers to.
+		* @exception out_of_range() if the block indices are out of range; invalid_argument() if the block is not Dense.
+		*/
+		ConstMatrixView getBlock(size_t i, size_t j) const;
+		/** @return The factor of an Identity block.
+		* @exception out_of_range() if the block indices are out of range; invalid_argument() if it is not an Identity.
+		*/
+		double getIdentityScale(size_t i, size_t j) const;
+
+		/** Unchecked element lookup, by binary search over the partition. */
+		double coeff(size_t pos_x, size_t pos_y) const;
+		/** Range-checked element lookup.
+		* @exception out_of_range() if the indices are out of range.
+		*/
+		double getAt(size_t pos_x, size_t pos_y) const;
+		/** Checks whether the partition is square, i.e. block row i and block column i have the same size for every i.
+		* Block solves need it, so that the diagonal blocks are square.
+		*/
+		bool hasSquarePartition() const;
+		/** Materialises the block matrix into a contiguous one, in a single parallel pass over its rows: each row of a
+		* dense block is one memcpy.
+		*/
+		Matrix2D toDense() const;
+	};
+
+	/** Composes [left | right] without copying either side.
+	* @exception range_error() if the row counts differ.
+	*/
+	MATRIX2D_LIB BlockMatrix ComposeHorizontally(ConstMatrixView left, ConstMatrixView right);
+	/** Composes [top; bottom] without copying either side.
+	* @exception range_error() if the column counts differ.
+	*/
+	MATRIX2D_LIB BlockMatrix ComposeVertically(ConstMatrixView top, ConstMatrixView bottom);
+
+	/** Block matrix multiply-accumulate: C = alpha * A * B + beta * C, one gemm() per dense block of A.
+	* Zero blocks cost nothing and identity blocks cost one scaled addition.
+	* @param C: Output, accumulated into in place. With beta = 0 it is overwritten. Must not overlap B.
+	* @exception invalid_argument() if the sizes do not match.
+	*/
+	MATRIX2D_LIB void gemm(double alpha, const BlockMatrix &A, ConstMatrixView B, double beta, MatrixView C);
+	/** Multiplies a block matrix by a dense matrix or vector, block by block.
+	* @exception invalid_argument() if the sizes do not match.
+	*/
+	MATRIX2D_LIB Matrix2D operator*(const BlockMatrix &A, ConstMatrixView B);
+	/** Solves A * X = B block by block where the structure allows it, and densely otherwise:
+	* - with a square partition and all blocks above (or below) the diagonal zero, by block forward (or backward)
+	*   substitution, which only factorises the diagonal blocks;
+	* - for a 2 x 2 partition [A11 A12; A21 A22] with a well-conditioned leading block A11, such as a saddle-point
+	*   system, through the Schur complement A22 - A21 * A11^-1 * A12. A11 passes when every pivot of its LU
+	*   factorisation exceeds sqrt(eps) times both its largest pivot and the largest entry of A12 and A21;
+	*   otherwise eliminating it first would lose accuracy, since nothing pivots across blocks;
+	* - otherwise, by solve() on toDense().
+	* @exception invalid_argument() if A is not square or B does not have as many rows; range_error() if A is singular.
+	*/
+	MATRIX2D_LIB Matrix2D solve(const BlockMatrix &A, ConstMatrixView B);
+}
+
+#endif // MATRIX2D_BLOCK
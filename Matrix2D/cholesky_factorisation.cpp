@@ -0,0 +1,271 @@
+/**
+* @file cholesky_factorisation.cpp
+* Contains implementations of the blocked Cholesky (LL^T) and LDL^T factorisations and their solvers.
+*/
+#include "stdafx.h"
+#include "matrix_2d.h"
+#include "gemm_kernel.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		// Panel width. Trailing updates are GEMMs with k = kCholeskyBlock, as in the blocked LU.
+		constexpr size_t kCholeskyBlock = 128;
+
+		static double Dot(const double *a, const double *b, size_t n) {
+			double sum = 0;
+			for (size_t i = 0; i < n; i++) sum += a[i] * b[i];
+			return sum;
+		}
+
+		// Unblocked Cholesky of a diagonal block, lower triangle in place. Rows of L are contiguous, so every step
+		// is a dot product of two rows. Returns the index of the first pivot that is not positive (or is NaN), or n.
+		static size_t CholeskyBlock(size_t n, double *A, size_t lda) {
+			for (size_t c = 0; c < n; c++) {
+				double *rc = A + c * lda;
+				double d = rc[c] - Dot(rc, rc, c);
+				if (!(d > 0)) return c;
+				d = sqrt(d);
+				rc[c] = d;
+				for (size_t r = c + 1; r < n; r++) {
+					double *rr = A + r * lda;
+					rr[c] = (rr[c] - Dot(rr, rc, c)) / d;
+				}
+			}
+			return n;
+		}
+
+		// Unblocked LDL^T of a diagonal block: unit L in the strict lower triangle, D on the diagonal.
+		// work holds n elements. Returns the index of the first zero (or non-finite) pivot, or n.
+		static size_t LdlBlock(size_t n, double *A, size_t lda, double *work) {
+			for (size_t c = 0; c < n; c++) {
+				double *rc = A + c * lda;
+				for (size_t k = 0; k < c; k++) work[k] = rc[k] * A[k * lda + k]; // row c of L * D
+				double d = rc[c] - Dot(rc, work, c);
+				if (d == 0 || !isfinite(d)) return c;
+				rc[c] = d;
+				for (size_t r = c + 1; r < n; r++) {
+					double *rr = A + r * lda;
+					rr[c] = (rr[c] - Dot(rr, work, c)) / d;
+				}
+			}
+			return n;
+		}
+
+		// Solves X * L^T = B for the m x n block B, with L n x n lower triangular: each row of B independently,
+		// by forward substitution along the row. With unit set, L's diagonal is taken as 1s.
+		static void TrsmRightLowerTransposed(size_t m, size_t n, const double *L, size_t ldl, double *B, size_t ldb,
+			bool unit) {
+			ParallelFor(0, m, RowGrain(n * n / 2 + 1), [&](size_t lo, size_t hi) {
+				for (size_t i = lo; i < hi; i++) {
+					double *x = B + i * ldb;
+					for (size_t c = 0; c < n; c++) {
+						const double *lc = L + c * ldl;
+						double v = x[c] - Dot(x, lc, c);
+						x[c] = unit ? v : v / lc[c];
+					}
+				}
+			});
+		}
+
+		// A22 -= X * Y^T on the lower triangle only, for the trailing (n x n) matrix of a symmetric factorisation.
+		// X and Y are n x k. One GEMM per block row, each stopping at the diagonal, so half the flops of a full update.
+		static void SyrkLower(size_t n, size_t k, const double *X, size_t ldx, const double *Y, size_t ldy,
+			double *C, size_t ldc) {
+			for (size_t i = 0; i < n; i += kCholeskyBlock) {
+				size_t ib = min(kCholeskyBlock, n - i);
+				Dgemm(false, true, ib, i + ib, k, -1.0, X + i * ldx, ldx, Y, ldy, 1.0, C + i * ldc, ldc);
+			}
+		}
+
+		// Blocked, right-looking Cholesky of the lower triangle. Returns n on success, or the index of the first
+		// pivot that is not positive.
+		static size_t Potrf(size_t n, double *A, size_t lda) {
+			for (size_t j = 0; j < n; j += kCholeskyBlock) {
+				size_t jb = min(kCholeskyBlock, n - j);
+				double *a11 = A + j * lda + j;
+				size_t z = CholeskyBlock(jb, a11, lda);
+				if (z < jb) return j + z;
+				if (j + jb == n) break;
+				// L21 = A21 * L11^-T, then A22 -= L21 * L21^T.
+				double *a21 = A + (j + jb) * lda + j;
+				TrsmRightLowerTransposed(n - j - jb, jb, a11, lda, a21, lda, false);
+				SyrkLower(n - j - jb, jb, a21, lda, a21, lda, A + (j + jb) * lda + j + jb, lda);
+			}
+			return n;
+		}
+
+		// Blocked LDL^T, the same sweep as Potrf() with D folded into one side of each update.
+		static size_t Sytrf(size_t n, double *A, size_t lda) {
+			size_t nb = min(kCholeskyBlock, n);
+			Matrix2D W(max<size_t>(n, 1), nb); // L21 * D1 of the current panel
+			vector<double> work(nb);
+			for (size_t j = 0; j < n; j += kCholeskyBlock) {
+				size_t jb = min(kCholeskyBlock, n - j);
+				double *a11 = A + j * lda + j;
+				size_t z = LdlBlock(jb, a11, lda, work.data());
+				if (z < jb) return j + z;
+				if (j + jb == n) break;
+				// W = A21 * L11^-T is L21 * D1; keep it for the update, then scale A21 down to L21.
+				size_t m = n - j - jb;
+				double *a21 = A + (j + jb) * lda + j;
+				TrsmRightLowerTransposed(m, jb, a11, lda, a21, lda, true);
+				ParallelFor(0, m, RowGrain(jb), [&](size_t lo, size_t hi) {
+					for (size_t i = lo; i < hi; i++) {
+						double *a = a21 + i * lda, *w = W.row(i);
+						for (size_t c = 0; c < jb; c++) {
+							w[c] = a[c];
+							a[c] /= a11[c * lda + c];
+						}
+					}
+				});
+				SyrkLower(m, jb, W.data(), W.getStride(), a21, lda, A + (j + jb) * lda + j + jb, lda);
+			}
+			return n;
+		}
+
+		// Unblocked solves on one diagonal block, in parallel over the columns of B as in the LU kernels.
+		static void TrsmLowerBlock(size_t m, size_t n, const double *L, size_t ldl, double *B, size_t ldb, bool unit) {
+			ParallelFor(0, n, max<size_t>(64, 16384 / (m * m + 1)), [&](size_t lo, size_t hi) {
+				for (size_t r = 0; r < m; r++) {
+					double *br = B + r * ldb;
+					for (size_t q = 0; q < r; q++) {
+						double l = L[r * ldl + q];
+						if (l == 0) continue;
+						const double *bq = B + q * ldb;
+						for (size_t c = lo; c < hi; c++) br[c] -= l * bq[c];
+					}
+					if (!unit) {
+						double d = L[r * ldl + r];
+						for (size_t c = lo; c < hi; c++) br[c] /= d;
+					}
+				}
+			});
+		}
+		static void TrsmLowerTransposedBlock(size_t m, size_t n, const double *L, size_t ldl, double *B, size_t ldb,
+			bool unit) {
+			ParallelFor(0, n, max<size_t>(64, 16384 / (m * m + 1)), [&](size_t lo, size_t hi) {
+				for (size_t r = m; r-- > 0;) {
+					double *br = B + r * ldb;
+					for (size_t q = r + 1; q < m; q++) {
+						double l = L[q * ldl + r];
+						if (l == 0) continue;
+						const double *bq = B + q * ldb;
+						for (size_t c = lo; c < hi; c++) br[c] -= l * bq[c];
+					}
+					if (!unit) {
+						double d = L[r * ldl + r];
+						for (size_t c = lo; c < hi; c++) br[c] /= d;
+					}
+				}
+			});
+		}
+
+		// B = L^-1 * B, blocked like TrsmLowerUnit().
+		static void TrsmLower(size_t m, size_t n, const double *L, size_t ldl, double *B, size_t ldb, bool unit) {
+			for (size_t j = 0; j < m; j += kCholeskyBlock) {
+				size_t jb = min(kCholeskyBlock, m - j);
+				TrsmLowerBlock(jb, n, L + j * ldl + j, ldl, B + j * ldb, ldb, unit);
+				if (j + jb < m)
+					Dgemm(false, false, m - j - jb, n, jb, -1.0, L + (j + jb) * ldl + j, ldl,
+						B + j * ldb, ldb, 1.0, B + (j + jb) * ldb, ldb);
+			}
+		}
+		// B = L^-T * B: back substitution with the transposed block column of L feeding each GEMM update.
+		static void TrsmLowerTransposed(size_t m, size_t n, const double *L, size_t ldl, double *B, size_t ldb,
+			bool unit) {
+			for (size_t end = m; end > 0;) {
+				size_t jb = min(kCholeskyBlock, end), j = end - jb;
+				TrsmLowerTransposedBlock(jb, n, L + j * ldl + j, ldl, B + j * ldb, ldb, unit);
+				if (j > 0)
+					Dgemm(true, false, j, n, jb, -1.0, L + j * ldl, ldl, B + j * ldb, ldb, 1.0, B, ldb);
+				end = j;
+			}
+		}
+
+		static void ZeroStrictUpper(size_t n, double *A, size_t lda) {
+			for (size_t i = 0; i + 1 < n; i++) fill(A + i * lda + i + 1, A + i * lda + n, 0.0);
+		}
+	}
+
+	bool CholeskyFactorize(MatrixView A) {
+		if (!A.isSquare()) throw invalid_argument("Cannot factorize non-square matrices.");
+		double n = (double)A.getSizeX();
+		detail::ProfileScope profile(detail::ProfiledOp::CholeskyFactorize, n * n * n / 3, n * n * sizeof(double));
+		if (!A.isStrided()) { // a minor: factorise a strided copy, then write it back
+			Matrix2D work(A);
+			bool spd = CholeskyFactorize(work);
+			A = work;
+			return spd;
+		}
+		size_t sz = A.getSizeX();
+		if (detail::Potrf(sz, A.data(), A.getStride()) < sz) return false;
+		detail::ZeroStrictUpper(sz, A.data(), A.getStride());
+		return true;
+	}
+
+	bool LDLFactorize(MatrixView A) {
+		if (!A.isSquare()) throw invalid_argument("Cannot factorize non-square matrices.");
+		double n = (double)A.getSizeX();
+		detail::ProfileScope profile(detail::ProfiledOp::LDLFactorize, n * n * n / 3, 1.5 * n * n * sizeof(double));
+		if (!A.isStrided()) {
+			Matrix2D work(A);
+			bool ok = LDLFactorize(work);
+			A = work;
+			return ok;
+		}
+		size_t sz = A.getSizeX();
+		if (detail::Sytrf(sz, A.data(), A.getStride()) < sz) return false;
+		detail::ZeroStrictUpper(sz, A.data(), A.getStride());
+		return true;
+	}
+
+	// Shared checks and copies of the two solvers. Returns false once it has solved through a strided copy.
+	static bool PrepareSymmetricSolve(ConstMatrixView F, MatrixView B, void (*solver)(ConstMatrixView, MatrixView)) {
+		if (!F.isSquare() || B.getSizeX() != F.getSizeX())
+			throw invalid_argument("Cannot solve: the factorisation must be square and match the right-hand sides.");
+		if (!F.isStrided()) {
+			solver(Matrix2D(F), B);
+			return false;
+		}
+		if (!B.isStrided()) {
+			Matrix2D X(B);
+			solver(F, X);
+			B = X;
+			return false;
+		}
+		for (size_t i = 0; i < F.getSizeX(); i++) {
+			if (F.coeff(i, i) == 0) throw range_error("Cannot solve: the matrix is singular.");
+		}
+		return true;
+	}
+
+	void CholeskySolve(ConstMatrixView L, MatrixView B) {
+		if (!PrepareSymmetricSolve(L, B, CholeskySolve)) return;
+		size_t n = L.getSizeX(), r = B.getSizeY();
+		detail::ProfileScope profile(detail::ProfiledOp::CholeskySolve, 2.0 * n * n * r,
+			((double)n * n / 2 + 2.0 * n * r) * sizeof(double));
+		// X = L^-T * L^-1 * B.
+		detail::TrsmLower(n, r, L.data(), L.getStride(), B.data(), B.getStride(), false);
+		detail::TrsmLowerTransposed(n, r, L.data(), L.getStride(), B.data(), B.getStride(), false);
+	}
+
+	void LDLSolve(ConstMatrixView LD, MatrixView B) {
+		if (!PrepareSymmetricSolve(LD, B, LDLSolve)) return;
+		size_t n = LD.getSizeX(), r = B.getSizeY();
+		detail::ProfileScope profile(detail::ProfiledOp::LDLSolve, 2.0 * n * n * r,
+			((double)n * n / 2 + 2.0 * n * r) * sizeof(double));
+		// X = L^-T * D^-1 * L^-1 * B.
+		detail::TrsmLower(n, r, LD.data(), LD.getStride(), B.data(), B.getStride(), true);
+		for (size_t i = 0; i < n; i++) {
+			double d = LD.coeff(i, i), *b = B.data() + i * B.getStride();
+			for (size_t c = 0; c < r; c++) b[c] /= d;
+		}
+		detail::TrsmLowerTransposed(n, r, LD.data(), LD.getStride(), B.data(), B.getStride(), true);
+	}
+}
@@ -0,0 +1,37 @@
+/**
+* @file cpu_features.cpp
+* Contains the runtime CPU feature checks used for kernel dispatch.
+*/
+#include "stdafx.h"
+#include "cpu_features.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace m2d {
+	namespace detail {
+		static bool DetectAvx2Fma() {
+#ifndef M2D_X86
+			return false;
+#elif defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7) return false;
+			__cpuid(info, 1);
+			bool fma = (info[2] & (1 << 12)) != 0, osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+			if (!fma || !osxsave || !avx) return false;
+			if ((_xgetbv(0) & 0x6) != 0x6) return false; // OS must save ymm state
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+		}
+
+		bool CpuHasAvx2Fma() {
+			static const bool supported = DetectAvx2Fma();
+			return supported;
+		}
+	}
+}
@@ -0,0 +1,37 @@
+/**
+ * @file cpu_features.h
+ * Internal helpers for runtime selection of SIMD kernels.
+ * Not part of the public interface.
+ */
+
+#ifndef MATRIX2D_CPU_FEATURES
+#define MATRIX2D_CPU_FEATURES
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define M2D_X86 1
+#include <immintrin.h>
+// Marks a function that may use AVX2/FMA intrinsics. MSVC allows them anywhere; GCC and Clang need the target.
+#ifdef _MSC_VER
+#define M2D_TARGET_AVX2
+#else
+#define M2D_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+// Forces inlining, so that a kernel body written once can be compiled into both a baseline and an AVX2 wrapper.
+#ifdef _MSC_VER
+#define M2D_ALWAYS_INLINE __forceinline
+#else
+#define M2D_ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace m2d {
+	namespace detail {
+		/** Checks, once, whether both the CPU and the OS support AVX2 and FMA.
+		* @return True if AVX2/FMA kernels may run. Always false on non-x86 targets.
+		*/
+		bool CpuHasAvx2Fma();
+	}
+}
+
+#endif // MATRIX2D_CPU_FEATURES
@@ -0,0 +1,22 @@
+/**
+ * @file export_macros.h
+ * DLL import/export decoration shared by every public Matrix2D header.
+ */
+
+#ifndef MATRIX2D_EXPORT_MACROS
+#define MATRIX2D_EXPORT_MACROS
+
+#ifdef _WIN32
+#ifdef MATRIX2D_EXPORTS
+#define MATRIX2D_LIB __declspec(dllexport) // dll building
+#else
+#define MATRIX2D_LIB __declspec(dllimport) // usage
+#endif
+// Explicit instantiation definitions need the export again under MSVC; GCC takes it from the extern declaration.
+#define MATRIX2D_LIB_INSTANTIATION MATRIX2D_LIB
+#else // shared object: built with hidden visibility, so only MATRIX2D_LIB symbols are exported, as from the DLL
+#define MATRIX2D_LIB __attribute__((visibility("default")))
+#define MATRIX2D_LIB_INSTANTIATION
+#endif
+
+#endif // MATRIX2D_EXPORT_MACROS
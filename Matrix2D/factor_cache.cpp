@@ -0,0 +1,153 @@
+/**
+* @file factor_cache.cpp
+* Contains implementations of the cached LU factorisation and its Sherman-Morrison-Woodbury updates.
+*/
+#include "stdafx.h"
+#include "factor_cache.h"
+#include "factor_kernels.h"
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		constexpr uint64_t kStaleVersion = UINT64_MAX; // matrix versions count up from 0 and never get here
+		constexpr size_t kMaxUpdateRank = 32;
+
+		// Past this rank, each solve pays more for the correction than a fresh factorisation saves.
+		static size_t MaxUpdateRank(size_t n) {
+			return min(kMaxUpdateRank, n / 4);
+		}
+
+		FactorCache::FactorCache() : lu(0, 0), singular(false), base_det(0), vt(0, 0), zt(0, 0), cap(0, 0),
+			rank(0), version(kStaleVersion) {}
+
+		double FactorCache::factorize(const Matrix2D &A) {
+			size_t n = A.getSizeX();
+			lu = A; // reuses the buffer of the last factorisation when the size is unchanged
+			piv = LUFactorize(lu);
+			base_det = PivotSign(piv.data(), n);
+			singular = false;
+			for (size_t i = 0; i < n; i++) {
+				double d = lu.row(i)[i];
+				base_det *= d;
+				singular |= d == 0;
+			}
+			rank = 0;
+			pending.clear();
+			version = A.getVersion();
+			return 2.0 / 3.0 * n * n * n;
+		}
+
+		double FactorCache::absorb(const Matrix2D &A, ConstMatrixView U, ConstMatrixView V) {
+			size_t n = lu.getSizeX(), k = U.getSizeY(), max_rank = MaxUpdateRank(n);
+			if (k == 0) return 0;
+			if (singular || rank + k > max_rank) return factorize(A);
+			if (vt.getSizeX() != max_rank || vt.getSizeY() != n) {
+				vt = Matrix2D(max_rank, n);
+				zt = Matrix2D(max_rank, n);
+			}
+			Matrix2D Z(U);
+			LUSolve(lu, piv, Z); // Z = A0^-1 * U
+			vt.subView(rank, 0, k, n) = V.transposed();
+			zt.subView(rank, 0, k, n) = Z.transposed();
+			rank += k;
+			// C = I + V^T * Z, rebuilt whole: at rank <= 32 that is cheap next to computing Z.
+			cap = Matrix2D(rank, rank);
+			gemm(1, vt.subView(0, 0, rank, n), zt.subView(0, 0, rank, n).transposed(), 0, cap);
+			for (size_t i = 0; i < rank; i++) cap.row(i)[i] += 1;
+			cap_piv = LUFactorize(cap);
+			// A nearly singular C means A is nearly singular itself, or has drifted too far from A0 for the
+			// correction to stay accurate. Either way, factorising A afresh gives the better answer.
+			double lo = numeric_limits<double>::infinity(), hi = 0;
+			for (size_t i = 0; i < rank; i++) {
+				lo = min(lo, fabs(cap.row(i)[i]));
+				hi = max(hi, fabs(cap.row(i)[i]));
+			}
+			if (!(lo > sqrt(numeric_limits<double>::epsilon()) * hi)) return factorize(A);
+			return 2.0 * n * n * k + 2.0 * rank * rank * n + 2.0 / 3.0 * rank * rank * rank;
+		}
+
+		double FactorCache::foldPending(const Matrix2D &A) {
+			// Changes confined to few rows (or columns) form a correction of that rank: row i changing by d^T is
+			// e_i * d^T. Take whichever of the two is smaller.
+			size_t n = lu.getSizeX();
+			vector<size_t> rows, cols;
+			for (const Change &c : pending) {
+				rows.push_back(c.x);
+				cols.push_back(c.y);
+			}
+			sort(rows.begin(), rows.end());
+			rows.erase(unique(rows.begin(), rows.end()), rows.end());
+			sort(cols.begin(), cols.end());
+			cols.erase(unique(cols.begin(), cols.end()), cols.end());
+			bool by_row = rows.size() <= cols.size();
+			size_t k = by_row ? rows.size() : cols.size();
+			if (singular || rank + k > MaxUpdateRank(n)) return factorize(A);
+			Matrix2D U(n, k), V(n, k);
+			for (const Change &c : pending) {
+				if (by_row) {
+					size_t t = lower_bound(rows.begin(), rows.end(), c.x) - rows.begin();
+					U.row(c.x)[t] = 1;
+					V.row(c.y)[t] += c.delta;
+				}
+				else {
+					size_t t = lower_bound(cols.begin(), cols.end(), c.y) - cols.begin();
+					U.row(c.x)[t] += c.delta;
+					V.row(c.y)[t] = 1;
+				}
+			}
+			pending.clear();
+			return absorb(A, U, V);
+		}
+
+		double FactorCache::refresh(const Matrix2D &A) {
+			if (version != A.getVersion()) return factorize(A);
+			if (!pending.empty()) return foldPending(A);
+			return 0;
+		}
+
+		void FactorCache::noteChange(uint64_t before, uint64_t after, size_t x, size_t y, double delta) {
+			if (version != before) return;
+			if (pending.size() >= kMaxUpdateRank * lu.getSizeX()) { // too scattered to be worth tracking
+				pending.clear();
+				version = kStaleVersion;
+				return;
+			}
+			pending.push_back({ x, y, delta });
+			version = after;
+		}
+
+		void FactorCache::update(const Matrix2D &A, uint64_t before, ConstMatrixView U, ConstMatrixView V) {
+			if (version != before) return;
+			if (!pending.empty()) { // A already includes U * V^T, so the queued changes cannot be folded in after it
+				version = kStaleVersion;
+				return;
+			}
+			version = A.getVersion();
+			absorb(A, U, V);
+		}
+
+		double FactorCache::det() const {
+			if (singular) return 0;
+			double result = base_det;
+			if (rank) {
+				result *= PivotSign(cap_piv.data(), rank);
+				for (size_t i = 0; i < rank; i++) result *= cap.row(i)[i];
+			}
+			return result;
+		}
+
+		void FactorCache::solveInPlace(MatrixView B) const {
+			LUSolve(lu, piv, B); // B = A0^-1 * B
+			if (!rank) return;
+			// B -= Z * C^-1 * V^T * B
+			size_t n = lu.getSizeX();
+			Matrix2D T(rank, B.getSizeY());
+			gemm(1, vt.subView(0, 0, rank, n), B, 0, T);
+			LUSolve(cap, cap_piv, T);
+			gemm(-1, zt.subView(0, 0, rank, n).transposed(), T, 1, B);
+		}
+	}
+}
@@ -0,0 +1,64 @@
+/**
+ * @file factor_cache.h
+ * Internal LU factorisation cached on a Matrix2D, with Sherman-Morrison-Woodbury low-rank updates.
+ * Not part of the public interface.
+ */
+
+#ifndef MATRIX2D_FACTOR_CACHE
+#define MATRIX2D_FACTOR_CACHE
+
+#include "matrix_2d.h"
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace m2d {
+	namespace detail {
+		/** Factorisation of A = A0 + U * V^T: the LU of a base matrix A0, plus a correction of rank k.
+		* Solves use the Woodbury identity A^-1 = A0^-1 - Z * C^-1 * V^T * A0^-1, with Z = A0^-1 * U and the k x k
+		* capacitance C = I + V^T * Z, so an update of rank k costs O(n^2 k) instead of an O(n^3) factorisation.
+		* Single-element changes made through setAt() are queued and folded in as one update on next use.
+		* Callers hold lock around every member call.
+		*/
+		class FactorCache {
+			struct Change {
+				size_t x, y;
+				double delta;
+			};
+			Matrix2D lu; /** LU of A0, in place, as left by LUFactorize(). */
+			std::vector<size_t> piv;
+			bool singular; /** A0 has an exact zero pivot. Never set while rank > 0. */
+			double base_det; /** det(A0). */
+			Matrix2D vt, zt; /** Rows 0 .. rank - 1 hold the columns of V and Z. */
+			Matrix2D cap; /** LU of the capacitance matrix C, rank x rank. */
+			std::vector<size_t> cap_piv;
+			size_t rank;
+			std::vector<Change> pending; /** setAt() changes not yet folded in. */
+			uint64_t version; /** Version of the matrix this describes, pending changes included. */
+
+			double factorize(const Matrix2D &A);
+			double absorb(const Matrix2D &A, ConstMatrixView U, ConstMatrixView V);
+			double foldPending(const Matrix2D &A);
+		public:
+			std::mutex lock;
+
+			FactorCache();
+			/** Brings the factorisation up to date with A, factorising from scratch if A changed untracked.
+			* @return Floating-point operations spent, for the profiler.
+			*/
+			double refresh(const Matrix2D &A);
+			/** Queues A(x, y) += delta, made while A's version went from before to after. Ignored if stale. */
+			void noteChange(uint64_t before, uint64_t after, size_t x, size_t y, double delta);
+			/** Records A = A + U * V^T, already applied to A, whose version was before. Ignored if stale. */
+			void update(const Matrix2D &A, uint64_t before, ConstMatrixView U, ConstMatrixView V);
+			/** @return det(A). refresh() must have been called. */
+			double det() const;
+			/** B = A^-1 * B. refresh() must have been called.
+			* @exception range_error() if A is singular.
+			*/
+			void solveInPlace(MatrixView B) const;
+		};
+	}
+}
+
+#endif // MATRIX2D_FACTOR_CACHE
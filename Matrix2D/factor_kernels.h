@@ -0,0 +1,116 @@
+/**
+ * @file factor_kernels.h
+ * Internal interface to the raw-buffer factorisation kernels shared by the factorisation routines.
+ * The LU kernels are templates on the element type, defined for float, double, complex<float> and complex<double>;
+ * the D-prefixed names are their double-precision forms. The QR and SVD kernels are double-precision only.
+ * Not part of the public interface.
+ */
+
+#ifndef MATRIX2D_FACTOR_KERNELS
+#define MATRIX2D_FACTOR_KERNELS
+
+#include <cstddef>
+#include <complex>
+
+namespace m2d {
+	namespace detail {
+		/** Blocked, right-looking LU factorisation of an m x n row-major buffer, in place.
+		* On return the strict lower part holds L (unit diagonal implied) and the upper part holds U.
+		* With partial pivoting, piv[i] is the row that was swapped with row i at step i; exact zero columns are
+		* skipped rather than divided by, so the factorisation always completes.
+		* Without pivoting (piv == nullptr) the factorisation stops at the first zero pivot.
+		* @param m: Row count.
+		* @param n: Column count.
+		* @param A: Pointer to element (0, 0).
+		* @param lda: Leading dimension of A.
+		* @param piv: Output array of min(m, n) pivot indices, or nullptr to factorise without pivoting.
+		* @return Index of the first exactly-zero pivot, or min(m, n) if there is none.
+		*/
+		template <class T>
+		size_t Getrf(size_t m, size_t n, T *A, size_t lda, size_t *piv);
+		/** Applies the row interchanges recorded in piv[k0, k1) to columns [c0, c1) of A, in order.
+		* @param A: Pointer to element (0, 0).
+		* @param lda: Leading dimension of A.
+		* @param c0: First column to permute.
+		* @param c1: One past the last column to permute.
+		* @param piv: Pivot indices, as produced by Dgetrf().
+		* @param k0: First interchange to apply.
+		* @param k1: One past the last interchange to apply.
+		*/
+		template <class T>
+		void Laswp(T *A, size_t lda, size_t c0, size_t c1, const size_t *piv, size_t k0, size_t k1);
+		/** Solves L * X = B in place, where L is the m x m unit lower triangle stored in the strict lower part of Lbuf.
+		* @param m: Order of L and row count of B.
+		* @param n: Column count of B.
+		* @param Lbuf: Pointer to element (0, 0) of L.
+		* @param ldl: Leading dimension of L.
+		* @param B: Pointer to element (0, 0) of B, overwritten by X.
+		* @param ldb: Leading dimension of B.
+		*/
+		template <class T>
+		void TrsmLowerUnit(size_t m, size_t n, const T *Lbuf, size_t ldl, T *B, size_t ldb);
+		/** Solves U * X = B in place, where U is the m x m upper triangle, diagonal included, stored in U.
+		* @param m: Order of U and row count of B.
+		* @param n: Column count of B.
+		* @param U: Pointer to element (0, 0) of U.
+		* @param ldu: Leading dimension of U.
+		* @param B: Pointer to element (0, 0) of B, overwritten by X.
+		* @param ldb: Leading dimension of B.
+		*/
+		template <class T>
+		void TrsmUpper(size_t m, size_t n, const T *U, size_t ldu, T *B, size_t ldb);
+		/** Computes the sign of the permutation described by a pivot vector.
+		* @param piv: Pivot indices, as produced by Dgetrf().
+		* @param count: Number of pivot indices.
+		* @return 1 for an even number of interchanges, -1 for an odd one.
+		*/
+		int PivotSign(const size_t *piv, size_t count);
+		/** Householder QR with column pivoting, unblocked, in place: A * P = Q * R, the largest remaining column
+		* moved forward at each step, so that |R(i, i)| decreases and a rank deficiency shows up in R's trailing rows.
+		* Storage of R and the reflectors is as for QRFactorize().
+		* @param m: Row count.
+		* @param n: Column count.
+		* @param A: Pointer to element (0, 0).
+		* @param lda: Leading dimension of A.
+		* @param tau: Output array of min(m, n) reflector scales.
+		* @param perm: Output array of n column indices: column j of A * P is column perm[j] of A.
+		*/
+		void Geqp3(size_t m, size_t n, double *A, size_t lda, double *tau, size_t *perm);
+		/** Multiplies the m x r block B on the left by Q or Q^T, Q being the product of the first k reflectors of
+		* a factorisation by QRFactorize() or Geqp3(), applied in blocks in compact WY form.
+		* @param transpose: Multiply by Q^T instead of Q.
+		* @param QR: Pointer to element (0, 0) of the factorisation, whose column count is at least k.
+		* @param tau: The reflector scales.
+		* @param B: Pointer to element (0, 0) of B, overwritten by the product.
+		*/
+		void Ormqr(bool transpose, size_t m, size_t r, size_t k, const double *QR, size_t ldq, const double *tau,
+			double *B, size_t ldb);
+		/** One-sided (Hestenes) Jacobi SVD of an n x n row-major buffer, in place. Double precision only.
+		* Plane rotations are applied to pairs of rows of A until every two rows are orthogonal to working precision,
+		* and accumulated in Q, so that Q * A_in = A_out and A_in = Q^T * diag(sigma) * Y, where the rows of Y are
+		* those of A_out normalised. Each sweep rotates n / 2 disjoint pairs at a time on the thread pool.
+		* @param n: Order of A and Q.
+		* @param A: Pointer to element (0, 0) of A, overwritten by A_out.
+		* @param lda: Leading dimension of A.
+		* @param Q: Pointer to element (0, 0) of Q, overwritten by the product of the rotations.
+		* @param ldq: Leading dimension of Q.
+		* @param sigma: Output array of the n singular values, the row norms of A_out, unsorted.
+		*/
+		void JacobiSvd(size_t n, double *A, size_t lda, double *Q, size_t ldq, double *sigma);
+
+		inline size_t Dgetrf(size_t m, size_t n, double *A, size_t lda, size_t *piv) {
+			return Getrf<double>(m, n, A, lda, piv);
+		}
+		inline void Dlaswp(double *A, size_t lda, size_t c0, size_t c1, const size_t *piv, size_t k0, size_t k1) {
+			Laswp<double>(A, lda, c0, c1, piv, k0, k1);
+		}
+		inline void DtrsmLowerUnit(size_t m, size_t n, const double *Lbuf, size_t ldl, double *B, size_t ldb) {
+			TrsmLowerUnit<double>(m, n, Lbuf, ldl, B, ldb);
+		}
+		inline void DtrsmUpper(size_t m, size_t n, const double *U, size_t ldu, double *B, size_t ldb) {
+			TrsmUpper<double>(m, n, U, ldu, B, ldb);
+		}
+	}
+}
+
+#endif // MATRIX2D_FACTOR_KERNELS
@@ -0,0 +1,267 @@
+/**
+ * @file fixed_matrix.h
+ * Fixed-size matrices, for hot loops over small matrices whose sizes are known at compile time.
+ * A Matrix<R, C> keeps its elements inline, so it never allocates. Everything it does is constexpr and every loop
+ * has a compile-time trip count, which compilers unroll into straight-line code; mismatched sizes fail to compile
+ * instead of throwing. Determinants and inverses up to 4 x 4 are computed in closed form.
+ * Fixed-size matrices convert to views, and so work with every function taking one, and to and from Matrix2D.
+ */
+
+#ifndef MATRIX2D_FIXED
+#define MATRIX2D_FIXED
+
+#include "matrix_2d.h"
+#include <type_traits>
+
+namespace m2d {
+	namespace detail {
+		constexpr double ConstexprAbs(double x) { return x < 0 ? -x : x; }
+	}
+
+	/** Matrix of R rows and C columns, stored row-major on the stack. Only getAt() and setAt() are range-checked. */
+	template <size_t R, size_t C>
+	class Matrix {
+		static_assert(R > 0 && C > 0, "A fixed-size matrix cannot be empty.");
+		double elem[R * C]; /** Row-major elements, without padding. */
+	public:
+		/** Zero matrix. */
+		constexpr Matrix() : elem{} {}
+		/** Builds a matrix from its R * C elements, row by row, as in Matrix<2, 2>(1, 2, 3, 4). */
+		template <class... T, class = typename std::enable_if<sizeof...(T) == R * C &&
+			std::conjunction<std::is_arithmetic<T>...>::value>::type>
+		constexpr Matrix(T... values) : elem{ static_cast<double>(values)... } {}
+		/** Copies a matrix or view of the same size.
+		* @exception invalid_argument() if the sizes differ.
+		*/
+		explicit Matrix(ConstMatrixView src) : elem{} {
+			if (src.getSizeX() != R || src.getSizeY() != C)
+				throw invalid_argument("Cannot convert a matrix of different dimensions to a fixed-size matrix.");
+			for (size_t x = 0; x < R; x++)
+				for (size_t y = 0; y < C; y++) elem[x * C + y] = src.coeff(x, y);
+		}
+		/** The identity matrix. Only square matrices have one. */
+		static constexpr Matrix identity() {
+			static_assert(R == C, "Only square matrices have an identity.");
+			Matrix result;
+			for (size_t i = 0; i < R; i++) result.elem[i * C + i] = 1;
+			return result;
+		}
+
+		static constexpr size_t getSizeX() { return R; }
+		static constexpr size_t getSizeY() { return C; }
+		static constexpr bool isSquare() { return R == C; }
+		/** Unchecked element access. */
+		constexpr double coeff(size_t pos_x, size_t pos_y) const { return elem[pos_x * C + pos_y]; }
+		constexpr double &coeffRef(size_t pos_x, size_t pos_y) { return elem[pos_x * C + pos_y]; }
+		/** Getter method.
+		* @exception: out_of_range() if supplied pos_x and/or pos_y are out-of-range of this matrix.
+		*/
+		constexpr double getAt(size_t pos_x, size_t pos_y) const {
+			if (pos_x >= R || pos_y >= C) throw out_of_range("Indices exceeded Matrix range.");
+			return coeff(pos_x, pos_y);
+		}
+		/** Setter method.
+		* @exception: out_of_range() if supplied pos_x and/or pos_y are out-of-range of this matrix.
+		*/
+		constexpr void setAt(size_t pos_x, size_t pos_y, double val) {
+			if (pos_x >= R || pos_y >= C) throw out_of_range("Indices exceeded Matrix range.");
+			coeffRef(pos_x, pos_y) = val;
+		}
+		/** Raw access to the row-major elements, with a stride of C. */
+		constexpr double *data() { return elem; }
+		constexpr const double *data() const { return elem; }
+
+		/** Views this matrix, to pass it to any function taking a view. The view must not outlive the matrix. */
+		ConstMatrixView view() const { return ConstMatrixView(elem, R, C, C); }
+		MatrixView view() { return MatrixView(elem, R, C, C); }
+		operator ConstMatrixView() const { return view(); }
+		operator MatrixView() { return view(); }
+		/** Copies this matrix into a dynamically-sized one. */
+		Matrix2D toMatrix() const { return Matrix2D(view()); }
+
+		/// Matrix arithmetics
+		constexpr bool operator==(const Matrix &other) const {
+			for (size_t i = 0; i < R * C; i++) if (elem[i] != other.elem[i]) return false;
+			return true;
+		}
+		constexpr bool operator!=(const Matrix &other) const { return !(*this == other); }
+		template <size_t R2, size_t C2>
+		constexpr Matrix& operator+=(const Matrix<R2, C2> &other) {
+			static_assert(R == R2 && C == C2, "Cannot add matrices of different dimensions.");
+			for (size_t i = 0; i < R * C; i++) elem[i] += other.data()[i];
+			return *this;
+		}
+		template <size_t R2, size_t C2>
+		constexpr Matrix& operator-=(const Matrix<R2, C2> &other) {
+			static_assert(R == R2 && C == C2, "Cannot subtract matrices of different dimensions.");
+			for (size_t i = 0; i < R * C; i++) elem[i] -= other.data()[i];
+			return *this;
+		}
+		constexpr Matrix& operator*=(double factor) {
+			for (size_t i = 0; i < R * C; i++) elem[i] *= factor;
+			return *this;
+		}
+		constexpr Matrix& operator/=(double divisor) {
+			for (size_t i = 0; i < R * C; i++) elem[i] /= divisor;
+			return *this;
+		}
+		template <size_t R2, size_t C2>
+		constexpr Matrix operator+(const Matrix<R2, C2> &other) const { return Matrix(*this) += other; }
+		template <size_t R2, size_t C2>
+		constexpr Matrix operator-(const Matrix<R2, C2> &other) const { return Matrix(*this) -= other; }
+		constexpr Matrix operator-() const { return Matrix(*this) *= -1.0; }
+		constexpr Matrix operator*(double factor) const { return Matrix(*this) *= factor; }
+		constexpr Matrix operator/(double divisor) const { return Matrix(*this) /= divisor; }
+		friend constexpr Matrix operator*(double factor, const Matrix &m) { return m * factor; }
+		/** Matrix product. Each row of the result accumulates scaled rows of the right operand, so the innermost loop
+		* runs along contiguous rows and vectorises once unrolled.
+		*/
+		template <size_t R2, size_t C2>
+		constexpr Matrix<R, C2> operator*(const Matrix<R2, C2> &other) const {
+			static_assert(C == R2, "Cannot multiply these matrices: incompatible dimensions.");
+			Matrix<R, C2> result;
+			for (size_t i = 0; i < R; i++) {
+				for (size_t k = 0; k < C; k++) {
+					double aik = elem[i * C + k];
+					for (size_t j = 0; j < C2; j++) result.coeffRef(i, j) += aik * other.coeff(k, j);
+				}
+			}
+			return result;
+		}
+
+		/** Returns the transpose of this matrix. */
+		constexpr Matrix<C, R> transposed() const {
+			Matrix<C, R> result;
+			for (size_t x = 0; x < R; x++)
+				for (size_t y = 0; y < C; y++) result.coeffRef(y, x) = elem[x * C + y];
+			return result;
+		}
+		/** Computes the determinant: in closed form up to 4 x 4, by Gaussian elimination with partial pivoting above. */
+		constexpr double det() const {
+			static_assert(R == C, "Cannot compute determinant of non-square matrices.");
+			const double *a = elem;
+			if constexpr (R == 1) return a[0];
+			else if constexpr (R == 2) return a[0] * a[3] - a[1] * a[2];
+			else if constexpr (R == 3) {
+				return a[0] * (a[4] * a[8] - a[5] * a[7]) - a[1] * (a[3] * a[8] - a[5] * a[6]) + a[2] * (a[3] * a[7] - a[4] * a[6]);
+			}
+			else if constexpr (R == 4) {
+				// Laplace expansion along the top two rows: their 2 x 2 minors times the complementary ones below.
+				double s0 = a[0] * a[5] - a[4] * a[1], s1 = a[0] * a[6] - a[4] * a[2], s2 = a[0] * a[7] - a[4] * a[3];
+				double s3 = a[1] * a[6] - a[5] * a[2], s4 = a[1] * a[7] - a[5] * a[3], s5 = a[2] * a[7] - a[6] * a[3];
+				double c5 = a[10] * a[15] - a[14] * a[11], c4 = a[9] * a[15] - a[13] * a[11], c3 = a[9] * a[14] - a[13] * a[10];
+				double c2 = a[8] * a[15] - a[12] * a[11], c1 = a[8] * a[14] - a[12] * a[10], c0 = a[8] * a[13] - a[12] * a[9];
+				return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+			}
+			else {
+				Matrix u(*this);
+				double det = 1;
+				for (size_t k = 0; k < R; k++) {
+					size_t p = k;
+					for (size_t i = k + 1; i < R; i++)
+						if (detail::ConstexprAbs(u.elem[i * C + k]) > detail::ConstexprAbs(u.elem[p * C + k])) p = i;
+					if (u.elem[p * C + k] == 0) return 0;
+					if (p != k) {
+						for (size_t j = k; j < C; j++) {
+							double t = u.elem[k * C + j];
+							u.elem[k * C + j] = u.elem[p * C + j];
+							u.elem[p * C + j] = t;
+						}
+						det = -det;
+					}
+					det *= u.elem[k * C + k];
+					for (size_t i = k + 1; i < R; i++) {
+						double l = u.elem[i * C + k] / u.elem[k * C + k];
+						for (size_t j = k + 1; j < C; j++) u.elem[i * C + j] -= l * u.elem[k * C + j];
+					}
+				}
+				return det;
+			}
+		}
+		/** Returns the inverse of this matrix: the adjugate over the determinant up to 4 x 4, Gauss-Jordan elimination
+		* with partial pivoting above.
+		* @exception range_error() if the matrix is singular.
+		*/
+		constexpr Matrix inverse() const {
+			static_assert(R == C, "Cannot invert non-square matrices.");
+			const double *a = elem;
+			Matrix result;
+			double *b = result.elem;
+			if constexpr (R <= 4) {
+				double d = det();
+				if (d == 0) throw range_error("Cannot invert: the matrix is singular.");
+				double inv = 1 / d;
+				if constexpr (R == 1) {
+					b[0] = inv;
+				}
+				else if constexpr (R == 2) {
+					b[0] = a[3] * inv; b[1] = -a[1] * inv;
+					b[2] = -a[2] * inv; b[3] = a[0] * inv;
+				}
+				else if constexpr (R == 3) {
+					b[0] = (a[4] * a[8] - a[5] * a[7]) * inv; b[1] = (a[2] * a[7] - a[1] * a[8]) * inv; b[2] = (a[1] * a[5] - a[2] * a[4]) * inv;
+					b[3] = (a[5] * a[6] - a[3] * a[8]) * inv; b[4] = (a[0] * a[8] - a[2] * a[6]) * inv; b[5] = (a[2] * a[3] - a[0] * a[5]) * inv;
+					b[6] = (a[3] * a[7] - a[4] * a[6]) * inv; b[7] = (a[1] * a[6] - a[0] * a[7]) * inv; b[8] = (a[0] * a[4] - a[1] * a[3]) * inv;
+				}
+				else {
+					double s0 = a[0] * a[5] - a[4] * a[1], s1 = a[0] * a[6] - a[4] * a[2], s2 = a[0] * a[7] - a[4] * a[3];
+					double s3 = a[1] * a[6] - a[5] * a[2], s4 = a[1] * a[7] - a[5] * a[3], s5 = a[2] * a[7] - a[6] * a[3];
+					double c5 = a[10] * a[15] - a[14] * a[11], c4 = a[9] * a[15] - a[13] * a[11], c3 = a[9] * a[14] - a[13] * a[10];
+					double c2 = a[8] * a[15] - a[12] * a[11], c1 = a[8] * a[14] - a[12] * a[10], c0 = a[8] * a[13] - a[12] * a[9];
+					b[0] = (a[5] * c5 - a[6] * c4 + a[7] * c3) * inv;
+					b[1] = (-a[1] * c5 + a[2] * c4 - a[3] * c3) * inv;
+					b[2] = (a[13] * s5 - a[14] * s4 + a[15] * s3) * inv;
+					b[3] = (-a[9] * s5 + a[10] * s4 - a[11] * s3) * inv;
+					b[4] = (-a[4] * c5 + a[6] * c2 - a[7] * c1) * inv;
+					b[5] = (a[0] * c5 - a[2] * c2 + a[3] * c1) * inv;
+					b[6] = (-a[12] * s5 + a[14] * s2 - a[15] * s1) * inv;
+					b[7] = (a[8] * s5 - a[10] * s2 + a[11] * s1) * inv;
+					b[8] = (a[4] * c4 - a[5] * c2 + a[7] * c0) * inv;
+					b[9] = (-a[0] * c4 + a[1] * c2 - a[3] * c0) * inv;
+					b[10] = (a[12] * s4 - a[13] * s2 + a[15] * s0) * inv;
+					b[11] = (-a[8] * s4 + a[9] * s2 - a[11] * s0) * inv;
+					b[12] = (-a[4] * c3 + a[5] * c1 - a[6] * c0) * inv;
+					b[13] = (a[0] * c3 - a[1] * c1 + a[2] * c0) * inv;
+					b[14] = (-a[12] * s3 + a[13] * s1 - a[14] * s0) * inv;
+					b[15] = (a[8] * s3 - a[9] * s1 + a[10] * s0) * inv;
+				}
+			}
+			else {
+				Matrix u(*this);
+				result = identity();
+				for (size_t k = 0; k < R; k++) {
+					size_t p = k;
+					for (size_t i = k + 1; i < R; i++)
+						if (detail::ConstexprAbs(u.elem[i * C + k]) > detail::ConstexprAbs(u.elem[p * C + k])) p = i;
+					if (u.elem[p * C + k] == 0) throw range_error("Cannot invert: the matrix is singular.");
+					for (size_t j = 0; j < C; j++) {
+						double t = u.elem[k * C + j]; u.elem[k * C + j] = u.elem[p * C + j]; u.elem[p * C + j] = t;
+						t = b[k * C + j]; b[k * C + j] = b[p * C + j]; b[p * C + j] = t;
+					}
+					double inv = 1 / u.elem[k * C + k];
+					for (size_t j = 0; j < C; j++) {
+						u.elem[k * C + j] *= inv;
+						b[k * C + j] *= inv;
+					}
+					for (size_t i = 0; i < R; i++) {
+						if (i == k) continue;
+						double l = u.elem[i * C + k];
+						for (size_t j = 0; j < C; j++) {
+							u.elem[i * C + j] -= l * u.elem[k * C + j];
+							b[i * C + j] -= l * b[k * C + j];
+						}
+					}
+				}
+			}
+			return result;
+		}
+		/** Inverts this matrix in place. See inverse().
+		* @exception range_error() if the matrix is singular. The matrix is then unchanged.
+		*/
+		constexpr void invert() { *this = inverse(); }
+		/** Prints the matrix, space-separated. */
+		void print() const { view().print(); }
+	};
+}
+
+#endif // MATRIX2D_FIXED
@@ -0,0 +1,411 @@
+/**
+* @file gemm.cpp
+* Contains the packed, cache-blocked GEMM engine and its micro-kernels.
+*
+* The loop structure follows the usual five-loop GotoBLAS/BLIS layout:
+*  - B is packed into KC x NC blocks that stay resident in L3,
+*  - A is packed into MC x KC blocks that stay resident in L2,
+*  - a KC x NR micro-panel of B stays resident in L1 while the MR x NR micro-kernel
+*    streams MR x KC micro-panels of A through it, accumulating entirely in registers.
+*/
+#include "stdafx.h"
+#include "matrix_2d.h"
+#include "gemm_kernel.h"
+#include "aligned_memory.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <complex>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		// Cache block sizes, in elements of double. Other element types keep KC and NC and scale MC to the same bytes.
+		constexpr size_t KC = 256; // depth of one packed block: a KC x NR B micro-panel is 16 KiB, fits L1
+		constexpr size_t MC = 120; // rows of one packed A block: MC x KC is 240 KiB, fits L2
+		constexpr size_t NC = 2048; // columns of one packed B block: KC x NC is 4 MiB, fits a shared L3
+		// Below this many multiply-adds, packing costs more than it saves.
+		constexpr size_t kSmallGemmFlops = 32 * 32 * 32;
+		// Below this many multiply-adds, the product runs on the calling thread only.
+		constexpr size_t kParallelGemmFlops = 96 * 96 * 96;
+
+		/** Register tile of each element type: MR rows by NR columns of C. */
+		template <class T> struct GemmTile { static constexpr size_t MR = 4, NR = 4; };
+		template <> struct GemmTile<double> { static constexpr size_t MR = 6, NR = 8; }; // 6 x 2 ymm accumulators
+		template <> struct GemmTile<float> { static constexpr size_t MR = 6, NR = 16; }; // 6 x 2 ymm accumulators
+
+		template <class T>
+		using MicroKernel = void(*)(size_t kc, const T *a, const T *b, T *c, size_t ldc, T alpha);
+
+		/** Owns one growable, aligned packing buffer per thread, so steady-state calls never allocate. */
+		template <class T>
+		class PackBuffer {
+			T *buf = nullptr;
+			size_t cap = 0;
+			bool busy = false;
+			template <class> friend class PackLease;
+		public:
+			~PackBuffer() { FreeBuffer(reinterpret_cast<double*>(buf)); }
+		};
+
+		// Packing buffers come from the double allocator, in whole doubles. They live as long as their thread, so they
+		// bypass any pool or arena the caller has made current.
+		template <class T>
+		static T *AllocatePack(size_t count) {
+			return reinterpret_cast<T*>(AllocateBuffer((count * sizeof(T) + sizeof(double) - 1) / sizeof(double), HeapAllocator()));
+		}
+
+		/** Borrows a thread's PackBuffer for one packing/compute phase.
+		* If the buffer is already borrowed further up the stack (a thread waiting on a parallel region can pick up
+		* another GEMM's task), the lease falls back to a private allocation instead of clobbering it.
+		*/
+		template <class T>
+		class PackLease {
+			PackBuffer<T> *owner = nullptr;
+			T *own = nullptr;
+			T *ptr;
+		public:
+			PackLease(PackBuffer<T> &pb, size_t count) {
+				if (!pb.busy) {
+					if (count > pb.cap) {
+						FreeBuffer(reinterpret_cast<double*>(pb.buf));
+						pb.buf = nullptr;
+						pb.buf = AllocatePack<T>(count);
+						pb.cap = count;
+					}
+					pb.busy = true;
+					owner = &pb;
+					ptr = pb.buf;
+				}
+				else {
+					ptr = own = AllocatePack<T>(count);
+				}
+			}
+			~PackLease() {
+				if (owner) owner->busy = false;
+				FreeBuffer(reinterpret_cast<double*>(own));
+			}
+			PackLease(const PackLease&) = delete;
+			PackLease& operator=(const PackLease&) = delete;
+			T *get() const { return ptr; }
+		};
+
+		template <class T> struct PackBuffers {
+			static thread_local PackBuffer<T> a, b;
+		};
+		template <class T> thread_local PackBuffer<T> PackBuffers<T>::a;
+		template <class T> thread_local PackBuffer<T> PackBuffers<T>::b;
+
+		// Portable micro-kernel: C[0:MR, 0:NR] += alpha * a_panel * b_panel.
+		template <class T>
+		static void KernelScalar(size_t kc, const T *a, const T *b, T *c, size_t ldc, T alpha) {
+			constexpr size_t MR = GemmTile<T>::MR, NR = GemmTile<T>::NR;
+			T ab[MR][NR] = {};
+			for (size_t p = 0; p < kc; p++) {
+				for (size_t i = 0; i < MR; i++) {
+					T ai = a[i];
+					for (size_t j = 0; j < NR; j++) ab[i][j] += ai * b[j];
+				}
+				a += MR;
+				b += NR;
+			}
+			for (size_t i = 0; i < MR; i++) {
+				for (size_t j = 0; j < NR; j++) c[i * ldc + j] += alpha * ab[i][j];
+			}
+		}
+
+#ifdef M2D_X86
+		// AVX2/FMA micro-kernel: the whole 6 x 8 tile of C lives in 12 ymm registers for the duration of the k loop.
+		M2D_TARGET_AVX2 static void KernelAvx2Double(size_t kc, const double *a, const double *b, double *c, size_t ldc, double alpha) {
+			__m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+			__m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+			__m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+			__m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+			__m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+			__m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+			for (size_t p = 0; p < kc; p++) {
+				__m256d b0 = _mm256_load_pd(b), b1 = _mm256_load_pd(b + 4);
+				__m256d ai;
+				ai = _mm256_broadcast_sd(a + 0); c00 = _mm256_fmadd_pd(ai, b0, c00); c01 = _mm256_fmadd_pd(ai, b1, c01);
+				ai = _mm256_broadcast_sd(a + 1); c10 = _mm256_fmadd_pd(ai, b0, c10); c11 = _mm256_fmadd_pd(ai, b1, c11);
+				ai = _mm256_broadcast_sd(a + 2); c20 = _mm256_fmadd_pd(ai, b0, c20); c21 = _mm256_fmadd_pd(ai, b1, c21);
+				ai = _mm256_broadcast_sd(a + 3); c30 = _mm256_fmadd_pd(ai, b0, c30); c31 = _mm256_fmadd_pd(ai, b1, c31);
+				ai = _mm256_broadcast_sd(a + 4); c40 = _mm256_fmadd_pd(ai, b0, c40); c41 = _mm256_fmadd_pd(ai, b1, c41);
+				ai = _mm256_broadcast_sd(a + 5); c50 = _mm256_fmadd_pd(ai, b0, c50); c51 = _mm256_fmadd_pd(ai, b1, c51);
+				a += 6;
+				b += 8;
+			}
+			__m256d va = _mm256_set1_pd(alpha);
+			double *r;
+			r = c + 0 * ldc; _mm256_storeu_pd(r, _mm256_fmadd_pd(va, c00, _mm256_loadu_pd(r))); _mm256_storeu_pd(r + 4, _mm256_fmadd_pd(va, c01, _mm256_loadu_pd(r + 4)));
+			r = c + 1 * ldc; _mm256_storeu_pd(r, _mm256_fmadd_pd(va, c10, _mm256_loadu_pd(r))); _mm256_storeu_pd(r + 4, _mm256_fmadd_pd(va, c11, _mm256_loadu_pd(r + 4)));
+			r = c + 2 * ldc; _mm256_storeu_pd(r, _mm256_fmadd_pd(va, c20, _mm256_loadu_pd(r))); _mm256_storeu_pd(r + 4, _mm256_fmadd_pd(va, c21, _mm256_loadu_pd(r + 4)));
+			r = c + 3 * ldc; _mm256_storeu_pd(r, _mm256_fmadd_pd(va, c30, _mm256_loadu_pd(r))); _mm256_storeu_pd(r + 4, _mm256_fmadd_pd(va, c31, _mm256_loadu_pd(r + 4)));
+			r = c + 4 * ldc; _mm256_storeu_pd(r, _mm256_fmadd_pd(va, c40, _mm256_loadu_pd(r))); _mm256_storeu_pd(r + 4, _mm256_fmadd_pd(va, c41, _mm256_loadu_pd(r + 4)));
+			r = c + 5 * ldc; _mm256_storeu_pd(r, _mm256_fmadd_pd(va, c50, _mm256_loadu_pd(r))); _mm256_storeu_pd(r + 4, _mm256_fmadd_pd(va, c51, _mm256_loadu_pd(r + 4)));
+		}
+		// Single-precision counterpart: a 6 x 16 tile of C in 12 ymm registers, eight floats each.
+		M2D_TARGET_AVX2 static void KernelAvx2Float(size_t kc, const float *a, const float *b, float *c, size_t ldc, float alpha) {
+			__m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+			__m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+			__m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+			__m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+			__m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+			__m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+			for (size_t p = 0; p < kc; p++) {
+				__m256 b0 = _mm256_load_ps(b), b1 = _mm256_load_ps(b + 8);
+				__m256 ai;
+				ai = _mm256_broadcast_ss(a + 0); c00 = _mm256_fmadd_ps(ai, b0, c00); c01 = _mm256_fmadd_ps(ai, b1, c01);
+				ai = _mm256_broadcast_ss(a + 1); c10 = _mm256_fmadd_ps(ai, b0, c10); c11 = _mm256_fmadd_ps(ai, b1, c11);
+				ai = _mm256_broadcast_ss(a + 2); c20 = _mm256_fmadd_ps(ai, b0, c20); c21 = _mm256_fmadd_ps(ai, b1, c21);
+				ai = _mm256_broadcast_ss(a + 3); c30 = _mm256_fmadd_ps(ai, b0, c30); c31 = _mm256_fmadd_ps(ai, b1, c31);
+				ai = _mm256_broadcast_ss(a + 4); c40 = _mm256_fmadd_ps(ai, b0, c40); c41 = _mm256_fmadd_ps(ai, b1, c41);
+				ai = _mm256_broadcast_ss(a + 5); c50 = _mm256_fmadd_ps(ai, b0, c50); c51 = _mm256_fmadd_ps(ai, b1, c51);
+				a += 6;
+				b += 16;
+			}
+			__m256 va = _mm256_set1_ps(alpha);
+			float *r;
+			r = c + 0 * ldc; _mm256_storeu_ps(r, _mm256_fmadd_ps(va, c00, _mm256_loadu_ps(r))); _mm256_storeu_ps(r + 8, _mm256_fmadd_ps(va, c01, _mm256_loadu_ps(r + 8)));
+			r = c + 1 * ldc; _mm256_storeu_ps(r, _mm256_fmadd_ps(va, c10, _mm256_loadu_ps(r))); _mm256_storeu_ps(r + 8, _mm256_fmadd_ps(va, c11, _mm256_loadu_ps(r + 8)));
+			r = c + 2 * ldc; _mm256_storeu_ps(r, _mm256_fmadd_ps(va, c20, _mm256_loadu_ps(r))); _mm256_storeu_ps(r + 8, _mm256_fmadd_ps(va, c21, _mm256_loadu_ps(r + 8)));
+			r = c + 3 * ldc; _mm256_storeu_ps(r, _mm256_fmadd_ps(va, c30, _mm256_loadu_ps(r))); _mm256_storeu_ps(r + 8, _mm256_fmadd_ps(va, c31, _mm256_loadu_ps(r + 8)));
+			r = c + 4 * ldc; _mm256_storeu_ps(r, _mm256_fmadd_ps(va, c40, _mm256_loadu_ps(r))); _mm256_storeu_ps(r + 8, _mm256_fmadd_ps(va, c41, _mm256_loadu_ps(r + 8)));
+			r = c + 5 * ldc; _mm256_storeu_ps(r, _mm256_fmadd_ps(va, c50, _mm256_loadu_ps(r))); _mm256_storeu_ps(r + 8, _mm256_fmadd_ps(va, c51, _mm256_loadu_ps(r + 8)));
+		}
+#endif
+
+		// Picks the micro-kernel once per element type, on first use. Complex types always use the portable one.
+		template <class T>
+		static MicroKernel<T> SelectKernel() { return KernelScalar<T>; }
+		template <>
+		MicroKernel<double> SelectKernel<double>() {
+#ifdef M2D_X86
+			static const MicroKernel<double> kernel = CpuHasAvx2Fma() ? KernelAvx2Double : KernelScalar<double>;
+#else
+			static const MicroKernel<double> kernel = KernelScalar<double>;
+#endif
+			return kernel;
+		}
+		template <>
+		MicroKernel<float> SelectKernel<float>() {
+#ifdef M2D_X86
+			static const MicroKernel<float> kernel = CpuHasAvx2Fma() ? KernelAvx2Float : KernelScalar<float>;
+#else
+			static const MicroKernel<float> kernel = KernelScalar<float>;
+#endif
+			return kernel;
+		}
+
+		const char *GemmKernelName() {
+			return SelectKernel<double>() == KernelScalar<double> ? "scalar" : "avx2-fma";
+		}
+
+		// Packs the mc x kc block of op(A) starting at (i0, p0) into MR-row micro-panels, zero-padding the last one.
+		template <class T>
+		static void PackA(bool trans, const T *A, size_t lda, size_t i0, size_t p0, size_t mc, size_t kc, T *dst) {
+			constexpr size_t MR = GemmTile<T>::MR;
+			for (size_t ir = 0; ir < mc; ir += MR) {
+				size_t mr = min(MR, mc - ir);
+				for (size_t p = 0; p < kc; p++) {
+					for (size_t i = 0; i < mr; i++) {
+						size_t row = i0 + ir + i, col = p0 + p;
+						dst[i] = trans ? A[col * lda + row] : A[row * lda + col];
+					}
+					for (size_t i = mr; i < MR; i++) dst[i] = 0;
+					dst += MR;
+				}
+			}
+		}
+
+		// Packs the kc x nc block of op(B) starting at (p0, j0) into NR-column micro-panels, zero-padding the last one.
+		template <class T>
+		static void PackB(bool trans, const T *B, size_t ldb, size_t p0, size_t j0, size_t kc, size_t nc, T *dst) {
+			constexpr size_t NR = GemmTile<T>::NR;
+			for (size_t jr = 0; jr < nc; jr += NR) {
+				size_t nr = min(NR, nc - jr);
+				for (size_t p = 0; p < kc; p++) {
+					size_t row = p0 + p;
+					if (!trans && nr == NR) {
+						memcpy(dst, B + row * ldb + j0 + jr, NR * sizeof(T));
+					}
+					else {
+						for (size_t j = 0; j < nr; j++) {
+							size_t col = j0 + jr + j;
+							dst[j] = trans ? B[col * ldb + row] : B[row * ldb + col];
+						}
+						for (size_t j = nr; j < NR; j++) dst[j] = 0;
+					}
+					dst += NR;
+				}
+			}
+		}
+
+		// Runs the micro-kernel over one packed mc x nc block of C.
+		template <class T>
+		static void MacroKernel(MicroKernel<T> kernel, size_t mc, size_t nc, size_t kc, T alpha,
+			const T *Ap, const T *Bp, T *C, size_t ldc) {
+			constexpr size_t MR = GemmTile<T>::MR, NR = GemmTile<T>::NR;
+			alignas(64) T edge[MR * NR];
+			for (size_t jr = 0; jr < nc; jr += NR) {
+				size_t nr = min(NR, nc - jr);
+				const T *b = Bp + jr * kc;
+				for (size_t ir = 0; ir < mc; ir += MR) {
+					size_t mr = min(MR, mc - ir);
+					const T *a = Ap + ir * kc;
+					T *c = C + ir * ldc + jr;
+					if (mr == MR && nr == NR) {
+						kernel(kc, a, b, c, ldc, alpha);
+					}
+					else { // partial tile: accumulate into a scratch tile, then add the valid part
+						fill_n(edge, MR * NR, T());
+						kernel(kc, a, b, edge, NR, alpha);
+						for (size_t i = 0; i < mr; i++) {
+							for (size_t j = 0; j < nr; j++) c[i * ldc + j] += edge[i * NR + j];
+						}
+					}
+				}
+			}
+		}
+
+		// Straightforward i-p-j loop for products too small to amortise packing.
+		template <class T>
+		static void GemmSmall(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+			T alpha, const T *A, size_t lda, const T *B, size_t ldb, T *C, size_t ldc) {
+			for (size_t i = 0; i < m; i++) {
+				T *c = C + i * ldc;
+				for (size_t p = 0; p < k; p++) {
+					T a = alpha * (trans_a ? A[p * lda + i] : A[i * lda + p]);
+					if (a == T()) continue;
+					if (!trans_b) {
+						const T *b = B + p * ldb;
+						for (size_t j = 0; j < n; j++) c[j] += a * b[j];
+					}
+					else {
+						for (size_t j = 0; j < n; j++) c[j] += a * B[j * ldb + p];
+					}
+				}
+			}
+		}
+
+		// Applies C = beta * C, treating beta == 0 as an overwrite so that NaNs in C do not survive.
+		template <class T>
+		static void ScaleC(size_t m, size_t n, T beta, T *C, size_t ldc) {
+			if (beta == T(1)) return;
+			for (size_t i = 0; i < m; i++) {
+				T *c = C + i * ldc;
+				if (beta == T()) fill_n(c, n, T());
+				else for (size_t j = 0; j < n; j++) c[j] *= beta;
+			}
+		}
+
+		template <class T>
+		void Gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+			T alpha, const T *A, size_t lda, const T *B, size_t ldb,
+			T beta, T *C, size_t ldc) {
+			constexpr size_t MR = GemmTile<T>::MR, NR = GemmTile<T>::NR;
+			// Packed A blocks hold the same number of bytes whatever the element size.
+			constexpr size_t MC = detail::MC * sizeof(double) / sizeof(T) / MR * MR;
+			if (m == 0 || n == 0) return;
+			ScaleC(m, n, beta, C, ldc);
+			if (k == 0 || alpha == T()) return;
+			if (m * n * k <= kSmallGemmFlops) {
+				GemmSmall(trans_a, trans_b, m, n, k, alpha, A, lda, B, ldb, C, ldc);
+				return;
+			}
+
+			MicroKernel<T> kernel = SelectKernel<T>();
+			PackLease<T> b_lease(PackBuffers<T>::b, KC * ((min(NC, n) + NR - 1) / NR * NR));
+			T *Bp = b_lease.get();
+			size_t a_block = KC * ((min(MC, m) + MR - 1) / MR * MR);
+			bool parallel = m * n * k >= kParallelGemmFlops && ParallelWidth() > 1;
+			for (size_t jc = 0; jc < n; jc += NC) {
+				size_t nc = min(NC, n - jc);
+				size_t n_panels = (nc + NR - 1) / NR;
+				for (size_t pc = 0; pc < k; pc += KC) {
+					size_t kc = min(KC, k - pc);
+					ParallelFor(0, n_panels, parallel ? 16 : n_panels, [&](size_t lo, size_t hi) {
+						PackB(trans_b, B, ldb, pc, jc + lo * NR, kc, min(nc, hi * NR) - lo * NR, Bp + lo * NR * kc);
+					});
+
+					// Output tiles are one MC row block by a run of NR panels. Row blocks alone give enough tiles
+					// for big m; for short, wide products the columns are split too so that every thread gets work.
+					size_t m_blocks = (m + MC - 1) / MC;
+					size_t n_chunks = 1;
+					if (parallel && m_blocks < ParallelWidth() * 2)
+						n_chunks = min(n_panels, (ParallelWidth() * 2 + m_blocks - 1) / m_blocks);
+					size_t chunk_panels = (n_panels + n_chunks - 1) / n_chunks;
+					auto run_tiles = [&](size_t lo, size_t hi) {
+						PackLease<T> a_lease(PackBuffers<T>::a, a_block);
+						T *Ap = a_lease.get();
+						size_t packed_ic = SIZE_MAX;
+						for (size_t t = lo; t < hi; t++) {
+							size_t ic = (t / n_chunks) * MC, j0 = (t % n_chunks) * chunk_panels * NR;
+							if (j0 >= nc) continue;
+							size_t mc = min(MC, m - ic), ncc = min(chunk_panels * NR, nc - j0);
+							if (ic != packed_ic) { // consecutive tiles of one row block share their packed A
+								PackA(trans_a, A, lda, ic, pc, mc, kc, Ap);
+								packed_ic = ic;
+							}
+							MacroKernel(kernel, mc, ncc, kc, alpha, Ap, Bp + j0 * kc, C + ic * ldc + jc + j0, ldc);
+						}
+					};
+					size_t tiles = m_blocks * n_chunks;
+					if (parallel) ParallelFor(0, tiles, 1, run_tiles);
+					else run_tiles(0, tiles);
+				}
+			}
+		}
+
+		template void Gemm<float>(bool, bool, size_t, size_t, size_t, float, const float*, size_t, const float*, size_t, float, float*, size_t);
+		template void Gemm<double>(bool, bool, size_t, size_t, size_t, double, const double*, size_t, const double*, size_t, double, double*, size_t);
+		template void Gemm<complex<float>>(bool, bool, size_t, size_t, size_t, complex<float>, const complex<float>*, size_t,
+			const complex<float>*, size_t, complex<float>, complex<float>*, size_t);
+		template void Gemm<complex<double>>(bool, bool, size_t, size_t, size_t, complex<double>, const complex<double>*, size_t,
+			const complex<double>*, size_t, complex<double>, complex<double>*, size_t);
+	}
+
+	// Whether the memory spanned by two strided views intersects.
+	// Both views are strided, possibly after undoing a transpose.
+	static bool Overlaps(ConstMatrixView a, ConstMatrixView b) {
+		if (a.getSizeX() == 0 || a.getSizeY() == 0 || b.getSizeX() == 0 || b.getSizeY() == 0) return false;
+		const double *a_end = a.data() + (a.getSizeX() - 1) * a.getStride() + a.getSizeY();
+		const double *b_end = b.data() + (b.getSizeX() - 1) * b.getStride() + b.getSizeY();
+		return a.data() < b_end && b.data() < a_end;
+	}
+
+	void gemm(double alpha, ConstMatrixView A, ConstMatrixView B, double beta, MatrixView C) {
+		if (A.getSizeY() != B.getSizeX() || C.getSizeX() != A.getSizeX() || C.getSizeY() != B.getSizeY())
+			throw invalid_argument("Cannot multiply these matrices: incompatible dimensions.");
+		// Transposed views are passed to the packing routines as their source plus a flag.
+		ConstMatrixView a = A.isTransposed() ? A.transposed() : A;
+		ConstMatrixView b = B.isTransposed() ? B.transposed() : B;
+		MatrixView c = C.isTransposed() ? C.transposed() : C;
+		if (!a.isStrided() || !b.isStrided()) { // minors: multiply strided copies instead
+			gemm(alpha, a.isStrided() ? A : Matrix2D(A), b.isStrided() ? B : Matrix2D(B), beta, C);
+			return;
+		}
+		if (!c.isStrided()) {
+			Matrix2D tmp(C);
+			gemm(alpha, A, B, beta, tmp);
+			C = tmp;
+			return;
+		}
+		double m = (double)A.getSizeX(), k = (double)A.getSizeY(), n = (double)B.getSizeY();
+		detail::ProfileScope profile(detail::ProfiledOp::Gemm, 2 * m * k * n + (beta != 0 ? 2 * m * n : 0),
+			(m * k + k * n + (beta != 0 ? 2 : 1) * m * n) * sizeof(double));
+		if (Overlaps(c, a) || Overlaps(c, b))
+			throw invalid_argument("The output of gemm() must not overlap either of its inputs.");
+		if (C.isTransposed()) { // C^T = B^T * A^T, written straight into C's source
+			detail::Dgemm(!B.isTransposed(), !A.isTransposed(), B.getSizeY(), A.getSizeX(), A.getSizeY(),
+				alpha, b.data(), b.getStride(), a.data(), a.getStride(), beta, c.data(), c.getStride());
+			return;
+		}
+		detail::Dgemm(A.isTransposed(), B.isTransposed(), A.getSizeX(), B.getSizeY(), A.getSizeY(),
+			alpha, a.data(), a.getStride(), b.data(), b.getStride(), beta, c.data(), c.getStride());
+	}
+}
@@ -0,0 +1,50 @@
+/**
+ * @file gemm_kernel.h
+ * Internal interface to the packed, cache-blocked GEMM engine.
+ * Not part of the public interface: the library routes Matrix2D::operator*, gemm() and the factorisations through it.
+ */
+
+#ifndef MATRIX2D_GEMM_KERNEL
+#define MATRIX2D_GEMM_KERNEL
+
+#include <cstddef>
+#include <complex>
+
+namespace m2d {
+	namespace detail {
+		/** Computes C = alpha * op(A) * op(B) + beta * C on raw row-major buffers of T.
+		* op(X) is X, or its transpose when the matching trans flag is set. No range checking is done.
+		* When beta is zero, C is overwritten without being read, so it may hold uninitialised values.
+		* @param trans_a: Whether to use the transpose of A.
+		* @param trans_b: Whether to use the transpose of B.
+		* @param m: Row count of op(A) and C.
+		* @param n: Column count of op(B) and C.
+		* @param k: Column count of op(A), row count of op(B).
+		* @param alpha: Scale factor for the product.
+		* @param A: Pointer to element (0, 0) of A.
+		* @param lda: Leading dimension of A.
+		* @param B: Pointer to element (0, 0) of B.
+		* @param ldb: Leading dimension of B.
+		* @param beta: Scale factor for the existing contents of C.
+		* @param C: Pointer to element (0, 0) of C. Must not alias A or B.
+		* @param ldc: Leading dimension of C.
+		* Defined for float, double, complex<float> and complex<double> only; float and double run the AVX2 kernels.
+		*/
+		template <class T>
+		void Gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+			T alpha, const T *A, size_t lda, const T *B, size_t ldb,
+			T beta, T *C, size_t ldc);
+		/** Double-precision Gemm(), the engine behind Matrix2D. */
+		inline void Dgemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+			double alpha, const double *A, size_t lda, const double *B, size_t ldb,
+			double beta, double *C, size_t ldc) {
+			Gemm<double>(trans_a, trans_b, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+		}
+		/** Reports which micro-kernel Dgemm() dispatches to on this machine.
+		* @return "avx2-fma" or "scalar".
+		*/
+		const char *GemmKernelName();
+	}
+}
+
+#endif // MATRIX2D_GEMM_KERNEL
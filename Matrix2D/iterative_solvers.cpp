@@ -0,0 +1,316 @@
+/**
+* @file iterative_solvers.cpp
+* Contains implementations of the stationary and Krylov iterative solvers and their preconditioners.
+*/
+#include "stdafx.h"
+#include "iterative_solvers.h"
+#include "vector_tools.h"
+#include "thread_pool.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		constexpr size_t kNoEntry = SIZE_MAX;
+		constexpr size_t kVectorGrain = 16384; // elements per task of an element-wise vector loop
+
+		static void CheckSystem(const SparseMatrix &A, ConstMatrixView b, ConstMatrixView x) {
+			if (!A.isSquare()) throw invalid_argument("Cannot solve: the matrix must be square.");
+			size_t n = A.getSizeX();
+			for (const ConstMatrixView *v : { &b, &x }) {
+				if ((v->getSizeY() != 1 || v->getSizeX() != n) && (v->getSizeX() != 1 || v->getSizeY() != n))
+					throw invalid_argument("Cannot solve: b and x must be vectors with one element per row of A.");
+			}
+		}
+
+		// Copies a row or column vector into a contiguous column.
+		static Matrix2D ColumnOf(ConstMatrixView v) {
+			size_t n = v.getSizeX() * v.getSizeY();
+			Matrix2D c(n, 1);
+			double *p = c.data();
+			if (v.getSizeY() == 1) for (size_t i = 0; i < n; i++) p[i] = v.coeff(i, 0);
+			else for (size_t i = 0; i < n; i++) p[i] = v.coeff(0, i);
+			return c;
+		}
+		static void StoreColumn(const Matrix2D &c, MatrixView v) {
+			if (v.getSizeY() == 1) v = c;
+			else v = c.transposed();
+		}
+
+		// Position of each diagonal entry in the CSR arrays of A.
+		static vector<size_t> DiagonalPositions(const SparseMatrix &A) {
+			const vector<size_t> &row_ptr = A.rowPointers(), &col_idx = A.columnIndices();
+			const vector<double> &vals = A.values();
+			vector<size_t> pos(A.getSizeX());
+			for (size_t i = 0; i < pos.size(); i++) {
+				auto begin = col_idx.begin() + row_ptr[i], end = col_idx.begin() + row_ptr[i + 1];
+				auto it = lower_bound(begin, end, i);
+				if (it == end || *it != i || vals[it - col_idx.begin()] == 0)
+					throw range_error("Cannot iterate: the matrix has a zero on its diagonal.");
+				pos[i] = it - col_idx.begin();
+			}
+			return pos;
+		}
+
+		static size_t SparseRowGrain(const SparseMatrix &A) {
+			return RowGrain(A.getNonZeroCount() / max<size_t>(A.getSizeX(), 1) + 1);
+		}
+
+		// r = b - A * x, returning ||r||.
+		static double Residual(const SparseMatrix &A, const Matrix2D &b, const Matrix2D &x, Matrix2D &r) {
+			r = b;
+			spmm(-1, A, x, 1, r);
+			return nrm2(r);
+		}
+
+		/** A preconditioner M, applied as z = M^-1 * r. */
+		class PreconditionerOp {
+			Preconditioner kind;
+			const SparseMatrix &A;
+			vector<double> inv_diag; /** Jacobi: 1 / a_ii. */
+			vector<double> lu; /** ILU(0): L below and U on and above the diagonal, in the CSR pattern of A. */
+			vector<size_t> diag_pos;
+		public:
+			PreconditionerOp(const SparseMatrix &A, Preconditioner kind) : kind(kind), A(A) {
+				if (kind == Preconditioner::None) return;
+				diag_pos = DiagonalPositions(A);
+				const vector<double> &vals = A.values();
+				if (kind == Preconditioner::Jacobi) {
+					inv_diag.resize(diag_pos.size());
+					for (size_t i = 0; i < diag_pos.size(); i++) inv_diag[i] = 1 / vals[diag_pos[i]];
+					return;
+				}
+				// ILU(0), row by row (IKJ order): eliminate with the earlier rows, discarding fill outside the pattern.
+				const vector<size_t> &row_ptr = A.rowPointers(), &col_idx = A.columnIndices();
+				lu = vals;
+				size_t n = A.getSizeX();
+				vector<size_t> where(n, kNoEntry);
+				for (size_t i = 0; i < n; i++) {
+					for (size_t k = row_ptr[i]; k < row_ptr[i + 1]; k++) where[col_idx[k]] = k;
+					for (size_t k = row_ptr[i]; k < diag_pos[i]; k++) {
+						size_t c = col_idx[k];
+						double l = lu[k] /= lu[diag_pos[c]];
+						for (size_t kk = diag_pos[c] + 1; kk < row_ptr[c + 1]; kk++) {
+							size_t at = where[col_idx[kk]];
+							if (at != kNoEntry) lu[at] -= l * lu[kk];
+						}
+					}
+					if (lu[diag_pos[i]] == 0) throw range_error("Cannot precondition: ILU(0) produced a zero pivot.");
+					for (size_t k = row_ptr[i]; k < row_ptr[i + 1]; k++) where[col_idx[k]] = kNoEntry;
+				}
+			}
+
+			void apply(const double *r, double *z) const {
+				size_t n = A.getSizeX();
+				if (kind == Preconditioner::None) {
+					copy(r, r + n, z);
+					return;
+				}
+				if (kind == Preconditioner::Jacobi) {
+					ParallelFor(0, n, kVectorGrain, [&](size_t lo, size_t hi) {
+						for (size_t i = lo; i < hi; i++) z[i] = r[i] * inv_diag[i];
+					});
+					return;
+				}
+				// Forward substitution with the unit lower factor, then back substitution with the upper one.
+				const vector<size_t> &row_ptr = A.rowPointers(), &col_idx = A.columnIndices();
+				for (size_t i = 0; i < n; i++) {
+					double s = r[i];
+					for (size_t k = row_ptr[i]; k < diag_pos[i]; k++) s -= lu[k] * z[col_idx[k]];
+					z[i] = s;
+				}
+				for (size_t i = n; i-- > 0;) {
+					double s = z[i];
+					for (size_t k = diag_pos[i] + 1; k < row_ptr[i + 1]; k++) s -= lu[k] * z[col_idx[k]];
+					z[i] = s / lu[diag_pos[i]];
+				}
+			}
+		};
+	}
+
+	IterativeResult Jacobi(const SparseMatrix &A, ConstMatrixView b, MatrixView x, const IterativeOptions &options) {
+		detail::CheckSystem(A, b, x);
+		size_t n = A.getSizeX();
+		Matrix2D bc = detail::ColumnOf(b), xc = detail::ColumnOf(x), next(n, 1);
+		double b_norm = nrm2(bc);
+		if (b_norm == 0) {
+			detail::StoreColumn(Matrix2D(n, 1), x);
+			return { 0, 0, true };
+		}
+		vector<size_t> diag_pos = detail::DiagonalPositions(A);
+		const vector<size_t> &row_ptr = A.rowPointers(), &col_idx = A.columnIndices();
+		const vector<double> &vals = A.values();
+		vector<double> sq(n);
+		IterativeResult result = { 0, 0, false };
+		for (;; result.iterations++) {
+			// One pass computes both the residual of the current iterate and the next iterate, x + D^-1 * r.
+			const double *xp = xc.data(), *bp = bc.data();
+			double *np = next.data();
+			detail::ParallelFor(0, n, detail::SparseRowGrain(A), [&](size_t lo, size_t hi) {
+				for (size_t i = lo; i < hi; i++) {
+					double s = 0;
+					for (size_t k = row_ptr[i]; k < row_ptr[i + 1]; k++) s += vals[k] * xp[col_idx[k]];
+					double r = bp[i] - s;
+					sq[i] = r * r;
+					np[i] = xp[i] + r / vals[diag_pos[i]];
+				}
+			});
+			double r_norm = 0;
+			for (double v : sq) r_norm += v;
+			result.residual = sqrt(r_norm) / b_norm;
+			result.converged = result.residual <= options.tolerance;
+			if (result.converged || result.iterations == options.max_iterations || !isfinite(result.residual)) break;
+			swap(xc, next);
+		}
+		detail::StoreColumn(xc, x);
+		return result;
+	}
+
+	IterativeResult GaussSeidel(const SparseMatrix &A, ConstMatrixView b, MatrixView x, const IterativeOptions &options) {
+		detail::CheckSystem(A, b, x);
+		double omega = options.relaxation;
+		if (!(omega > 0 && omega < 2)) throw invalid_argument("Cannot iterate: the relaxation factor must lie in (0, 2).");
+		size_t n = A.getSizeX();
+		Matrix2D bc = detail::ColumnOf(b), xc = detail::ColumnOf(x), r(n, 1);
+		double b_norm = nrm2(bc);
+		if (b_norm == 0) {
+			detail::StoreColumn(Matrix2D(n, 1), x);
+			return { 0, 0, true };
+		}
+		vector<size_t> diag_pos = detail::DiagonalPositions(A);
+		const vector<size_t> &row_ptr = A.rowPointers(), &col_idx = A.columnIndices();
+		const vector<double> &vals = A.values();
+		IterativeResult result = { 0, 0, false };
+		for (;; result.iterations++) {
+			result.residual = detail::Residual(A, bc, xc, r) / b_norm;
+			result.converged = result.residual <= options.tolerance;
+			if (result.converged || result.iterations == options.max_iterations || !isfinite(result.residual)) break;
+			// The sweep is inherently sequential: row i reads the values of rows before it from this same sweep.
+			double *xp = xc.data();
+			const double *bp = bc.data();
+			for (size_t i = 0; i < n; i++) {
+				double s = bp[i];
+				for (size_t k = row_ptr[i]; k < row_ptr[i + 1]; k++) s -= vals[k] * xp[col_idx[k]];
+				xp[i] += omega * s / vals[diag_pos[i]];
+			}
+		}
+		detail::StoreColumn(xc, x);
+		return result;
+	}
+
+	IterativeResult ConjugateGradient(const SparseMatrix &A, ConstMatrixView b, MatrixView x,
+		const IterativeOptions &options, Preconditioner preconditioner) {
+		detail::CheckSystem(A, b, x);
+		size_t n = A.getSizeX();
+		Matrix2D bc = detail::ColumnOf(b), xc = detail::ColumnOf(x), r(n, 1), z(n, 1), p(n, 1), q(n, 1);
+		double b_norm = nrm2(bc);
+		if (b_norm == 0) {
+			detail::StoreColumn(Matrix2D(n, 1), x);
+			return { 0, 0, true };
+		}
+		detail::PreconditionerOp M(A, preconditioner);
+		IterativeResult result = { 0, detail::Residual(A, bc, xc, r) / b_norm, false };
+		bool restart = true;
+		double rz = 0;
+		while (result.residual > options.tolerance && result.iterations < options.max_iterations) {
+			if (restart) { // (re)start along the preconditioned residual
+				M.apply(r.data(), z.data());
+				p = z;
+				rz = dot(r, z);
+				restart = false;
+			}
+			spmm(1, A, p, 0, q);
+			double pq = dot(p, q);
+			if (!(pq > 0)) break; // A is not positive definite along p
+			double alpha = rz / pq;
+			axpy(alpha, p, xc);
+			axpy(-alpha, q, r);
+			result.iterations++;
+			result.residual = nrm2(r) / b_norm;
+			if (result.residual <= options.tolerance) {
+				// The recursively updated r drifts from b - A * x; confirm against the true residual before stopping.
+				result.residual = detail::Residual(A, bc, xc, r) / b_norm;
+				restart = true;
+				continue;
+			}
+			M.apply(r.data(), z.data());
+			double rz_next = dot(r, z);
+			scal(rz_next / rz, p);
+			axpy(1, z, p);
+			rz = rz_next;
+		}
+		result.converged = result.residual <= options.tolerance;
+		detail::StoreColumn(xc, x);
+		return result;
+	}
+
+	IterativeResult GMRES(const SparseMatrix &A, ConstMatrixView b, MatrixView x,
+		const IterativeOptions &options, Preconditioner preconditioner) {
+		detail::CheckSystem(A, b, x);
+		size_t n = A.getSizeX(), m = max<size_t>(1, min(options.restart, n));
+		Matrix2D bc = detail::ColumnOf(b), xc = detail::ColumnOf(x), r(n, 1), z(n, 1), w(n, 1);
+		double b_norm = nrm2(bc);
+		if (b_norm == 0) {
+			detail::StoreColumn(Matrix2D(n, 1), x);
+			return { 0, 0, true };
+		}
+		detail::PreconditionerOp M(A, preconditioner);
+		Matrix2D V(m + 1, n); // Arnoldi basis, one vector per row
+		Matrix2D H(m + 1, m); // Hessenberg matrix, reduced to triangular by Givens rotations as it grows
+		vector<double> cs(m), sn(m), g(m + 1), y(m);
+		IterativeResult result = { 0, 0, false };
+		for (;;) {
+			double beta = detail::Residual(A, bc, xc, r);
+			result.residual = beta / b_norm;
+			result.converged = result.residual <= options.tolerance;
+			if (result.converged || result.iterations >= options.max_iterations || !isfinite(result.residual)) break;
+			const MatrixView v0(V.rowView(0));
+			v0 = r.transposed();
+			scal(1 / beta, v0);
+			fill(g.begin(), g.end(), 0.0);
+			g[0] = beta;
+			size_t k = 0;
+			while (k < m && result.iterations < options.max_iterations) {
+				// w = A * M^-1 * v_k, orthogonalised against the basis by modified Gram-Schmidt.
+				M.apply(V.row(k), z.data());
+				spmm(1, A, z, 0, w);
+				for (size_t i = 0; i <= k; i++) {
+					double h = dot(w, V.rowView(i));
+					H.row(i)[k] = h;
+					axpy(-h, V.rowView(i), w);
+				}
+				double h_next = nrm2(w);
+				for (size_t i = 0; i < k; i++) {
+					double a = H.row(i)[k], c = H.row(i + 1)[k];
+					H.row(i)[k] = cs[i] * a + sn[i] * c;
+					H.row(i + 1)[k] = -sn[i] * a + cs[i] * c;
+				}
+				double diag = H.row(k)[k], rho = hypot(diag, h_next);
+				cs[k] = rho == 0 ? 1 : diag / rho;
+				sn[k] = rho == 0 ? 0 : h_next / rho;
+				H.row(k)[k] = rho;
+				g[k + 1] = -sn[k] * g[k];
+				g[k] *= cs[k];
+				k++;
+				result.iterations++;
+				if (h_next == 0 || fabs(g[k]) <= options.tolerance * b_norm) break; // lucky breakdown, or converged
+				const MatrixView vk(V.rowView(k));
+				vk = w.transposed();
+				scal(1 / h_next, vk);
+			}
+			// Solve the k x k triangular system for the basis coefficients, then x += M^-1 * (V^T * y).
+			for (size_t i = k; i-- > 0;) {
+				double s = g[i];
+				for (size_t j = i + 1; j < k; j++) s -= H.row(i)[j] * y[j];
+				y[i] = H.row(i)[i] == 0 ? 0 : s / H.row(i)[i];
+			}
+			fill_n(w.data(), n, 0.0);
+			for (size_t i = 0; i < k; i++) axpy(y[i], V.rowView(i), w);
+			M.apply(w.data(), z.data());
+			axpy(1, z, xc);
+		}
+		detail::StoreColumn(xc, x);
+		return result;
+	}
+}
@@ -0,0 +1,76 @@
+/**
+ * @file iterative_solvers.h
+ * Interface to iterative solvers for large sparse systems A * x = b: Jacobi, Gauss-Seidel/SOR, preconditioned
+ * conjugate gradients and restarted GMRES. Each iteration costs one sparse product plus vector operations, so the
+ * work scales with the nonzeros of A rather than with n^3, and no factors are stored beyond an optional ILU(0).
+ *
+ * Every solver takes x as both the initial guess and the result, so a previous solution can be passed back in as
+ * a warm start; pass zeros for a cold start. Iteration stops once the residual satisfies
+ * ||b - A * x|| <= tolerance * ||b||, or after max_iterations.
+ */
+
+#ifndef MATRIX2D_ITERATIVE
+#define MATRIX2D_ITERATIVE
+
+#include "sparse_matrix.h"
+
+namespace m2d {
+	/** Stopping criteria and tuning shared by the iterative solvers. */
+	struct IterativeOptions {
+		double tolerance = 1e-10; /** Target for the relative residual ||b - A * x|| / ||b||. */
+		size_t max_iterations = 1000; /** Cap on iterations; for GMRES, on inner iterations across restarts. */
+		double relaxation = 1.0; /** SOR factor omega in (0, 2), used by GaussSeidel(). 1 is plain Gauss-Seidel. */
+		size_t restart = 30; /** Krylov subspace size before GMRES restarts. */
+	};
+
+	/** Outcome of an iterative solve. */
+	struct IterativeResult {
+		size_t iterations; /** Iterations performed. */
+		double residual; /** Final relative residual ||b - A * x|| / ||b||. */
+		bool converged; /** Whether residual <= tolerance. */
+	};
+
+	/** Preconditioners for ConjugateGradient() and GMRES(). */
+	enum class Preconditioner {
+		None, /** Plain Krylov iteration. */
+		Jacobi, /** Scale by the inverse diagonal. Cheap, and enough for well-scaled problems. */
+		ILU0 /** Incomplete LU with no fill beyond the pattern of A. Needs a nonzero diagonal. */
+	};
+
+	/** Jacobi iteration, updating every unknown from the previous iterate, in parallel over rows.
+	* Converges for any starting guess when A.isDiagonallyDominant().
+	* @param x: On entry, the initial guess; on exit, the last iterate.
+	* @exception invalid_argument() if A is not square or b or x is not a vector of matching length;
+	* range_error() if the diagonal of A has a zero.
+	*/
+	MATRIX2D_LIB IterativeResult Jacobi(const SparseMatrix &A, ConstMatrixView b, MatrixView x,
+		const IterativeOptions &options = IterativeOptions());
+	/** Gauss-Seidel iteration with successive over-relaxation by options.relaxation. Each sweep uses the unknowns
+	* already updated in it, so it usually needs about half the iterations of Jacobi; sweeps are sequential.
+	* Converges for any starting guess when A.isDiagonallyDominant() and the relaxation is 1, and for any SPD A
+	* with a relaxation in (0, 2).
+	* @param x: On entry, the initial guess; on exit, the last iterate.
+	* @exception invalid_argument() if A is not square, b or x is not a vector of matching length, or the relaxation
+	* is outside (0, 2); range_error() if the diagonal of A has a zero.
+	*/
+	MATRIX2D_LIB IterativeResult GaussSeidel(const SparseMatrix &A, ConstMatrixView b, MatrixView x,
+		const IterativeOptions &options = IterativeOptions());
+	/** Preconditioned conjugate gradients, for symmetric positive definite A.
+	* Stops without converging if a search direction shows that A is not positive definite.
+	* @param x: On entry, the initial guess; on exit, the last iterate.
+	* @exception invalid_argument() if A is not square or b or x is not a vector of matching length;
+	* range_error() if the preconditioner needs a diagonal entry that is zero.
+	*/
+	MATRIX2D_LIB IterativeResult ConjugateGradient(const SparseMatrix &A, ConstMatrixView b, MatrixView x,
+		const IterativeOptions &options = IterativeOptions(), Preconditioner preconditioner = Preconditioner::Jacobi);
+	/** Restarted GMRES(options.restart) with right preconditioning, for general nonsingular A. Right
+	* preconditioning keeps the monitored residual equal to the true one.
+	* @param x: On entry, the initial guess; on exit, the last iterate.
+	* @exception invalid_argument() if A is not square or b or x is not a vector of matching length;
+	* range_error() if the preconditioner needs a diagonal entry that is zero.
+	*/
+	MATRIX2D_LIB IterativeResult GMRES(const SparseMatrix &A, ConstMatrixView b, MatrixView x,
+		const IterativeOptions &options = IterativeOptions(), Preconditioner preconditioner = Preconditioner::ILU0);
+}
+
+#endif // MATRIX2D_ITERATIVE
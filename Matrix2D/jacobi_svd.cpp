@@ -0,0 +1,97 @@
+/**
+* @file jacobi_svd.cpp
+* Contains the implementation of the one-sided Jacobi singular value decomposition.
+*/
+#include "stdafx.h"
+#include "factor_kernels.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		// Enough for any matrix in practice: Jacobi converges quadratically once the off-diagonal mass is small,
+		// typically within 6 to 12 sweeps.
+		constexpr size_t kMaxJacobiSweeps = 60;
+
+		// Rotates rows p and q of A (and of Q alongside) so that they become orthogonal.
+		// Returns false if they already were, their cosine being at most tol.
+		static bool RotatePair(size_t n, double *ap, double *aq, double *qp, double *qq, double tol) {
+			// Two partial sums each, so that the three reductions do not serialise on the add latency.
+			double alpha[2] = {}, beta[2] = {}, gamma[2] = {};
+			size_t i = 0;
+			for (; i + 1 < n; i += 2) {
+				for (size_t k = 0; k < 2; k++) {
+					alpha[k] += ap[i + k] * ap[i + k];
+					beta[k] += aq[i + k] * aq[i + k];
+					gamma[k] += ap[i + k] * aq[i + k];
+				}
+			}
+			if (i < n) {
+				alpha[0] += ap[i] * ap[i];
+				beta[0] += aq[i] * aq[i];
+				gamma[0] += ap[i] * aq[i];
+			}
+			double a = alpha[0] + alpha[1], b = beta[0] + beta[1], g = gamma[0] + gamma[1];
+			if (!(fabs(g) > tol * sqrt(a * b))) return false;
+			// The rotation angle that zeroes the off-diagonal entry of [[a, g], [g, b]], as in LAPACK's dgesvj:
+			// the smaller root t of t^2 + 2 * zeta * t - 1 = 0.
+			double zeta = (b - a) / (2 * g);
+			double t = copysign(1.0, zeta) / (fabs(zeta) + sqrt(1 + zeta * zeta));
+			double c = 1 / sqrt(1 + t * t), s = c * t;
+			for (i = 0; i < n; i++) {
+				double x = ap[i], y = aq[i];
+				ap[i] = c * x - s * y;
+				aq[i] = s * x + c * y;
+			}
+			for (i = 0; i < n; i++) {
+				double x = qp[i], y = qq[i];
+				qp[i] = c * x - s * y;
+				qq[i] = s * x + c * y;
+			}
+			return true;
+		}
+
+		void JacobiSvd(size_t n, double *A, size_t lda, double *Q, size_t ldq, double *sigma) {
+			for (size_t i = 0; i < n; i++) {
+				fill(Q + i * ldq, Q + i * ldq + n, 0.0);
+				Q[i * ldq + i] = 1;
+			}
+			// Round-robin ordering: each of the m - 1 rounds of a sweep pairs every row with another, the last row
+			// staying put while the rest rotate around it. An odd n gets a phantom row m - 1 = n, paired with nobody.
+			size_t m = n + n % 2;
+			// Rounding leaves a cosine of about sqrt(n) * eps between rows orthogonal in exact arithmetic, as in dgesvj.
+			double tol = sqrt((double)n) * numeric_limits<double>::epsilon();
+			for (size_t sweep = 0; sweep < kMaxJacobiSweeps && m > 1; sweep++) {
+				atomic<bool> rotated{ false };
+				for (size_t round = 0; round + 1 < m; round++) {
+					ParallelFor(0, m / 2, RowGrain(6 * n), [&](size_t lo, size_t hi) {
+						bool any = false;
+						for (size_t k = lo; k < hi; k++) {
+							size_t p = k == 0 ? m - 1 : (round + k) % (m - 1);
+							size_t q = k == 0 ? round : (round + m - 1 - k) % (m - 1);
+							if (p >= n || q >= n) continue;
+							if (p > q) swap(p, q);
+							any |= RotatePair(n, A + p * lda, A + q * lda, Q + p * ldq, Q + q * ldq, tol);
+						}
+						if (any) rotated.store(true, memory_order_relaxed);
+					});
+				}
+				if (!rotated.load()) break;
+			}
+			for (size_t i = 0; i < n; i++) {
+				const double *a = A + i * lda;
+				double scale = 0, sum = 0;
+				for (size_t j = 0; j < n; j++) scale = max(scale, fabs(a[j]));
+				if (scale > 0) {
+					for (size_t j = 0; j < n; j++) sum += (a[j] / scale) * (a[j] / scale);
+				}
+				sigma[i] = scale * sqrt(sum);
+			}
+		}
+	}
+}
@@ -4,76 +4,392 @@
 */
 #include "stdafx.h"
 #include "matrix_2d.h"
+#include "factor_kernels.h"
+#include "gemm_kernel.h"
+#include "thread_pool.h"
+#include "basic_matrix.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <complex>
+#include <limits>
 
 using namespace std;
 
 namespace m2d {
-	void LUFactorizeDoolittle(const Matrix2D& A, Matrix2D& L, Matrix2D& U) {
-		size_t sz = A.getSizeX();
-		for (size_t i = 0; i < sz; i++) {
-			if (A.getAt(i, i) == 0) throw range_error("A is not factorizable: one of its diagonal elements are zero.");
-			L.setAt(i, i, 1); // Set diagonal of L to 1
-			U.setAt(0, i, A.getAt(0, i)); // Copy first row of A to U
-		}
-		for (size_t i = 1; i < sz; i++) { // First column of L sans first element
-			L.setAt(i, 0, A.getAt(i, 0) / U.getAt(0, 0));
+	namespace detail {
+		// Panel width of the blocked factorisation. Trailing updates are GEMMs with k = kLuBlock.
+		constexpr size_t kLuBlock = 128;
+
+		// Pivot size used for partial pivoting: |x| for real types, the cheaper |re| + |im| for complex ones.
+		template <class T> static double PivotMagnitude(T x) { return fabs(x); }
+		template <class T> static double PivotMagnitude(complex<T> x) { return fabs(x.real()) + fabs(x.imag()); }
+
+		// Unblocked factorisation of an m x n panel. Pivot indices are relative to the panel's first row.
+		template <class T>
+		static size_t PanelFactor(size_t m, size_t n, T *A, size_t lda, size_t *piv) {
+			size_t mn = min(m, n), first_zero = mn;
+			for (size_t k = 0; k < mn; k++) {
+				T *rk = A + k * lda;
+				if (piv) {
+					size_t p = k;
+					double best = PivotMagnitude(rk[k]);
+					for (size_t i = k + 1; i < m; i++) {
+						double v = PivotMagnitude(A[i * lda + k]);
+						if (v > best) {
+							best = v;
+							p = i;
+						}
+					}
+					piv[k] = p;
+					if (p != k) swap_ranges(rk, rk + n, A + p * lda);
+				}
+				T d = rk[k];
+				if (d == T()) { // singular column: nothing to eliminate with
+					if (first_zero == mn) first_zero = k;
+					if (!piv) return k;
+					continue;
+				}
+				ParallelFor(k + 1, m, RowGrain(n - k), [&](size_t lo, size_t hi) {
+					for (size_t i = lo; i < hi; i++) {
+						T *ri = A + i * lda;
+						T l = ri[k] / d;
+						ri[k] = l;
+						for (size_t c = k + 1; c < n; c++) ri[c] -= l * rk[c];
+					}
+				});
+			}
+			return first_zero;
 		}
-		for (size_t i = 1; i < sz - 1; i++) { // Compute middle elements for L and U
-			double sum_iji = 0;
-			for (size_t j = 0; j < i; j++) {
-				sum_iji += L.getAt(i, j) * U.getAt(j, i);
+
+		template <class T>
+		size_t Getrf(size_t m, size_t n, T *A, size_t lda, size_t *piv) {
+			size_t mn = min(m, n);
+			if (mn <= kLuBlock) return PanelFactor(m, n, A, lda, piv);
+			size_t first_zero = mn;
+			for (size_t j = 0; j < mn; j += kLuBlock) {
+				size_t jb = min(kLuBlock, mn - j);
+				// Factorise the tall panel A[j:m, j:j+jb].
+				size_t z = PanelFactor(m - j, jb, A + j * lda + j, lda, piv ? piv + j : nullptr);
+				if (z < jb) {
+					if (!piv) return j + z;
+					if (first_zero == mn) first_zero = j + z;
+				}
+				if (piv) { // make the panel's pivots global, then apply them left and right of the panel
+					for (size_t i = j; i < j + jb; i++) piv[i] += j;
+					Laswp(A, lda, 0, j, piv, j, j + jb);
+					Laswp(A, lda, j + jb, n, piv, j, j + jb);
+				}
+				if (j + jb < n) {
+					// U12 = L11^-1 * A12, then the trailing update A22 -= L21 * U12 as one GEMM.
+					TrsmLowerUnit(jb, n - j - jb, A + j * lda + j, lda, A + j * lda + j + jb, lda);
+					if (j + jb < m)
+						Gemm<T>(false, false, m - j - jb, n - j - jb, jb, T(-1), A + (j + jb) * lda + j, lda,
+							A + j * lda + j + jb, lda, T(1), A + (j + jb) * lda + j + jb, lda);
+				}
 			}
-			U.setAt(i, i, A.getAt(i, i) - sum_iji);
-			for (size_t j = i + 1; j < sz; j++) {
-				double sum_ikj = 0, sum_jki = 0;
-				for (size_t k = 0; k < i; k++) {
-					sum_ikj += L.getAt(i, k) * U.getAt(k, j);
-					sum_jki += L.getAt(j, k) * U.getAt(k, i);
+			return first_zero;
+		}
+
+		template <class T>
+		void Laswp(T *A, size_t lda, size_t c0, size_t c1, const size_t *piv, size_t k0, size_t k1) {
+			if (c0 >= c1) return;
+			// Wide blocks, e.g. many right-hand sides, swap column chunks in parallel.
+			ParallelFor(c0, c1, max<size_t>(256, RowGrain(k1 - k0)), [&](size_t lo, size_t hi) {
+				for (size_t k = k0; k < k1; k++) {
+					size_t p = piv[k];
+					if (p != k) swap_ranges(A + k * lda + lo, A + k * lda + hi, A + p * lda + lo);
+				}
+			});
+		}
+
+		// Unblocked triangular solves on one diagonal block. Columns of B are independent; each chunk sweeps its
+		// own column range row by row.
+		template <class T>
+		static void TrsmLowerUnitBlock(size_t m, size_t n, const T *Lbuf, size_t ldl, T *B, size_t ldb) {
+			ParallelFor(0, n, max<size_t>(64, 16384 / (m * m + 1)), [&](size_t lo, size_t hi) {
+				for (size_t r = 1; r < m; r++) {
+					T *br = B + r * ldb;
+					for (size_t q = 0; q < r; q++) {
+						T l = Lbuf[r * ldl + q];
+						if (l == T()) continue;
+						const T *bq = B + q * ldb;
+						for (size_t c = lo; c < hi; c++) br[c] -= l * bq[c];
+					}
 				}
-				U.setAt(i, j, (A.getAt(i, j) - sum_ikj) / L.getAt(i, i));
-				L.setAt(j, i, (A.getAt(j, i) - sum_jki) / U.getAt(i, i));
-				L.print();
+			});
+		}
+		template <class T>
+		static void TrsmUpperBlock(size_t m, size_t n, const T *U, size_t ldu, T *B, size_t ldb) {
+			ParallelFor(0, n, max<size_t>(64, 16384 / (m * m + 1)), [&](size_t lo, size_t hi) {
+				for (size_t r = m; r-- > 0;) {
+					T *br = B + r * ldb;
+					for (size_t q = r + 1; q < m; q++) {
+						T u = U[r * ldu + q];
+						if (u == T()) continue;
+						const T *bq = B + q * ldb;
+						for (size_t c = lo; c < hi; c++) br[c] -= u * bq[c];
+					}
+					T d = U[r * ldu + r];
+					for (size_t c = lo; c < hi; c++) br[c] /= d;
+				}
+			});
+		}
+
+		template <class T>
+		void TrsmLowerUnit(size_t m, size_t n, const T *Lbuf, size_t ldl, T *B, size_t ldb) {
+			// Forward substitution a block row at a time: solve the diagonal block, then eliminate it from the rows
+			// below with one GEMM, so most of the work runs on the GEMM engine.
+			for (size_t j = 0; j < m; j += kLuBlock) {
+				size_t jb = min(kLuBlock, m - j);
+				TrsmLowerUnitBlock(jb, n, Lbuf + j * ldl + j, ldl, B + j * ldb, ldb);
+				if (j + jb < m)
+					Gemm<T>(false, false, m - j - jb, n, jb, T(-1), Lbuf + (j + jb) * ldl + j, ldl,
+						B + j * ldb, ldb, T(1), B + (j + jb) * ldb, ldb);
+			}
+		}
+
+		template <class T>
+		void TrsmUpper(size_t m, size_t n, const T *U, size_t ldu, T *B, size_t ldb) {
+			// Back substitution, the mirror image of TrsmLowerUnit(): bottom block row first, GEMM updates upwards.
+			for (size_t end = m; end > 0;) {
+				size_t jb = min(kLuBlock, end), j = end - jb;
+				TrsmUpperBlock(jb, n, U + j * ldu + j, ldu, B + j * ldb, ldb);
+				if (j > 0)
+					Gemm<T>(false, false, j, n, jb, T(-1), U + j, ldu, B + j * ldb, ldb, T(1), B, ldb);
+				end = j;
+			}
+		}
+
+		// The four element types the library supports.
+#define M2D_INSTANTIATE_FACTOR_KERNELS(T) \
+		template size_t Getrf<T>(size_t, size_t, T*, size_t, size_t*); \
+		template void Laswp<T>(T*, size_t, size_t, size_t, const size_t*, size_t, size_t); \
+		template void TrsmLowerUnit<T>(size_t, size_t, const T*, size_t, T*, size_t); \
+		template void TrsmUpper<T>(size_t, size_t, const T*, size_t, T*, size_t);
+		M2D_INSTANTIATE_FACTOR_KERNELS(float)
+		M2D_INSTANTIATE_FACTOR_KERNELS(double)
+		M2D_INSTANTIATE_FACTOR_KERNELS(complex<float>)
+		M2D_INSTANTIATE_FACTOR_KERNELS(complex<double>)
+#undef M2D_INSTANTIATE_FACTOR_KERNELS
+
+		int PivotSign(const size_t *piv, size_t count) {
+			int sign = 1;
+			for (size_t i = 0; i < count; i++) {
+				if (piv[i] != i) sign = -sign;
 			}
+			return sign;
+		}
+	}
+
+	vector<size_t> LUFactorize(MatrixView A) {
+		if (!A.isSquare()) throw invalid_argument("Cannot factorize non-square matrices.");
+		double n = (double)A.getSizeX();
+		detail::ProfileScope profile(detail::ProfiledOp::LUFactorize, 2.0 / 3.0 * n * n * n, 2 * n * n * sizeof(double));
+		vector<size_t> piv(A.getSizeX());
+		if (A.isStrided()) {
+			detail::Dgetrf(A.getSizeX(), A.getSizeY(), A.data(), A.getStride(), piv.data());
 		}
-		// Compute the bottom-right element of U
-		double sum_nin = 0;
-		for (size_t i = 0; i < sz - 1; i++) {
-			sum_nin += L.getAt(sz - 1, i) * U.getAt(i, sz - 1);
+		else { // a minor: factorise a strided copy, then write it back
+			Matrix2D work(A);
+			detail::Dgetrf(work.getSizeX(), work.getSizeY(), work.data(), work.getStride(), piv.data());
+			A = work;
 		}
-		U.setAt(sz - 1, sz - 1, A.getAt(sz - 1, sz - 1) - sum_nin);
+		return piv;
 	}
 
-	void LUFactorizeCrout(const Matrix2D& A, Matrix2D& L, Matrix2D& U) {
-		size_t sz = A.getSizeX();
-		for (size_t i = 0; i < sz; i++) {
-			if (A.getAt(i, i) == 0) throw range_error("A is not factorizable: one of its diagonal elements are zero.");
-			U.setAt(i, i, 1); // Set diagonal of U to 1
-			L.setAt(i, 0, A.getAt(i, 0)); // Copy first column of A to L
+	void LUSolve(ConstMatrixView LU, const vector<size_t> &piv, MatrixView B) {
+		size_t n = LU.getSizeX();
+		if (!LU.isSquare() || piv.size() != n || B.getSizeX() != n)
+			throw invalid_argument("Cannot solve: the factorisation must be square and match the pivots and right-hand sides.");
+		if (!LU.isStrided()) {
+			LUSolve(Matrix2D(LU), piv, B);
+			return;
 		}
-		for (size_t i = 1; i < sz; i++) { // First row of U sans first element
-			U.setAt(0, i, A.getAt(0, i) / L.getAt(0, 0));
+		if (!B.isStrided()) {
+			Matrix2D X(B);
+			LUSolve(LU, piv, X);
+			B = X;
+			return;
 		}
-		for (size_t i = 1; i < sz - 1; i++) { // Compute middle elements for L and U
-			double sum_iji = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (LU.coeff(i, i) == 0) throw range_error("Cannot solve: the matrix is singular.");
+		}
+		size_t r = B.getSizeY();
+		detail::ProfileScope profile(detail::ProfiledOp::LUSolve, 2.0 * n * n * r,
+			((double)n * n + 2.0 * n * r) * sizeof(double));
+		// X = U^-1 * L^-1 * P * B, each triangle solved for all right-hand sides at once.
+		detail::Dlaswp(B.data(), B.getStride(), 0, r, piv.data(), 0, n);
+		detail::DtrsmLowerUnit(n, r, LU.data(), LU.getStride(), B.data(), B.getStride());
+		detail::DtrsmUpper(n, r, LU.data(), LU.getStride(), B.data(), B.getStride());
+	}
+
+	// Cheap necessary conditions for positive definiteness, as MATLAB's backslash checks before trying Cholesky.
+	static bool MaybePositiveDefinite(ConstMatrixView A) {
+		for (size_t i = 0; i < A.getSizeX(); i++) {
+			if (!(A.coeff(i, i) > 0)) return false;
 			for (size_t j = 0; j < i; j++) {
-				sum_iji += L.getAt(i, j) * U.getAt(j, i);
+				if (A.coeff(i, j) != A.coeff(j, i)) return false;
+			}
+		}
+		return true;
+	}
+
+	Matrix2D solve(ConstMatrixView A, ConstMatrixView B) {
+		if (!A.isSquare()) throw invalid_argument("Cannot solve: the matrix must be square.");
+		if (A.getSizeX() != B.getSizeX()) throw invalid_argument("Cannot solve: A and B must have the same row count.");
+		double n = (double)A.getSizeX(), r = (double)B.getSizeY();
+		detail::ProfileScope profile(detail::ProfiledOp::Solve, 2.0 / 3.0 * n * n * n + 2 * n * n * r,
+			(2 * n * n + 2 * n * r) * sizeof(double));
+		Matrix2D LU(A), X(B);
+		if (MaybePositiveDefinite(A)) {
+			if (CholeskyFactorize(LU)) {
+				profile.setWork(n * n * n / 3 + 2 * n * n * r, (1.5 * n * n + 2 * n * r) * sizeof(double));
+				CholeskySolve(LU, X);
+				return X;
 			}
-			L.setAt(i, i, A.getAt(i, i) - sum_iji);
-			for (size_t j = i + 1; j < sz; j++) {
-				double sum_ikj = 0, sum_jki = 0;
-				for (size_t k = 0; k < i; k++) {
-					sum_ikj += L.getAt(i, k) * U.getAt(k, j);
-					sum_jki += L.getAt(j, k) * U.getAt(k, i);
+			LU = Matrix2D(A);
+		}
+		vector<size_t> piv = LUFactorize(LU);
+		LUSolve(LU, piv, X);
+		return X;
+	}
+	Matrix2D solve(const Matrix2D &A, ConstMatrixView B) {
+		Matrix2D X(B);
+		A.solveInPlace(X);
+		return X;
+	}
+
+	namespace detail {
+		// Refinement steps SolveMixedPrecision() takes before giving up on the float factorisation, as in LAPACK's dsgesv.
+		constexpr int kMaxRefinements = 30;
+
+		// Rounds the elements of a view to float. Returns false if any of them overflows.
+		static bool RoundToFloat(ConstMatrixView src, MatrixF &dst) {
+			if (!src.isStrided()) return RoundToFloat(Matrix2D(src), dst);
+			bool in_range = true;
+			for (size_t x = 0; x < src.getSizeX(); x++) {
+				const double *s = src.data() + x * src.getStride();
+				float *d = dst.row(x);
+				for (size_t y = 0; y < src.getSizeY(); y++) {
+					in_range &= fabs(s[y]) <= FLT_MAX;
+					d[y] = (float)s[y];
 				}
-				U.setAt(i, j, (A.getAt(i, j) - sum_ikj) / L.getAt(i, i));
-				L.setAt(j, i, (A.getAt(j, i) - sum_jki) / U.getAt(i, i));
 			}
+			return in_range;
 		}
-		double sum_nin = 0;
-		for (size_t i = 0; i < sz - 1; i++) {
-			sum_nin += L.getAt(sz - 1, i) * U.getAt(i, sz - 1);
+
+		// Solves LU * X = B in place in single precision. The factorisation is known to be non-singular.
+		static void SolveFloat(const MatrixF &LU, const vector<size_t> &piv, MatrixF &B) {
+			size_t n = LU.getSizeX(), r = B.getSizeY();
+			Laswp<float>(B.data(), B.getStride(), 0, r, piv.data(), 0, n);
+			TrsmLowerUnit<float>(n, r, LU.data(), LU.getStride(), B.data(), B.getStride());
+			TrsmUpper<float>(n, r, LU.data(), LU.getStride(), B.data(), B.getStride());
 		}
-		L.setAt(sz - 1, sz - 1, A.getAt(sz - 1, sz - 1) - sum_nin);
+	}
+
+	Matrix2D SolveMixedPrecision(ConstMatrixView A, ConstMatrixView B, int *iterations) {
+		if (!A.isSquare()) throw invalid_argument("Cannot solve: the matrix must be square.");
+		if (A.getSizeX() != B.getSizeX()) throw invalid_argument("Cannot solve: A and B must have the same row count.");
+		size_t n = A.getSizeX(), r = B.getSizeY();
+		detail::ProfileScope profile(detail::ProfiledOp::SolveMixedPrecision, 2.0 / 3.0 * n * n * n + 2.0 * n * n * r,
+			(1.5 * n * n + 2.0 * n * r) * sizeof(double));
+		auto fallback = [&]() {
+			if (iterations) *iterations = -1;
+			return solve(A, B);
+		};
+		MatrixF LU(n, n), work(n, r);
+		vector<size_t> piv(n);
+		if (!detail::RoundToFloat(A, LU) || detail::Getrf<float>(n, n, LU.data(), LU.getStride(), piv.data()) < n)
+			return fallback();
+
+		// Stopping test of dsgesv: each column's residual must fall below ||A||inf * ||x||inf * eps * sqrt(n).
+		double a_norm = 0;
+		for (size_t i = 0; i < n; i++) {
+			double sum = 0;
+			if (A.isStrided()) for (size_t j = 0; j < n; j++) sum += fabs(A.data()[i * A.getStride() + j]);
+			else for (size_t j = 0; j < n; j++) sum += fabs(A.coeff(i, j));
+			a_norm = max(a_norm, sum);
+		}
+		double tolerance = a_norm * numeric_limits<double>::epsilon() * sqrt((double)n);
+
+		Matrix2D X(n, r), R(n, r);
+		const MatrixView residual(R);
+		vector<double> x_max(r), r_max(r);
+		if (!detail::RoundToFloat(B, work)) return fallback();
+		for (int step = 0; ; step++) {
+			// X += the float solution of the last residual (of B itself, on the first pass).
+			detail::SolveFloat(LU, piv, work);
+			for (size_t i = 0; i < n; i++) {
+				double *x = X.row(i);
+				const float *w = work.row(i);
+				for (size_t j = 0; j < r; j++) x[j] += w[j];
+			}
+			residual = B;
+			gemm(-1.0, A, X, 1.0, R);
+			fill(x_max.begin(), x_max.end(), 0.0);
+			fill(r_max.begin(), r_max.end(), 0.0);
+			for (size_t i = 0; i < n; i++) {
+				const double *x = X.row(i), *res = R.row(i);
+				for (size_t j = 0; j < r; j++) {
+					x_max[j] = max(x_max[j], fabs(x[j]));
+					r_max[j] = max(r_max[j], fabs(res[j]));
+				}
+			}
+			bool converged = true;
+			for (size_t j = 0; j < r; j++) {
+				if (!isfinite(r_max[j])) return fallback(); // the float factors are too far off to refine
+				if (r_max[j] > x_max[j] * tolerance) converged = false;
+			}
+			if (converged) {
+				if (iterations) *iterations = step;
+				return X;
+			}
+			if (step == detail::kMaxRefinements || !detail::RoundToFloat(R, work)) return fallback();
+		}
+	}
+
+	// Both classic variants are the unpivoted blocked factorisation, unpacked into separate L and U.
+	// Doolittle keeps the unit diagonal on L; Crout moves U's diagonal onto L instead.
+	static void FactorizeUnpivoted(ConstMatrixView A, MatrixView L, MatrixView U, bool unit_upper) {
+		size_t sz = A.getSizeX();
+		if (!A.isSquare() || L.getSizeX() != sz || L.getSizeY() != sz || U.getSizeX() != sz || U.getSizeY() != sz)
+			throw invalid_argument("Cannot factorize: A must be square and L, U must be of the same size.");
+		double n = (double)sz;
+		detail::ProfileScope profile(unit_upper ? detail::ProfiledOp::LUFactorizeCrout : detail::ProfiledOp::LUFactorizeDoolittle,
+			2.0 / 3.0 * n * n * n, 4 * n * n * sizeof(double));
+		Matrix2D LU(A);
+		if (detail::Dgetrf(sz, sz, LU.data(), LU.getStride(), nullptr) < sz)
+			throw range_error("A is not factorizable without pivoting: a zero pivot was encountered.");
+		for (size_t i = 0; i < sz; i++) {
+			const double *lu = LU.row(i);
+			for (size_t c = 0; c < sz; c++) {
+				double &l = L.coeffRef(i, c), &u = U.coeffRef(i, c);
+				if (c < i) {
+					l = unit_upper ? lu[c] * LU.row(c)[c] : lu[c];
+					u = 0;
+				}
+				else if (c == i) {
+					l = unit_upper ? lu[c] : 1;
+					u = unit_upper ? 1 : lu[c];
+				}
+				else {
+					l = 0;
+					u = unit_upper ? lu[c] / lu[i] : lu[c];
+				}
+			}
+		}
+		L.markModified();
+		U.markModified();
+	}
+
+	void LUFactorizeDoolittle(ConstMatrixView A, MatrixView L, MatrixView U) {
+		FactorizeUnpivoted(A, L, U, false);
+	}
+
+	void LUFactorizeCrout(ConstMatrixView A, MatrixView L, MatrixView U) {
+		FactorizeUnpivoted(A, L, U, true);
 	}
 }
 
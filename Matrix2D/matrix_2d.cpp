@@ -4,50 +4,122 @@
 */
 #include "stdafx.h"
 #include "matrix_2d.h"
+#include "matrix_io.h"
+#include "block_matrix.h"
+#include "profiler.h"
+#include "aligned_memory.h"
+#include "gemm_kernel.h"
+#include "factor_kernels.h"
+#include "factor_cache.h"
+#include "transpose_kernel.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
 
 using namespace std;
 
 namespace m2d {
 	void InputMatrix(ifstream &ifs, Matrix2D &mat) {
-		double temp;
-		for (size_t r = 0; r < mat.getSizeX(); r++) {
-			for (size_t c = 0; c < mat.getSizeY(); c++) {
-				ifs >> temp;
-				mat.setAt(r, c, temp);
-			}
+		InputMatrix(ifs, MatrixView(mat));
+	}
+	void InputMatrix(ifstream &ifs, MatrixView mat) {
+		detail::ProfileScope profile(detail::ProfiledOp::InputMatrix, 0, 0);
+		// Slurp the rest of the stream and parse it in parallel, then leave the stream just after the last value read.
+		streampos start = ifs.tellg();
+		ifs.seekg(0, ios::end);
+		streamoff remaining = ifs.tellg() - start;
+		ifs.seekg(start);
+		if (!ifs || remaining < 0) throw runtime_error("Cannot read matrix input.");
+		string text((size_t)remaining, '\0');
+		ifs.read(&text[0], remaining);
+		text.resize((size_t)ifs.gcount()); // fewer characters than bytes in text mode on Windows
+		profile.setWork(0, text.size() + (double)mat.getSizeX() * mat.getSizeY() * sizeof(double));
+		ifs.clear();
+		const char *first = text.data(), *last = first + text.size();
+		const char *end = ParseText(first, last, mat);
+		if (all_of(end, last, [](char c) { return isspace((unsigned char)c) != 0; })) ifs.seekg(0, ios::end);
+		else {
+			ifs.seekg(start);
+			ifs.ignore(end - first); // counts characters, not bytes, so it is exact in text mode too
 		}
 	}
 
 	// Constructor and destructor
-	Matrix2D::Matrix2D(size_t size_x, size_t size_y) :
-		size_x(size_x), size_y(size_y) {
-		elem = new double*[size_x];
-		for (size_t i = 0; i < size_x; i++) {
-			elem[i] = new double[size_y] {0};
-		}
+	Matrix2D::BasicMatrix(size_t size_x, size_t size_y) :
+		size_x(size_x), size_y(size_y), stride(detail::MatrixStride(size_y)), version(0), factor(nullptr) {
+		elem = detail::AllocateBuffer(size_x * stride);
 	}
-	Matrix2D::Matrix2D(const Matrix2D& src):
+	Matrix2D::BasicMatrix(const Matrix2D& src):
 	Matrix2D(src.getSizeX(), src.getSizeY()) {
-		for (size_t x = 0; x < src.getSizeX(); x++) {
-			for (size_t y = 0; y < src.getSizeY(); y++) {
-				setAt(x, y, src.getAt(x, y));
-			}
+		if (elem) memcpy(elem, src.elem, size_x * stride * sizeof(double)); // same stride, padding included
+	}
+	Matrix2D::BasicMatrix(ConstMatrixView src) :
+	Matrix2D(src.getSizeX(), src.getSizeY()) {
+		if (src.isStrided()) {
+			for (size_t x = 0; x < size_x; x++) memcpy(row(x), src.data() + x * src.getStride(), size_y * sizeof(double));
+		}
+		else if (src.isTransposed() && src.transposed().isStrided()) {
+			detail::TransposeInto(size_y, size_x, src.data(), src.getStride(), elem, stride);
+		}
+		else {
+			for (size_t x = 0; x < size_x; x++)
+				for (size_t y = 0; y < size_y; y++) elem[x * stride + y] = src.coeff(x, y);
+		}
+	}
+	Matrix2D::BasicMatrix(Matrix2D&& src) noexcept :
+		elem(src.elem), size_x(src.size_x), size_y(src.size_y), stride(src.stride), version(src.version),
+		factor(src.factor.exchange(nullptr)) { // same contents, same version: the factorisation stays valid
+		src.elem = nullptr;
+		src.size_x = src.size_y = src.stride = 0;
+		src.version++;
+	}
+	Matrix2D& Matrix2D::operator=(const Matrix2D& src) {
+		if (this == &src) return *this;
+		if (size_x == src.size_x && size_y == src.size_y) { // same shape, hence same stride: reuse the buffer
+			if (elem) memcpy(elem, src.elem, size_x * stride * sizeof(double));
+			version++;
+			return *this;
 		}
+		return *this = Matrix2D(src);
+	}
+	Matrix2D& Matrix2D::operator=(Matrix2D&& src) noexcept {
+		swap(elem, src.elem);
+		swap(size_x, src.size_x);
+		swap(size_y, src.size_y);
+		swap(stride, src.stride);
+		// Both sides change contents. Swapping the factorisations as well lets either reuse the other's storage,
+		// and moving both versions past either old one marks them stale.
+		detail::FactorCache *mine = factor.load(memory_order_relaxed);
+		factor.store(src.factor.load(memory_order_relaxed), memory_order_relaxed);
+		src.factor.store(mine, memory_order_relaxed);
+		version = src.version = max(version, src.version) + 1;
+		return *this;
 	}
-	Matrix2D::~Matrix2D() {
-		for (size_t i = 0; i < size_x; i++) delete[] elem[i];
-		delete[] elem;
+	Matrix2D::~BasicMatrix() {
+		delete factor.load();
+		detail::FreeBuffer(elem);
 	}
 
 	// Getter and setter
 	double Matrix2D::getAt(size_t pos_x, size_t pos_y) const {
 		if (pos_x >= size_x || pos_y >= size_y) throw out_of_range("Indices exceeded Matrix2D range.");
-		return elem[pos_x][pos_y];
+		return elem[pos_x * stride + pos_y];
 	}
 	void Matrix2D::setAt(size_t pos_x, size_t pos_y, double val) {
 		try {
 			if (pos_x >= size_x || pos_y >= size_y) throw out_of_range("Indices exceeded Matrix2D range.");
-			elem[pos_x][pos_y] = val;
+			double &target = elem[pos_x * stride + pos_y];
+			double delta = val - target;
+			target = val;
+			uint64_t before = version++;
+			if (detail::FactorCache *cache = factor.load(memory_order_acquire)) {
+				lock_guard<mutex> guard(cache->lock);
+				cache->noteChange(before, version, pos_x, pos_y, delta);
+			}
 			return;
 		}
 		catch (out_of_range &e) {
@@ -67,101 +139,168 @@ namespace m2d {
 	}
 
 	// Concatenators
-	Matrix2D ConcatenateHorizontally(const Matrix2D &left, const Matrix2D &right) {
+	Matrix2D ConcatenateHorizontally(ConstMatrixView left, ConstMatrixView right) {
 		if (left.getSizeX() != right.getSizeX())
 			throw range_error("Cannot horizontally concatenate two matrices with different row counts.");
-		Matrix2D result(left.getSizeX(), left.getSizeY() + right.getSizeY()); // TODO: warn if overflow
-		for (size_t y = 0; y < left.getSizeY(); y++) { // put left matrix in result
-			for (size_t x = 0; x < left.getSizeX(); x++) {
-				result.setAt(x, y, left.getAt(x, y));
-			}
-		}
-		for (size_t y = left.getSizeY(); y < left.getSizeY() + right.getSizeY(); y++) { // put right matrix in result
-			for (size_t x = 0; x < left.getSizeX(); x++) {
-				result.setAt(x, y, right.getAt(x, y));
-			}
-		}
-		return result;
+		return ComposeHorizontally(left, right).toDense(); // one row-wise pass, a memcpy per side and row
 	}
-	Matrix2D ConcatenateVertically(const Matrix2D &top, const Matrix2D &bottom) {
+	Matrix2D ConcatenateVertically(ConstMatrixView top, ConstMatrixView bottom) {
 		if (top.getSizeY() != bottom.getSizeY())
 			throw range_error("Cannot vertically concatenate two matrices with different column counts.");
-		Matrix2D result(top.getSizeX() + bottom.getSizeX(), top.getSizeY()); // TODO: warn if overflow
-		for (size_t x = 0; x < top.getSizeX(); x++) { // put top matrix in result
-			for (size_t y = 0; y < top.getSizeY(); y++) {
-				result.setAt(x, y, top.getAt(x, y));
-			}
-		}
-		for (size_t x = top.getSizeX(); x < top.getSizeX() + bottom.getSizeX(); x++) { // put top matrix in result
-			for (size_t y = 0; y < top.getSizeY(); y++) {
-				result.setAt(x, y, top.getAt(x, y));
-			}
-		}
-		return result;
+		return ComposeVertically(top, bottom).toDense();
 	}
 
 	// Submatrix extractor
 	Matrix2D Matrix2D::subMatrix(size_t pos_x, size_t pos_y, size_t sub_size_x, size_t sub_size_y) const {
-		if (pos_x + sub_size_x - 1 > size_x || pos_y + sub_size_y - 1 > size_y)
-			throw range_error("Submatrix is out of bounds.");
-		Matrix2D result(sub_size_x, sub_size_y);
-		for (size_t x = 0; x < sub_size_x; x++) {
-			for (size_t y = 0; y < sub_size_y; y++) {
-				result.setAt(x, y, this->getAt(pos_x + x, pos_y + y));
-			}
-		}
-		return result;
+		detail::ProfileScope profile(detail::ProfiledOp::SubMatrix, 0, 2.0 * sub_size_x * sub_size_y * sizeof(double));
+		return Matrix2D(subView(pos_x, pos_y, sub_size_x, sub_size_y));
 	}
 
 	// Cofactor methods
 	Matrix2D Matrix2D::cofactorOf(size_t pos_x, size_t pos_y) const {
-		Matrix2D cof(size_x - 1, size_y - 1);
-		size_t cof_x = 0, cof_y = 0; // indices for cofactor
-		for (size_t x = 0; x < size_x; x++) { // indices to iterate over source matrix (this one)
-			for (size_t y = 0; y < size_y; y++) {
-				if (x != pos_x || y != pos_y) { // skip row and column that the target element is in
-					cof.setAt(cof_x++, cof_y++, getAt(x, y));
-				}
+		return Matrix2D(minorView(pos_x, pos_y));
+	}
+	Matrix2D Matrix2D::cofactorMatrix() const {
+		Matrix2D cofactors = adjugate();
+		cofactors.transpose();
+		return cofactors;
+	}
+
+	// Sign of a permutation given as an array of images.
+	static double PermutationSign(const vector<size_t> &perm) {
+		vector<bool> seen(perm.size());
+		double sign = 1;
+		for (size_t i = 0; i < perm.size(); i++) {
+			if (seen[i]) continue;
+			for (size_t j = i; !seen[j]; j = perm[j]) {
+				seen[j] = true;
+				if (j != i) sign = -sign; // a cycle of length L is L - 1 transpositions
 			}
 		}
-		return cof;
+		return sign;
 	}
 
-	// Transposer
-	void Matrix2D::transpose() noexcept {
-		double** transposed = new double* [size_y];
-		for (size_t i = 0; i < size_y; i++) {
-			transposed[i] = new double[size_x];
-			for (size_t j = 0; j < size_x; j++) {
-				transposed[i][j] = getAt(i, j);
+	// The SVD comes from a pivoted QR, A * P = Q1 * R, then Jacobi on the rows of R, J * R = S * Y, which converges in
+	// a few sweeps on the graded R where it would take a dozen or more on A itself (as in LAPACK's dgejsv). So
+	// A = Q1 * J^T * S * Y * P^T and adj(A) = det(Y * P^T) * P * Y^T * adj(S) * det(Q1 * J^T) * J * Q1^T, with adj(S) =
+	// diag(prod over j != i of s_j). That is continuous in the singular values, so tiny ones need no threshold: only
+	// exact zeros are special.
+	static Matrix2D AdjugateFromSvd(const Matrix2D &A) {
+		size_t n = A.getSizeX();
+		Matrix2D QR(A), Y(n, n), J(n, n), result(n, n);
+		vector<double> tau(n), sigma(n);
+		vector<size_t> perm(n);
+		detail::Geqp3(n, n, QR.data(), QR.getStride(), tau.data(), perm.data());
+		for (size_t i = 0; i < n; i++) copy(QR.row(i) + i, QR.row(i) + n, Y.row(i) + i);
+		detail::JacobiSvd(n, Y.data(), Y.getStride(), J.data(), J.getStride(), sigma.data());
+		size_t zeros = count(sigma.begin(), sigma.end(), 0.0);
+		if (zeros > 1) return result; // every minor of a matrix of rank n - 2 or less is singular
+		size_t null_row = n;
+		for (size_t i = 0; i < n; i++) {
+			double *y = Y.row(i);
+			if (sigma[i] == 0) null_row = i;
+			else for (size_t j = 0; j < n; j++) y[j] /= sigma[i];
+		}
+		if (null_row < n) {
+			// Complete Y with a unit vector orthogonal to the other rows: start from the coordinate axis they cover
+			// least and orthogonalise twice against them, enough for full precision.
+			vector<double> cover(n, 0.0);
+			for (size_t i = 0; i < n; i++) {
+				const double *y = Y.row(i);
+				for (size_t j = 0; j < n; j++) cover[j] += y[j] * y[j];
+			}
+			double *v = Y.row(null_row);
+			fill(v, v + n, 0.0);
+			v[min_element(cover.begin(), cover.end()) - cover.begin()] = 1;
+			for (int pass = 0; pass < 2; pass++) {
+				for (size_t i = 0; i < n; i++) {
+					if (i == null_row) continue;
+					const double *y = Y.row(i);
+					double d = 0;
+					for (size_t j = 0; j < n; j++) d += y[j] * v[j];
+					for (size_t j = 0; j < n; j++) v[j] -= d * y[j];
+				}
 			}
+			double norm = 0;
+			for (size_t j = 0; j < n; j++) norm += v[j] * v[j];
+			norm = sqrt(norm);
+			for (size_t j = 0; j < n; j++) v[j] /= norm;
+		}
+		// det(Y) is +-1, its sign taken from an LU factorisation. Each non-trivial reflector of Q1 has det -1.
+		Matrix2D LU(Y);
+		vector<size_t> piv(n);
+		detail::Dgetrf(n, n, LU.data(), LU.getStride(), piv.data());
+		double sign = detail::PivotSign(piv.data(), n) * PermutationSign(perm);
+		for (size_t i = 0; i < n; i++) {
+			if (LU.row(i)[i] < 0) sign = -sign;
+			if (tau[i] != 0) sign = -sign;
+		}
+		// Row i of J scaled by the sign and prod over j != i of s_j, from prefix and suffix products.
+		vector<double> suffix(n + 1, 1.0);
+		for (size_t i = n; i-- > 0;) suffix[i] = suffix[i + 1] * sigma[i];
+		double prefix = sign;
+		for (size_t i = 0; i < n; i++) {
+			double w = prefix * suffix[i + 1], *q = J.row(i);
+			for (size_t j = 0; j < n; j++) q[j] *= w;
+			prefix *= sigma[i];
 		}
-		for (size_t i = 0; i < size_x; i++) delete[] elem[i];
-		delete[] elem;
-		elem = transposed;
-		size_t temp = size_x;
-		size_x = size_y;
-		size_y = temp;
-		return;
+		// (adj(S) * J) * Q1^T = (Q1 * (adj(S) * J)^T)^T, then Y^T times that, then the rows permuted by P.
+		Matrix2D JQ(J.transposed()), T(n, n);
+		detail::Ormqr(false, n, n, n, QR.data(), QR.getStride(), tau.data(), JQ.data(), JQ.getStride());
+		gemm(1, Y.transposed(), JQ.transposed(), 0, T);
+		for (size_t j = 0; j < n; j++) copy(T.row(j), T.row(j) + n, result.row(perm[j]));
+		return result;
 	}
 
-	// Simple determinant calculator. It assumes that the permutation matrix has determinant 1.
-	double Matrix2D::det() const {
-		if (!isSquare()) throw invalid_argument("Cannot compute determinant of non-square matrices.");
-		double result = 1;
-		Matrix2D L(size_x, size_x), U(size_x, size_x);
-
-		// Factorise current matrix into lower and upper halves.
-		LUFactorizeDoolittle(*this, L, U);
-
-		// det(A) = 1*det(L)*det(U), with determinants of triangular matrices being the product of their diagonals.
+	Matrix2D Matrix2D::adjugate() const {
+		if (!isSquare()) throw invalid_argument("Cannot compute the adjugate of non-square matrices.");
+		double n = (double)size_x;
+		detail::ProfileScope profile(detail::ProfiledOp::Adjugate, 2 * n * n * n, 3 * n * n * sizeof(double));
+		// adj(A) = det(A) * A^-1 is accurate to about cond(A) * eps relative, while adj(A) itself stays well
+		// conditioned as A nears singularity. The pivot ratio estimates cond(A) for free: past 1 / sqrt(eps), use the SVD.
+		Matrix2D LU(*this);
+		vector<size_t> piv(size_x);
+		detail::Dgetrf(size_x, size_x, LU.data(), LU.getStride(), piv.data());
+		double det = detail::PivotSign(piv.data(), size_x), lo = numeric_limits<double>::infinity(), hi = 0;
 		for (size_t i = 0; i < size_x; i++) {
-			result *= L.getAt(i, i);
-			result *= U.getAt(i, i);
+			double u = LU.row(i)[i];
+			det *= u;
+			lo = min(lo, fabs(u));
+			hi = max(hi, fabs(u));
 		}
+		if (!(lo > sqrt(numeric_limits<double>::epsilon()) * hi)) {
+			profile.setWork(2.0 / 3.0 * n * n * n + 30 * n * n * n, 6 * n * n * sizeof(double)); // a few sweeps
+			return AdjugateFromSvd(*this);
+		}
+		Matrix2D result(size_x, size_x);
+		for (size_t i = 0; i < size_x; i++) result.row(i)[i] = det;
+		LUSolve(LU, piv, result);
 		return result;
 	}
 
+	// Transposer
+	void Matrix2D::transpose() {
+		detail::ProfileScope profile(detail::ProfiledOp::Transpose, 0, 2.0 * size_x * size_y * sizeof(double));
+		if (isSquare()) { // same shape and stride afterwards: no allocation needed
+			detail::TransposeSquareInPlace(size_x, elem, stride);
+			version++;
+			return;
+		}
+		*this = Matrix2D(transposed());
+	}
+
+	// Determinant from the pivoted LU factorisation: det(A) = det(P) * prod(diag(U)), det(L) being 1.
+	double Matrix2D::det() const {
+		if (!isSquare()) throw invalid_argument("Cannot compute determinant of non-square matrices.");
+		double n = (double)size_x;
+		detail::ProfileScope profile(detail::ProfiledOp::Det, 0, 0);
+		detail::FactorCache &cache = factorization();
+		lock_guard<mutex> guard(cache.lock);
+		double flops = cache.refresh(*this);
+		profile.setWork(flops + n, (flops ? 2 : 1) * n * n * sizeof(double));
+		return cache.det();
+	}
+
 	// Bool checks
 	bool Matrix2D::isUpperTriangular() const {
 		if (!isSquare()) return false;
@@ -190,6 +329,15 @@ namespace m2d {
 		}
 		return true;
 	}
+	bool Matrix2D::isSymmetric() const {
+		if (!isSquare()) return false;
+		for (size_t x = 1; x < size_x; x++) {
+			for (size_t y = 0; y < x; y++) {
+				if (getAt(x, y) != getAt(y, x)) return false;
+			}
+		}
+		return true;
+	}
 	bool Matrix2D::isDiagonallyDominant() const {
 		if (!isSquare()) return false;
 		for (size_t x = 0; x < size_x; x++) {
@@ -197,52 +345,77 @@ namespace m2d {
 			for (size_t y = 0; y < size_y; y++) {
 				if (x != y) row_sum += fabs(getAt(x, y));
 			}
-			if (row_sum >= getAt(x, x)) return false;
+			if (row_sum >= fabs(getAt(x, x))) return false;
 		}
 		return true;
 	}
 
 	// Arithmetics
-	Matrix2D Matrix2D::operator+(const Matrix2D& other) const {
-		if (size_x != other.getSizeX() || getSizeY() != other.getSizeY()) 
-			throw invalid_argument("Cannot add two matrices of different dimensions.");
-		Matrix2D result(size_x, size_y);
-		for (size_t x = 0; x < size_x; x++) {
-			for (size_t y = 0; y < size_y; y++) {
-				result.setAt(x, y, getAt(x, y) + other.getAt(x, y));
-			}
-		}
-		return result;
-	}
-	Matrix2D Matrix2D::operator-(const Matrix2D& other) const {
-		if (getSizeX() != other.getSizeX() || getSizeY() != other.getSizeY())
-			throw invalid_argument("Cannot subtract two matrices of different dimensions.");
-		Matrix2D result(size_x, size_y);
-		for (size_t x = 0; x < size_x; x++) {
-			for (size_t y = 0; y < size_y; y++) {
-				result.setAt(x, y, getAt(x, y) - other.getAt(x, y));
-			}
-		}
-		return result;
-
-	}
 	Matrix2D Matrix2D::operator*(const Matrix2D& other) const {
 		if (size_y != other.getSizeX()) 
 			throw invalid_argument("Cannot multiply these matrices: incompatible dimensions.");
+		double m = (double)size_x, k = (double)size_y, n = (double)other.getSizeY();
+		detail::ProfileScope profile(detail::ProfiledOp::Multiply, 2 * m * k * n, (m * k + k * n + m * n) * sizeof(double));
 		Matrix2D result(size_x, other.getSizeY());
-		for (size_t x = 0; x < size_x; x++) {
-			for (size_t y = 0; y < other.getSizeY(); y++) {
-				double temp = 0;
-				for (size_t row_idx = 0; row_idx < size_y; row_idx++) {
-					for (size_t col_idx = 0; col_idx < other.getSizeX(); col_idx++) {
-						temp += getAt(x, row_idx) * other.getAt(y, col_idx);
-					}
-				}
-				result.setAt(x, y, temp);
-			}
-		}
+		detail::Dgemm(false, false, size_x, other.getSizeY(), size_y,
+			1.0, elem, stride, other.data(), other.getStride(), 0.0, result.data(), result.getStride());
 		return result;
 	}
 	void Matrix2D::invert() {
+		if (!isSquare()) throw invalid_argument("Cannot invert non-square matrices.");
+		double n = (double)size_x;
+		detail::ProfileScope profile(detail::ProfiledOp::Invert, 0, 0);
+		Matrix2D inverse(size_x, size_x);
+		for (size_t i = 0; i < size_x; i++) inverse.row(i)[i] = 1;
+		{
+			detail::FactorCache &cache = factorization();
+			lock_guard<mutex> guard(cache.lock);
+			double flops = cache.refresh(*this);
+			cache.solveInPlace(inverse);
+			profile.setWork(flops + 4.0 / 3.0 * n * n * n, 3 * n * n * sizeof(double));
+		}
+		*this = move(inverse); // the old factorisation goes with the old buffer
+	}
+
+	// Cached factorisation
+	detail::FactorCache &Matrix2D::factorization() const {
+		detail::FactorCache *cache = factor.load(memory_order_acquire);
+		if (cache) return *cache;
+		// Two const callers may race to create it; the loser discards its own.
+		detail::FactorCache *fresh = new detail::FactorCache();
+		if (factor.compare_exchange_strong(cache, fresh, memory_order_acq_rel)) return *fresh;
+		delete fresh;
+		return *cache;
+	}
+	void Matrix2D::releaseFactorization() const {
+		delete factor.exchange(nullptr);
+	}
+	void Matrix2D::solveInPlace(MatrixView B) const {
+		if (!isSquare()) throw invalid_argument("Cannot solve: the matrix must be square.");
+		if (B.getSizeX() != size_x) throw invalid_argument("Cannot solve: A and B must have the same row count.");
+		double n = (double)size_x, r = (double)B.getSizeY();
+		detail::ProfileScope profile(detail::ProfiledOp::Solve, 0, 0);
+		detail::FactorCache &cache = factorization();
+		lock_guard<mutex> guard(cache.lock);
+		double flops = cache.refresh(*this);
+		cache.solveInPlace(B);
+		profile.setWork(flops + 2 * n * n * r, ((flops ? 2 : 1) * n * n + 2 * n * r) * sizeof(double));
+	}
+	void Matrix2D::rankUpdate(ConstMatrixView U, ConstMatrixView V) {
+		if (U.getSizeX() != size_x || V.getSizeX() != size_y || U.getSizeY() != V.getSizeY())
+			throw invalid_argument("Cannot update: U and V must have as many rows as this matrix has rows and columns, and the same column count.");
+		uint64_t before = version;
+		gemm(1, U, V.transposed(), 1, *this); // the view made for gemm moves the version on
+		detail::FactorCache *cache = factor.load(memory_order_acquire);
+		if (cache && isSquare()) {
+			lock_guard<mutex> guard(cache->lock);
+			cache->update(*this, before, U, V);
+		}
+	}
+	void Matrix2D::rankOneUpdate(ConstMatrixView u, ConstMatrixView v) {
+		ConstMatrixView uc = u.getSizeY() == 1 ? u : u.transposed(), vc = v.getSizeY() == 1 ? v : v.transposed();
+		if (uc.getSizeY() != 1 || uc.getSizeX() != size_x || vc.getSizeY() != 1 || vc.getSizeX() != size_y)
+			throw invalid_argument("Cannot update: u and v must be vectors as long as this matrix's column and row.");
+		rankUpdate(uc, vc);
 	}
 }
\ No newline at end of file
@@ -6,41 +6,104 @@
 #ifndef MATRIX2D_BASE
 #define MATRIX2D_BASE
 
-#ifdef MATRIX2D_EXPORTS
-#define MATRIX2D_LIB __declspec(dllexport) // dll building
-#else
-#define MATRIX2D_LIB __declspec(dllimport) // usage
-#endif
-
+#include "export_macros.h"
+#include "matrix_view.h"
+#include <atomic>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <cmath>
 #include <stdexcept>
 #include <iomanip>
+#include <vector>
 
 using namespace std;
 namespace m2d {
-	/** Main 2D Matrix class definition.
-	* This matrix class is range-checked and compatible with const parameters.
+	template <> struct IsMatrixExpr<Matrix2D> : std::true_type {};
+	namespace detail {
+		template <> struct IsExprLeaf<Matrix2D> : std::true_type {};
+		template <> struct IsHeldByReference<Matrix2D> : std::true_type {};
+		class FactorCache;
+	}
+
+	/** Main 2D Matrix class definition: BasicMatrix<double>, known everywhere as Matrix2D.
+	* This matrix class is range-checked and compatible with const parameters. Views, expression templates, I/O and
+	* the batched and tiled engines work on it; other element types use the general BasicMatrix<T> (see basic_matrix.h).
 	*/
-	class MATRIX2D_LIB Matrix2D {
-		double **elem; /** A 2D array of double-precision floating point numbers. */
+	template <>
+	class MATRIX2D_LIB BasicMatrix<double> {
+		double *elem; /** Contiguous row-major buffer of size_x rows of stride doubles each. The buffer is 64-byte aligned; rows are padded to 64 bytes except when there is one column. */
 		size_t size_x, size_y; /** Size of this matrix, which must always be initialised. */
+		size_t stride; /** Leading dimension: distance, in elements, between the starts of two consecutive rows. */
+		uint64_t version; /** Modification counter, see getVersion(). */
+		mutable std::atomic<detail::FactorCache*> factor; /** LU factorisation kept for det(), solve() and invert(), built on first use. */
+		detail::FactorCache &factorization() const;
+		friend class MatrixView; // moves version on when written through
 	public:
 		/** Simple constructor.
-		* Initialises all elements to zero.
+		* Initialises all elements to zero. Storage is a single aligned allocation, with each row padded
+		* to a multiple of 64 bytes so that every row starts on a cache line. A single column is not padded, so
+		* column vectors are contiguous.
 		* @param size_x: Can be understood as number of rows.
 		* @param size_y: Can be understood as number of columns.
 		*/
-		Matrix2D(size_t size_x, size_t size_y);
+		BasicMatrix(size_t size_x, size_t size_y);
 		/** Copy constructor
 		* @param src: The source Matrix2D object to copy from.
 		*/
-		Matrix2D(const Matrix2D& src);
+		BasicMatrix(const Matrix2D& src);
+		/** Move constructor. Takes over the source's buffer without copying.
+		* @param src: The source Matrix2D object. It is left as an empty 0 x 0 matrix.
+		*/
+		BasicMatrix(Matrix2D&& src) noexcept;
+		/** Copies the elements addressed by a view into a new matrix.
+		* @param src: The view to copy from.
+		*/
+		explicit BasicMatrix(ConstMatrixView src);
+		/** Constructs a matrix by evaluating an element-wise expression, such as A + B - 2 * C, in a single pass.
+		* @param expr: The expression to evaluate.
+		*/
+		template <class E, class = detail::EnableIfNode<E>>
+		BasicMatrix(const E& expr) : BasicMatrix(expr.getSizeX(), expr.getSizeY()) {
+			detail::EvaluateInto(elem, stride, expr);
+		}
+		/** Copy assignment. Reuses the existing buffer when the sizes match.
+		* @param src: The source Matrix2D object to copy from.
+		* @return A reference to this matrix.
+		*/
+		Matrix2D& operator=(const Matrix2D& src);
+		/** Move assignment. Takes over the source's buffer without copying.
+		* @param src: The source Matrix2D object. It receives this matrix's old buffer, to be freed with it.
+		* @return A reference to this matrix.
+		*/
+		Matrix2D& operator=(Matrix2D&& src) noexcept;
+		/** Assigns an element-wise expression in a single pass, reusing the existing buffer when the sizes match.
+		* The expression may refer to this matrix in any way. When it only reads it whole, as in A = A + B, it is
+		* evaluated in place; when it reads it transposed or through a minor, as in A = A + A.transposed(), it is
+		* evaluated into a new buffer that then replaces this one.
+		* @param expr: The expression to evaluate.
+		* @return A reference to this matrix.
+		*/
+		template <class E, class = detail::EnableIfNode<E>>
+		Matrix2D& operator=(const E& expr) {
+			if (expr.getSizeX() == size_x && expr.getSizeY() == size_y
+				&& !detail::ReadsReordered<E>::check(expr, elem, stride, size_x, size_y)) {
+				detail::EvaluateInto(elem, stride, expr);
+				version++;
+			}
+			else *this = Matrix2D(expr);
+			return *this;
+		}
 		/** Destructor.
-		* Deallocates 2D double array.
+		* Deallocates 2D double array and the cached factorisation, if any.
 		*/
-		~Matrix2D();
+		~BasicMatrix();
+		/** Unchecked getter, for kernels and expression templates.
+		* @param pos_x: Row index of desired value.
+		* @param pos_y: Column index of desired value.
+		* @return a copy of the value at that location.
+		*/
+		double coeff(size_t pos_x, size_t pos_y) const { return elem[pos_x * stride + pos_y]; }
 		/** Getter method
 		* Returns the value at the specified location in the 2D double matrix.
 		* @param pos_x: Row index of desired value.
@@ -65,28 +128,89 @@ namespace m2d {
 		* @return The matrix's column count as std::size_t.
 		*/
 		size_t getSizeY() const { return size_y; }
+		/** Method to get the leading dimension of the underlying buffer.
+		* @return Distance, in elements, between row i and row i + 1. Always >= getSizeY().
+		*/
+		size_t getStride() const { return stride; }
+		/** Raw access to the underlying row-major buffer, for kernels.
+		* No range checking is done. Padding elements past getSizeY() in each row are zero on construction.
+		* Writes through this pointer are not tracked: call markModified() after them (see getVersion()).
+		* @return Pointer to element (0, 0), aligned to 64 bytes.
+		*/
+		double *data() { return elem; }
+		const double *data() const { return elem; }
+		/** Raw access to one row of the underlying buffer, for kernels.
+		* No range checking is done. As with data(), writes through this pointer are not tracked.
+		* @param i: Row index.
+		* @return Pointer to element (i, 0). Aligned to 64 bytes unless the matrix has a single column, whose rows are
+		* not padded.
+		*/
+		double *row(size_t i) { return elem + i * stride; }
+		const double *row(size_t i) const { return elem + i * stride; }
 		/** Method to extract a submatrix from the current matrix.
 		* The submatrix is defined by the position of its top-left element and its size (counting from that element).
 		* @param pos_x: x-position of the top-left element of the desired submatrix.
 		* @param pos_y: x-position of the top-left element of the desired submatrix.
 		* @param sub_size_x: Row count of desired submatrix.
 		* @param sub_size_y: Column count of desired submatrix.
-		* @return A reference to the resulting submatrix.
+		* @return A copy of the resulting submatrix. Use subView() to address it without copying.
 		* @exception Throws range_error() if the submatrix exceeds the source's range, for example when its
 		* top-left element is at the bottom-right of the source and its size is larger than 1 in any direction.
 		*/
 		Matrix2D subMatrix(size_t pos_x, size_t pos_y, size_t sub_size_x, size_t sub_size_y) const;
+		/** Views a submatrix in place, without copying. Parameters are as for subMatrix().
+		* @return A view that must not outlive this matrix.
+		* @exception Throws range_error() if the submatrix exceeds the source's range.
+		*/
+		ConstMatrixView subView(size_t pos_x, size_t pos_y, size_t sub_size_x, size_t sub_size_y) const {
+			return ConstMatrixView(*this).subView(pos_x, pos_y, sub_size_x, sub_size_y);
+		}
+		MatrixView subView(size_t pos_x, size_t pos_y, size_t sub_size_x, size_t sub_size_y) {
+			return MatrixView(*this).subView(pos_x, pos_y, sub_size_x, sub_size_y);
+		}
+		/** Views one row in place, as a 1 x getSizeY() matrix.
+		* @exception Throws range_error() if the index is out of range.
+		*/
+		ConstMatrixView rowView(size_t pos_x) const { return ConstMatrixView(*this).rowView(pos_x); }
+		MatrixView rowView(size_t pos_x) { return MatrixView(*this).rowView(pos_x); }
+		/** Views one column in place, as a getSizeX() x 1 matrix.
+		* @exception Throws range_error() if the index is out of range.
+		*/
+		ConstMatrixView colView(size_t pos_y) const { return ConstMatrixView(*this).colView(pos_y); }
+		MatrixView colView(size_t pos_y) { return MatrixView(*this).colView(pos_y); }
+		/** Views the minor left by removing one row and one column, in place.
+		* @exception Throws range_error() if the indices are out of range.
+		*/
+		ConstMatrixView minorView(size_t pos_x, size_t pos_y) const { return ConstMatrixView(*this).minorView(pos_x, pos_y); }
+		MatrixView minorView(size_t pos_x, size_t pos_y) { return MatrixView(*this).minorView(pos_x, pos_y); }
+		/** Views the transpose of this matrix in place, as a getSizeY() x getSizeX() matrix. Nothing is moved:
+		* gemm() and the matrix product consume such views directly, so A.transposed() * B never copies A.
+		*/
+		ConstMatrixView transposed() const { return ConstMatrixView(*this).transposed(); }
+		MatrixView transposed() { return MatrixView(*this).transposed(); }
 		/** Returns the cofactor of an element specified by its indices.
 		* @param pos_x: The row-index of the specified element.
 		* @param pos_y: The column-index of the specified element.
-		* @return The cofactor of that element, as a matrix.
+		* @return The cofactor of that element, as a matrix: a copy of minorView(pos_x, pos_y).
 		* @exception: Throws range_error() if the supplied indices are out-of-range.
 		*/
 		Matrix2D cofactorOf(size_t pos_x, size_t pos_y) const;
-		/** Computes the cofactor matrix of this matrix.
-		* @return The cofactor matrix, through a copy constructor.
+		/** Computes the cofactor matrix of this matrix: element (i, j) is (-1)^(i + j) times the determinant of the
+		* minor left by removing row i and column j. This is the transpose of adjugate(), and costs the same.
+		* @return The cofactor matrix.
+		* @exception: Throws invalid_argument() if the matrix is not square.
 		*/
-		Matrix2D cofactorMatrix();
+		Matrix2D cofactorMatrix() const;
+		/** Computes the adjugate of this matrix, the transpose of its cofactor matrix, in O(n^3) rather than through n^2
+		* minor determinants. Well-conditioned matrices take det(A) * A^-1 from one pivoted LU factorisation. When
+		* the LU pivots reveal A to be singular or nearly so, it is computed from a Jacobi singular value decomposition
+		* instead, adj(A) = det(U) * det(V) * V * adj(S) * U^T, which stays accurate down to and past singularity: for
+		* rank n - 1 it is the rank-1 matrix spanned by the null vectors, for lower rank it is exactly zero.
+		* The SVD path costs a few dozen n^3 flops, 20 to 40 times the LU path.
+		* @return The adjugate. A 1 x 1 matrix has the adjugate [1].
+		* @exception: Throws invalid_argument() if the matrix is not square.
+		*/
+		Matrix2D adjugate() const;
 		/** Prints the matrix.
 		* Format: space-separated for now, iomanip later.
 		*/
@@ -107,90 +231,321 @@ namespace m2d {
 		* @return True if matrix is diagonal, false otherwise.
 		*/
 		bool isDiagonal() const;
+		/** Checks if this matrix equals its transpose, exactly. Only square matrices can be symmetric.
+		* @return True if matrix is symmetric, false otherwise.
+		*/
+		bool isSymmetric() const;
 		/**
 		* Checks if this matrix is diagonally-dominant, that is, the sum of the absolute values of all elements
-		* except the diagonal one in a row is less than the diagonal element.
+		* except the diagonal one in a row is less than the absolute value of the diagonal element. This is the
+		* condition under which the Jacobi and Gauss-Seidel iterations of iterative_solvers.h always converge.
 		* @return True if it is diagonally dominant, false if it's not, or if it's non-square.
 		*/
 		bool isDiagonallyDominant() const;
-		/** Computes and returns the determinant of this matrix, if it's square.
-		* Uses a basic form of LU decomposition (assumes det(P) = 1).
-		* @return The determinant of this matrix if it's square.
-		* @exception Throws range_error() if this matrix isn't square.
-		*/
 
 		/// Matrix arithmetics
-		/** Adds two matrices together, provided they're of the same size.
-		* @return The resulting matrix.
+		// Addition, subtraction and scaling are lazy, element-wise expressions: see matrix_expr.h.
+		/** Adds an element-wise expression to this matrix in place, in a single pass.
+		* @return A reference to this matrix.
 		* @exception Throws invalid_argument() if the size of the matrices do not match.
 		*/
-		Matrix2D operator+(const Matrix2D& other) const;
-		/** Subtract another matrix from this matrix, provided they're of the same size.
-		* @return The resulting matrix.
+		template <class E, class = detail::EnableIfExprs<E>>
+		Matrix2D& operator+=(const E& expr) { return *this = *this + expr; }
+		/** Subtracts an element-wise expression from this matrix in place, in a single pass.
+		* @return A reference to this matrix.
 		* @exception Throws invalid_argument() if the size of the matrices do not match.
 		*/
-		Matrix2D operator-(const Matrix2D& other) const;
+		template <class E, class = detail::EnableIfExprs<E>>
+		Matrix2D& operator-=(const E& expr) { return *this = *this - expr; }
+		/** Scales this matrix in place.
+		* @return A reference to this matrix.
+		*/
+		Matrix2D& operator*=(double factor) { return *this = *this * factor; }
+		Matrix2D& operator/=(double divisor) { return *this = *this / divisor; }
 		/** Multiply two matrices, provided this matrix's size_y is the same as the other's size_x.
+		* Runs on the packed, cache-blocked GEMM engine (see gemm()).
 		* @return The resulting matrix. Note that the resulting matrix might have a different size.
 		* @exception Throws invalid_argument() if the sizes do not match the above criterion.
 		*/
 		Matrix2D operator*(const Matrix2D& other) const;
-		/** Inverts this matrix. Not always possible.
-		* @return The inverted matrix. Note that it also modifies the current matrix's value to that of the inverted one.
+		/** Inverts this matrix in place. Not always possible.
+		* Factorises once with LUFactorize(), or reuses the cached factorisation (see det()), then solves against the
+		* identity for all columns at once. The cached factorisation is released afterwards.
+		* To apply the inverse to some matrix B, solve(A, B) is both faster and more accurate.
+		* @exception invalid_argument() if this matrix isn't square; range_error() if it is singular.
 		*/
 		void invert();
 
-
-		
+		/** Computes and returns the determinant of this matrix, if it's square.
+		* Uses the blocked LU factorisation with partial pivoting, so det(P) is accounted for. The factorisation is
+		* kept with the matrix and reused by later calls to det(), solve() and invert() for as long as the matrix is
+		* unchanged; changes made through setAt() or rankUpdate() patch it in O(n^2) instead of discarding it, and
+		* writes through a MatrixView discard it. Writes through raw pointers must be followed by markModified().
+		* @return The determinant of this matrix if it's square. A matrix that factorises with an exact zero pivot gives exactly 0.
+		* @exception Throws invalid_argument() if this matrix isn't square.
+		*/
 		double det() const;
 		/** Method to transpose current matrix.
-		* It writes to a new matrix, deallocates the current one then point *data to the new one.
-		* @return The determinant, as a double-precision value.
-		* @exception invalid_argument() if this matrix isn't square.
+		* Square matrices are transposed in place by swapping mirrored tiles. Rectangular ones are transposed tile by
+		* tile into a new buffer, which then replaces the current one. Use transposed() to avoid moving anything.
+		* @exception bad_alloc() if the new buffer of a rectangular matrix cannot be allocated. The matrix is then unchanged.
+		*/
+		void transpose();
+
+		/// Cached factorisation
+		/** Returns the modification version of this matrix. It changes whenever the elements may have changed: on
+		* setAt(), assignment, transpose(), invert(), rankUpdate(), whenever a MatrixView of the matrix is made,
+		* including the mutable subView(), rowView(), colView() and transposed(), and on every write through such a
+		* view's setAt() or assignment. Writes through data() or row(), or through a view's data() or coeffRef(), do
+		* not change it, so code that writes through those pointers must call markModified() afterwards.
+		* @return The current version. Equal versions of the same matrix mean equal contents, provided every raw
+		* pointer write was followed by markModified().
+		*/
+		uint64_t getVersion() const { return version; }
+		/** Records a change made behind the matrix's back, through data() or row() or a view's data(), so that the
+		* cached factorisation is rebuilt on next use.
+		*/
+		void markModified() { version++; }
+		/** Frees the cached factorisation, if any, which takes as much memory as the matrix itself. */
+		void releaseFactorization() const;
+		/** Solves this * X = B in place, through the cached factorisation.
+		* @param B: The right-hand sides, one per column, overwritten by the solutions.
+		* @exception invalid_argument() if this matrix isn't square or B has a different row count; range_error() if it is singular.
+		*/
+		void solveInPlace(MatrixView B) const;
+		/** Low-rank update in place: this = this + U * V^T, in O(n^2 k) for k columns in U and V.
+		* If a factorisation is cached, it is patched by the Sherman-Morrison-Woodbury identity rather than discarded.
+		* Corrections accumulate up to rank min(32, n / 4) or until they lose accuracy, after which the next use
+		* factorises from scratch.
+		* @param U: getSizeX() x k.
+		* @param V: getSizeY() x k.
+		* @exception invalid_argument() if the sizes do not match.
+		*/
+		void rankUpdate(ConstMatrixView U, ConstMatrixView V);
+		/** Rank-1 update in place: this = this + u * v^T. See rankUpdate().
+		* @param u: Vector, row or column, of getSizeX() elements.
+		* @param v: Vector, row or column, of getSizeY() elements.
+		* @exception invalid_argument() if u or v is not a vector of the right length.
 		*/
-		void transpose() noexcept;
+		void rankOneUpdate(ConstMatrixView u, ConstMatrixView v);
 	};
 
+	inline ConstMatrixView::ConstMatrixView(const Matrix2D &m) :
+		ConstMatrixView(m.data(), m.getSizeX(), m.getSizeY(), m.getStride()) {}
+	inline MatrixView::MatrixView(Matrix2D &m) : ConstMatrixView(m), owner_version(&m.version) { m.markModified(); }
+	inline double ConstMatrixView::det() const { return Matrix2D(*this).det(); }
+
 	// Non-member functions
 
 	/** Method to create a matrix from an std::ifstream.
-	* The ifstream must contain a matrix written row-by-row and separated by spaces.
+	* The ifstream must contain a matrix written row-by-row and separated by spaces. The rest of the stream is read in
+	* one go and parsed in parallel with ParseText() (see matrix_io.h); the stream is then left just after the last value.
+	* For large matrices, prefer the binary format of SaveBinary() and LoadBinary().
 	* @param ifs: Reference to the ifstream containing input.
 	* @param m: Reference to the target matrix. This function directly modifies its parameter instead of returning its own matrix.
+	* @exception invalid_argument() if the stream holds a malformed number or too few numbers.
 	*/
 	extern "C" void MATRIX2D_LIB InputMatrix(ifstream &ifs, Matrix2D &m);
+	/** Fills the elements addressed by a view from an std::ifstream, row by row.
+	* @param ifs: Reference to the ifstream containing input.
+	* @param m: The target view, e.g. a block of a larger matrix.
+	* @exception invalid_argument() if the stream holds a malformed number or too few numbers.
+	*/
+	MATRIX2D_LIB void InputMatrix(ifstream &ifs, MatrixView m);
 	/** This function concatenates two given matrices horizontally.
-	* The two matrices must have the same row count.
+	* The two matrices must have the same row count. Either may be a view.
+	* To refer to the two sides without copying them, use ComposeHorizontally() from block_matrix.h.
 	* @param left: Reference to the first matrix.
 	* @param right: Reference to the second matrix, which will be concatenated to the right of the first matrix.
 	* @exception range_error() if the two matrices do not have the same row count.
 	* @return A reference to the resulting matrix.
 	*/
-	MATRIX2D_LIB Matrix2D ConcatenateHorizontally(const Matrix2D &left, const Matrix2D &right);
+	MATRIX2D_LIB Matrix2D ConcatenateHorizontally(ConstMatrixView left, ConstMatrixView right);
 	/** This function concatenates two given matrices vertically.
-	* The two matrices must have the same column count.
+	* The two matrices must have the same column count. Either may be a view.
+	* To refer to the two halves without copying them, use ComposeVertically() from block_matrix.h.
 	* @param top: Reference to the first matrix.
 	* @param bottom: Reference to the second matrix, which will be concatenated below the first matrix.
 	* @return A reference to the resulting matrix.
 	* @exception range_error() if the two matrices do not have the same column count.
 	*/
-	MATRIX2D_LIB Matrix2D ConcatenateVertically(const Matrix2D &top, const Matrix2D &bottom);
+	MATRIX2D_LIB Matrix2D ConcatenateVertically(ConstMatrixView top, ConstMatrixView bottom);
+	/** General matrix multiply-accumulate: C = alpha * A * B + beta * C.
+	* Packs both operands into cache-sized blocks and runs a register-tiled micro-kernel, using AVX2/FMA when
+	* the CPU supports it and a portable scalar kernel otherwise. With beta = 0, C is overwritten.
+	* Any operand may be a view, e.g. a panel of a larger matrix; minors are copied to a temporary first.
+	* Transposed views, such as A.transposed(), are read in place by the packing routines and never copied.
+	* @param alpha: Scale factor for the product A * B.
+	* @param A: Left operand, of size m x k.
+	* @param B: Right operand, of size k x n.
+	* @param beta: Scale factor for the existing contents of C.
+	* @param C: Output, of size m x n, accumulated into in place. Must not overlap A or B in memory.
+	* @exception invalid_argument() if the sizes do not match, or if C overlaps A or B.
+	*/
+	MATRIX2D_LIB void gemm(double alpha, ConstMatrixView A, ConstMatrixView B, double beta, MatrixView C);
+
+	namespace detail {
+		// Lets the matrix product take any operands: matrices and views pass through, expressions are evaluated once.
+		inline const Matrix2D& Materialize(const Matrix2D& m) { return m; }
+		inline ConstMatrixView Materialize(ConstMatrixView v) { return v; }
+		template <class E, class = EnableIfNode<E>>
+		Matrix2D Materialize(const E& expr) { return Matrix2D(expr); }
+	}
+
+	/** Multiplies two operands of which at least one is a view or an unevaluated expression, as in (A + B) * C.
+	* Expression operands are evaluated into temporaries first; the product itself runs on gemm().
+	* @exception Throws invalid_argument() if the sizes do not match.
+	*/
+	template <class L, class R, class = detail::EnableIfExprs<L, R>,
+		class = typename std::enable_if<!std::is_same<L, Matrix2D>::value || !std::is_same<R, Matrix2D>::value>::type>
+	Matrix2D operator*(const L& lhs, const R& rhs) {
+		const auto &l = detail::Materialize(lhs);
+		const auto &r = detail::Materialize(rhs);
+		if (l.getSizeY() != r.getSizeX())
+			throw invalid_argument("Cannot multiply these matrices: incompatible dimensions.");
+		Matrix2D result(l.getSizeX(), r.getSizeY());
+		gemm(1.0, l, r, 0.0, result);
+		return result;
+	}
+
+	/** Blocked, right-looking LU factoriser with partial pivoting, working in place.
+	* Computes P * A = L * U. On return, the strict lower part of A holds L (whose unit diagonal is not stored)
+	* and the upper part holds U. Trailing updates run as GEMM calls on the thread pool.
+	* Singular matrices still factorise; U then has an exact zero on its diagonal.
+	* \param A: The matrix to factorise, which must be square. Overwritten by L and U. May be a view.
+	* \return The pivot vector: at step i, row i was interchanged with row piv[i] (piv[i] >= i).
+	* \exception invalid_argument(): Throws when A is not square.
+	*/
+	MATRIX2D_LIB vector<size_t> LUFactorize(MatrixView A);
+	/** Solves A * X = B for many right-hand sides, given the factorisation of A from LUFactorize().
+	* Applies the row interchanges, then runs blocked, parallel forward and back substitution (TRSM) over all the
+	* columns of B at once. Factorise once and call this for every new batch of right-hand sides.
+	* \param LU: The factorised matrix, as left in place by LUFactorize().
+	* \param piv: The pivot vector returned by LUFactorize().
+	* \param B: The right-hand sides, one per column, overwritten by the solutions X. May be a view.
+	* \exception invalid_argument(): Throws when the sizes do not match.
+	* \exception range_error(): Throws when U has an exact zero on its diagonal, i.e. A is singular.
+	*/
+	MATRIX2D_LIB void LUSolve(ConstMatrixView LU, const vector<size_t> &piv, MatrixView B);
+	/** Solves A * X = B, factorising A once for all the right-hand sides in the columns of B.
+	* A that is symmetric with a positive diagonal is tried with CholeskyFactorize() first, at half the cost of LU,
+	* falling back to LU if it turns out not to be positive definite.
+	* \param A: The matrix, which must be square. Left untouched.
+	* \param B: The right-hand sides, one per column, with as many rows as A.
+	* \return The solutions X, one per column.
+	* \exception invalid_argument(): Throws when A is not square or the row counts differ.
+	* \exception range_error(): Throws when A is singular.
+	*/
+	MATRIX2D_LIB Matrix2D solve(ConstMatrixView A, ConstMatrixView B);
+	/** Solves A * X = B through the factorisation cached on A, building it if needed (see Matrix2D::det()).
+	* Repeated solves with an unchanged or low-rank-updated A cost O(n^2) per right-hand side.
+	* \exception invalid_argument(): Throws when A is not square or the row counts differ.
+	* \exception range_error(): Throws when A is singular.
+	*/
+	MATRIX2D_LIB Matrix2D solve(const Matrix2D &A, ConstMatrixView B);
+	/** Solves A * X = B to double-precision accuracy with a single-precision factorisation.
+	* A is factorised in float, where LU runs on twice as many SIMD lanes and moves half the bytes, then the float
+	* solution is refined: each step computes the residual R = B - A * X in double and solves for a correction with the
+	* float factors. Refinement converges when A is not too ill-conditioned (roughly cond(A) < 1e6); otherwise, or if A
+	* overflows float or its float factorisation is singular, the solver falls back to solve() in double.
+	* \param A: The matrix, which must be square. Left untouched.
+	* \param B: The right-hand sides, one per column, with as many rows as A.
+	* \param iterations: If not null, receives the number of refinement steps taken, or -1 after a fallback to solve().
+	* \return The solutions X, one per column.
+	* \exception invalid_argument(): Throws when A is not square or the row counts differ.
+	* \exception range_error(): Throws when A is singular.
+	*/
+	MATRIX2D_LIB Matrix2D SolveMixedPrecision(ConstMatrixView A, ConstMatrixView B, int *iterations = nullptr);
 	/** LU-Factoriser implementing Doolittle's method.
 	* In accordance with Doolittle's method, it assumes the diagonal of the lower matrix L to be 1s (ones).
+	* No pivoting is done, so use LUFactorize() for general matrices.
 	* \param A: The source matrix, which must be square.
 	* \param L: The lower triangular matrix, passed as reference to be written to. In this method, its diagonal is assumed to be 1s.
 	* \param U: The upper triangular matrix, also passed as reference.
-	* \exception range_error(): Throws when matrix A is not factorizable.
+	* \exception range_error(): Throws when matrix A is not factorizable without pivoting.
+	* \exception invalid_argument(): Throws when A is not square or L, U are not of the same size.
 	*/
-	extern "C" MATRIX2D_LIB void LUFactorizeDoolittle(const Matrix2D& A, Matrix2D& L, Matrix2D& U);
+	extern "C" MATRIX2D_LIB void LUFactorizeDoolittle(ConstMatrixView A, MatrixView L, MatrixView U);
 	/** LU-Factoriser implementing Crout's method.
 	* In accordance with Crout's method, it assumes the diagonal of the upper matrix U to be 1s (ones).
+	* No pivoting is done, so use LUFactorize() for general matrices.
 	* \param A: The source matrix, which must be square.
 	* \param L: The lower triangular matrix, passed as reference to be written to.
 	* \param U: The upper triangular matrix, also passed as reference. In this method, its diagonal is assumed to be 1s.
-	* \exception range_error(): Throws when matrix A is not factorizable.
+	* \exception range_error(): Throws when matrix A is not factorizable without pivoting.
+	* \exception invalid_argument(): Throws when A is not square or L, U are not of the same size.
+	*/
+	extern "C" MATRIX2D_LIB void LUFactorizeCrout(ConstMatrixView A, MatrixView L, MatrixView U);
+	/** Blocked, right-looking Cholesky factoriser, working in place: A = L * L^T for symmetric positive-definite A.
+	* Each step factorises a diagonal block, solves the panel below it, then updates the trailing lower triangle with
+	* GEMM calls on the thread pool, for n^3 / 3 flops, half those of LUFactorize().
+	* \param A: The matrix to factorise, which must be square. Only its lower triangle is read. On success A holds L,
+	* its strict upper triangle zeroed; otherwise it is left partially overwritten. May be a view.
+	* \return Whether A is positive definite, i.e. every pivot came out positive.
+	* \exception invalid_argument(): Throws when A is not square.
+	*/
+	MATRIX2D_LIB bool CholeskyFactorize(MatrixView A);
+	/** Blocked LDL^T factoriser, working in place: A = L * D * L^T with unit lower triangular L and diagonal D.
+	* Takes no square roots and accepts symmetric indefinite matrices whose leading minors are all non-singular.
+	* No pivoting is done, so it is only stable for definite or quasi-definite matrices; use LUFactorize() otherwise.
+	* \param A: The matrix to factorise, which must be square. Only its lower triangle is read. On success the strict
+	* lower triangle holds L (whose unit diagonal is not stored), the diagonal holds D and the strict upper triangle is
+	* zeroed. May be a view.
+	* \return Whether the factorisation ran to completion without an exact zero pivot.
+	* \exception invalid_argument(): Throws when A is not square.
+	*/
+	MATRIX2D_LIB bool LDLFactorize(MatrixView A);
+	/** Solves A * X = B given the Cholesky factor L of A from CholeskyFactorize(), as two blocked triangular solves.
+	* \param L: The factor, as left in place by CholeskyFactorize().
+	* \param B: The right-hand sides, one per column, overwritten by the solutions X. May be a view.
+	* \exception invalid_argument(): Throws when the sizes do not match.
+	* \exception range_error(): Throws when L has a zero on its diagonal.
+	*/
+	MATRIX2D_LIB void CholeskySolve(ConstMatrixView L, MatrixView B);
+	/** Solves A * X = B given the factorisation of A from LDLFactorize().
+	* \param LD: The factorisation, as left in place by LDLFactorize().
+	* \param B: The right-hand sides, one per column, overwritten by the solutions X. May be a view.
+	* \exception invalid_argument(): Throws when the sizes do not match.
+	* \exception range_error(): Throws when D has a zero on its diagonal.
+	*/
+	MATRIX2D_LIB void LDLSolve(ConstMatrixView LD, MatrixView B);
+	/** Blocked Householder QR factoriser, working in place: A = Q * R for any m x n matrix.
+	* Each panel of 64 columns is reduced by Householder reflectors, which are then applied to the rest of the matrix
+	* all at once in compact WY form, Q_panel = I - V * T * V^T, as three GEMM calls.
+	* \param A: The matrix to factorise. On return R occupies the upper triangle (trapezoid) and the reflectors, whose
+	* leading 1s are not stored, occupy the part below the diagonal. May be a view.
+	* \return The min(m, n) reflector scales tau: reflector i is I - tau[i] * v_i * v_i^T.
+	*/
+	MATRIX2D_LIB vector<double> QRFactorize(MatrixView A);
+	/** Multiplies B on the left by Q, or by Q^T, given the factorisation from QRFactorize(), without forming Q.
+	* Call it on the first columns of an m x m identity to obtain Q explicitly.
+	* \param QR: The factorised matrix, as left in place by QRFactorize().
+	* \param tau: The reflector scales returned by QRFactorize().
+	* \param B: The matrix to multiply, with as many rows as QR. Overwritten by the product. May be a view.
+	* \param transpose: Multiply by Q^T instead of Q.
+	* \exception invalid_argument(): Throws when the sizes do not match.
+	*/
+	MATRIX2D_LIB void QRMultiply(ConstMatrixView QR, const vector<double> &tau, MatrixView B, bool transpose);
+	/** Solves the least-squares problem min ||A * X - B|| column by column, given the factorisation of A from
+	* QRFactorize(). Factorise once and call this for every new batch of right-hand sides.
+	* \param QR: The factorised m x n matrix, m >= n.
+	* \param tau: The reflector scales returned by QRFactorize().
+	* \param B: The right-hand sides, one per column, with m rows.
+	* \return The n x r solutions X.
+	* \exception invalid_argument(): Throws when m < n or the sizes do not match.
+	* \exception range_error(): Throws when A is numerically rank deficient, i.e. some diagonal entry of R is no
+	* larger than n * eps times the largest one.
+	*/
+	MATRIX2D_LIB Matrix2D QRSolve(ConstMatrixView QR, const vector<double> &tau, ConstMatrixView B);
+	/** Solves the overdetermined system A * X = B in the least-squares sense through a QR factorisation of A.
+	* Unlike the normal equations A^T * A * X = A^T * B, this does not square the condition number of A.
+	* \param A: The m x n matrix, m >= n. Left untouched.
+	* \param B: The right-hand sides, one per column, with m rows.
+	* \return The n x r solutions X.
+	* \exception invalid_argument(): Throws when m < n or the row counts differ.
+	* \exception range_error(): Throws when A is rank deficient.
 	*/
-	extern "C" MATRIX2D_LIB void LUFactorizeCrout(const Matrix2D& A, Matrix2D& L, Matrix2D& U);
+	MATRIX2D_LIB Matrix2D LeastSquares(ConstMatrixView A, ConstMatrixView B);
 }
 
 #endif // MATRIX2D_BASE
@@ -0,0 +1,215 @@
+/**
+* @file matrix_allocator.cpp
+* Contains implementations of the heap, pool and arena matrix allocators and the per-thread allocator selection.
+*/
+#include "stdafx.h"
+#include "matrix_allocator.h"
+#include "aligned_memory.h"
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <stdexcept>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		static void *HeapAllocate(size_t bytes) {
+			return ::operator new(bytes, align_val_t(kBufferAlignment));
+		}
+		static void HeapFree(void *p) noexcept {
+			::operator delete(p, align_val_t(kBufferAlignment));
+		}
+
+		class HeapAllocatorImpl : public MatrixAllocator {
+		public:
+			void *allocate(size_t bytes) override { return HeapAllocate(bytes); }
+			void deallocate(void *p, size_t) noexcept override { HeapFree(p); }
+		};
+
+		// Size classes: 64 bytes, then four per power of two, (4 + q + 1) * 2^(e - 2) for q = 0..3.
+		constexpr size_t kPoolClasses = 1 + 4 * (sizeof(size_t) * 8 - 6);
+
+		static size_t PoolClass(size_t bytes, size_t &class_bytes) {
+			if (bytes <= kBufferAlignment) {
+				class_bytes = kBufferAlignment;
+				return 0;
+			}
+			size_t n = bytes - 1;
+			size_t e = 0;
+			while ((n >> e) > 1) e++;
+			size_t q = (n >> (e - 2)) & 3;
+			class_bytes = (4 + q + 1) << (e - 2);
+			return 1 + (e - 6) * 4 + q;
+		}
+
+		static atomic<size_t> g_pool_limit{ size_t(256) << 20 };
+
+		struct FreeBlock {
+			FreeBlock *next;
+		};
+
+		// 0 before the thread's cache is made, 1 while it lives, 2 once thread exit has destroyed it.
+		// Buffers freed after that, by later thread_local destructors, go straight back to the heap.
+		static thread_local int t_pool_state = 0;
+
+		struct PoolCache {
+			FreeBlock *lists[kPoolClasses] = {};
+			size_t cached = 0; /** Bytes held in the lists. */
+			PoolCache() { t_pool_state = 1; }
+			~PoolCache() {
+				t_pool_state = 2;
+				for (FreeBlock *&head : lists) {
+					while (head) {
+						FreeBlock *next = head->next;
+						HeapFree(head);
+						head = next;
+					}
+				}
+			}
+		};
+
+		static PoolCache *ThreadPoolCache() {
+			if (t_pool_state == 2) return nullptr;
+			static thread_local PoolCache cache;
+			return &cache;
+		}
+
+		class PoolAllocatorImpl : public MatrixAllocator {
+		public:
+			void *allocate(size_t bytes) override {
+				size_t class_bytes;
+				size_t c = PoolClass(bytes, class_bytes);
+				if (class_bytes > g_pool_limit.load(memory_order_relaxed) / 8) return HeapAllocate(bytes);
+				PoolCache *cache = ThreadPoolCache();
+				if (cache && cache->lists[c]) {
+					FreeBlock *block = cache->lists[c];
+					cache->lists[c] = block->next;
+					cache->cached -= class_bytes;
+					return block;
+				}
+				return HeapAllocate(class_bytes);
+			}
+			void deallocate(void *p, size_t bytes) noexcept override {
+				size_t class_bytes;
+				size_t c = PoolClass(bytes, class_bytes);
+				size_t limit = g_pool_limit.load(memory_order_relaxed);
+				PoolCache *cache = class_bytes > limit / 8 ? nullptr : ThreadPoolCache();
+				if (!cache || cache->cached + class_bytes > limit) {
+					HeapFree(p);
+					return;
+				}
+				FreeBlock *block = static_cast<FreeBlock*>(p);
+				block->next = cache->lists[c];
+				cache->lists[c] = block;
+				cache->cached += class_bytes;
+			}
+		};
+
+		// Never destroyed, so that matrices with static storage can still release their buffers at exit.
+		static MatrixAllocator &g_heap_allocator = *new HeapAllocatorImpl();
+		static MatrixAllocator &g_pool_allocator = *new PoolAllocatorImpl();
+
+		static atomic<MatrixAllocator*> g_default_allocator{ nullptr }; // nullptr: the heap
+		static thread_local MatrixAllocator *t_allocator = nullptr; // set by ScopedAllocator
+
+		constexpr size_t kMaxArenaChunk = size_t(256) << 20;
+
+		static size_t RoundToAlignment(size_t bytes) {
+			if (bytes > SIZE_MAX - kBufferAlignment) throw bad_alloc();
+			return (bytes + kBufferAlignment - 1) / kBufferAlignment * kBufferAlignment;
+		}
+	}
+
+	MatrixAllocator *HeapAllocator() {
+		return &detail::g_heap_allocator;
+	}
+
+	MatrixAllocator *PoolAllocator() {
+		return &detail::g_pool_allocator;
+	}
+
+	void SetPoolCacheLimit(size_t bytes) {
+		detail::g_pool_limit.store(bytes);
+	}
+
+	MatrixAllocator *SetDefaultAllocator(MatrixAllocator *allocator) {
+		MatrixAllocator *previous = detail::g_default_allocator.exchange(allocator);
+		return previous ? previous : HeapAllocator();
+	}
+
+	MatrixAllocator *CurrentAllocator() {
+		if (detail::t_allocator) return detail::t_allocator;
+		MatrixAllocator *allocator = detail::g_default_allocator.load(memory_order_acquire);
+		return allocator ? allocator : HeapAllocator();
+	}
+
+	ScopedAllocator::ScopedAllocator(MatrixAllocator &allocator) : previous(detail::t_allocator) {
+		detail::t_allocator = &allocator;
+	}
+	ScopedAllocator::~ScopedAllocator() {
+		detail::t_allocator = previous;
+	}
+
+	// Arena
+	MatrixArena::MatrixArena(size_t chunk_bytes) : used(0), live(0),
+		next_chunk(detail::RoundToAlignment(max<size_t>(chunk_bytes, detail::kBufferAlignment))) {}
+
+	MatrixArena::~MatrixArena() {
+		freeChunks();
+	}
+
+	void MatrixArena::addChunk(size_t min_bytes) {
+		size_t size = max(next_chunk, detail::RoundToAlignment(min_bytes));
+		chunks.reserve(chunks.size() + 1); // cannot throw after the chunk is allocated
+		chunks.push_back({ static_cast<char*>(detail::HeapAllocate(size)), size });
+		used = 0;
+		next_chunk = min(max(next_chunk, size) * 2, max(detail::kMaxArenaChunk, next_chunk));
+	}
+
+	void MatrixArena::freeChunks() noexcept {
+		for (const Chunk &c : chunks) detail::HeapFree(c.base);
+		chunks.clear();
+		used = 0;
+	}
+
+	void *MatrixArena::allocate(size_t bytes) {
+		lock_guard<mutex> guard(lock);
+		if (chunks.empty() || chunks.back().size - used < bytes) addChunk(bytes);
+		void *p = chunks.back().base + used;
+		used += bytes;
+		live++;
+		return p;
+	}
+
+	void MatrixArena::deallocate(void *p, size_t bytes) noexcept {
+		lock_guard<mutex> guard(lock);
+		live--;
+		// Temporaries are usually released in reverse order of allocation; give the space of the newest one back.
+		if (!chunks.empty() && static_cast<char*>(p) + bytes == chunks.back().base + used) used -= bytes;
+	}
+
+	void MatrixArena::reset() {
+		lock_guard<mutex> guard(lock);
+		if (live) throw logic_error("Cannot reset an arena while matrices allocated from it are alive.");
+		if (chunks.size() > 1) { // one chunk as large as all of them holds the same workload next time
+			size_t total = 0;
+			for (const Chunk &c : chunks) total += c.size;
+			freeChunks();
+			addChunk(total);
+		}
+		used = 0;
+	}
+
+	size_t MatrixArena::capacity() const {
+		lock_guard<mutex> guard(lock);
+		size_t total = 0;
+		for (const Chunk &c : chunks) total += c.size;
+		return total;
+	}
+
+	size_t MatrixArena::liveBlocks() const {
+		lock_guard<mutex> guard(lock);
+		return live;
+	}
+}
@@ -0,0 +1,121 @@
+/**
+ * @file matrix_allocator.h
+ * Interface to the pluggable allocators behind matrix storage. Every matrix buffer is obtained from the allocator
+ * current on the constructing thread and remembers it, so it is always released to the allocator that made it,
+ * whichever thread destroys the matrix. Three allocators are provided: the plain heap (the default), a pool that
+ * keeps freed buffers in per-thread size classes for reuse, and arenas that release everything allocated from them
+ * at once. Custom allocators derive from MatrixAllocator.
+ *
+ * Only the storage of matrices (Matrix2D, BasicMatrix<T>, MatrixBatch) goes through these allocators; the small
+ * index vectors some operations use internally (pivots, for example) still come from the heap.
+ */
+
+#ifndef MATRIX2D_ALLOCATOR
+#define MATRIX2D_ALLOCATOR
+
+#include "export_macros.h"
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace m2d {
+	/** Source of matrix storage. Implementations must be safe to call from any thread. */
+	class MATRIX2D_LIB MatrixAllocator {
+	public:
+		virtual ~MatrixAllocator() = default;
+		/** Allocates a block. The contents need not be initialised.
+		* @param bytes: Size of the block, a multiple of 64 and never zero.
+		* @return Pointer to the block, aligned to 64 bytes.
+		* @exception bad_alloc() if the allocation fails.
+		*/
+		virtual void *allocate(size_t bytes) = 0;
+		/** Releases a block obtained from allocate() on this allocator.
+		* @param p: The block.
+		* @param bytes: The size it was allocated with.
+		*/
+		virtual void deallocate(void *p, size_t bytes) noexcept = 0;
+	};
+
+	/** The global heap, through aligned operator new. The default allocator. */
+	MATRIX2D_LIB MatrixAllocator *HeapAllocator();
+	/** A pool that recycles freed buffers. Each thread keeps its own free lists, one per size class (four classes per
+	* power of two), so allocation and release take no lock and make no heap call once the pool is warm. A buffer
+	* freed on a thread other than the one that made it joins the freeing thread's lists. Each thread caches at most
+	* SetPoolCacheLimit() bytes and returns the surplus to the heap; buffers over 1/8 of the limit bypass the pool.
+	*/
+	MATRIX2D_LIB MatrixAllocator *PoolAllocator();
+	/** Sets how many bytes of freed buffers each thread may keep in PoolAllocator(). 256 MiB by default. Lowering it
+	* does not trim buffers already cached until they are next reused.
+	*/
+	MATRIX2D_LIB void SetPoolCacheLimit(size_t bytes);
+
+	/** Replaces the process-wide default allocator, used by threads with no ScopedAllocator in effect.
+	* Matrices made before the change keep releasing to their own allocator.
+	* @param allocator: The new default; nullptr restores HeapAllocator().
+	* @return The previous default.
+	*/
+	MATRIX2D_LIB MatrixAllocator *SetDefaultAllocator(MatrixAllocator *allocator);
+	/** @return The allocator that matrices constructed on the calling thread will use. */
+	MATRIX2D_LIB MatrixAllocator *CurrentAllocator();
+
+	/** Makes an allocator current on the calling thread for the lifetime of this object; scopes nest.
+	* Only matrices constructed on this thread are affected, not those made by thread pool workers.
+	*/
+	class MATRIX2D_LIB ScopedAllocator {
+		MatrixAllocator *previous; /** The thread's allocator before this scope, restored on destruction. */
+	public:
+		explicit ScopedAllocator(MatrixAllocator &allocator);
+		~ScopedAllocator();
+		ScopedAllocator(const ScopedAllocator&) = delete;
+		ScopedAllocator& operator=(const ScopedAllocator&) = delete;
+	};
+
+	/** Bump allocator for temporaries. Allocation advances a pointer through large chunks; releasing a block is free,
+	* and gives its memory back immediately when it is the most recent allocation. reset() reclaims everything at
+	* once and, when the last round needed several chunks, merges them into one, so that a workload repeated between
+	* resets settles into a single chunk and no heap calls.
+	*
+	* Every matrix allocated from an arena must be destroyed before the arena is reset or destroyed; beware of
+	* move-assigning an arena temporary into a longer-lived matrix, which hands it the arena buffer. Typical use:
+	*     MatrixArena arena;
+	*     for (auto &request : requests) {
+	*         { ScopedAllocator use(arena); handle(request); } // temporaries inside handle() come from the arena
+	*         arena.reset();
+	*     }
+	*/
+	class MATRIX2D_LIB MatrixArena : public MatrixAllocator {
+		struct Chunk {
+			char *base;
+			size_t size;
+		};
+		mutable std::mutex lock;
+		std::vector<Chunk> chunks; /** The last chunk is the one being filled. */
+		size_t used; /** Bytes taken from the last chunk. */
+		size_t live; /** Blocks allocated and not yet released. */
+		size_t next_chunk; /** Size of the next chunk to add. */
+		void addChunk(size_t min_bytes);
+		void freeChunks() noexcept;
+	public:
+		/** Creates an arena. No memory is reserved until the first allocation.
+		* @param chunk_bytes: Size of the first chunk; later chunks double, up to 256 MiB, or fit the request.
+		*/
+		explicit MatrixArena(size_t chunk_bytes = size_t(1) << 20);
+		/** Returns all chunks to the heap. */
+		~MatrixArena();
+		MatrixArena(const MatrixArena&) = delete;
+		MatrixArena& operator=(const MatrixArena&) = delete;
+
+		void *allocate(size_t bytes) override;
+		void deallocate(void *p, size_t bytes) noexcept override;
+		/** Reclaims every block at once.
+		* @exception logic_error() if a matrix allocated from the arena is still alive.
+		*/
+		void reset();
+		/** @return Bytes reserved from the heap, in all chunks. */
+		size_t capacity() const;
+		/** @return Number of blocks allocated and not yet released. */
+		size_t liveBlocks() const;
+	};
+}
+
+#endif // MATRIX2D_ALLOCATOR
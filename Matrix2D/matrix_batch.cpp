@@ -0,0 +1,522 @@
+/**
+* @file matrix_batch.cpp
+* Contains the structure-of-arrays batch engine.
+*
+* Every kernel walks the batch in blocks of kLanes matrices and works on whole blocks at a time: one Lanes value
+* holds an element of all the block's matrices. Pivoting decisions, which differ from matrix to matrix, become
+* per-lane selects instead of branches. Each kernel body is compiled twice, for the baseline instruction set and
+* for AVX2/FMA, and the better one is picked at run time. Orders up to kMaxFixed have fully local kernels.
+*/
+#include "stdafx.h"
+#include "matrix_batch.h"
+#include "aligned_memory.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		constexpr size_t kLanes = kDoublesPerAlignment; // one block of matrices: a cache line of every plane
+
+		/** Operands of a batch kernel. Element (i, j) of an operand with c columns is at ptr + (i * c + j) * lanes. */
+		struct BatchArgs {
+			const double *a; /** First operand, or the LU factors. */
+			const double *b; /** Second operand, or the pivots. */
+			double *c; /** Output, or the operand updated in place. */
+			double *piv; /** Pivots written by the factorisation, or nullptr. */
+			size_t m, k, n; /** Sizes: a is m x k and c is m x n, or, for the solves, k is the order and n the right-hand side count. */
+			size_t lanes; /** Plane stride shared by all operands. */
+		};
+		typedef void(*BatchKernel)(const BatchArgs &x, size_t lo, size_t hi);
+
+		// The value of one element in every matrix of a block, handled as a whole. With GCC and Clang it is a native
+		// vector, so a kernel body becomes SSE2 or AVX2 code depending on the wrapper it is inlined into, and no lane
+		// loop is left for the auto-vectoriser to give up on. Elsewhere it is an array, with fixed-count loops.
+#if defined(__GNUC__) || defined(__clang__)
+		// Two halves of four doubles each: a ymm register apiece under AVX2, a pair of xmm registers otherwise.
+		typedef double LaneVector __attribute__((vector_size(4 * sizeof(double))));
+		typedef decltype(LaneVector() > LaneVector()) LaneMaskVector;
+		struct Lanes { LaneVector lo, hi; };
+		struct LaneMask { LaneMaskVector lo, hi; };
+		static M2D_ALWAYS_INLINE Lanes Splat(double s) { return { LaneVector{} + s, LaneVector{} + s }; }
+		static M2D_ALWAYS_INLINE Lanes operator+(const Lanes &a, const Lanes &b) { return { a.lo + b.lo, a.hi + b.hi }; }
+		static M2D_ALWAYS_INLINE Lanes operator-(const Lanes &a, const Lanes &b) { return { a.lo - b.lo, a.hi - b.hi }; }
+		static M2D_ALWAYS_INLINE Lanes operator*(const Lanes &a, const Lanes &b) { return { a.lo * b.lo, a.hi * b.hi }; }
+		static M2D_ALWAYS_INLINE Lanes operator/(const Lanes &a, const Lanes &b) { return { a.lo / b.lo, a.hi / b.hi }; }
+		static M2D_ALWAYS_INLINE Lanes operator-(const Lanes &a) { return { -a.lo, -a.hi }; }
+		static M2D_ALWAYS_INLINE LaneMask operator>(const Lanes &a, const Lanes &b) { return { a.lo > b.lo, a.hi > b.hi }; }
+		static M2D_ALWAYS_INLINE LaneMask operator==(const Lanes &a, const Lanes &b) { return { a.lo == b.lo, a.hi == b.hi }; }
+		static M2D_ALWAYS_INLINE LaneMask operator!=(const Lanes &a, const Lanes &b) { return { a.lo != b.lo, a.hi != b.hi }; }
+		static M2D_ALWAYS_INLINE Lanes Select(const LaneMask &s, const Lanes &a, const Lanes &b) { return { s.lo ? a.lo : b.lo, s.hi ? a.hi : b.hi }; }
+		static M2D_ALWAYS_INLINE Lanes Abs(const Lanes &a) {
+			return { (LaneVector)((LaneMaskVector)a.lo & INT64_MAX), (LaneVector)((LaneMaskVector)a.hi & INT64_MAX) };
+		}
+		static M2D_ALWAYS_INLINE bool Any(const LaneMask &s) {
+			LaneMaskVector m = s.lo | s.hi;
+			return (m[0] | m[1] | m[2] | m[3]) != 0;
+		}
+		static M2D_ALWAYS_INLINE Lanes Load(const double *p) {
+			Lanes r;
+			memcpy(&r.lo, p, sizeof(r.lo));
+			memcpy(&r.hi, p + 4, sizeof(r.hi));
+			return r;
+		}
+		static M2D_ALWAYS_INLINE void Store(double *p, const Lanes &a) {
+			memcpy(p, &a.lo, sizeof(a.lo));
+			memcpy(p + 4, &a.hi, sizeof(a.hi));
+		}
+#else
+		struct Lanes { double v[kLanes]; };
+		struct LaneMask { bool m[kLanes]; };
+		static M2D_ALWAYS_INLINE Lanes Splat(double s) { Lanes r; for (size_t l = 0; l < kLanes; l++) r.v[l] = s; return r; }
+		static M2D_ALWAYS_INLINE Lanes operator+(Lanes a, Lanes b) { for (size_t l = 0; l < kLanes; l++) a.v[l] += b.v[l]; return a; }
+		static M2D_ALWAYS_INLINE Lanes operator-(Lanes a, Lanes b) { for (size_t l = 0; l < kLanes; l++) a.v[l] -= b.v[l]; return a; }
+		static M2D_ALWAYS_INLINE Lanes operator*(Lanes a, Lanes b) { for (size_t l = 0; l < kLanes; l++) a.v[l] *= b.v[l]; return a; }
+		static M2D_ALWAYS_INLINE Lanes operator/(Lanes a, Lanes b) { for (size_t l = 0; l < kLanes; l++) a.v[l] /= b.v[l]; return a; }
+		static M2D_ALWAYS_INLINE Lanes operator-(Lanes a) { for (size_t l = 0; l < kLanes; l++) a.v[l] = -a.v[l]; return a; }
+		static M2D_ALWAYS_INLINE LaneMask operator>(Lanes a, Lanes b) { LaneMask r; for (size_t l = 0; l < kLanes; l++) r.m[l] = a.v[l] > b.v[l]; return r; }
+		static M2D_ALWAYS_INLINE LaneMask operator==(Lanes a, Lanes b) { LaneMask r; for (size_t l = 0; l < kLanes; l++) r.m[l] = a.v[l] == b.v[l]; return r; }
+		static M2D_ALWAYS_INLINE LaneMask operator!=(Lanes a, Lanes b) { LaneMask r; for (size_t l = 0; l < kLanes; l++) r.m[l] = a.v[l] != b.v[l]; return r; }
+		static M2D_ALWAYS_INLINE Lanes Select(LaneMask s, Lanes a, Lanes b) { for (size_t l = 0; l < kLanes; l++) a.v[l] = s.m[l] ? a.v[l] : b.v[l]; return a; }
+		static M2D_ALWAYS_INLINE Lanes Abs(Lanes a) { for (size_t l = 0; l < kLanes; l++) a.v[l] = fabs(a.v[l]); return a; }
+		static M2D_ALWAYS_INLINE bool Any(LaneMask s) { bool any = false; for (size_t l = 0; l < kLanes; l++) any |= s.m[l]; return any; }
+		static M2D_ALWAYS_INLINE Lanes Load(const double *p) { Lanes r; memcpy(r.v, p, sizeof(r.v)); return r; }
+		static M2D_ALWAYS_INLINE void Store(double *p, Lanes a) { memcpy(p, a.v, sizeof(a.v)); }
+#endif
+
+		// Each plane an operand spans is a memory stream of its own, far more than hardware prefetchers follow at once,
+		// so the kernels ask for the block kPrefetchBlocks ahead in every plane they read.
+		constexpr size_t kPrefetchBlocks = 4;
+		static M2D_ALWAYS_INLINE void Prefetch(const double *first, size_t planes, size_t lanes) {
+			const double *p = first + kPrefetchBlocks * kLanes; // prefetches past the end are harmless
+			for (size_t e = 0; e < planes; e++) {
+#ifdef M2D_X86
+				_mm_prefetch((const char*)(p + e * lanes), _MM_HINT_T0);
+#elif defined(__GNUC__)
+				__builtin_prefetch(p + e * lanes);
+#endif
+			}
+		}
+
+		// C = A * B over blocks [lo, hi).
+		static M2D_ALWAYS_INLINE void MultiplyBlocks(const BatchArgs &x, size_t lo, size_t hi) {
+			for (size_t b0 = lo * kLanes; b0 < hi * kLanes; b0 += kLanes) {
+				Prefetch(x.a + b0, x.m * x.k, x.lanes);
+				Prefetch(x.b + b0, x.k * x.n, x.lanes);
+				for (size_t i = 0; i < x.m; i++) {
+					for (size_t j = 0; j < x.n; j++) {
+						Lanes acc = Splat(0.0);
+						for (size_t p = 0; p < x.k; p++)
+							acc = acc + Load(x.a + (i * x.k + p) * x.lanes + b0) * Load(x.b + (p * x.n + j) * x.lanes + b0);
+						Store(x.c + (i * x.n + j) * x.lanes + b0, acc);
+					}
+				}
+			}
+		}
+
+		// Fixed-size kernels for orders up to kMaxFixed hold a whole block in local values: every trip count is known
+		// and nothing aliases, so a factorisation unrolls into straight-line code. Pivots are kept as exact doubles.
+		constexpr size_t kMaxFixed = 8;
+		template <size_t N>
+		static M2D_ALWAYS_INLINE void FactorFixed(Lanes (&a)[N * N], Lanes (&p)[N]) {
+			for (size_t k = 0; k < N; k++) {
+				Lanes best = Abs(a[k * N + k]);
+				p[k] = Splat((double)k);
+				for (size_t i = k + 1; i < N; i++) {
+					Lanes v = Abs(a[i * N + k]);
+					LaneMask gt = v > best;
+					best = Select(gt, v, best);
+					p[k] = Select(gt, Splat((double)i), p[k]);
+				}
+				for (size_t i = k + 1; i < N; i++) {
+					LaneMask sel = p[k] == Splat((double)i);
+					for (size_t c = 0; c < N; c++) {
+						Lanes t = a[k * N + c];
+						a[k * N + c] = Select(sel, a[i * N + c], t);
+						a[i * N + c] = Select(sel, t, a[i * N + c]);
+					}
+				}
+				LaneMask nonzero = a[k * N + k] != Splat(0.0); // a zero column has nothing to eliminate
+				for (size_t i = k + 1; i < N; i++) {
+					Lanes li = Select(nonzero, a[i * N + k] / a[k * N + k], Splat(0.0));
+					a[i * N + k] = li;
+					for (size_t c = k + 1; c < N; c++) a[i * N + c] = a[i * N + c] - li * a[k * N + c];
+				}
+			}
+		}
+		// Solves one right-hand side per lane against factors produced by FactorFixed().
+		template <size_t N>
+		static M2D_ALWAYS_INLINE void SolveFixed(const Lanes (&a)[N * N], const Lanes (&p)[N], Lanes (&x)[N]) {
+			for (size_t k = 0; k < N; k++) {
+				for (size_t i = k + 1; i < N; i++) {
+					LaneMask sel = p[k] == Splat((double)i);
+					Lanes t = x[k];
+					x[k] = Select(sel, x[i], t);
+					x[i] = Select(sel, t, x[i]);
+				}
+			}
+			for (size_t k = 0; k < N; k++)
+				for (size_t i = k + 1; i < N; i++) x[i] = x[i] - a[i * N + k] * x[k];
+			for (size_t i = N; i-- > 0;) {
+				for (size_t k = i + 1; k < N; k++) x[i] = x[i] - a[i * N + k] * x[k];
+				x[i] = x[i] / a[i * N + i];
+			}
+		}
+
+		template <size_t N>
+		static M2D_ALWAYS_INLINE void FactorBlocksFixed(const BatchArgs &x, size_t lo, size_t hi) {
+			for (size_t b0 = lo * kLanes; b0 < hi * kLanes; b0 += kLanes) {
+				Prefetch(x.c + b0, N * N, x.lanes);
+				Lanes a[N * N], p[N];
+				for (size_t e = 0; e < N * N; e++) a[e] = Load(x.c + e * x.lanes + b0);
+				FactorFixed<N>(a, p);
+				for (size_t e = 0; e < N * N; e++) Store(x.c + e * x.lanes + b0, a[e]);
+				for (size_t k = 0; k < N; k++) Store(x.piv + k * x.lanes + b0, p[k]);
+			}
+		}
+		template <size_t N>
+		static M2D_ALWAYS_INLINE void SolveBlocksFixed(const BatchArgs &x, size_t lo, size_t hi) {
+			const size_t r = x.n, ld = x.lanes;
+			for (size_t b0 = lo * kLanes; b0 < hi * kLanes; b0 += kLanes) {
+				Prefetch(x.a + b0, N * N, ld);
+				Prefetch(x.b + b0, N, ld);
+				Prefetch(x.c + b0, N * r, ld);
+				Lanes a[N * N], p[N];
+				for (size_t e = 0; e < N * N; e++) a[e] = Load(x.a + e * ld + b0);
+				for (size_t k = 0; k < N; k++) p[k] = Load(x.b + k * ld + b0);
+				for (size_t col = 0; col < r; col++) {
+					Lanes v[N];
+					for (size_t i = 0; i < N; i++) v[i] = Load(x.c + (i * r + col) * ld + b0);
+					SolveFixed<N>(a, p, v);
+					for (size_t i = 0; i < N; i++) Store(x.c + (i * r + col) * ld + b0, v[i]);
+				}
+			}
+		}
+		// Solves x.a[b] * X = x.c[b] in place, factorising in registers only. x.c == x.a inverts, with x.n == 0 meaning
+		// that the right-hand side is the identity: each block is read in full before any of it is overwritten.
+		template <size_t N>
+		static M2D_ALWAYS_INLINE void FactorSolveBlocksFixed(const BatchArgs &x, size_t lo, size_t hi) {
+			const bool identity = x.n == 0;
+			const size_t r = identity ? N : x.n, ld = x.lanes;
+			for (size_t b0 = lo * kLanes; b0 < hi * kLanes; b0 += kLanes) {
+				Prefetch(x.a + b0, N * N, ld);
+				if (!identity) Prefetch(x.c + b0, N * r, ld);
+				Lanes a[N * N], p[N];
+				for (size_t e = 0; e < N * N; e++) a[e] = Load(x.a + e * ld + b0);
+				FactorFixed<N>(a, p);
+				for (size_t col = 0; col < r; col++) {
+					Lanes v[N];
+					for (size_t i = 0; i < N; i++) v[i] = identity ? Splat(i == col ? 1.0 : 0.0) : Load(x.c + (i * r + col) * ld + b0);
+					SolveFixed<N>(a, p, v);
+					for (size_t i = 0; i < N; i++) Store(x.c + (i * r + col) * ld + b0, v[i]);
+				}
+			}
+		}
+		// det = det(P) * prod(diag(U)) of the matrices in x.a, to x.c, without writing the factors anywhere.
+		template <size_t N>
+		static M2D_ALWAYS_INLINE void DetBlocksFixed(const BatchArgs &x, size_t lo, size_t hi) {
+			for (size_t b0 = lo * kLanes; b0 < hi * kLanes; b0 += kLanes) {
+				Prefetch(x.a + b0, N * N, x.lanes);
+				Lanes a[N * N], p[N];
+				for (size_t e = 0; e < N * N; e++) a[e] = Load(x.a + e * x.lanes + b0);
+				FactorFixed<N>(a, p);
+				Lanes det = Splat(1.0);
+				for (size_t k = 0; k < N; k++) det = det * Select(p[k] != Splat((double)k), -a[k * N + k], a[k * N + k]);
+				Store(x.c + b0, det);
+			}
+		}
+
+		// Larger orders run the same algorithms straight on the planes. Swaps rows k and i of the r-column block at c
+		// in the lanes whose pivot is i, if there are any.
+		static M2D_ALWAYS_INLINE void SwapRowsWhere(double *c, size_t r, size_t lanes, const Lanes &pivot, size_t k, size_t i) {
+			LaneMask sel = pivot == Splat((double)i);
+			if (!Any(sel)) return;
+			for (size_t col = 0; col < r; col++) {
+				double *rk = c + (k * r + col) * lanes, *ri = c + (i * r + col) * lanes;
+				Lanes t = Load(rk), u = Load(ri);
+				Store(rk, Select(sel, u, t));
+				Store(ri, Select(sel, t, u));
+			}
+		}
+		static M2D_ALWAYS_INLINE void FactorBlocksAny(const BatchArgs &x, size_t lo, size_t hi) {
+			const size_t n = x.n, ld = x.lanes;
+			for (size_t b0 = lo * kLanes; b0 < hi * kLanes; b0 += kLanes) {
+				Prefetch(x.c + b0, n * n, ld);
+				double *A = x.c + b0;
+				auto e = [&](size_t i, size_t j) { return A + (i * n + j) * ld; };
+				for (size_t k = 0; k < n; k++) {
+					Lanes best = Abs(Load(e(k, k))), pivot = Splat((double)k);
+					for (size_t i = k + 1; i < n; i++) {
+						Lanes v = Abs(Load(e(i, k)));
+						LaneMask gt = v > best;
+						best = Select(gt, v, best);
+						pivot = Select(gt, Splat((double)i), pivot);
+					}
+					Store(x.piv + k * ld + b0, pivot);
+					for (size_t i = k + 1; i < n; i++) SwapRowsWhere(A, n, ld, pivot, k, i);
+					Lanes d = Load(e(k, k));
+					LaneMask nonzero = d != Splat(0.0);
+					for (size_t i = k + 1; i < n; i++) {
+						Lanes li = Select(nonzero, Load(e(i, k)) / d, Splat(0.0));
+						Store(e(i, k), li);
+						for (size_t c = k + 1; c < n; c++) Store(e(i, c), Load(e(i, c)) - li * Load(e(k, c)));
+					}
+				}
+			}
+		}
+		static M2D_ALWAYS_INLINE void SolveBlocksAny(const BatchArgs &x, size_t lo, size_t hi) {
+			const size_t n = x.k, r = x.n, ld = x.lanes;
+			for (size_t b0 = lo * kLanes; b0 < hi * kLanes; b0 += kLanes) {
+				Prefetch(x.a + b0, n * n, ld);
+				Prefetch(x.c + b0, n * r, ld);
+				const double *LU = x.a + b0;
+				double *B = x.c + b0;
+				auto lu = [&](size_t i, size_t j) { return Load(LU + (i * n + j) * ld); };
+				auto b = [&](size_t i, size_t j) { return B + (i * r + j) * ld; };
+				for (size_t k = 0; k < n; k++) {
+					Lanes pivot = Load(x.b + k * ld + b0);
+					for (size_t i = k + 1; i < n; i++) SwapRowsWhere(B, r, ld, pivot, k, i);
+				}
+				for (size_t k = 0; k < n; k++) { // forward substitution with the unit lower triangle
+					for (size_t i = k + 1; i < n; i++) {
+						Lanes lik = lu(i, k);
+						for (size_t col = 0; col < r; col++) Store(b(i, col), Load(b(i, col)) - lik * Load(b(k, col)));
+					}
+				}
+				for (size_t i = n; i-- > 0;) { // back substitution with the upper triangle
+					for (size_t k = i + 1; k < n; k++) {
+						Lanes uik = lu(i, k);
+						for (size_t col = 0; col < r; col++) Store(b(i, col), Load(b(i, col)) - uik * Load(b(k, col)));
+					}
+					Lanes uii = lu(i, i);
+					for (size_t col = 0; col < r; col++) Store(b(i, col), Load(b(i, col)) / uii);
+				}
+			}
+		}
+
+		// Size dispatch. x.n is the order of the matrices being factorised; x.k that of the factors being solved with.
+		static M2D_ALWAYS_INLINE void FactorBlocks(const BatchArgs &x, size_t lo, size_t hi) {
+			switch (x.n) {
+			case 1: FactorBlocksFixed<1>(x, lo, hi); break;
+			case 2: FactorBlocksFixed<2>(x, lo, hi); break;
+			case 3: FactorBlocksFixed<3>(x, lo, hi); break;
+			case 4: FactorBlocksFixed<4>(x, lo, hi); break;
+			case 5: FactorBlocksFixed<5>(x, lo, hi); break;
+			case 6: FactorBlocksFixed<6>(x, lo, hi); break;
+			case 7: FactorBlocksFixed<7>(x, lo, hi); break;
+			case 8: FactorBlocksFixed<8>(x, lo, hi); break;
+			default: FactorBlocksAny(x, lo, hi);
+			}
+		}
+		static M2D_ALWAYS_INLINE void SolveBlocks(const BatchArgs &x, size_t lo, size_t hi) {
+			switch (x.k) {
+			case 1: SolveBlocksFixed<1>(x, lo, hi); break;
+			case 2: SolveBlocksFixed<2>(x, lo, hi); break;
+			case 3: SolveBlocksFixed<3>(x, lo, hi); break;
+			case 4: SolveBlocksFixed<4>(x, lo, hi); break;
+			case 5: SolveBlocksFixed<5>(x, lo, hi); break;
+			case 6: SolveBlocksFixed<6>(x, lo, hi); break;
+			case 7: SolveBlocksFixed<7>(x, lo, hi); break;
+			case 8: SolveBlocksFixed<8>(x, lo, hi); break;
+			default: SolveBlocksAny(x, lo, hi);
+			}
+		}
+		static M2D_ALWAYS_INLINE void FactorSolveBlocks(const BatchArgs &x, size_t lo, size_t hi) {
+			switch (x.k) {
+			case 1: FactorSolveBlocksFixed<1>(x, lo, hi); break;
+			case 2: FactorSolveBlocksFixed<2>(x, lo, hi); break;
+			case 3: FactorSolveBlocksFixed<3>(x, lo, hi); break;
+			case 4: FactorSolveBlocksFixed<4>(x, lo, hi); break;
+			case 5: FactorSolveBlocksFixed<5>(x, lo, hi); break;
+			case 6: FactorSolveBlocksFixed<6>(x, lo, hi); break;
+			case 7: FactorSolveBlocksFixed<7>(x, lo, hi); break;
+			case 8: FactorSolveBlocksFixed<8>(x, lo, hi); break;
+			}
+		}
+		static M2D_ALWAYS_INLINE void DetBlocks(const BatchArgs &x, size_t lo, size_t hi) {
+			switch (x.n) {
+			case 4: DetBlocksFixed<4>(x, lo, hi); break;
+			case 5: DetBlocksFixed<5>(x, lo, hi); break;
+			case 6: DetBlocksFixed<6>(x, lo, hi); break;
+			case 7: DetBlocksFixed<7>(x, lo, hi); break;
+			case 8: DetBlocksFixed<8>(x, lo, hi); break;
+			}
+		}
+
+		// Closed-form determinants of 1 x 1 to 3 x 3 matrices (x.n) over blocks [lo, hi), written to x.c.
+		static M2D_ALWAYS_INLINE void SmallDetBlocks(const BatchArgs &x, size_t lo, size_t hi) {
+			const size_t n = x.n, ld = x.lanes;
+			for (size_t b0 = lo * kLanes; b0 < hi * kLanes; b0 += kLanes) {
+				Prefetch(x.a + b0, n * n, ld);
+				auto e = [&](size_t i, size_t j) { return Load(x.a + (i * n + j) * ld + b0); };
+				Lanes det;
+				if (n == 1) det = e(0, 0);
+				else if (n == 2) det = e(0, 0) * e(1, 1) - e(0, 1) * e(1, 0);
+				else det = e(0, 0) * (e(1, 1) * e(2, 2) - e(1, 2) * e(2, 1)) - e(0, 1) * (e(1, 0) * e(2, 2) - e(1, 2) * e(2, 0))
+					+ e(0, 2) * (e(1, 0) * e(2, 1) - e(1, 1) * e(2, 0));
+				Store(x.c + b0, det);
+			}
+		}
+
+		static void MultiplyBase(const BatchArgs &x, size_t lo, size_t hi) { MultiplyBlocks(x, lo, hi); }
+		static void FactorBase(const BatchArgs &x, size_t lo, size_t hi) { FactorBlocks(x, lo, hi); }
+		static void SolveBase(const BatchArgs &x, size_t lo, size_t hi) { SolveBlocks(x, lo, hi); }
+		static void SmallDetBase(const BatchArgs &x, size_t lo, size_t hi) { SmallDetBlocks(x, lo, hi); }
+		static void DetBase(const BatchArgs &x, size_t lo, size_t hi) { DetBlocks(x, lo, hi); }
+		static void FactorSolveBase(const BatchArgs &x, size_t lo, size_t hi) { FactorSolveBlocks(x, lo, hi); }
+#ifdef M2D_X86
+		M2D_TARGET_AVX2 static void MultiplyAvx2(const BatchArgs &x, size_t lo, size_t hi) { MultiplyBlocks(x, lo, hi); }
+		M2D_TARGET_AVX2 static void FactorAvx2(const BatchArgs &x, size_t lo, size_t hi) { FactorBlocks(x, lo, hi); }
+		M2D_TARGET_AVX2 static void SolveAvx2(const BatchArgs &x, size_t lo, size_t hi) { SolveBlocks(x, lo, hi); }
+		M2D_TARGET_AVX2 static void SmallDetAvx2(const BatchArgs &x, size_t lo, size_t hi) { SmallDetBlocks(x, lo, hi); }
+		M2D_TARGET_AVX2 static void DetAvx2(const BatchArgs &x, size_t lo, size_t hi) { DetBlocks(x, lo, hi); }
+		M2D_TARGET_AVX2 static void FactorSolveAvx2(const BatchArgs &x, size_t lo, size_t hi) { FactorSolveBlocks(x, lo, hi); }
+#else
+		constexpr BatchKernel MultiplyAvx2 = MultiplyBase, FactorAvx2 = FactorBase, SolveAvx2 = SolveBase;
+		constexpr BatchKernel SmallDetAvx2 = SmallDetBase, DetAvx2 = DetBase, FactorSolveAvx2 = FactorSolveBase;
+#endif
+
+		// Runs a kernel over all blocks of the batch in parallel, in chunks of roughly 16K flops.
+		static void RunBatch(BatchKernel base, BatchKernel avx2, const BatchArgs &x, size_t flops_per_matrix) {
+			BatchKernel kernel = CpuHasAvx2Fma() ? avx2 : base;
+			size_t blocks = x.lanes / kLanes;
+			size_t grain = max<size_t>(1, 16384 / (kLanes * max<size_t>(1, flops_per_matrix)));
+			ParallelFor(0, blocks, grain, [&](size_t lo, size_t hi) { kernel(x, lo, hi); });
+		}
+	}
+
+	MatrixBatch::MatrixBatch(size_t count, size_t size_x, size_t size_y) :
+		count(count), size_x(size_x), size_y(size_y), lanes(detail::PaddedStride(count)) {
+		elem = detail::AllocateBuffer(size_x * size_y * lanes);
+	}
+	MatrixBatch::MatrixBatch(const MatrixBatch& src) : MatrixBatch(src.count, src.size_x, src.size_y) {
+		if (elem) memcpy(elem, src.elem, size_x * size_y * lanes * sizeof(double));
+	}
+	MatrixBatch::MatrixBatch(MatrixBatch&& src) noexcept :
+		elem(src.elem), count(src.count), size_x(src.size_x), size_y(src.size_y), lanes(src.lanes) {
+		src.elem = nullptr;
+		src.count = src.size_x = src.size_y = src.lanes = 0;
+	}
+	MatrixBatch& MatrixBatch::operator=(const MatrixBatch& src) {
+		if (this == &src) return *this;
+		if (count == src.count && size_x == src.size_x && size_y == src.size_y) {
+			if (elem) memcpy(elem, src.elem, size_x * size_y * lanes * sizeof(double));
+			return *this;
+		}
+		return *this = MatrixBatch(src);
+	}
+	MatrixBatch& MatrixBatch::operator=(MatrixBatch&& src) noexcept {
+		swap(elem, src.elem);
+		swap(count, src.count);
+		swap(size_x, src.size_x);
+		swap(size_y, src.size_y);
+		swap(lanes, src.lanes);
+		return *this;
+	}
+	MatrixBatch::~MatrixBatch() {
+		detail::FreeBuffer(elem);
+	}
+
+	Matrix2D MatrixBatch::get(size_t index) const {
+		if (index >= count) throw out_of_range("Index exceeded MatrixBatch range.");
+		Matrix2D result(size_x, size_y);
+		for (size_t x = 0; x < size_x; x++)
+			for (size_t y = 0; y < size_y; y++) result.row(x)[y] = plane(x, y)[index];
+		return result;
+	}
+	void MatrixBatch::set(size_t index, ConstMatrixView m) {
+		if (index >= count) throw out_of_range("Index exceeded MatrixBatch range.");
+		if (m.getSizeX() != size_x || m.getSizeY() != size_y) throw invalid_argument("Cannot store a matrix of different dimensions in a batch.");
+		for (size_t x = 0; x < size_x; x++)
+			for (size_t y = 0; y < size_y; y++) plane(x, y)[index] = m.coeff(x, y);
+	}
+
+	void BatchMultiply(const MatrixBatch &A, const MatrixBatch &B, MatrixBatch &C) {
+		if (A.getCount() != B.getCount() || A.getSizeY() != B.getSizeX())
+			throw invalid_argument("Cannot multiply these batches: incompatible counts or dimensions.");
+		if (&C == &A || &C == &B) { // the kernel writes C while reading A and B
+			MatrixBatch result(A.getCount(), A.getSizeX(), B.getSizeY());
+			BatchMultiply(A, B, result);
+			C = move(result);
+			return;
+		}
+		if (C.getCount() != A.getCount() || C.getSizeX() != A.getSizeX() || C.getSizeY() != B.getSizeY())
+			C = MatrixBatch(A.getCount(), A.getSizeX(), B.getSizeY());
+		detail::BatchArgs x = { A.plane(0, 0), B.plane(0, 0), C.plane(0, 0), nullptr, A.getSizeX(), A.getSizeY(), B.getSizeY(), A.getLaneStride() };
+		detail::RunBatch(detail::MultiplyBase, detail::MultiplyAvx2, x, 2 * x.m * x.k * x.n);
+	}
+
+	void BatchLUFactorize(MatrixBatch &A, MatrixBatch &piv) {
+		size_t n = A.getSizeX();
+		if (A.getSizeY() != n) throw invalid_argument("Cannot factorize non-square matrices.");
+		if (piv.getCount() != A.getCount() || piv.getSizeX() != n || piv.getSizeY() != 1)
+			piv = MatrixBatch(A.getCount(), n, 1);
+		detail::BatchArgs x = { nullptr, nullptr, A.plane(0, 0), piv.plane(0, 0), n, n, n, A.getLaneStride() };
+		detail::RunBatch(detail::FactorBase, detail::FactorAvx2, x, 2 * n * n * n / 3 + n * n);
+	}
+
+	void BatchLUSolve(const MatrixBatch &LU, const MatrixBatch &piv, MatrixBatch &B) {
+		size_t n = LU.getSizeX();
+		if (LU.getSizeY() != n || B.getSizeX() != n || piv.getSizeX() != n || piv.getSizeY() != 1 ||
+			LU.getCount() != B.getCount() || piv.getCount() != B.getCount())
+			throw invalid_argument("Cannot solve: the factorisations must be square and match the pivots and right-hand sides.");
+		detail::BatchArgs x = { LU.plane(0, 0), piv.plane(0, 0), B.plane(0, 0), nullptr, n, n, B.getSizeY(), LU.getLaneStride() };
+		detail::RunBatch(detail::SolveBase, detail::SolveAvx2, x, 2 * n * n * B.getSizeY());
+	}
+
+	void BatchSolve(const MatrixBatch &A, MatrixBatch &B) {
+		size_t n = A.getSizeX();
+		if (A.getSizeY() != n) throw invalid_argument("Cannot solve with non-square matrices.");
+		if (B.getCount() != A.getCount() || B.getSizeX() != n) throw invalid_argument("Cannot solve these batches: incompatible sizes.");
+		if (n <= detail::kMaxFixed && B.getSizeY() > 0) { // factorise in registers, leaving A untouched
+			detail::BatchArgs x = { A.plane(0, 0), nullptr, B.plane(0, 0), nullptr, 0, n, B.getSizeY(), A.getLaneStride() };
+			detail::RunBatch(detail::FactorSolveBase, detail::FactorSolveAvx2, x, 2 * n * n * n / 3 + 2 * n * n * B.getSizeY());
+			return;
+		}
+		MatrixBatch LU(A), piv(A.getCount(), n, 1);
+		BatchLUFactorize(LU, piv);
+		BatchLUSolve(LU, piv, B);
+	}
+
+	void BatchInvert(MatrixBatch &A) {
+		size_t n = A.getSizeX();
+		if (A.getSizeY() != n) throw invalid_argument("Cannot invert non-square matrices.");
+		if (n <= detail::kMaxFixed) { // in place, without materialising the identity
+			detail::BatchArgs x = { A.plane(0, 0), nullptr, A.plane(0, 0), nullptr, 0, n, 0, A.getLaneStride() };
+			detail::RunBatch(detail::FactorSolveBase, detail::FactorSolveAvx2, x, 8 * n * n * n / 3);
+			return;
+		}
+		MatrixBatch inverse(A.getCount(), n, n), piv(A.getCount(), n, 1);
+		for (size_t i = 0; i < n; i++) fill_n(inverse.plane(i, i), inverse.getLaneStride(), 1.0);
+		BatchLUFactorize(A, piv);
+		BatchLUSolve(A, piv, inverse);
+		A = move(inverse);
+	}
+
+	vector<double> BatchDet(const MatrixBatch &A) {
+		size_t n = A.getSizeX();
+		if (A.getSizeY() != n) throw invalid_argument("Cannot compute determinant of non-square matrices.");
+		vector<double> result(A.getCount(), 1.0);
+		if (n == 0 || A.getCount() == 0) return result;
+		if (n <= detail::kMaxFixed) { // closed form up to 3 x 3, LU in registers above
+			MatrixBatch out(A.getCount(), 1, 1);
+			detail::BatchArgs x = { A.plane(0, 0), nullptr, out.plane(0, 0), nullptr, n, n, n, A.getLaneStride() };
+			if (n <= 3) detail::RunBatch(detail::SmallDetBase, detail::SmallDetAvx2, x, 2 * n * n * n);
+			else detail::RunBatch(detail::DetBase, detail::DetAvx2, x, 2 * n * n * n / 3 + n * n);
+			copy_n(out.plane(0, 0), A.getCount(), result.begin());
+			return result;
+		}
+		// det = det(P) * prod(diag(U)), lane by lane.
+		MatrixBatch LU(A), piv(A.getCount(), n, 1);
+		BatchLUFactorize(LU, piv);
+		for (size_t k = 0; k < n; k++) {
+			const double *d = LU.plane(k, k), *p = piv.plane(k, 0);
+			for (size_t b = 0; b < A.getCount(); b++) result[b] *= p[b] != (double)k ? -d[b] : d[b];
+		}
+		return result;
+	}
+}
@@ -0,0 +1,89 @@
+/**
+ * @file matrix_batch.h
+ * Batched engine for large numbers of small, same-sized matrices.
+ * A MatrixBatch stores its matrices in structure-of-arrays layout: element (i, j) of every matrix in the batch is
+ * contiguous in memory, so each operation runs the same scalar algorithm on a whole row of SIMD lanes at once,
+ * one matrix per lane, with no per-matrix allocation, indexing or range checking.
+ */
+
+#ifndef MATRIX2D_BATCH
+#define MATRIX2D_BATCH
+
+#include "matrix_2d.h"
+
+namespace m2d {
+	/** A batch of getCount() matrices, all of size getSizeX() x getSizeY(), in structure-of-arrays layout.
+	* Element (i, j) of matrix b lives at plane(i, j)[b]. Planes are 64-byte aligned and padded to a multiple of
+	* 8 matrices; the padding matrices are computed along with the others and are never observable.
+	*/
+	class MATRIX2D_LIB MatrixBatch {
+		double *elem; /** One aligned buffer of size_x * size_y planes. */
+		size_t count; /** Number of matrices. */
+		size_t size_x, size_y; /** Size of every matrix. */
+		size_t lanes; /** Distance between two planes, count rounded up to a multiple of 8. */
+	public:
+		/** Creates a batch of zero matrices.
+		* @param count: Number of matrices.
+		* @param size_x: Row count of every matrix.
+		* @param size_y: Column count of every matrix.
+		*/
+		MatrixBatch(size_t count, size_t size_x, size_t size_y);
+		MatrixBatch(const MatrixBatch& src);
+		MatrixBatch(MatrixBatch&& src) noexcept;
+		MatrixBatch& operator=(const MatrixBatch& src);
+		MatrixBatch& operator=(MatrixBatch&& src) noexcept;
+		~MatrixBatch();
+
+		size_t getCount() const { return count; }
+		size_t getSizeX() const { return size_x; }
+		size_t getSizeY() const { return size_y; }
+		/** Distance, in elements, between two consecutive planes. */
+		size_t getLaneStride() const { return lanes; }
+		/** Raw access to the plane holding element (i, j) of every matrix, for kernels. No range checking is done. */
+		double *plane(size_t pos_x, size_t pos_y) { return elem + (pos_x * size_y + pos_y) * lanes; }
+		const double *plane(size_t pos_x, size_t pos_y) const { return elem + (pos_x * size_y + pos_y) * lanes; }
+		/** Unchecked element access. */
+		double coeff(size_t index, size_t pos_x, size_t pos_y) const { return plane(pos_x, pos_y)[index]; }
+		double &coeffRef(size_t index, size_t pos_x, size_t pos_y) { return plane(pos_x, pos_y)[index]; }
+		/** Copies one matrix of the batch out.
+		* @exception out_of_range() if the index is out of range.
+		*/
+		Matrix2D get(size_t index) const;
+		/** Copies a matrix into the batch.
+		* @exception out_of_range() if the index is out of range; invalid_argument() if the size differs.
+		*/
+		void set(size_t index, ConstMatrixView m);
+	};
+
+	/** Multiplies matrices pairwise: C[b] = A[b] * B[b].
+	* @exception invalid_argument() if the counts or sizes do not match.
+	*/
+	MATRIX2D_LIB void BatchMultiply(const MatrixBatch &A, const MatrixBatch &B, MatrixBatch &C);
+	/** Computes the determinant of every matrix, in closed form up to 3 x 3 and by pivoted LU above.
+	* @return One determinant per matrix.
+	* @exception invalid_argument() if the matrices are not square.
+	*/
+	MATRIX2D_LIB vector<double> BatchDet(const MatrixBatch &A);
+	/** LU-factorises every matrix in place with partial pivoting, as LUFactorize() does for one matrix.
+	* As there, singular matrices still factorise, with an exact zero on the diagonal of U.
+	* @param A: The matrices, which must be square. Overwritten by L (unit diagonal not stored) and U.
+	* @param piv: Receives the pivots as a batch of n x 1 matrices: element (k, 0) is the row swapped with row k.
+	* @exception invalid_argument() if the matrices are not square or piv is not of the right size.
+	*/
+	MATRIX2D_LIB void BatchLUFactorize(MatrixBatch &A, MatrixBatch &piv);
+	/** Solves LU[b] * X[b] = B[b] in place, given the output of BatchLUFactorize().
+	* A singular matrix does not stop the batch: its solutions are simply not finite.
+	* @exception invalid_argument() if the counts or sizes do not match.
+	*/
+	MATRIX2D_LIB void BatchLUSolve(const MatrixBatch &LU, const MatrixBatch &piv, MatrixBatch &B);
+	/** Solves A[b] * X[b] = B[b] in place, factorising a copy of A. See BatchLUSolve().
+	* @exception invalid_argument() if the counts or sizes do not match or A is not square.
+	*/
+	MATRIX2D_LIB void BatchSolve(const MatrixBatch &A, MatrixBatch &B);
+	/** Inverts every matrix in place. Singular matrices come out with non-finite elements.
+	* @exception invalid_argument() if the matrices are not square.
+	*/
+	MATRIX2D_LIB void BatchInvert(MatrixBatch &A);
+}
+
+#endif // MATRIX2D_BATCH
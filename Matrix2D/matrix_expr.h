@@ -0,0 +1,168 @@
+/**
+ * @file matrix_expr.h
+ * Lazy expression templates for element-wise Matrix2D arithmetic.
+ * Chains of +, -, unary minus and scalar scaling build a small expression tree instead of temporaries.
+ * The tree is evaluated in a single pass over memory when it is assigned to (or used to construct) a Matrix2D.
+ * Expressions hold references to their Matrix2D operands, so they must not outlive them: prefer
+ * "Matrix2D C = A + B;" over "auto C = A + B;". Views are small handles and are held by copy, so an expression
+ * over temporary views, such as A.subView(0, 0, 2, 2) + B.subView(0, 0, 2, 2), only needs A and B to outlive it.
+ */
+
+#ifndef MATRIX2D_EXPR
+#define MATRIX2D_EXPR
+
+#include "profiler.h"
+#include "thread_pool.h"
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+namespace m2d {
+	/** Trait marking the types that can appear in an element-wise expression.
+	* Every such type provides getSizeX(), getSizeY() and an unchecked coeff(x, y).
+	*/
+	template <class T> struct IsMatrixExpr : std::false_type {};
+
+	namespace detail {
+		/** Trait marking expression leaves (types that own or address storage), as opposed to expression nodes. */
+		template <class T> struct IsExprLeaf : std::false_type {};
+		/** Trait marking the operands too costly to copy, which expressions capture by reference: matrices that own
+		* their storage. Everything else, expression nodes and views alike, is captured by value, so that temporary
+		* views stay valid for as long as the expression.
+		*/
+		template <class T> struct IsHeldByReference : std::false_type {};
+		template <class T> using ExprOperand = typename std::conditional<IsHeldByReference<T>::value, const T&, const T>::type;
+		template <class... T> using EnableIfExprs = typename std::enable_if<(IsMatrixExpr<T>::value && ...)>::type;
+		template <class T> using EnableIfNode = typename std::enable_if<IsMatrixExpr<T>::value && !IsExprLeaf<T>::value>::type;
+
+		struct AddOp { static double apply(double a, double b) { return a + b; } };
+		struct SubOp { static double apply(double a, double b) { return a - b; } };
+
+		/** Per-element cost of an expression, for the profiler: arithmetic operations and leaves read. */
+		template <class T> struct ExprCost {
+			static constexpr double flops = 0, reads = 1;
+		};
+
+		/** Trait telling whether evaluating an expression element by element into a row-major buffer would read some
+		* element of the buffer after writing another one, i.e. whether a leaf reads the buffer transposed, through a
+		* minor or with a shifted layout. Such expressions must be evaluated into a temporary first.
+		* Leaves not specialised here (whole matrices) read each element at its own position, so never do.
+		*/
+		template <class T> struct ReadsReordered {
+			static bool check(const T&, const double*, size_t, size_t, size_t) { return false; }
+		};
+
+		/** Evaluates an expression into a row-major buffer of the same size, in one parallel pass over row blocks.
+		* Reads and writes of every element happen at the same position, so the destination may also be an operand as
+		* long as ReadsReordered is false for it.
+		* @param dst: Pointer to element (0, 0) of the destination.
+		* @param ld: Leading dimension of the destination.
+		* @param expr: The expression to evaluate.
+		*/
+		template <class E>
+		void EvaluateInto(double *dst, size_t ld, const E& expr) {
+			size_t rows = expr.getSizeX(), cols = expr.getSizeY();
+			double count = (double)rows * cols;
+			ProfileScope profile(ProfiledOp::Elementwise, count * ExprCost<E>::flops,
+				count * sizeof(double) * (ExprCost<E>::reads + 1));
+			ParallelFor(0, rows, RowGrain(cols), [&](size_t lo, size_t hi) {
+				for (size_t x = lo; x < hi; x++) {
+					double *r = dst + x * ld;
+					for (size_t y = 0; y < cols; y++) r[y] = expr.coeff(x, y);
+				}
+			});
+		}
+	}
+
+	/** Element-wise combination of two expressions of the same size. */
+	template <class L, class R, class Op>
+	class BinaryExpr {
+		detail::ExprOperand<L> lhs;
+		detail::ExprOperand<R> rhs;
+	public:
+		BinaryExpr(const L& lhs, const R& rhs) : lhs(lhs), rhs(rhs) {}
+		const L& getLhs() const { return lhs; }
+		const R& getRhs() const { return rhs; }
+		size_t getSizeX() const { return lhs.getSizeX(); }
+		size_t getSizeY() const { return lhs.getSizeY(); }
+		double coeff(size_t x, size_t y) const { return Op::apply(lhs.coeff(x, y), rhs.coeff(x, y)); }
+	};
+
+	/** An expression multiplied by a scalar. */
+	template <class E>
+	class ScaledExpr {
+		detail::ExprOperand<E> expr;
+		double factor;
+	public:
+		ScaledExpr(const E& expr, double factor) : expr(expr), factor(factor) {}
+		const E& getOperand() const { return expr; }
+		size_t getSizeX() const { return expr.getSizeX(); }
+		size_t getSizeY() const { return expr.getSizeY(); }
+		double coeff(size_t x, size_t y) const { return factor * expr.coeff(x, y); }
+	};
+
+	template <class L, class R, class Op> struct IsMatrixExpr<BinaryExpr<L, R, Op>> : std::true_type {};
+	template <class E> struct IsMatrixExpr<ScaledExpr<E>> : std::true_type {};
+
+	namespace detail {
+		template <class L, class R, class Op> struct ExprCost<BinaryExpr<L, R, Op>> {
+			static constexpr double flops = ExprCost<L>::flops + ExprCost<R>::flops + 1;
+			static constexpr double reads = ExprCost<L>::reads + ExprCost<R>::reads;
+		};
+		template <class E> struct ExprCost<ScaledExpr<E>> {
+			static constexpr double flops = ExprCost<E>::flops + 1, reads = ExprCost<E>::reads;
+		};
+		template <class L, class R, class Op> struct ReadsReordered<BinaryExpr<L, R, Op>> {
+			static bool check(const BinaryExpr<L, R, Op>& expr, const double *dst, size_t ld, size_t rows, size_t cols) {
+				return ReadsReordered<L>::check(expr.getLhs(), dst, ld, rows, cols)
+					|| ReadsReordered<R>::check(expr.getRhs(), dst, ld, rows, cols);
+			}
+		};
+		template <class E> struct ReadsReordered<ScaledExpr<E>> {
+			static bool check(const ScaledExpr<E>& expr, const double *dst, size_t ld, size_t rows, size_t cols) {
+				return ReadsReordered<E>::check(expr.getOperand(), dst, ld, rows, cols);
+			}
+		};
+	}
+
+	/** Adds two matrix expressions lazily.
+	* @return An expression node; nothing is computed until it is assigned to a Matrix2D.
+	* @exception Throws invalid_argument() if the size of the operands do not match.
+	*/
+	template <class L, class R, class = detail::EnableIfExprs<L, R>>
+	BinaryExpr<L, R, detail::AddOp> operator+(const L& lhs, const R& rhs) {
+		if (lhs.getSizeX() != rhs.getSizeX() || lhs.getSizeY() != rhs.getSizeY())
+			throw std::invalid_argument("Cannot add two matrices of different dimensions.");
+		return BinaryExpr<L, R, detail::AddOp>(lhs, rhs);
+	}
+	/** Subtracts one matrix expression from another lazily.
+	* @return An expression node; nothing is computed until it is assigned to a Matrix2D.
+	* @exception Throws invalid_argument() if the size of the operands do not match.
+	*/
+	template <class L, class R, class = detail::EnableIfExprs<L, R>>
+	BinaryExpr<L, R, detail::SubOp> operator-(const L& lhs, const R& rhs) {
+		if (lhs.getSizeX() != rhs.getSizeX() || lhs.getSizeY() != rhs.getSizeY())
+			throw std::invalid_argument("Cannot subtract two matrices of different dimensions.");
+		return BinaryExpr<L, R, detail::SubOp>(lhs, rhs);
+	}
+	/** Negates a matrix expression lazily. */
+	template <class E, class = detail::EnableIfExprs<E>>
+	ScaledExpr<E> operator-(const E& expr) {
+		return ScaledExpr<E>(expr, -1.0);
+	}
+	/** Scales a matrix expression lazily. */
+	template <class E, class = detail::EnableIfExprs<E>>
+	ScaledExpr<E> operator*(double factor, const E& expr) {
+		return ScaledExpr<E>(expr, factor);
+	}
+	template <class E, class = detail::EnableIfExprs<E>>
+	ScaledExpr<E> operator*(const E& expr, double factor) {
+		return ScaledExpr<E>(expr, factor);
+	}
+	template <class E, class = detail::EnableIfExprs<E>>
+	ScaledExpr<E> operator/(const E& expr, double divisor) {
+		return ScaledExpr<E>(expr, 1.0 / divisor);
+	}
+}
+
+#endif // MATRIX2D_EXPR
@@ -0,0 +1,326 @@
+/**
+* @file matrix_io.cpp
+* Contains the binary matrix file format, file mapping and the parallel text parser.
+*/
+#include "stdafx.h"
+#include "matrix_io.h"
+#include "aligned_memory.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <system_error>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		/** On-disk header of a binary matrix file. See matrix_io.h for the layout. */
+		struct BinaryHeader {
+			char magic[4];
+			uint16_t version;
+			uint16_t byte_order;
+			uint8_t dtype;
+			uint8_t layout;
+			uint8_t reserved0[6];
+			uint64_t rows;
+			uint64_t cols;
+			uint64_t stride;
+			uint64_t data_offset;
+			uint64_t checksum;
+			uint64_t reserved1;
+		};
+		static_assert(sizeof(BinaryHeader) == 64, "The binary header must be exactly 64 bytes.");
+
+		constexpr char kBinaryMagic[4] = { 'M', '2', 'D', 'B' };
+		constexpr uint16_t kBinaryVersion = 1;
+		constexpr uint16_t kByteOrderMark = 0xFEFF;
+		constexpr uint8_t kDtypeFloat64 = 1;
+		constexpr uint8_t kLayoutRowMajor = 0;
+
+		// Multiply-rotate hash over 8-byte words, four independent lanes wide.
+		constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL, kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+		constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL, kPrime4 = 0x85EBCA77C2B2AE63ULL;
+		static inline uint64_t Rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+		static inline uint64_t HashRound(uint64_t acc, uint64_t word) { return Rotl(acc + word * kPrime2, 31) * kPrime1; }
+		static inline uint64_t Avalanche(uint64_t h) {
+			h ^= h >> 33; h *= kPrime2;
+			h ^= h >> 29; h *= kPrime3;
+			return h ^ (h >> 32);
+		}
+		static uint64_t HashRow(const double *p, size_t n, uint64_t seed) {
+			uint64_t lane[4] = { seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1 };
+			uint64_t w[4];
+			size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				memcpy(w, p + i, sizeof(w));
+				for (int l = 0; l < 4; l++) lane[l] = HashRound(lane[l], w[l]);
+			}
+			uint64_t h = Rotl(lane[0], 1) + Rotl(lane[1], 7) + Rotl(lane[2], 12) + Rotl(lane[3], 18) + n;
+			for (; i < n; i++) {
+				memcpy(w, p + i, sizeof(uint64_t));
+				h = Rotl(h ^ HashRound(0, w[0]), 27) * kPrime1 + kPrime4;
+			}
+			return Avalanche(h);
+		}
+
+		// Maps a whole file read-only. Handles are closed straight away: the mapping keeps the file alive.
+		static void *MapFile(const char *path, size_t &length) {
+#ifdef _WIN32
+			HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE) throw runtime_error("Cannot open matrix file.");
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file, &size) || size.QuadPart < (LONGLONG)sizeof(BinaryHeader)) {
+				CloseHandle(file);
+				throw runtime_error("Not a Matrix2D binary file.");
+			}
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			CloseHandle(file);
+			if (!mapping) throw runtime_error("Cannot map matrix file.");
+			void *base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+			if (!base) throw runtime_error("Cannot map matrix file.");
+			length = (size_t)size.QuadPart;
+			return base;
+#else
+			int fd = open(path, O_RDONLY);
+			if (fd < 0) throw runtime_error("Cannot open matrix file.");
+			struct stat st;
+			if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(BinaryHeader)) {
+				close(fd);
+				throw runtime_error("Not a Matrix2D binary file.");
+			}
+			void *base = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (base == MAP_FAILED) throw runtime_error("Cannot map matrix file.");
+			length = (size_t)st.st_size;
+			return base;
+#endif
+		}
+		static void UnmapFile(void *base, size_t length) noexcept {
+			if (!base) return;
+#ifdef _WIN32
+			(void)length;
+			UnmapViewOfFile(base);
+#else
+			munmap(base, length);
+#endif
+		}
+
+		// Validates the header of a mapped file and returns a view of its data.
+		static ConstMatrixView CheckMappedFile(const void *base, size_t length) {
+			BinaryHeader h;
+			memcpy(&h, base, sizeof(h));
+			if (memcmp(h.magic, kBinaryMagic, sizeof(h.magic)) != 0) throw runtime_error("Not a Matrix2D binary file.");
+			if (h.byte_order != kByteOrderMark) throw runtime_error("Matrix file was written with a different byte order.");
+			if (h.version != kBinaryVersion || h.dtype != kDtypeFloat64 || h.layout != kLayoutRowMajor)
+				throw runtime_error("Unsupported Matrix2D binary file version, element type or layout.");
+			const uint64_t max_elems = numeric_limits<size_t>::max() / sizeof(double);
+			if (h.stride < h.cols || h.data_offset < sizeof(h) || h.data_offset % kBufferAlignment != 0 || h.data_offset > length ||
+				(h.stride != 0 && h.rows > max_elems / h.stride) || h.rows * h.stride * sizeof(double) > length - h.data_offset)
+				throw runtime_error("Matrix file is truncated or its header is corrupt.");
+			const double *data = reinterpret_cast<const double*>(static_cast<const char*>(base) + h.data_offset);
+			return ConstMatrixView(data, (size_t)h.rows, (size_t)h.cols, (size_t)h.stride);
+		}
+		static uint64_t StoredChecksum(const void *base) {
+			BinaryHeader h;
+			memcpy(&h, base, sizeof(h));
+			return h.checksum;
+		}
+
+		static inline bool IsSpace(char c) { return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+
+		// Parses one number starting at p, which is not whitespace. Returns the position just after it.
+		static const char *ParseNumber(const char *p, const char *last, double &value) {
+			const char *q = (*p == '+' && p + 1 < last) ? p + 1 : p; // from_chars rejects a leading '+', operator>> does not
+			from_chars_result r = from_chars(q, last, value);
+			if (r.ec == errc::result_out_of_range) { // overflow and subnormals: take strtod's value, like operator>>
+				string token(q, r.ptr);
+				value = strtod(token.c_str(), nullptr);
+			}
+			else if (r.ec != errc()) throw invalid_argument("Malformed number in matrix input.");
+			if (r.ptr != last && !IsSpace(*r.ptr)) throw invalid_argument("Malformed number in matrix input.");
+			return r.ptr;
+		}
+		// Parses count numbers from [p, last) into consecutive elements of m, starting at element index k.
+		static const char *ParseRun(const char *p, const char *last, MatrixView m, size_t k, size_t count) {
+			size_t cols = m.getSizeY();
+			size_t x = k / cols, y = k % cols;
+			while (count > 0) {
+				size_t run = min(count, cols - y); // the rest of row x
+				if (m.isStrided()) {
+					double *r = m.data() + x * m.getStride();
+					for (size_t j = y; j < y + run; j++) {
+						while (IsSpace(*p)) p++;
+						p = ParseNumber(p, last, r[j]);
+					}
+				}
+				else {
+					for (size_t j = y; j < y + run; j++) {
+						while (IsSpace(*p)) p++;
+						p = ParseNumber(p, last, m.coeffRef(x, j));
+					}
+				}
+				count -= run;
+				x++;
+				y = 0;
+			}
+			return p;
+		}
+		// Counts the numbers starting in [p, end). p is the start of the text or a whitespace character.
+		// Any byte up to ' ' counts as a separator here; the stray control characters this accepts are then rejected
+		// as malformed numbers by ParseNumber().
+		static size_t CountTokens(const char *p, const char *end) {
+			if (p == end) return 0;
+			const unsigned char *u = reinterpret_cast<const unsigned char*>(p);
+			size_t n = (size_t)(end - p), count = u[0] > ' ';
+			for (size_t i = 1; i < n; i++) count += (u[i - 1] <= ' ') & (u[i] > ' '); // vectorises: no loop-carried state
+			return count;
+		}
+	}
+
+	uint64_t MatrixChecksum(ConstMatrixView m) {
+		if (!m.isStrided()) return MatrixChecksum(Matrix2D(m));
+		size_t rows = m.getSizeX(), cols = m.getSizeY();
+		atomic<uint64_t> sum(0);
+		detail::ParallelFor(0, rows, detail::RowGrain(cols), [&](size_t lo, size_t hi) {
+			uint64_t partial = 0; // rows combine by addition, so the result is independent of chunking
+			for (size_t x = lo; x < hi; x++) partial += detail::HashRow(m.data() + x * m.getStride(), cols, x);
+			sum.fetch_add(partial, memory_order_relaxed);
+		});
+		return detail::Avalanche(sum.load() ^ (rows * detail::kPrime3) ^ (cols * detail::kPrime4));
+	}
+
+	void SaveBinary(const char *path, ConstMatrixView m) {
+		if (!m.isStrided()) {
+			SaveBinary(path, Matrix2D(m));
+			return;
+		}
+		detail::BinaryHeader h = {};
+		memcpy(h.magic, detail::kBinaryMagic, sizeof(h.magic));
+		h.version = detail::kBinaryVersion;
+		h.byte_order = detail::kByteOrderMark;
+		h.dtype = detail::kDtypeFloat64;
+		h.layout = detail::kLayoutRowMajor;
+		h.rows = m.getSizeX();
+		h.cols = m.getSizeY();
+		h.stride = detail::MatrixStride(m.getSizeY());
+		h.data_offset = sizeof(h);
+		h.checksum = MatrixChecksum(m);
+		detail::ProfileScope profile(detail::ProfiledOp::SaveBinary, 0, (double)h.data_offset + (double)h.rows * h.stride * sizeof(double));
+
+		FILE *f = fopen(path, "wb");
+		if (!f) throw runtime_error("Cannot create matrix file.");
+		bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+		const double padding[detail::kDoublesPerAlignment] = {};
+		size_t pad = (size_t)(h.stride - h.cols);
+		if (h.rows == 0 || h.cols == 0) {
+			// No elements means no data section, and an empty matrix has no buffer to point fwrite() at.
+		}
+		else if (ok && m.getStride() == h.stride) { // same layout as Matrix2D: one write, zero padding included
+			size_t count = (size_t)((h.rows - 1) * h.stride + h.cols);
+			ok = fwrite(m.data(), sizeof(double), count, f) == count && fwrite(padding, sizeof(double), pad, f) == pad;
+		}
+		else {
+			for (size_t x = 0; ok && x < h.rows; x++) {
+				ok = fwrite(m.data() + x * m.getStride(), sizeof(double), (size_t)h.cols, f) == h.cols &&
+					fwrite(padding, sizeof(double), pad, f) == pad;
+			}
+		}
+		if (fclose(f) != 0 || !ok) throw runtime_error("Cannot write matrix file.");
+	}
+
+	Matrix2D LoadBinary(const char *path, bool verify) {
+		detail::ProfileScope profile(detail::ProfiledOp::LoadBinary, 0, 0);
+		MappedMatrix mapped(path, verify);
+		profile.setWork(0, (double)mapped.view().getSizeX() * mapped.view().getStride() * sizeof(double) * (verify ? 3 : 2));
+		ConstMatrixView src = mapped.view();
+		if (src.getStride() != detail::MatrixStride(src.getSizeY())) return Matrix2D(src); // foreign stride: row by row
+		Matrix2D result(src.getSizeX(), src.getSizeY());
+		size_t count = src.getSizeX() * src.getStride();
+		if (count) memcpy(result.data(), src.data(), count * sizeof(double)); // empty matrices have no buffer
+		return result;
+	}
+
+	MappedMatrix::MappedMatrix(const char *path, bool verify) : base(nullptr), length(0), v(nullptr, 0, 0, 0) {
+		base = detail::MapFile(path, length);
+		try {
+			v = detail::CheckMappedFile(base, length);
+			if (verify && MatrixChecksum(v) != detail::StoredChecksum(base))
+				throw runtime_error("Matrix file checksum mismatch.");
+		}
+		catch (...) {
+			detail::UnmapFile(base, length);
+			throw;
+		}
+	}
+	MappedMatrix::MappedMatrix(MappedMatrix&& src) noexcept : base(src.base), length(src.length), v(src.v) {
+		src.base = nullptr;
+		src.length = 0;
+		src.v = ConstMatrixView(nullptr, 0, 0, 0);
+	}
+	MappedMatrix& MappedMatrix::operator=(MappedMatrix&& src) noexcept {
+		swap(base, src.base);
+		swap(length, src.length);
+		swap(v, src.v);
+		return *this;
+	}
+	MappedMatrix::~MappedMatrix() {
+		detail::UnmapFile(base, length);
+	}
+
+	const char *ParseText(const char *first, const char *last, MatrixView m) {
+		size_t total = m.getSizeX() * m.getSizeY();
+		if (total == 0) return first;
+		const size_t kSerialBytes = 1 << 20;
+		size_t bytes = (size_t)(last - first);
+		size_t chunks = min(detail::ParallelWidth() * 4, bytes / kSerialBytes + 1);
+		if (chunks <= 1) {
+			if (detail::CountTokens(first, last) < total) throw invalid_argument("Not enough values in matrix input.");
+			const char *end = detail::ParseRun(first, last, m, 0, total);
+			m.markModified();
+			return end;
+		}
+		// Cut the text at whitespace so that no number straddles two chunks, count the numbers in every chunk,
+		// then let each chunk parse its numbers straight into their final positions.
+		vector<const char*> cut(chunks + 1);
+		cut[0] = first;
+		cut[chunks] = last;
+		for (size_t i = 1; i < chunks; i++) {
+			const char *p = max(cut[i - 1], first + bytes / chunks * i);
+			while (p < last && !detail::IsSpace(*p)) p++;
+			cut[i] = p;
+		}
+		vector<size_t> offset(chunks + 1, 0);
+		detail::ParallelFor(0, chunks, 1, [&](size_t lo, size_t hi) {
+			for (size_t i = lo; i < hi; i++) offset[i + 1] = detail::CountTokens(cut[i], cut[i + 1]);
+		});
+		for (size_t i = 0; i < chunks; i++) offset[i + 1] += offset[i];
+		if (offset[chunks] < total) throw invalid_argument("Not enough values in matrix input.");
+		const char *end = last;
+		detail::ParallelFor(0, chunks, 1, [&](size_t lo, size_t hi) {
+			for (size_t i = lo; i < hi; i++) {
+				if (offset[i] >= total) continue;
+				size_t count = min(offset[i + 1], total) - offset[i];
+				const char *p = detail::ParseRun(cut[i], cut[i + 1], m, offset[i], count);
+				if (offset[i] + count == total) end = p; // exactly one chunk parses the last value
+			}
+		});
+		m.markModified(); // once, here: the chunks wrote through the view from several threads
+		return end;
+	}
+}
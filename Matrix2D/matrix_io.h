@@ -0,0 +1,91 @@
+/**
+ * @file matrix_io.h
+ * Fast matrix input and output: a binary, memory-mappable file format and a parallel text parser.
+ *
+ * Binary format (version 1, little-endian):
+ *   bytes  0..3   magic "M2DB"
+ *   bytes  4..5   format version, 1
+ *   bytes  6..7   byte order mark 0xFEFF, read back as 0xFFFE on a host of the other endianness
+ *   byte   8      element type, 1 = IEEE-754 double
+ *   byte   9      layout, 0 = row-major
+ *   bytes 10..15  reserved, zero
+ *   bytes 16..23  row count
+ *   bytes 24..31  column count
+ *   bytes 32..39  row stride in elements, at least the column count
+ *   bytes 40..47  offset of the data from the start of the file, a multiple of 64
+ *   bytes 48..55  checksum of the elements (padding excluded), see MatrixChecksum()
+ *   bytes 56..63  reserved, zero
+ * The data is row-major, each row padded with zeros to the stride. Files written by SaveBinary() use the same stride
+ * as Matrix2D, so loading one is a single memcpy and mapping one gives a view that kernels can consume directly.
+ */
+
+#ifndef MATRIX2D_IO
+#define MATRIX2D_IO
+
+#include "matrix_2d.h"
+#include <cstdint>
+
+namespace m2d {
+	/** Writes a matrix or view to a binary matrix file, replacing the file if it exists.
+	* @param path: Path of the file to write.
+	* @param m: The matrix to save. Minors and transposed views are materialised first.
+	* @exception runtime_error() if the file cannot be created or written.
+	*/
+	MATRIX2D_LIB void SaveBinary(const char *path, ConstMatrixView m);
+	/** Reads a binary matrix file into a new matrix, with one memcpy out of a read-only mapping of the file.
+	* @param path: Path of the file to read.
+	* @param verify: Whether to check the stored checksum.
+	* @return The loaded matrix.
+	* @exception runtime_error() if the file cannot be opened, is not a valid matrix file or fails its checksum.
+	*/
+	MATRIX2D_LIB Matrix2D LoadBinary(const char *path, bool verify = true);
+	/** Checksum stored in binary matrix files: a 64-bit multiply-rotate hash of every row, seeded with the row index.
+	* Rows are hashed in parallel and the result does not depend on the stride or on the thread count.
+	* @param m: The matrix to hash.
+	* @return The checksum.
+	*/
+	MATRIX2D_LIB uint64_t MatrixChecksum(ConstMatrixView m);
+
+	/** Read-only matrix backed directly by a memory mapping of a binary matrix file.
+	* Nothing is read up front: pages are faulted in by the OS as they are touched. Converts to ConstMatrixView,
+	* so it can be passed to gemm(), multiplied, concatenated or copied into a Matrix2D. Views of it must not outlive it.
+	*/
+	class MATRIX2D_LIB MappedMatrix {
+		void *base; /** Start of the mapping, or nullptr once moved from. */
+		size_t length; /** Length of the mapping in bytes. */
+		ConstMatrixView v; /** The matrix inside the mapping. */
+	public:
+		/** Maps a binary matrix file.
+		* @param path: Path of the file to map.
+		* @param verify: Whether to check the stored checksum, which reads the whole file once.
+		* @exception runtime_error() if the file cannot be mapped, is not a valid matrix file or fails its checksum.
+		*/
+		explicit MappedMatrix(const char *path, bool verify = false);
+		MappedMatrix(const MappedMatrix&) = delete;
+		MappedMatrix& operator=(const MappedMatrix&) = delete;
+		/** Move constructor. The source is left as an empty 0 x 0 matrix. */
+		MappedMatrix(MappedMatrix&& src) noexcept;
+		MappedMatrix& operator=(MappedMatrix&& src) noexcept;
+		/** Unmaps the file. */
+		~MappedMatrix();
+
+		size_t getSizeX() const { return v.getSizeX(); }
+		size_t getSizeY() const { return v.getSizeY(); }
+		/** Views the mapped matrix, e.g. for use in element-wise expressions. */
+		ConstMatrixView view() const { return v; }
+		operator ConstMatrixView() const { return v; }
+	};
+
+	/** Parses whitespace-separated numbers from a memory buffer into a matrix, row by row, in parallel.
+	* Numbers are read with std::from_chars, so they must be in plain decimal or scientific notation, optionally
+	* signed; "inf" and "nan" are accepted. Anything after the last needed number is left unread.
+	* @param first: Start of the text.
+	* @param last: End of the text.
+	* @param m: The target, whose size gives the number of values to read.
+	* @return Pointer just past the last number read.
+	* @exception invalid_argument() if the text holds a malformed number or fewer numbers than m has elements.
+	*/
+	MATRIX2D_LIB const char *ParseText(const char *first, const char *last, MatrixView m);
+}
+
+#endif // MATRIX2D_IO
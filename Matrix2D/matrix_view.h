@@ -0,0 +1,235 @@
+/**
+ * @file matrix_view.h
+ * Non-owning, strided views into Matrix2D storage.
+ * A view addresses a submatrix, a single row or column, a minor (one row and one column removed) or the
+ * transpose of a matrix without copying anything. Views never own memory: they must not outlive the matrix
+ * they refer to.
+ */
+
+#ifndef MATRIX2D_VIEW
+#define MATRIX2D_VIEW
+
+#include "matrix_expr.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace m2d {
+	template <class T> class BasicMatrix;
+	template <> class BasicMatrix<double>;
+	using Matrix2D = BasicMatrix<double>;
+	class ConstMatrixView;
+	class MatrixView;
+	template <> struct IsMatrixExpr<ConstMatrixView> : std::true_type {};
+	template <> struct IsMatrixExpr<MatrixView> : std::true_type {};
+
+	namespace detail {
+		template <> struct IsExprLeaf<ConstMatrixView> : std::true_type {};
+		template <> struct IsExprLeaf<MatrixView> : std::true_type {};
+		/** Marks a view that does not hide any row or column. */
+		constexpr size_t kNoSkip = SIZE_MAX;
+		/** Maps an index in a view to the index in its source, stepping over the hidden one. */
+		inline size_t SkipIndex(size_t i, size_t skip) { return i + (i >= skip ? 1 : 0); }
+		/** Position of a hidden index relative to a new first source index, or kNoSkip if it falls before it. */
+		inline size_t RebaseSkip(size_t first, size_t skip) { return (skip == kNoSkip || skip < first) ? kNoSkip : skip - first; }
+	}
+
+	/** Read-only view of a block of a row-major matrix.
+	* Element (x, y) of the view lives at data()[x * getStride() + y] unless the view is a minor, in which case one
+	* source row and/or column is stepped over, or transposed, in which case it lives at data()[y * getStride() + x].
+	* Kernels should check isStrided() before using data() directly.
+	*/
+	class ConstMatrixView {
+	protected:
+		const double *ptr; /** Source element that appears at (0, 0) in the view, before any skipping. */
+		size_t size_x, size_y; /** Size of the view. */
+		size_t stride; /** Leading dimension of the source. */
+		size_t skip_x, skip_y; /** Source row/column (relative to ptr) hidden by a minor, or kNoSkip. */
+		bool trans; /** View element (x, y) is source element (y, x). Sizes are those of the view, skips those of the source. */
+
+		ConstMatrixView(const double *ptr, size_t size_x, size_t size_y, size_t stride, size_t skip_x, size_t skip_y, bool trans) :
+			ptr(ptr), size_x(size_x), size_y(size_y), stride(stride), skip_x(skip_x), skip_y(skip_y), trans(trans) {}
+		void checkBlock(size_t pos_x, size_t pos_y, size_t sub_size_x, size_t sub_size_y) const {
+			if (pos_x > size_x || pos_y > size_y || sub_size_x > size_x - pos_x || sub_size_y > size_y - pos_y)
+				throw std::range_error("Submatrix is out of bounds.");
+		}
+		size_t offsetOf(size_t pos_x, size_t pos_y) const {
+			if (trans) std::swap(pos_x, pos_y);
+			return detail::SkipIndex(pos_x, skip_x) * stride + detail::SkipIndex(pos_y, skip_y);
+		}
+	public:
+		/** Wraps a raw row-major buffer.
+		* @param ptr: Pointer to element (0, 0).
+		* @param size_x: Row count.
+		* @param size_y: Column count.
+		* @param stride: Leading dimension of the buffer, at least size_y.
+		*/
+		ConstMatrixView(const double *ptr, size_t size_x, size_t size_y, size_t stride) :
+			ConstMatrixView(ptr, size_x, size_y, stride, detail::kNoSkip, detail::kNoSkip, false) {}
+		/** Views a whole matrix. */
+		ConstMatrixView(const Matrix2D &m);
+
+		size_t getSizeX() const { return size_x; }
+		size_t getSizeY() const { return size_y; }
+		size_t getStride() const { return stride; }
+		bool isSquare() const { return size_x == size_y; }
+		/** Checks whether this is a plain strided block, i.e. neither a minor with a hidden row or column nor transposed.
+		* @return True if element (x, y) lives at data()[x * getStride() + y].
+		*/
+		bool isStrided() const { return skip_x == detail::kNoSkip && skip_y == detail::kNoSkip && !trans; }
+		/** Checks whether this view reads its source transposed. If so, transposed() is a view of the source itself,
+		* which kernels such as gemm() can consume directly with a transpose flag.
+		*/
+		bool isTransposed() const { return trans; }
+		/** Raw access for kernels. Only meaningful as a strided buffer when isStrided() is true. */
+		const double *data() const { return ptr; }
+		/** Checks whether any element of the source rows this view spans lies in [begin, end). */
+		bool overlaps(const double *begin, const double *end) const {
+			if (!size_x || !size_y) return false;
+			size_t rows = (trans ? size_y : size_x) + (skip_x != detail::kNoSkip);
+			size_t cols = (trans ? size_x : size_y) + (skip_y != detail::kNoSkip);
+			return ptr < end && begin < ptr + (rows - 1) * stride + cols;
+		}
+		/** Unchecked getter, for kernels and expression templates. */
+		double coeff(size_t pos_x, size_t pos_y) const { return ptr[offsetOf(pos_x, pos_y)]; }
+		/** Getter method.
+		* @exception: out_of_range() if supplied pos_x and/or pos_y are out-of-range of this view.
+		*/
+		double getAt(size_t pos_x, size_t pos_y) const {
+			if (pos_x >= size_x || pos_y >= size_y) throw std::out_of_range("Indices exceeded MatrixView range.");
+			return coeff(pos_x, pos_y);
+		}
+
+		/** Views a block of this view, defined by its top-left element and its size.
+		* @exception Throws range_error() if the block exceeds this view's range.
+		*/
+		ConstMatrixView subView(size_t pos_x, size_t pos_y, size_t sub_size_x, size_t sub_size_y) const {
+			checkBlock(pos_x, pos_y, sub_size_x, sub_size_y);
+			if (trans) std::swap(pos_x, pos_y); // source coordinates from here on
+			size_t first_x = detail::SkipIndex(pos_x, skip_x), first_y = detail::SkipIndex(pos_y, skip_y);
+			return ConstMatrixView(ptr + first_x * stride + first_y, sub_size_x, sub_size_y, stride,
+				detail::RebaseSkip(first_x, skip_x), detail::RebaseSkip(first_y, skip_y), trans);
+		}
+		/** Views one row as a 1 x n matrix. */
+		ConstMatrixView rowView(size_t pos_x) const { return subView(pos_x, 0, 1, size_y); }
+		/** Views one column as an n x 1 matrix. */
+		ConstMatrixView colView(size_t pos_y) const { return subView(0, pos_y, size_x, 1); }
+		/** Views the minor obtained by removing one row and one column, e.g. for cofactors.
+		* @exception Throws range_error() if the indices are out of range or this view is already a minor.
+		*/
+		ConstMatrixView minorView(size_t pos_x, size_t pos_y) const {
+			if (pos_x >= size_x || pos_y >= size_y) throw std::range_error("Minor indices are out of bounds.");
+			if (skip_x != detail::kNoSkip || skip_y != detail::kNoSkip) throw std::range_error("Cannot take the minor of a minor.");
+			if (trans) std::swap(pos_x, pos_y);
+			return ConstMatrixView(ptr, size_x - 1, size_y - 1, stride, pos_x, pos_y, trans);
+		}
+		/** Views the transpose of this view, without copying. Transposing twice gives back the original view. */
+		ConstMatrixView transposed() const { return ConstMatrixView(ptr, size_y, size_x, stride, skip_x, skip_y, !trans); }
+
+		/** Prints the viewed elements, space-separated. */
+		void print() const {
+			for (size_t x = 0; x < size_x; x++) {
+				for (size_t y = 0; y < size_y; y++) std::cout << coeff(x, y) << ' ';
+				std::cout << std::endl;
+			}
+		}
+		/** Computes the determinant of the viewed block through a temporary copy. See Matrix2D::det(). */
+		double det() const;
+	};
+
+	/** Mutable view of a block of a row-major matrix.
+	* Copying a MatrixView copies the handle; assigning to one writes the source's values into the viewed elements.
+	* A view of a Matrix2D moves the matrix's version on (see Matrix2D::getVersion()) when it is made and on every
+	* write through setAt() or assignment, so the matrix's cached factorisation never outlives a change. Code
+	* that writes through data() or coeffRef() must call markModified() once when it is done.
+	*/
+	class MatrixView : public ConstMatrixView {
+		uint64_t *owner_version; /** Version counter of the Matrix2D viewed, or null for a raw buffer. */
+
+		MatrixView(const ConstMatrixView &v, uint64_t *owner_version) : ConstMatrixView(v), owner_version(owner_version) {} // only for views known to be mutable
+	public:
+		MatrixView(double *ptr, size_t size_x, size_t size_y, size_t stride) :
+			ConstMatrixView(ptr, size_x, size_y, stride), owner_version(nullptr) {}
+		/** Views a whole matrix. */
+		MatrixView(Matrix2D &m);
+		MatrixView(const MatrixView&) = default;
+
+		/** Raw access for kernels. Writes through this pointer are not tracked: call markModified() after them. */
+		double *data() const { return const_cast<double*>(ptr); }
+		/** Records a change made through data() or coeffRef(), so that the viewed matrix's cached factorisation is rebuilt. */
+		void markModified() const {
+			if (owner_version) ++*owner_version;
+		}
+		/** Unchecked reference to an element, for kernels. Like data(), it is not tracked: call markModified() after
+		* writing through it.
+		*/
+		double &coeffRef(size_t pos_x, size_t pos_y) const { return data()[offsetOf(pos_x, pos_y)]; }
+		/** Setter method.
+		* @exception: out_of_range() if supplied pos_x and/or pos_y are out-of-range of this view.
+		*/
+		void setAt(size_t pos_x, size_t pos_y, double val) const {
+			if (pos_x >= size_x || pos_y >= size_y) throw std::out_of_range("Indices exceeded MatrixView range.");
+			coeffRef(pos_x, pos_y) = val;
+			markModified();
+		}
+
+		MatrixView subView(size_t pos_x, size_t pos_y, size_t sub_size_x, size_t sub_size_y) const {
+			return MatrixView(ConstMatrixView::subView(pos_x, pos_y, sub_size_x, sub_size_y), owner_version);
+		}
+		MatrixView rowView(size_t pos_x) const { return subView(pos_x, 0, 1, size_y); }
+		MatrixView colView(size_t pos_y) const { return subView(0, pos_y, size_x, 1); }
+		MatrixView minorView(size_t pos_x, size_t pos_y) const {
+			return MatrixView(ConstMatrixView::minorView(pos_x, pos_y), owner_version);
+		}
+		MatrixView transposed() const { return MatrixView(ConstMatrixView::transposed(), owner_version); }
+
+		/** Writes the values of a same-sized matrix, view or element-wise expression into the viewed elements.
+		* When this view is a plain block, the source may refer to it in any way, as in v += v.transposed(): sources
+		* that read it out of order are evaluated into a temporary first. When this view is itself transposed or a
+		* minor, the source may only read its elements through this same view.
+		* @exception Throws invalid_argument() if the sizes do not match.
+		*/
+		template <class E, class = detail::EnableIfExprs<E>>
+		const MatrixView& operator=(const E& src) const {
+			if (src.getSizeX() != size_x || src.getSizeY() != size_y)
+				throw std::invalid_argument("Cannot assign a matrix of different dimensions to a view.");
+			if (isStrided()) {
+				if (detail::ReadsReordered<E>::check(src, data(), stride, size_x, size_y)) {
+					std::vector<double> temp(size_x * size_y);
+					detail::EvaluateInto(temp.data(), size_y, src);
+					for (size_t x = 0; x < size_x; x++)
+						std::copy(temp.begin() + x * size_y, temp.begin() + (x + 1) * size_y, data() + x * stride);
+				}
+				else detail::EvaluateInto(data(), stride, src);
+			}
+			else {
+				for (size_t x = 0; x < size_x; x++)
+					for (size_t y = 0; y < size_y; y++) data()[offsetOf(x, y)] = src.coeff(x, y);
+			}
+			markModified();
+			return *this;
+		}
+		const MatrixView& operator=(const MatrixView& src) const { return operator=<ConstMatrixView>(src); }
+		template <class E, class = detail::EnableIfExprs<E>>
+		const MatrixView& operator+=(const E& expr) const { return *this = *this + expr; }
+		template <class E, class = detail::EnableIfExprs<E>>
+		const MatrixView& operator-=(const E& expr) const { return *this = *this - expr; }
+		const MatrixView& operator*=(double factor) const { return *this = *this * factor; }
+	};
+
+	namespace detail {
+		/** A view reads a buffer out of order if it overlaps it and is not that very buffer, laid out the same way. */
+		template <> struct ReadsReordered<ConstMatrixView> {
+			static bool check(const ConstMatrixView& v, const double *dst, size_t ld, size_t rows, size_t cols) {
+				if (!rows || !cols || !v.overlaps(dst, dst + (rows - 1) * ld + cols)) return false;
+				return !(v.isStrided() && v.data() == dst && v.getStride() == ld);
+			}
+		};
+		template <> struct ReadsReordered<MatrixView> : ReadsReordered<ConstMatrixView> {};
+	}
+}
+
+#endif // MATRIX2D_VIEW
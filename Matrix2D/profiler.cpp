@@ -0,0 +1,195 @@
+/**
+* @file profiler.cpp
+* Contains implementations of the operation profiler and its Chrome trace writer.
+*/
+#include "stdafx.h"
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		atomic<bool> g_profiling_enabled{ false };
+
+		// Indexed by ProfiledOp.
+		static const char *const kOperationNames[] = {
+			"multiply", "gemm", "elementwise", "transpose", "subMatrix", "concatenate", "det", "invert",
+			"LUFactorize", "LUSolve", "solve", "SolveMixedPrecision", "LUFactorizeDoolittle", "LUFactorizeCrout",
+			"InputMatrix", "SaveBinary", "LoadBinary", "spmm", "SparseLU", "SparseLU::solve",
+			"CholeskyFactorize", "LDLFactorize", "CholeskySolve", "LDLSolve", "QRFactorize", "QRMultiply", "QRSolve",
+			"LeastSquares", "adjugate", "TaskGraph::evaluate", "gemm(BlockMatrix)", "solve(BlockMatrix)"
+		};
+		static_assert(sizeof(kOperationNames) / sizeof(kOperationNames[0]) == (size_t)ProfiledOp::Count,
+			"Every profiled operation needs a name.");
+
+		// Calls kept for the trace, so that a long run cannot exhaust memory.
+		constexpr size_t kMaxTraceEvents = size_t(1) << 20;
+
+		struct TraceEvent {
+			ProfiledOp op;
+			uint32_t thread;
+			int64_t start_ns, duration_ns;
+			double flops, bytes;
+			uint64_t allocations;
+		};
+
+		struct ProfileState {
+			mutex lock;
+			OperationProfile ops[(size_t)ProfiledOp::Count];
+			vector<TraceEvent> events;
+			size_t dropped = 0;
+			ProfileState() { clear(); }
+			void clear() {
+				for (size_t i = 0; i < (size_t)ProfiledOp::Count; i++) {
+					ops[i] = OperationProfile();
+					ops[i].name = kOperationNames[i];
+					ops[i].min_ns = UINT64_MAX;
+				}
+				events.clear();
+				dropped = 0;
+			}
+		};
+		static ProfileState &State() {
+			static ProfileState state;
+			return state;
+		}
+
+		// Time since the library loaded, the zero of the trace.
+		static const chrono::steady_clock::time_point g_profile_origin = chrono::steady_clock::now();
+		static int64_t Now() {
+			return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - g_profile_origin).count();
+		}
+
+		// Small, stable per-thread ids for the trace's tid field.
+		static atomic<uint32_t> g_next_thread_id{ 1 };
+		static thread_local uint32_t t_thread_id = 0;
+		static thread_local uint64_t t_allocations = 0, t_allocated_bytes = 0;
+
+		void NoteBufferAllocation(size_t bytes) {
+			if (!g_profiling_enabled.load(memory_order_relaxed)) return;
+			t_allocations++;
+			t_allocated_bytes += bytes;
+		}
+
+		void ProfileScope::begin() {
+			allocations = t_allocations;
+			allocated_bytes = t_allocated_bytes;
+			start_ns = Now();
+		}
+
+		void ProfileScope::end() {
+			int64_t duration = max<int64_t>(Now() - start_ns, 0);
+			uint64_t allocs = t_allocations - allocations, alloc_bytes = t_allocated_bytes - allocated_bytes;
+			if (t_thread_id == 0) t_thread_id = g_next_thread_id.fetch_add(1);
+			size_t bucket = 0;
+			while (bucket + 1 < kProfileBuckets && (uint64_t(1) << (bucket + 1)) <= (uint64_t)duration) bucket++;
+
+			ProfileState &state = State();
+			lock_guard<mutex> guard(state.lock);
+			OperationProfile &p = state.ops[(size_t)op];
+			p.calls++;
+			p.total_ns += duration;
+			p.min_ns = min<uint64_t>(p.min_ns, duration);
+			p.max_ns = max<uint64_t>(p.max_ns, duration);
+			p.histogram[bucket]++;
+			p.flops += flops;
+			p.bytes += bytes;
+			p.allocations += allocs;
+			p.allocated_bytes += alloc_bytes;
+			if (state.events.size() < kMaxTraceEvents)
+				state.events.push_back({ op, t_thread_id, start_ns, duration, flops, bytes, allocs });
+			else state.dropped++;
+		}
+
+		static string ProfilePathFromEnvironment() {
+			string value;
+#ifdef _MSC_VER
+			char *buf = nullptr;
+			size_t len = 0;
+			if (_dupenv_s(&buf, &len, "M2D_PROFILE") != 0 || buf == nullptr) return value;
+			value = buf;
+			free(buf);
+#else
+			const char *buf = getenv("M2D_PROFILE");
+			if (buf != nullptr) value = buf;
+#endif
+			return value;
+		}
+
+		// Enables profiling at load time when M2D_PROFILE is set, and writes the trace there at exit.
+		static struct EnvironmentProfile {
+			string path;
+			EnvironmentProfile() : path(ProfilePathFromEnvironment()) {
+				if (!path.empty()) {
+					State();
+					g_profiling_enabled.store(true);
+				}
+			}
+			~EnvironmentProfile() {
+				if (path.empty()) return;
+				try {
+					WriteChromeTrace(path.c_str());
+				}
+				catch (exception &) {} // nowhere left to report it
+			}
+		} g_environment_profile;
+	}
+
+	void SetProfilingEnabled(bool enabled) {
+		detail::State(); // constructed before the first scope can use it
+		detail::g_profiling_enabled.store(enabled);
+	}
+
+	bool IsProfilingEnabled() {
+		return detail::g_profiling_enabled.load();
+	}
+
+	vector<OperationProfile> GetProfileSnapshot() {
+		detail::ProfileState &state = detail::State();
+		lock_guard<mutex> guard(state.lock);
+		vector<OperationProfile> result;
+		for (const OperationProfile &p : state.ops) {
+			if (p.calls) result.push_back(p);
+		}
+		return result;
+	}
+
+	void ResetProfile() {
+		detail::ProfileState &state = detail::State();
+		lock_guard<mutex> guard(state.lock);
+		state.clear();
+	}
+
+	void WriteChromeTrace(const char *path) {
+		detail::ProfileState &state = detail::State();
+		vector<detail::TraceEvent> events;
+		size_t dropped;
+		{
+			lock_guard<mutex> guard(state.lock);
+			events = state.events;
+			dropped = state.dropped;
+		}
+		FILE *f = fopen(path, "w");
+		if (!f) throw runtime_error("Cannot create trace file.");
+		bool ok = fprintf(f, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"library\":\"Matrix2D\",\"dropped_events\":%zu},"
+			"\"traceEvents\":[\n", dropped) > 0;
+		// Complete ("X") events, timestamps in microseconds as the format requires.
+		for (size_t i = 0; ok && i < events.size(); i++) {
+			const detail::TraceEvent &e = events[i];
+			ok = fprintf(f, "{\"name\":\"%s\",\"cat\":\"matrix2d\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+				"\"args\":{\"flops\":%.0f,\"bytes\":%.0f,\"allocations\":%llu}}%s\n",
+				detail::kOperationNames[(size_t)e.op], (unsigned)e.thread, e.start_ns * 1e-3, e.duration_ns * 1e-3,
+				e.flops, e.bytes, (unsigned long long)e.allocations, i + 1 < events.size() ? "," : "") > 0;
+		}
+		ok = ok && fprintf(f, "]}\n") > 0;
+		if (fclose(f) != 0 || !ok) throw runtime_error("Cannot write trace file.");
+	}
+}
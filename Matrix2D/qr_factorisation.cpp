@@ -0,0 +1,247 @@
+/**
+* @file qr_factorisation.cpp
+* Contains implementations of the blocked Householder QR factorisation and the least-squares solver built on it.
+*/
+#include "stdafx.h"
+#include "matrix_2d.h"
+#include "factor_kernels.h"
+#include "gemm_kernel.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		// Panel width. Narrower than the LU's: the panel runs at matrix-vector speed, and forming T costs jb^2 per row.
+		constexpr size_t kQrBlock = 64;
+
+		// Builds the reflector H = I - tau * v * v^T, v[0] = 1, that maps [alpha; x] to [beta; 0], as LAPACK's dlarfg.
+		// x has n elements spaced incx apart and is overwritten by v[1..n]; alpha is replaced by beta.
+		// Returns tau, 0 when x is already zero and H = I.
+		static double Reflector(double &alpha, double *x, size_t n, size_t incx) {
+			double scale = 0;
+			for (size_t i = 0; i < n; i++) scale = max(scale, fabs(x[i * incx]));
+			if (scale == 0) return 0;
+			double sum = 0;
+			for (size_t i = 0; i < n; i++) {
+				double t = x[i * incx] / scale;
+				sum += t * t;
+			}
+			double beta = -copysign(hypot(alpha, scale * sqrt(sum)), alpha);
+			double tau = (beta - alpha) / beta, s = 1 / (alpha - beta);
+			for (size_t i = 0; i < n; i++) x[i * incx] *= s;
+			alpha = beta;
+			return tau;
+		}
+
+		// Step c of an unblocked QR: builds the reflector that zeroes column c below the diagonal, then applies it to
+		// the columns right of it as w = tau * A^T * v and the rank-1 update A -= v * w^T, both sweeping A by rows.
+		// w holds n elements.
+		static void HouseholderStep(size_t m, size_t n, double *A, size_t lda, size_t c, double *tau, double *w) {
+			double *acc = A + c * lda + c;
+			double t = Reflector(*acc, acc + lda, m - c - 1, lda);
+			tau[c] = t;
+			size_t nc = n - c - 1;
+			if (t == 0 || nc == 0) return;
+			copy(acc + 1, acc + 1 + nc, w); // v[0] = 1 is implicit; beta sits in its place
+			for (size_t i = c + 1; i < m; i++) {
+				double v = A[i * lda + c];
+				const double *ri = A + i * lda + c + 1;
+				for (size_t j = 0; j < nc; j++) w[j] += v * ri[j];
+			}
+			for (size_t j = 0; j < nc; j++) {
+				w[j] *= t;
+				acc[1 + j] -= w[j];
+			}
+			ParallelFor(c + 1, m, RowGrain(nc), [&](size_t lo, size_t hi) {
+				for (size_t i = lo; i < hi; i++) {
+					double v = A[i * lda + c], *ri = A + i * lda + c + 1;
+					for (size_t j = 0; j < nc; j++) ri[j] -= v * w[j];
+				}
+			});
+		}
+
+		// Unblocked QR of an m x n panel, one reflector per column.
+		static void PanelQR(size_t m, size_t n, double *A, size_t lda, double *tau) {
+			vector<double> w(n);
+			for (size_t c = 0; c < min(m, n); c++) HouseholderStep(m, n, A, lda, c, tau, w.data());
+		}
+
+		// Compact WY form of the k reflectors stored below the diagonal of an m x k panel: H_0 * ... * H_k-1 =
+		// I - V * T * V^T. V receives the reflectors as a dense m x k block (unit diagonal, zeros above) for the GEMMs,
+		// T the k x k upper triangular factor. Column c of T is -tau_c * T(0:c, 0:c) * V(:, 0:c)^T * v_c, the inner
+		// products all coming from one GEMM, V^T * V.
+		static void FormBlockReflector(size_t m, size_t k, const double *A, size_t lda, const double *tau,
+			Matrix2D &V, Matrix2D &T) {
+			V = Matrix2D(m, k);
+			for (size_t i = 0; i < m; i++) {
+				const double *a = A + i * lda;
+				double *v = V.row(i);
+				for (size_t c = 0; c < k; c++) v[c] = c < i ? a[c] : c == i ? 1 : 0;
+			}
+			Matrix2D G(k, k);
+			Dgemm(true, false, k, k, m, 1.0, V.data(), V.getStride(), V.data(), V.getStride(), 0.0, G.data(), G.getStride());
+			T = Matrix2D(k, k);
+			for (size_t c = 0; c < k; c++) {
+				for (size_t i = 0; i < c; i++) {
+					const double *ti = T.row(i);
+					double s = 0;
+					for (size_t l = i; l < c; l++) s += ti[l] * G.row(l)[c];
+					T.row(i)[c] = -tau[c] * s;
+				}
+				T.row(c)[c] = tau[c];
+			}
+		}
+
+		// C = (I - V * T * V^T) * C, or its transpose when transpose is set; C is m x n. Three GEMMs.
+		static void ApplyBlockReflector(bool transpose, size_t m, size_t n, const Matrix2D &V, const Matrix2D &T,
+			double *C, size_t ldc) {
+			size_t k = V.getSizeY();
+			Matrix2D W(k, n), TW(k, n);
+			Dgemm(true, false, k, n, m, 1.0, V.data(), V.getStride(), C, ldc, 0.0, W.data(), W.getStride());
+			Dgemm(transpose, false, k, n, k, 1.0, T.data(), T.getStride(), W.data(), W.getStride(), 0.0,
+				TW.data(), TW.getStride());
+			Dgemm(false, false, m, n, k, -1.0, V.data(), V.getStride(), TW.data(), TW.getStride(), 1.0, C, ldc);
+		}
+
+		// Blocked Householder QR: factorise a panel, then apply its reflectors to the trailing columns in compact WY
+		// form, so that most of the work runs on the GEMM engine.
+		static void Geqrf(size_t m, size_t n, double *A, size_t lda, double *tau) {
+			size_t k = min(m, n);
+			if (k <= kQrBlock) {
+				PanelQR(m, n, A, lda, tau);
+				return;
+			}
+			Matrix2D V(1, 1), T(1, 1);
+			for (size_t j = 0; j < k; j += kQrBlock) {
+				size_t jb = min(kQrBlock, k - j);
+				double *panel = A + j * lda + j;
+				PanelQR(m - j, jb, panel, lda, tau + j);
+				if (j + jb < n) {
+					FormBlockReflector(m - j, jb, panel, lda, tau + j, V, T);
+					ApplyBlockReflector(true, m - j, n - j - jb, V, T, panel + jb, lda);
+				}
+			}
+		}
+
+		void Geqp3(size_t m, size_t n, double *A, size_t lda, double *tau, size_t *perm) {
+			size_t k = min(m, n);
+			vector<double> norm(n), norm_ref(n), w(n);
+			auto column_norm = [&](size_t j, size_t r0) {
+				double sum = 0;
+				for (size_t i = r0; i < m; i++) sum += A[i * lda + j] * A[i * lda + j];
+				return sqrt(sum);
+			};
+			for (size_t j = 0; j < n; j++) {
+				perm[j] = j;
+				norm[j] = norm_ref[j] = column_norm(j, 0);
+			}
+			double tol = sqrt(numeric_limits<double>::epsilon());
+			for (size_t c = 0; c < k; c++) {
+				size_t p = max_element(norm.begin() + c, norm.end()) - norm.begin();
+				if (p != c) {
+					for (size_t i = 0; i < m; i++) swap(A[i * lda + c], A[i * lda + p]);
+					swap(perm[c], perm[p]);
+					swap(norm[c], norm[p]);
+					swap(norm_ref[c], norm_ref[p]);
+				}
+				HouseholderStep(m, n, A, lda, c, tau, w.data());
+				// Downdate the remaining column norms by the entries just moved into row c, recomputing those that
+				// have lost too many digits to cancellation, as LAPACK's dlaqp2 does.
+				for (size_t j = c + 1; j < n; j++) {
+					if (norm[j] == 0) continue;
+					double r = fabs(A[c * lda + j]) / norm[j];
+					double f = max(0.0, (1 - r) * (1 + r));
+					double ratio = norm[j] / norm_ref[j];
+					if (f * ratio * ratio <= tol) norm[j] = norm_ref[j] = column_norm(j, c + 1);
+					else norm[j] *= sqrt(f);
+				}
+			}
+		}
+
+		void Ormqr(bool transpose, size_t m, size_t r, size_t k, const double *QR, size_t ldq, const double *tau,
+			double *B, size_t ldb) {
+			Matrix2D V(1, 1), T(1, 1);
+			size_t blocks = (k + kQrBlock - 1) / kQrBlock;
+			for (size_t b = 0; b < blocks; b++) {
+				size_t j = (transpose ? b : blocks - 1 - b) * kQrBlock, jb = min(kQrBlock, k - j);
+				FormBlockReflector(m - j, jb, QR + j * ldq + j, ldq, tau + j, V, T);
+				ApplyBlockReflector(transpose, m - j, r, V, T, B + j * ldb, ldb);
+			}
+		}
+	}
+
+	vector<double> QRFactorize(MatrixView A) {
+		size_t m = A.getSizeX(), n = A.getSizeY(), k = min(m, n);
+		detail::ProfileScope profile(detail::ProfiledOp::QRFactorize,
+			2.0 * m * n * k - (double)(m + n) * k * k + 2.0 / 3.0 * k * k * k, 2.0 * m * n * sizeof(double));
+		vector<double> tau(k);
+		if (A.isStrided()) {
+			detail::Geqrf(m, n, A.data(), A.getStride(), tau.data());
+		}
+		else { // a minor: factorise a strided copy, then write it back
+			Matrix2D work(A);
+			detail::Geqrf(m, n, work.data(), work.getStride(), tau.data());
+			A = work;
+		}
+		return tau;
+	}
+
+	void QRMultiply(ConstMatrixView QR, const vector<double> &tau, MatrixView B, bool transpose) {
+		size_t m = QR.getSizeX(), k = tau.size();
+		if (k != min(m, QR.getSizeY()) || B.getSizeX() != m)
+			throw invalid_argument("Cannot multiply by Q: the factorisation must match tau and the rows of B.");
+		if (!QR.isStrided()) {
+			QRMultiply(Matrix2D(QR), tau, B, transpose);
+			return;
+		}
+		if (!B.isStrided()) {
+			Matrix2D X(B);
+			QRMultiply(QR, tau, X, transpose);
+			B = X;
+			return;
+		}
+		size_t r = B.getSizeY();
+		detail::ProfileScope profile(detail::ProfiledOp::QRMultiply, (4.0 * m - 2.0 * k) * k * r,
+			((double)m * k + 2.0 * m * r) * sizeof(double));
+		detail::Ormqr(transpose, m, r, k, QR.data(), QR.getStride(), tau.data(), B.data(), B.getStride());
+	}
+
+	Matrix2D QRSolve(ConstMatrixView QR, const vector<double> &tau, ConstMatrixView B) {
+		size_t m = QR.getSizeX(), n = QR.getSizeY();
+		if (m < n) throw invalid_argument("Cannot solve: the matrix must have at least as many rows as columns.");
+		if (!QR.isStrided()) return QRSolve(Matrix2D(QR), tau, B);
+		// Rounding leaves a tiny diagonal entry rather than an exact zero when columns are dependent, so compare
+		// against the largest one, scaled by n * eps as LAPACK's rank estimates are.
+		double largest = 0;
+		for (size_t i = 0; i < n; i++) largest = max(largest, fabs(QR.coeff(i, i)));
+		double tolerance = largest * numeric_limits<double>::epsilon() * (double)n;
+		for (size_t i = 0; i < n; i++) {
+			if (!(fabs(QR.coeff(i, i)) > tolerance)) throw range_error("Cannot solve: the matrix is rank deficient.");
+		}
+		size_t r = B.getSizeY();
+		detail::ProfileScope profile(detail::ProfiledOp::QRSolve, (4.0 * m - n) * n * r,
+			((double)m * n + 2.0 * m * r) * sizeof(double));
+		// X = R^-1 * (Q^T * B)(0:n), whose remaining rows hold the residual.
+		Matrix2D Y(B);
+		QRMultiply(QR, tau, Y, true);
+		detail::DtrsmUpper(n, r, QR.data(), QR.getStride(), Y.data(), Y.getStride());
+		return Matrix2D(Y.subView(0, 0, n, r));
+	}
+
+	Matrix2D LeastSquares(ConstMatrixView A, ConstMatrixView B) {
+		size_t m = A.getSizeX(), n = A.getSizeY();
+		if (m < n) throw invalid_argument("Cannot solve: the matrix must have at least as many rows as columns.");
+		if (B.getSizeX() != m) throw invalid_argument("Cannot solve: A and B must have the same row count.");
+		double r = (double)B.getSizeY();
+		detail::ProfileScope profile(detail::ProfiledOp::LeastSquares,
+			2.0 * m * n * n - 2.0 / 3.0 * n * n * n + (4.0 * m - n) * n * r, (2.0 * m * n + 2.0 * m * r) * sizeof(double));
+		Matrix2D QR(A);
+		vector<double> tau = QRFactorize(QR);
+		return QRSolve(QR, tau, B);
+	}
+}
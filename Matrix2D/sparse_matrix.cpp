@@ -0,0 +1,452 @@
+/**
+* @file sparse_matrix.cpp
+* Contains implementations of the compressed sparse matrix, its products, orderings and LU factorisation.
+*/
+#include "stdafx.h"
+#include "sparse_matrix.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include <algorithm>
+#include <numeric>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		constexpr size_t kNoIndex = SIZE_MAX;
+	}
+
+	// Constructors
+	SparseMatrix::SparseMatrix(size_t size_x, size_t size_y) :
+		size_x(size_x), size_y(size_y), row_ptr(size_x + 1, 0) {}
+
+	SparseMatrix::SparseMatrix(size_t size_x, size_t size_y, vector<size_t> row_ptr, vector<size_t> col_idx, vector<double> vals) :
+		size_x(size_x), size_y(size_y), row_ptr(move(row_ptr)), col_idx(move(col_idx)), vals(move(vals)) {
+		if (this->row_ptr.size() != size_x + 1 || this->row_ptr[0] != 0 || this->row_ptr[size_x] != this->col_idx.size()
+			|| this->col_idx.size() != this->vals.size())
+			throw invalid_argument("Inconsistent CSR arrays.");
+		for (size_t i = 0; i < size_x; i++) {
+			size_t begin = this->row_ptr[i], end = this->row_ptr[i + 1];
+			if (begin > end || end > this->col_idx.size()) throw invalid_argument("Inconsistent CSR arrays.");
+			for (size_t k = begin; k < end; k++) {
+				if (this->col_idx[k] >= size_y || (k > begin && this->col_idx[k] <= this->col_idx[k - 1]))
+					throw invalid_argument("CSR column indices must be in range and strictly increasing within a row.");
+			}
+		}
+	}
+
+	SparseMatrix::SparseMatrix(size_t size_x, size_t size_y, const vector<Triplet> &entries) :
+		size_x(size_x), size_y(size_y), row_ptr(size_x + 1, 0) {
+		// Counting sort by row, then sort each row by column and sum duplicates.
+		for (const Triplet &t : entries) {
+			if (t.row >= size_x || t.col >= size_y) throw out_of_range("Indices exceeded SparseMatrix range.");
+			row_ptr[t.row + 1]++;
+		}
+		partial_sum(row_ptr.begin(), row_ptr.end(), row_ptr.begin());
+		vector<pair<size_t, double>> sorted(entries.size());
+		vector<size_t> next(row_ptr.begin(), row_ptr.end() - 1);
+		for (const Triplet &t : entries) sorted[next[t.row]++] = { t.col, t.value };
+		col_idx.reserve(entries.size());
+		vals.reserve(entries.size());
+		size_t begin = 0;
+		for (size_t i = 0; i < size_x; i++) {
+			size_t end = row_ptr[i + 1];
+			sort(sorted.begin() + begin, sorted.begin() + end,
+				[](const pair<size_t, double> &a, const pair<size_t, double> &b) { return a.first < b.first; });
+			row_ptr[i] = col_idx.size();
+			for (size_t k = begin; k < end; k++) {
+				if (k > begin && sorted[k].first == col_idx.back()) vals.back() += sorted[k].second;
+				else {
+					col_idx.push_back(sorted[k].first);
+					vals.push_back(sorted[k].second);
+				}
+			}
+			begin = end;
+		}
+		row_ptr[size_x] = col_idx.size();
+	}
+
+	SparseMatrix::SparseMatrix(ConstMatrixView dense, double drop_tolerance) :
+		SparseMatrix(dense.getSizeX(), dense.getSizeY()) {
+		for (size_t x = 0; x < size_x; x++) {
+			for (size_t y = 0; y < size_y; y++) {
+				double v = dense.coeff(x, y);
+				if (fabs(v) > drop_tolerance) {
+					col_idx.push_back(y);
+					vals.push_back(v);
+				}
+			}
+			row_ptr[x + 1] = col_idx.size();
+		}
+	}
+
+	// Element access and conversion
+	double SparseMatrix::coeff(size_t pos_x, size_t pos_y) const {
+		auto first = col_idx.begin() + row_ptr[pos_x], last = col_idx.begin() + row_ptr[pos_x + 1];
+		auto it = lower_bound(first, last, pos_y);
+		return (it != last && *it == pos_y) ? vals[it - col_idx.begin()] : 0.0;
+	}
+	double SparseMatrix::getAt(size_t pos_x, size_t pos_y) const {
+		if (pos_x >= size_x || pos_y >= size_y) throw out_of_range("Indices exceeded SparseMatrix range.");
+		return coeff(pos_x, pos_y);
+	}
+	Matrix2D SparseMatrix::toDense() const {
+		Matrix2D result(size_x, size_y);
+		for (size_t x = 0; x < size_x; x++) {
+			double *r = result.row(x);
+			for (size_t k = row_ptr[x]; k < row_ptr[x + 1]; k++) r[col_idx[k]] = vals[k];
+		}
+		return result;
+	}
+	SparseMatrix SparseMatrix::transposed() const {
+		vector<size_t> t_ptr(size_y + 1, 0), t_idx(col_idx.size());
+		vector<double> t_vals(vals.size());
+		for (size_t c : col_idx) t_ptr[c + 1]++;
+		partial_sum(t_ptr.begin(), t_ptr.end(), t_ptr.begin());
+		vector<size_t> next(t_ptr.begin(), t_ptr.end() - 1);
+		for (size_t x = 0; x < size_x; x++) { // rows in order, so each transposed row comes out sorted
+			for (size_t k = row_ptr[x]; k < row_ptr[x + 1]; k++) {
+				size_t dst = next[col_idx[k]]++;
+				t_idx[dst] = x;
+				t_vals[dst] = vals[k];
+			}
+		}
+		return SparseMatrix(size_y, size_x, move(t_ptr), move(t_idx), move(t_vals));
+	}
+
+	// Bool checks
+	bool SparseMatrix::isUpperTriangular() const {
+		if (!isSquare()) return false;
+		for (size_t x = 0; x < size_x; x++) {
+			for (size_t k = row_ptr[x]; k < row_ptr[x + 1] && col_idx[k] < x; k++) {
+				if (vals[k] != 0) return false;
+			}
+		}
+		return true;
+	}
+	bool SparseMatrix::isLowerTriangular() const {
+		if (!isSquare()) return false;
+		for (size_t x = 0; x < size_x; x++) {
+			for (size_t k = row_ptr[x + 1]; k-- > row_ptr[x] && col_idx[k] > x;) {
+				if (vals[k] != 0) return false;
+			}
+		}
+		return true;
+	}
+	bool SparseMatrix::isDiagonal() const {
+		if (!isSquare()) return false;
+		for (size_t x = 0; x < size_x; x++) {
+			for (size_t k = row_ptr[x]; k < row_ptr[x + 1]; k++) {
+				if (col_idx[k] != x && vals[k] != 0) return false;
+			}
+		}
+		return true;
+	}
+
+	bool SparseMatrix::isDiagonallyDominant() const {
+		if (!isSquare()) return false;
+		for (size_t x = 0; x < size_x; x++) {
+			double row_sum = 0, diag = 0;
+			for (size_t k = row_ptr[x]; k < row_ptr[x + 1]; k++) {
+				if (col_idx[k] == x) diag = fabs(vals[k]);
+				else row_sum += fabs(vals[k]);
+			}
+			if (row_sum >= diag) return false;
+		}
+		return true;
+	}
+
+	// Products
+	void spmm(double alpha, const SparseMatrix &A, ConstMatrixView B, double beta, MatrixView C) {
+		if (A.getSizeY() != B.getSizeX() || C.getSizeX() != A.getSizeX() || C.getSizeY() != B.getSizeY())
+			throw invalid_argument("Cannot multiply these matrices: incompatible dimensions.");
+		if (!B.isStrided()) {
+			spmm(alpha, A, Matrix2D(B), beta, C);
+			return;
+		}
+		if (!C.isStrided()) {
+			Matrix2D tmp(C);
+			spmm(alpha, A, B, beta, tmp);
+			C = tmp;
+			return;
+		}
+		const vector<size_t> &row_ptr = A.rowPointers(), &col_idx = A.columnIndices();
+		const vector<double> &vals = A.values();
+		size_t rows = A.getSizeX(), r = B.getSizeY(), nnz = A.getNonZeroCount();
+		const double *b = B.data();
+		double *c = C.data();
+		size_t ldb = B.getStride(), ldc = C.getStride();
+		detail::ProfileScope profile(detail::ProfiledOp::SparseProduct, 2.0 * nnz * r,
+			(nnz * (sizeof(double) + sizeof(size_t)) + (double)rows * sizeof(size_t)) + (double)(B.getSizeX() + 2 * rows) * r * sizeof(double));
+
+		// Chunks hold roughly equal numbers of nonzeros rather than of rows, so skewed rows do not unbalance threads.
+		size_t work = (nnz + rows) * r;
+		size_t chunks = work < 16384 ? 1 : min(rows, detail::ParallelWidth() * 4);
+		vector<size_t> bounds(chunks + 1, rows);
+		for (size_t t = 0; t < chunks; t++)
+			bounds[t] = lower_bound(row_ptr.begin(), row_ptr.end() - 1, nnz / chunks * t) - row_ptr.begin();
+		detail::ParallelFor(0, chunks, 1, [&](size_t lo, size_t hi) {
+			for (size_t i = bounds[lo]; i < bounds[hi]; i++) {
+				double *ci = c + i * ldc;
+				if (beta == 0) fill_n(ci, r, 0.0);
+				else if (beta != 1) for (size_t j = 0; j < r; j++) ci[j] *= beta;
+				if (r == 1) { // SpMV: one dot product per row
+					double sum = 0;
+					for (size_t k = row_ptr[i]; k < row_ptr[i + 1]; k++) sum += vals[k] * b[col_idx[k] * ldb];
+					ci[0] += alpha * sum;
+				}
+				else {
+					for (size_t k = row_ptr[i]; k < row_ptr[i + 1]; k++) {
+						double a = alpha * vals[k];
+						const double *bk = b + col_idx[k] * ldb;
+						for (size_t j = 0; j < r; j++) ci[j] += a * bk[j];
+					}
+				}
+			}
+		});
+	}
+
+	Matrix2D operator*(const SparseMatrix &A, ConstMatrixView B) {
+		Matrix2D result(A.getSizeX(), B.getSizeY());
+		spmm(1.0, A, B, 0.0, result);
+		return result;
+	}
+
+	// Orderings
+	namespace detail {
+		// Breadth-first search from start over one connected component. Fills order with the nodes reached, level by
+		// level, sets last_begin to the index in order where the deepest level starts, and returns the number of
+		// levels. level must be kNoIndex for every node of the component on entry, and is restored on return.
+		static size_t LevelStructure(const vector<size_t> &adj_ptr, const vector<size_t> &adj, size_t start,
+			vector<size_t> &level, vector<size_t> &order, size_t &last_begin) {
+			order.assign(1, start);
+			level[start] = 0;
+			for (size_t head = 0; head < order.size(); head++) {
+				size_t v = order[head];
+				for (size_t k = adj_ptr[v]; k < adj_ptr[v + 1]; k++) {
+					if (level[adj[k]] == kNoIndex) {
+						level[adj[k]] = level[v] + 1;
+						order.push_back(adj[k]);
+					}
+				}
+			}
+			size_t deepest = level[order.back()];
+			last_begin = order.size();
+			while (last_begin > 0 && level[order[last_begin - 1]] == deepest) last_begin--;
+			for (size_t v : order) level[v] = kNoIndex;
+			return deepest + 1;
+		}
+	}
+
+	vector<size_t> ReverseCuthillMcKee(const SparseMatrix &A) {
+		if (!A.isSquare()) throw invalid_argument("Cannot order non-square matrices.");
+		size_t n = A.getSizeX();
+		// Adjacency of the pattern of A + A^T, without the diagonal: the union of row i of A and row i of A^T.
+		SparseMatrix At = A.transposed();
+		vector<size_t> adj_ptr(n + 1, 0), adj;
+		adj.reserve(2 * A.getNonZeroCount());
+		for (size_t i = 0; i < n; i++) {
+			auto a = A.columnIndices().begin(), t = At.columnIndices().begin();
+			size_t before = adj.size();
+			set_union(a + A.rowPointers()[i], a + A.rowPointers()[i + 1],
+				t + At.rowPointers()[i], t + At.rowPointers()[i + 1], back_inserter(adj));
+			adj.erase(remove(adj.begin() + before, adj.end(), i), adj.end());
+			adj_ptr[i + 1] = adj.size();
+		}
+		auto degree = [&](size_t v) { return adj_ptr[v + 1] - adj_ptr[v]; };
+
+		vector<size_t> by_degree(n);
+		iota(by_degree.begin(), by_degree.end(), 0);
+		stable_sort(by_degree.begin(), by_degree.end(), [&](size_t a, size_t b) { return degree(a) < degree(b); });
+		vector<size_t> perm, level(n, detail::kNoIndex), component, scratch;
+		vector<bool> numbered(n, false);
+		perm.reserve(n);
+		size_t next_start = 0;
+		while (perm.size() < n) {
+			while (numbered[by_degree[next_start]]) next_start++;
+			// Pseudo-peripheral start: hop to a minimum-degree node of the deepest level while the depth keeps growing.
+			size_t start = by_degree[next_start], last_begin, candidate_begin;
+			size_t depth = detail::LevelStructure(adj_ptr, adj, start, level, component, last_begin);
+			for (;;) {
+				size_t candidate = *min_element(component.begin() + last_begin, component.end(),
+					[&](size_t a, size_t b) { return degree(a) < degree(b); });
+				size_t candidate_depth = detail::LevelStructure(adj_ptr, adj, candidate, level, scratch, candidate_begin);
+				if (candidate_depth <= depth) break;
+				start = candidate;
+				depth = candidate_depth;
+				component.swap(scratch);
+				last_begin = candidate_begin;
+			}
+			// Cuthill-McKee numbering: breadth-first, visiting each node's unnumbered neighbours by increasing degree.
+			size_t head = perm.size();
+			perm.push_back(start);
+			numbered[start] = true;
+			for (; head < perm.size(); head++) {
+				size_t v = perm[head], first = perm.size();
+				for (size_t k = adj_ptr[v]; k < adj_ptr[v + 1]; k++) {
+					if (!numbered[adj[k]]) {
+						numbered[adj[k]] = true;
+						perm.push_back(adj[k]);
+					}
+				}
+				stable_sort(perm.begin() + first, perm.end(), [&](size_t a, size_t b) { return degree(a) < degree(b); });
+			}
+		}
+		reverse(perm.begin(), perm.end());
+		return perm;
+	}
+
+	// Sparse LU
+	namespace detail {
+		// Depth-first search from row j in the graph of the L factored so far, where row i, once eliminated at step
+		// pinv[i], points at the rows of L(:, pinv[i]). Pushes the rows reached onto xi[top - 1], xi[top - 2], ... in
+		// reverse postorder, which is a topological order for the sparse triangular solve, and returns the new top.
+		static size_t Reach(size_t j, size_t top, const vector<size_t> &l_ptr, const vector<size_t> &l_idx,
+			const vector<size_t> &pinv, vector<size_t> &xi, vector<size_t> &stack, vector<size_t> &next, vector<bool> &marked) {
+			size_t depth = 1;
+			stack[0] = j;
+			while (depth > 0) {
+				j = stack[depth - 1];
+				size_t col = pinv[j];
+				if (!marked[j]) {
+					marked[j] = true;
+					next[depth - 1] = col == kNoIndex ? 0 : l_ptr[col] + 1; // skip the unit diagonal
+				}
+				size_t end = col == kNoIndex ? 0 : l_ptr[col + 1];
+				bool done = true;
+				for (size_t p = next[depth - 1]; p < end; p++) {
+					size_t i = l_idx[p];
+					if (marked[i]) continue;
+					next[depth - 1] = p + 1; // resume here once i is finished
+					stack[depth++] = i;
+					done = false;
+					break;
+				}
+				if (done) {
+					depth--;
+					xi[--top] = j;
+				}
+			}
+			return top;
+		}
+	}
+
+	SparseLU::SparseLU(const SparseMatrix &A, SparseOrdering ordering, double pivot_threshold) : n(A.getSizeX()) {
+		if (!A.isSquare()) throw invalid_argument("Cannot factorize non-square matrices.");
+		detail::ProfileScope profile(detail::ProfiledOp::SparseLU, 0, 0);
+		double flops = 0;
+		if (ordering == SparseOrdering::ReverseCuthillMcKee) col_perm = ReverseCuthillMcKee(A);
+		else {
+			col_perm.resize(n);
+			iota(col_perm.begin(), col_perm.end(), 0);
+		}
+		SparseMatrix At = A.transposed(); // row j of A^T is column j of A
+		const vector<size_t> &a_ptr = At.rowPointers(), &a_idx = At.columnIndices();
+		const vector<double> &a_val = At.values();
+
+		vector<size_t> pinv(n, detail::kNoIndex), xi(n), stack(n), next(n);
+		vector<double> x(n, 0.0);
+		vector<bool> marked(n, false);
+		size_t guess = 4 * A.getNonZeroCount() + n;
+		l_idx.reserve(guess); l_val.reserve(guess);
+		u_idx.reserve(guess); u_val.reserve(guess);
+		l_ptr.assign(1, 0);
+		u_ptr.assign(1, 0);
+		for (size_t k = 0; k < n; k++) {
+			size_t col = col_perm[k];
+			// Nonzero pattern of x = L \ A(:, col), in topological order in xi[top, n).
+			size_t top = n;
+			for (size_t p = a_ptr[col]; p < a_ptr[col + 1]; p++) {
+				if (!marked[a_idx[p]]) top = detail::Reach(a_idx[p], top, l_ptr, l_idx, pinv, xi, stack, next, marked);
+			}
+			for (size_t p = top; p < n; p++) marked[xi[p]] = false;
+			// Numeric sparse triangular solve, touching only the pattern.
+			for (size_t p = a_ptr[col]; p < a_ptr[col + 1]; p++) x[a_idx[p]] = a_val[p];
+			for (size_t p = top; p < n; p++) {
+				size_t j = xi[p], J = pinv[j];
+				if (J == detail::kNoIndex) continue;
+				double xj = x[j];
+				flops += 2.0 * (l_ptr[J + 1] - l_ptr[J] - 1);
+				for (size_t q = l_ptr[J] + 1; q < l_ptr[J + 1]; q++) x[l_idx[q]] -= l_val[q] * xj;
+			}
+			// Rows already eliminated go to U; the largest of the others is the pivot candidate.
+			size_t ipiv = detail::kNoIndex;
+			double best = 0;
+			for (size_t p = top; p < n; p++) {
+				size_t i = xi[p];
+				if (pinv[i] == detail::kNoIndex) {
+					if (fabs(x[i]) > best) {
+						best = fabs(x[i]);
+						ipiv = i;
+					}
+				}
+				else {
+					u_idx.push_back(pinv[i]);
+					u_val.push_back(x[i]);
+				}
+			}
+			if (ipiv == detail::kNoIndex) throw range_error("Cannot factorize: the matrix is singular.");
+			// Threshold pivoting: keep the diagonal of the ordered matrix when it is large enough.
+			if (pinv[col] == detail::kNoIndex && fabs(x[col]) >= pivot_threshold * best) ipiv = col;
+			double pivot = x[ipiv];
+			u_idx.push_back(k);
+			u_val.push_back(pivot);
+			pinv[ipiv] = k;
+			l_idx.push_back(ipiv);
+			l_val.push_back(1.0);
+			for (size_t p = top; p < n; p++) {
+				size_t i = xi[p];
+				if (pinv[i] == detail::kNoIndex) {
+					l_idx.push_back(i);
+					l_val.push_back(x[i] / pivot);
+				}
+				x[i] = 0;
+			}
+			l_ptr.push_back(l_idx.size());
+			u_ptr.push_back(u_idx.size());
+		}
+		for (size_t &i : l_idx) i = pinv[i]; // L's rows, in pivot order
+		row_perm = move(pinv);
+		profile.setWork(flops + (double)l_idx.size(),
+			(A.getNonZeroCount() * 2.0 + l_idx.size() + u_idx.size()) * (sizeof(double) + sizeof(size_t)));
+	}
+
+	void SparseLU::solveInPlace(MatrixView B) const {
+		if (B.getSizeX() != n) throw invalid_argument("Cannot solve: B must have as many rows as the factorised matrix.");
+		if (!B.isStrided()) {
+			Matrix2D X(B);
+			solveInPlace(X);
+			B = X;
+			return;
+		}
+		double *b = B.data();
+		size_t ldb = B.getStride();
+		size_t work = getFactorNonZeroCount() + n;
+		detail::ProfileScope profile(detail::ProfiledOp::SparseSolve, 2.0 * work * B.getSizeY(),
+			work * (sizeof(double) + sizeof(size_t)) + 2.0 * n * B.getSizeY() * sizeof(double));
+		detail::ParallelFor(0, B.getSizeY(), max<size_t>(1, 16384 / work), [&](size_t lo, size_t hi) {
+			vector<double> x(n);
+			for (size_t c = lo; c < hi; c++) {
+				for (size_t i = 0; i < n; i++) x[row_perm[i]] = b[i * ldb + c];
+				for (size_t j = 0; j < n; j++) { // L, unit diagonal first in each column
+					double xj = x[j];
+					if (xj == 0) continue;
+					for (size_t p = l_ptr[j] + 1; p < l_ptr[j + 1]; p++) x[l_idx[p]] -= l_val[p] * xj;
+				}
+				for (size_t j = n; j-- > 0;) { // U, diagonal last in each column
+					x[j] /= u_val[u_ptr[j + 1] - 1];
+					double xj = x[j];
+					if (xj == 0) continue;
+					for (size_t p = u_ptr[j]; p < u_ptr[j + 1] - 1; p++) x[u_idx[p]] -= u_val[p] * xj;
+				}
+				for (size_t k = 0; k < n; k++) b[col_perm[k] * ldb + c] = x[k];
+			}
+		});
+	}
+
+	Matrix2D SparseLU::solve(ConstMatrixView B) const {
+		Matrix2D X(B);
+		solveInPlace(X);
+		return X;
+	}
+}
@@ -0,0 +1,143 @@
+/**
+ * @file sparse_matrix.h
+ * Interface to compressed sparse matrices, whose memory and running time scale with the number of nonzeros
+ * instead of size_x * size_y: conversion from and to Matrix2D, parallel sparse-dense products, a bandwidth-reducing
+ * ordering and a left-looking sparse LU.
+ */
+
+#ifndef MATRIX2D_SPARSE
+#define MATRIX2D_SPARSE
+
+#include "matrix_2d.h"
+
+namespace m2d {
+	/** One nonzero, for building sparse matrices in any order. */
+	struct Triplet {
+		size_t row, col;
+		double value;
+	};
+
+	/** Sparse matrix in compressed sparse row (CSR) layout.
+	* The nonzeros of row i are values()[k] for k in [rowPointers()[i], rowPointers()[i + 1]), in column
+	* columnIndices()[k]; columns are strictly increasing within a row. The CSR arrays of transposed() are the
+	* compressed sparse column (CSC) arrays of this matrix, which is how the column-oriented sparse LU reads it.
+	*/
+	class MATRIX2D_LIB SparseMatrix {
+		size_t size_x, size_y; /** Size of this matrix. */
+		vector<size_t> row_ptr; /** size_x + 1 offsets into col_idx and vals. */
+		vector<size_t> col_idx; /** Column of each nonzero. */
+		vector<double> vals; /** Value of each nonzero. */
+	public:
+		/** Creates an all-zero matrix.
+		* @param size_x: Row count.
+		* @param size_y: Column count.
+		*/
+		SparseMatrix(size_t size_x, size_t size_y);
+		/** Takes over ready-made CSR arrays.
+		* @exception invalid_argument() if the arrays are inconsistent, out of range or not sorted within a row.
+		*/
+		SparseMatrix(size_t size_x, size_t size_y, vector<size_t> row_ptr, vector<size_t> col_idx, vector<double> vals);
+		/** Builds a matrix from nonzeros given in any order. Duplicate entries are summed.
+		* @exception out_of_range() if an entry lies outside the matrix.
+		*/
+		SparseMatrix(size_t size_x, size_t size_y, const vector<Triplet> &entries);
+		/** Compresses a dense matrix, dropping every element whose magnitude is at most drop_tolerance.
+		* @param dense: The matrix or view to compress.
+		* @param drop_tolerance: Elements with |a| <= drop_tolerance are not stored. 0 drops exact zeros only.
+		*/
+		explicit SparseMatrix(ConstMatrixView dense, double drop_tolerance = 0);
+
+		size_t getSizeX() const { return size_x; }
+		size_t getSizeY() const { return size_y; }
+		bool isSquare() const { return size_x == size_y; }
+		/** Number of stored nonzeros. */
+		size_t getNonZeroCount() const { return vals.size(); }
+		const vector<size_t> &rowPointers() const { return row_ptr; }
+		const vector<size_t> &columnIndices() const { return col_idx; }
+		const vector<double> &values() const { return vals; }
+		/** Unchecked element lookup, by binary search within the row.
+		* @return The stored value, or 0 if (pos_x, pos_y) is not stored.
+		*/
+		double coeff(size_t pos_x, size_t pos_y) const;
+		/** Range-checked element lookup.
+		* @exception out_of_range() if the indices are out of range.
+		*/
+		double getAt(size_t pos_x, size_t pos_y) const;
+		/** Expands this matrix into a dense one. */
+		Matrix2D toDense() const;
+		/** Builds the transpose, in O(nonzeros). */
+		SparseMatrix transposed() const;
+		/** Structure checks, in O(nonzeros). Only square matrices can be triangular or diagonal.
+		* Explicitly stored zeros count as zeros.
+		*/
+		bool isUpperTriangular() const;
+		bool isLowerTriangular() const;
+		bool isDiagonal() const;
+		/** Checks strict diagonal dominance by rows, as Matrix2D::isDiagonallyDominant() does: in every row, the sum
+		* of the magnitudes of the off-diagonal elements is less than the magnitude of the diagonal one.
+		* @return True if it is diagonally dominant, false if it's not, or if it's non-square.
+		*/
+		bool isDiagonallyDominant() const;
+	};
+
+	/** Sparse-dense multiply-accumulate: C = alpha * A * B + beta * C. With B a single column, this is SpMV.
+	* Rows of A are split into chunks of roughly equal nonzero counts, which run in parallel.
+	* @param C: Output, accumulated into in place. With beta = 0 it is overwritten. Must not overlap B.
+	* @exception invalid_argument() if the sizes do not match.
+	*/
+	MATRIX2D_LIB void spmm(double alpha, const SparseMatrix &A, ConstMatrixView B, double beta, MatrixView C);
+	/** Multiplies a sparse matrix by a dense matrix or vector.
+	* @exception invalid_argument() if the sizes do not match.
+	*/
+	MATRIX2D_LIB Matrix2D operator*(const SparseMatrix &A, ConstMatrixView B);
+
+	/** Computes a reverse Cuthill-McKee ordering of the symmetrised pattern of A + A^T.
+	* Numbering the unknowns in this order gathers the nonzeros near the diagonal, which bounds the fill of LU.
+	* @return perm, where perm[k] is the original index of the k-th unknown.
+	* @exception invalid_argument() if A is not square.
+	*/
+	MATRIX2D_LIB vector<size_t> ReverseCuthillMcKee(const SparseMatrix &A);
+
+	/** Column orderings applied by SparseLU before factorising. */
+	enum class SparseOrdering {
+		Natural, /** Factorise the columns as given. */
+		ReverseCuthillMcKee /** Permute rows and columns symmetrically by ReverseCuthillMcKee(). */
+	};
+
+	/** Sparse LU factorisation P * A * Q = L * U, computed column by column with the Gilbert-Peierls algorithm:
+	* each column is a sparse triangular solve whose nonzero pattern is found by a depth-first search, so the work is
+	* proportional to the floating-point operations. Pivoting is partial, with a threshold that prefers the diagonal
+	* so as to keep the fill-reducing ordering intact.
+	*/
+	class MATRIX2D_LIB SparseLU {
+		size_t n;
+		vector<size_t> l_ptr, l_idx, u_ptr, u_idx; /** L and U in CSC layout. U's diagonal is last in each column. */
+		vector<double> l_val, u_val;
+		vector<size_t> row_perm; /** row_perm[i] is the pivot step that eliminated original row i. */
+		vector<size_t> col_perm; /** col_perm[k] is the original column factorised at step k. */
+	public:
+		/** Factorises A.
+		* @param A: The matrix, which must be square.
+		* @param ordering: The column ordering to apply first.
+		* @param pivot_threshold: The diagonal stays the pivot while its magnitude is at least this fraction of the
+		* largest candidate in its column. 1 gives plain partial pivoting.
+		* @exception invalid_argument() if A is not square; range_error() if it is structurally or numerically singular.
+		*/
+		explicit SparseLU(const SparseMatrix &A, SparseOrdering ordering = SparseOrdering::ReverseCuthillMcKee,
+			double pivot_threshold = 0.1);
+		size_t getSize() const { return n; }
+		/** Number of nonzeros stored in L and U together, the unit diagonal of L included. */
+		size_t getFactorNonZeroCount() const { return l_val.size() + u_val.size(); }
+		/** Solves A * X = B in place for every column of B, in parallel over the columns.
+		* @exception invalid_argument() if B does not have getSize() rows.
+		*/
+		void solveInPlace(MatrixView B) const;
+		/** Solves A * X = B.
+		* @return The solutions X, one per column.
+		* @exception invalid_argument() if B does not have getSize() rows.
+		*/
+		Matrix2D solve(ConstMatrixView B) const;
+	};
+}
+
+#endif // MATRIX2D_SPARSE
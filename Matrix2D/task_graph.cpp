@@ -0,0 +1,461 @@
+/**
+* @file task_graph.cpp
+* Contains the implementation of deferred execution through TaskGraph.
+*/
+#include "stdafx.h"
+#include "task_graph.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+using namespace std;
+
+namespace m2d {
+	enum class TaskGraph::Op {
+		Input, Multiply, Add, Subtract, Scale, Transpose, SubMatrix,
+		ConcatenateHorizontally, ConcatenateVertically, Solve, Inverse, Det
+	};
+
+	struct TaskGraph::Node {
+		enum class State {
+			Pending, /** Recorded, not computed yet. */
+			Done, /** Computed, or an input. */
+			Failed, /** Its operation, or one it depends on, threw: error says what. */
+			Released /** Unreachable from any handle, so skipped or freed. */
+		};
+		Op kind;
+		State state = State::Pending;
+		size_t args[2] = {};
+		size_t arg_count = 0;
+		size_t rows = 0, cols = 0; /** Shape of the result. */
+		double factor = 1; /** For Scale. */
+		size_t pos_x = 0, pos_y = 0; /** For SubMatrix. */
+		const Matrix2D *source = nullptr; /** Input matrix referred to, not owned. */
+		unique_ptr<Matrix2D> result; /** Computed matrix, or an input matrix handed over. */
+		double scalar = 0; /** For Det. */
+		exception_ptr error;
+		size_t handles = 0; /** Live DeferredMatrix and DeferredScalar handles to this node. */
+		size_t waiting = 0; /** Argument edges from nodes still pending: the result must be kept until they have run. */
+		bool fused = false; /** Computed by its only consumer, as part of one element-wise pass. Set by evaluate(). */
+
+		Node(Op kind, size_t rows, size_t cols) : kind(kind), rows(rows), cols(cols) {}
+		bool isElementwise() const { return kind == Op::Add || kind == Op::Subtract || kind == Op::Scale; }
+	};
+
+	// Handles
+	DeferredMatrix::DeferredMatrix(TaskGraph *graph, size_t node) : graph(graph), node(node) {
+		graph->acquire(node);
+	}
+	DeferredMatrix::DeferredMatrix(const DeferredMatrix &src) : DeferredMatrix(src.graph, src.node) {}
+	DeferredMatrix &DeferredMatrix::operator=(const DeferredMatrix &src) {
+		src.graph->acquire(src.node);
+		graph->release(node);
+		graph = src.graph;
+		node = src.node;
+		return *this;
+	}
+	DeferredMatrix::~DeferredMatrix() {
+		graph->release(node);
+	}
+	size_t DeferredMatrix::getSizeX() const { return graph->nodes[node]->rows; }
+	size_t DeferredMatrix::getSizeY() const { return graph->nodes[node]->cols; }
+	bool DeferredMatrix::isReady() const { return graph->nodes[node]->state == TaskGraph::Node::State::Done; }
+	const Matrix2D &DeferredMatrix::get() const {
+		graph->await(node);
+		return graph->valueOf(node);
+	}
+	DeferredMatrix DeferredMatrix::transposed() const {
+		return graph->record(TaskGraph::Op::Transpose, getSizeY(), getSizeX(), *this);
+	}
+	DeferredMatrix DeferredMatrix::subMatrix(size_t pos_x, size_t pos_y, size_t sub_size_x, size_t sub_size_y) const {
+		size_t size_x = getSizeX(), size_y = getSizeY();
+		if (pos_x > size_x || pos_y > size_y || sub_size_x > size_x - pos_x || sub_size_y > size_y - pos_y)
+			throw range_error("Submatrix is out of bounds.");
+		DeferredMatrix result = graph->record(TaskGraph::Op::SubMatrix, sub_size_x, sub_size_y, *this);
+		graph->nodes[result.node]->pos_x = pos_x;
+		graph->nodes[result.node]->pos_y = pos_y;
+		return result;
+	}
+	DeferredMatrix DeferredMatrix::inverse() const {
+		if (getSizeX() != getSizeY()) throw invalid_argument("Cannot invert non-square matrices.");
+		return graph->record(TaskGraph::Op::Inverse, getSizeX(), getSizeY(), *this);
+	}
+	DeferredScalar DeferredMatrix::det() const {
+		if (getSizeX() != getSizeY()) throw invalid_argument("Cannot compute determinant of non-square matrices.");
+		DeferredMatrix m = graph->record(TaskGraph::Op::Det, 1, 1, *this);
+		return DeferredScalar(graph, m.node);
+	}
+
+	DeferredScalar::DeferredScalar(TaskGraph *graph, size_t node) : graph(graph), node(node) {
+		graph->acquire(node);
+	}
+	DeferredScalar::DeferredScalar(const DeferredScalar &src) : DeferredScalar(src.graph, src.node) {}
+	DeferredScalar &DeferredScalar::operator=(const DeferredScalar &src) {
+		src.graph->acquire(src.node);
+		graph->release(node);
+		graph = src.graph;
+		node = src.node;
+		return *this;
+	}
+	DeferredScalar::~DeferredScalar() {
+		graph->release(node);
+	}
+	bool DeferredScalar::isReady() const { return graph->nodes[node]->state == TaskGraph::Node::State::Done; }
+	double DeferredScalar::get() const {
+		graph->await(node);
+		return graph->nodes[node]->scalar;
+	}
+
+	// Bookkeeping
+	TaskGraph::TaskGraph() {}
+	TaskGraph::~TaskGraph() {}
+
+	void TaskGraph::acquire(size_t node) {
+		nodes[node]->handles++;
+	}
+	void TaskGraph::release(size_t node) {
+		nodes[node]->handles--;
+		dropIfUnused(node);
+	}
+	void TaskGraph::dropIfUnused(size_t node) {
+		Node &n = *nodes[node];
+		if (n.handles > 0 || n.waiting > 0 || n.state != Node::State::Done) return;
+		n.result.reset();
+		n.source = nullptr;
+		n.state = Node::State::Released;
+	}
+	const Matrix2D &TaskGraph::valueOf(size_t node) const {
+		const Node &n = *nodes[node];
+		return n.result ? *n.result : *n.source;
+	}
+	void TaskGraph::await(size_t node) {
+		if (nodes[node]->state == Node::State::Pending) run();
+		if (nodes[node]->state == Node::State::Failed) rethrow_exception(nodes[node]->error);
+	}
+
+	// Recording
+	DeferredMatrix TaskGraph::input(const Matrix2D &m) {
+		unique_ptr<Node> node(new Node(Op::Input, m.getSizeX(), m.getSizeY()));
+		node->state = Node::State::Done;
+		node->source = &m;
+		nodes.push_back(move(node));
+		return DeferredMatrix(this, nodes.size() - 1);
+	}
+	DeferredMatrix TaskGraph::input(Matrix2D &&m) {
+		unique_ptr<Node> node(new Node(Op::Input, m.getSizeX(), m.getSizeY()));
+		node->state = Node::State::Done;
+		node->result.reset(new Matrix2D(move(m)));
+		nodes.push_back(move(node));
+		return DeferredMatrix(this, nodes.size() - 1);
+	}
+	DeferredMatrix TaskGraph::record(Op kind, size_t rows, size_t cols, const DeferredMatrix &a) {
+		unique_ptr<Node> node(new Node(kind, rows, cols));
+		node->args[node->arg_count++] = a.node;
+		nodes[a.node]->waiting++;
+		nodes.push_back(move(node));
+		return DeferredMatrix(this, nodes.size() - 1);
+	}
+	DeferredMatrix TaskGraph::record(Op kind, size_t rows, size_t cols, const DeferredMatrix &a, const DeferredMatrix &b) {
+		if (a.graph != this || b.graph != this)
+			throw invalid_argument("Cannot combine handles from different task graphs.");
+		DeferredMatrix result = record(kind, rows, cols, a);
+		Node &node = *nodes[result.node];
+		node.args[node.arg_count++] = b.node;
+		nodes[b.node]->waiting++;
+		return result;
+	}
+
+	DeferredMatrix TaskGraph::multiply(const DeferredMatrix &a, const DeferredMatrix &b) {
+		if (a.getSizeY() != b.getSizeX())
+			throw invalid_argument("Cannot multiply these matrices: incompatible dimensions.");
+		return record(Op::Multiply, a.getSizeX(), b.getSizeY(), a, b);
+	}
+	DeferredMatrix TaskGraph::add(const DeferredMatrix &a, const DeferredMatrix &b) {
+		if (a.getSizeX() != b.getSizeX() || a.getSizeY() != b.getSizeY())
+			throw invalid_argument("Cannot add two matrices of different dimensions.");
+		return record(Op::Add, a.getSizeX(), a.getSizeY(), a, b);
+	}
+	DeferredMatrix TaskGraph::subtract(const DeferredMatrix &a, const DeferredMatrix &b) {
+		if (a.getSizeX() != b.getSizeX() || a.getSizeY() != b.getSizeY())
+			throw invalid_argument("Cannot subtract two matrices of different dimensions.");
+		return record(Op::Subtract, a.getSizeX(), a.getSizeY(), a, b);
+	}
+	DeferredMatrix TaskGraph::scale(const DeferredMatrix &a, double factor) {
+		if (a.graph != this) throw invalid_argument("Cannot combine handles from different task graphs.");
+		DeferredMatrix result = record(Op::Scale, a.getSizeX(), a.getSizeY(), a);
+		nodes[result.node]->factor = factor;
+		return result;
+	}
+	DeferredMatrix TaskGraph::concatenateHorizontally(const DeferredMatrix &left, const DeferredMatrix &right) {
+		if (left.getSizeX() != right.getSizeX())
+			throw range_error("Cannot horizontally concatenate two matrices with different row counts.");
+		return record(Op::ConcatenateHorizontally, left.getSizeX(), left.getSizeY() + right.getSizeY(), left, right);
+	}
+	DeferredMatrix TaskGraph::concatenateVertically(const DeferredMatrix &top, const DeferredMatrix &bottom) {
+		if (top.getSizeY() != bottom.getSizeY())
+			throw range_error("Cannot vertically concatenate two matrices with different column counts.");
+		return record(Op::ConcatenateVertically, top.getSizeX() + bottom.getSizeX(), top.getSizeY(), top, bottom);
+	}
+	DeferredMatrix TaskGraph::solve(const DeferredMatrix &A, const DeferredMatrix &B) {
+		if (A.getSizeX() != A.getSizeY()) throw invalid_argument("Cannot solve: the matrix must be square.");
+		if (A.getSizeX() != B.getSizeX()) throw invalid_argument("Cannot solve: A and B must have the same row count.");
+		return record(Op::Solve, B.getSizeX(), B.getSizeY(), A, B);
+	}
+
+	DeferredMatrix operator*(const DeferredMatrix &lhs, const DeferredMatrix &rhs) { return lhs.getGraph().multiply(lhs, rhs); }
+	DeferredMatrix operator+(const DeferredMatrix &lhs, const DeferredMatrix &rhs) { return lhs.getGraph().add(lhs, rhs); }
+	DeferredMatrix operator-(const DeferredMatrix &lhs, const DeferredMatrix &rhs) { return lhs.getGraph().subtract(lhs, rhs); }
+	DeferredMatrix operator-(const DeferredMatrix &m) { return m.getGraph().scale(m, -1); }
+	DeferredMatrix operator*(double factor, const DeferredMatrix &m) { return m.getGraph().scale(m, factor); }
+	DeferredMatrix operator*(const DeferredMatrix &m, double factor) { return m.getGraph().scale(m, factor); }
+	DeferredMatrix ConcatenateHorizontally(const DeferredMatrix &left, const DeferredMatrix &right) {
+		return left.getGraph().concatenateHorizontally(left, right);
+	}
+	DeferredMatrix ConcatenateVertically(const DeferredMatrix &top, const DeferredMatrix &bottom) {
+		return top.getGraph().concatenateVertically(top, bottom);
+	}
+	DeferredMatrix solve(const DeferredMatrix &A, const DeferredMatrix &B) { return A.getGraph().solve(A, B); }
+
+	// Evaluation
+	template <class F>
+	void TaskGraph::forEachLeaf(size_t node, F &&fn) const {
+		const Node &n = *nodes[node];
+		for (size_t i = 0; i < n.arg_count; i++) {
+			if (nodes[n.args[i]]->fused) forEachLeaf(n.args[i], fn);
+			else fn(n.args[i]);
+		}
+	}
+	void TaskGraph::finishNode(size_t node) {
+		Node &n = *nodes[node];
+		for (size_t i = 0; i < n.arg_count; i++) {
+			Node &arg = *nodes[n.args[i]];
+			arg.waiting--;
+			if (arg.fused) {
+				// Never materialised, and nothing else can reach it.
+				finishNode(n.args[i]);
+				arg.fused = false;
+				arg.state = Node::State::Released;
+			}
+			else dropIfUnused(n.args[i]);
+		}
+	}
+
+	void TaskGraph::runElementwise(size_t node) {
+		Node &n = *nodes[node];
+		// One step of the pass, run on a stack of rows: Input pushes a row of src, the others pop their operands
+		// and push the result.
+		struct FusedStep {
+			Op op;
+			const Matrix2D *src;
+			double factor;
+		};
+		// Post-order walk of the fused tree: operands first, as on a stack machine.
+		vector<FusedStep> steps;
+		size_t depth = 0, max_depth = 0;
+		auto walk = [&](size_t i, auto &self) -> void {
+			const Node &m = *nodes[i];
+			if (i != node && !m.fused) {
+				steps.push_back({ Op::Input, &valueOf(i), 0 });
+				max_depth = max(max_depth, ++depth);
+				return;
+			}
+			for (size_t k = 0; k < m.arg_count; k++) self(m.args[k], self);
+			steps.push_back({ m.kind, nullptr, m.factor });
+			depth -= m.arg_count - 1;
+		};
+		walk(node, walk);
+
+		size_t rows = n.rows, cols = n.cols, loads = 0;
+		for (const FusedStep &s : steps) loads += s.op == Op::Input;
+		double count = (double)rows * cols;
+		detail::ProfileScope profile(detail::ProfiledOp::Elementwise, count * (steps.size() - loads),
+			count * sizeof(double) * (loads + 1));
+		n.result.reset(new Matrix2D(rows, cols));
+		Matrix2D &out = *n.result;
+		detail::ParallelFor(0, rows, detail::RowGrain(cols * steps.size()), [&](size_t lo, size_t hi) {
+			vector<double> scratch(max_depth * cols);
+			vector<const double*> stack(max_depth);
+			for (size_t x = lo; x < hi; x++) {
+				size_t top = 0;
+				for (size_t s = 0; s < steps.size(); s++) {
+					const FusedStep &step = steps[s];
+					if (step.op == Op::Input) {
+						stack[top++] = step.src->row(x);
+						continue;
+					}
+					size_t a = step.op == Op::Scale ? top - 1 : top - 2;
+					double *dst = s + 1 == steps.size() ? out.row(x) : scratch.data() + a * cols;
+					const double *p = stack[a], *q = stack[top - 1];
+					switch (step.op) {
+					case Op::Add:
+						for (size_t y = 0; y < cols; y++) dst[y] = p[y] + q[y];
+						break;
+					case Op::Subtract:
+						for (size_t y = 0; y < cols; y++) dst[y] = p[y] - q[y];
+						break;
+					default:
+						for (size_t y = 0; y < cols; y++) dst[y] = step.factor * p[y];
+						break;
+					}
+					stack[a] = dst;
+					top = a + 1;
+				}
+			}
+		});
+	}
+
+	void TaskGraph::runNode(size_t node) {
+		Node &n = *nodes[node];
+		if (n.isElementwise()) {
+			runElementwise(node);
+			return;
+		}
+		const Matrix2D &a = valueOf(n.args[0]);
+		switch (n.kind) {
+		case Op::Multiply:
+			n.result.reset(new Matrix2D(n.rows, n.cols));
+			gemm(1.0, a, valueOf(n.args[1]), 0.0, *n.result);
+			break;
+		case Op::Transpose:
+			n.result.reset(new Matrix2D(a.transposed()));
+			break;
+		case Op::SubMatrix:
+			n.result.reset(new Matrix2D(a.subMatrix(n.pos_x, n.pos_y, n.rows, n.cols)));
+			break;
+		case Op::ConcatenateHorizontally:
+			n.result.reset(new Matrix2D(m2d::ConcatenateHorizontally(a, valueOf(n.args[1]))));
+			break;
+		case Op::ConcatenateVertically:
+			n.result.reset(new Matrix2D(m2d::ConcatenateVertically(a, valueOf(n.args[1]))));
+			break;
+		case Op::Solve:
+			// Through the factorisation cached on A, so that several solves against one input share it.
+			n.result.reset(new Matrix2D(m2d::solve(a, ConstMatrixView(valueOf(n.args[1])))));
+			break;
+		case Op::Inverse:
+			n.result.reset(new Matrix2D(a));
+			n.result->invert();
+			break;
+		case Op::Det:
+			n.scalar = a.det();
+			break;
+		default:
+			break;
+		}
+	}
+
+	exception_ptr TaskGraph::run() {
+		detail::ProfileScope profile(detail::ProfiledOp::TaskGraphEvaluate, 0, 0);
+		// Dead-node elimination. Recording order is topological, so walking it backwards sees every consumer
+		// before its arguments.
+		vector<bool> needed(nodes.size(), false);
+		for (size_t i = nodes.size(); i-- > 0;) {
+			Node &n = *nodes[i];
+			if (n.handles > 0) needed[i] = true;
+			if (n.state != Node::State::Pending) continue;
+			if (needed[i]) {
+				for (size_t k = 0; k < n.arg_count; k++) needed[n.args[k]] = true;
+				continue;
+			}
+			n.state = Node::State::Released;
+			for (size_t k = 0; k < n.arg_count; k++) {
+				nodes[n.args[k]]->waiting--;
+				dropIfUnused(n.args[k]);
+			}
+		}
+		// Fusion. Only pending nodes remain as consumers, so waiting is now the number of nodes that will read
+		// this one: an element-wise node read once, by another element-wise node, and by no handle, never needs to
+		// exist as a matrix.
+		vector<size_t> consumer(nodes.size(), 0);
+		for (size_t i = 0; i < nodes.size(); i++) {
+			const Node &n = *nodes[i];
+			if (n.state != Node::State::Pending) continue;
+			for (size_t k = 0; k < n.arg_count; k++) consumer[n.args[k]] = i;
+		}
+		vector<size_t> units;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			Node &n = *nodes[i];
+			if (n.state != Node::State::Pending) continue;
+			n.fused = n.isElementwise() && n.handles == 0 && n.waiting == 1 && nodes[consumer[i]]->isElementwise();
+			if (!n.fused) units.push_back(i);
+		}
+		last_scheduled = units.size();
+		if (units.empty()) return nullptr;
+
+		// Dependencies between units, through the fused trees.
+		vector<size_t> unit_of(nodes.size(), 0), deps(units.size(), 0);
+		vector<vector<size_t>> dependents(units.size());
+		for (size_t u = 0; u < units.size(); u++) {
+			unit_of[units[u]] = u;
+			forEachLeaf(units[u], [&](size_t leaf) {
+				if (nodes[leaf]->state != Node::State::Pending) return;
+				deps[u]++;
+				dependents[unit_of[leaf]].push_back(u);
+			});
+		}
+
+		mutex lock;
+		exception_ptr first_error;
+		atomic<size_t> remaining{ units.size() };
+		bool parallel = detail::ParallelWidth() > 1;
+		detail::ThreadPool *pool = parallel ? &detail::GetThreadPool() : nullptr;
+		// Runs one unit and records its outcome. Returns the units it made ready.
+		auto execute = [&](size_t u) {
+			size_t node = units[u];
+			exception_ptr error;
+			forEachLeaf(node, [&](size_t leaf) {
+				if (!error && nodes[leaf]->state == Node::State::Failed) error = nodes[leaf]->error;
+			});
+			if (!error) {
+				try {
+					runNode(node);
+				}
+				catch (...) {
+					error = current_exception();
+				}
+			}
+			vector<size_t> ready;
+			lock_guard<mutex> guard(lock);
+			Node &n = *nodes[node];
+			n.error = error;
+			n.state = error ? Node::State::Failed : Node::State::Done;
+			if (error) n.result.reset();
+			if (error && !first_error) first_error = error;
+			finishNode(node);
+			dropIfUnused(node);
+			for (size_t d : dependents[u]) {
+				if (--deps[d] == 0) ready.push_back(d);
+			}
+			return ready;
+		};
+		if (!parallel) {
+			// Recording order already satisfies every dependency.
+			for (size_t u = 0; u < units.size(); u++) execute(u);
+			return first_error;
+		}
+		function<void(size_t)> submit = [&](size_t u) {
+			pool->submit([&, u] {
+				for (size_t d : execute(u)) submit(d);
+				remaining.fetch_sub(1, memory_order_acq_rel);
+			});
+		};
+		// Collected first: once the first unit is submitted, workers start updating deps.
+		vector<size_t> roots;
+		for (size_t u = 0; u < units.size(); u++) {
+			if (deps[u] == 0) roots.push_back(u);
+		}
+		for (size_t u : roots) submit(u);
+		while (remaining.load(memory_order_acquire) > 0) {
+			if (!pool->runPendingTask()) this_thread::yield();
+		}
+		return first_error;
+	}
+
+	void TaskGraph::evaluate() {
+		if (exception_ptr error = run()) rethrow_exception(error);
+	}
+}
@@ -0,0 +1,187 @@
+/**
+ * @file task_graph.h
+ * Deferred execution of Matrix2D operations as a task graph.
+ * Operations on DeferredMatrix handles only record nodes in a TaskGraph; nothing is computed until a result is
+ * asked for, or TaskGraph::evaluate() is called. Evaluation then sees the whole graph at once and:
+ * - skips every node whose result can no longer be reached from a live handle;
+ * - fuses chains of element-wise nodes (+, -, scaling) into one pass over memory, with no intermediate matrices;
+ * - runs independent nodes concurrently on the thread pool as soon as their inputs are ready, so the graph takes
+ *   about as long as its critical path;
+ * - frees each intermediate as soon as its last consumer is done.
+ * Typical use:
+ *     TaskGraph graph;
+ *     DeferredMatrix A = graph.input(a), B = graph.input(b);
+ *     DeferredScalar d = (A * B + A).det(); // recorded, not computed
+ *     DeferredMatrix C = ConcatenateHorizontally(A * A, B * B); // the two products can run side by side
+ *     double value = d.get(); // evaluates everything recorded so far
+ *
+ * A graph and its handles must be used from one thread at a time, and handles must not outlive their graph.
+ */
+
+#ifndef MATRIX2D_TASK_GRAPH
+#define MATRIX2D_TASK_GRAPH
+
+#include "matrix_2d.h"
+#include <exception>
+#include <memory>
+#include <vector>
+
+namespace m2d {
+	class TaskGraph;
+	class DeferredScalar;
+
+	/** Handle to the matrix a recorded operation will produce. Copies refer to the same node.
+	* The node's result is kept while any handle to it is alive.
+	*/
+	class MATRIX2D_LIB DeferredMatrix {
+		friend class TaskGraph;
+		friend class DeferredScalar;
+		TaskGraph *graph;
+		size_t node;
+		DeferredMatrix(TaskGraph *graph, size_t node);
+	public:
+		DeferredMatrix(const DeferredMatrix &src);
+		DeferredMatrix &operator=(const DeferredMatrix &src);
+		~DeferredMatrix();
+
+		/** @return The graph the operation was recorded in. */
+		TaskGraph &getGraph() const { return *graph; }
+		/** Row count of the result, known as soon as the operation is recorded. */
+		size_t getSizeX() const;
+		/** Column count of the result, known as soon as the operation is recorded. */
+		size_t getSizeY() const;
+		/** @return Whether the result has been computed. */
+		bool isReady() const;
+		/** Returns the result, evaluating the graph first if it has not been computed yet.
+		* The reference stays valid while this handle is alive and the graph is not evaluated again.
+		* @exception Rethrows the first exception thrown by an operation the result depends on.
+		*/
+		const Matrix2D &get() const;
+
+		/** Records the transpose. */
+		DeferredMatrix transposed() const;
+		/** Records the extraction of a block, as Matrix2D::subMatrix().
+		* @exception Throws range_error() if the block is out of bounds.
+		*/
+		DeferredMatrix subMatrix(size_t pos_x, size_t pos_y, size_t sub_size_x, size_t sub_size_y) const;
+		/** Records the inverse, as Matrix2D::invert().
+		* @exception Throws invalid_argument() if the matrix is not square.
+		*/
+		DeferredMatrix inverse() const;
+		/** Records the determinant, as Matrix2D::det().
+		* @exception Throws invalid_argument() if the matrix is not square.
+		*/
+		DeferredScalar det() const;
+	};
+
+	/** Handle to a scalar a recorded operation will produce. */
+	class MATRIX2D_LIB DeferredScalar {
+		friend class TaskGraph;
+		friend class DeferredMatrix;
+		TaskGraph *graph;
+		size_t node;
+		DeferredScalar(TaskGraph *graph, size_t node);
+	public:
+		DeferredScalar(const DeferredScalar &src);
+		DeferredScalar &operator=(const DeferredScalar &src);
+		~DeferredScalar();
+
+		/** @return Whether the value has been computed. */
+		bool isReady() const;
+		/** Returns the value, evaluating the graph first if it has not been computed yet.
+		* @exception Rethrows the first exception thrown by an operation the value depends on.
+		*/
+		double get() const;
+	};
+
+	/** A graph of deferred operations. Handles created by input() are the leaves; every operation on handles adds a
+	* node. Shapes are checked when an operation is recorded, so size errors throw right there, as they would eagerly.
+	* Results already computed stay available, and new operations can build on them after an evaluation.
+	*/
+	class MATRIX2D_LIB TaskGraph {
+		friend class DeferredMatrix;
+		friend class DeferredScalar;
+		struct Node;
+		enum class Op;
+		std::vector<std::unique_ptr<Node>> nodes; /** In recording order, which is also a topological order. */
+		size_t last_scheduled = 0;
+
+		void acquire(size_t node);
+		void release(size_t node);
+		void dropIfUnused(size_t node);
+		const Matrix2D &valueOf(size_t node) const;
+		void await(size_t node);
+		DeferredMatrix record(Op op, size_t rows, size_t cols, const DeferredMatrix &a);
+		DeferredMatrix record(Op op, size_t rows, size_t cols, const DeferredMatrix &a, const DeferredMatrix &b);
+		template <class F> void forEachLeaf(size_t node, F &&fn) const;
+		void finishNode(size_t node);
+		void runElementwise(size_t node);
+		void runNode(size_t node);
+		/** Evaluates every pending node still needed. Returns the first exception thrown instead of throwing it. */
+		std::exception_ptr run();
+	public:
+		TaskGraph();
+		~TaskGraph();
+		TaskGraph(const TaskGraph&) = delete;
+		TaskGraph& operator=(const TaskGraph&) = delete;
+
+		/** Adds a leaf referring to an existing matrix, without copying it. The matrix must outlive the graph's
+		* evaluation and must not be modified before it.
+		*/
+		DeferredMatrix input(const Matrix2D &m);
+		/** Adds a leaf that takes ownership of a matrix. */
+		DeferredMatrix input(Matrix2D &&m);
+
+		/** Computes every recorded result that a live handle can still reach, and releases what none can.
+		* @exception Rethrows the first exception thrown by an operation; results that did not depend on it are kept.
+		*/
+		void evaluate();
+		/** @return Number of nodes recorded so far, inputs included. */
+		size_t size() const { return nodes.size(); }
+		/** @return Number of recorded nodes computed in a pass of their own during the last evaluate(), i.e. neither
+		* skipped as dead nor fused into another node.
+		*/
+		size_t lastScheduled() const { return last_scheduled; }
+
+		// Recording. Operands must come from this graph.
+		DeferredMatrix multiply(const DeferredMatrix &a, const DeferredMatrix &b);
+		DeferredMatrix add(const DeferredMatrix &a, const DeferredMatrix &b);
+		DeferredMatrix subtract(const DeferredMatrix &a, const DeferredMatrix &b);
+		DeferredMatrix scale(const DeferredMatrix &a, double factor);
+		DeferredMatrix concatenateHorizontally(const DeferredMatrix &left, const DeferredMatrix &right);
+		DeferredMatrix concatenateVertically(const DeferredMatrix &top, const DeferredMatrix &bottom);
+		DeferredMatrix solve(const DeferredMatrix &A, const DeferredMatrix &B);
+	};
+
+	/** Records a matrix product.
+	* @exception Throws invalid_argument() if the dimensions are incompatible or the handles belong to different graphs.
+	*/
+	MATRIX2D_LIB DeferredMatrix operator*(const DeferredMatrix &lhs, const DeferredMatrix &rhs);
+	/** Records an element-wise sum, which evaluation may fuse with neighbouring element-wise operations.
+	* @exception Throws invalid_argument() if the sizes differ or the handles belong to different graphs.
+	*/
+	MATRIX2D_LIB DeferredMatrix operator+(const DeferredMatrix &lhs, const DeferredMatrix &rhs);
+	/** Records an element-wise difference, which evaluation may fuse with neighbouring element-wise operations.
+	* @exception Throws invalid_argument() if the sizes differ or the handles belong to different graphs.
+	*/
+	MATRIX2D_LIB DeferredMatrix operator-(const DeferredMatrix &lhs, const DeferredMatrix &rhs);
+	/** Records a negation, fusable like the other element-wise operations. */
+	MATRIX2D_LIB DeferredMatrix operator-(const DeferredMatrix &m);
+	/** Records a scaling, fusable like the other element-wise operations. */
+	MATRIX2D_LIB DeferredMatrix operator*(double factor, const DeferredMatrix &m);
+	MATRIX2D_LIB DeferredMatrix operator*(const DeferredMatrix &m, double factor);
+	/** Records a horizontal concatenation, as the eager ConcatenateHorizontally().
+	* @exception Throws range_error() if the row counts differ.
+	*/
+	MATRIX2D_LIB DeferredMatrix ConcatenateHorizontally(const DeferredMatrix &left, const DeferredMatrix &right);
+	/** Records a vertical concatenation, as the eager ConcatenateVertically().
+	* @exception Throws range_error() if the column counts differ.
+	*/
+	MATRIX2D_LIB DeferredMatrix ConcatenateVertically(const DeferredMatrix &top, const DeferredMatrix &bottom);
+	/** Records the solution of A * X = B, as the eager solve().
+	* @exception Throws invalid_argument() if A is not square or the row counts differ.
+	*/
+	MATRIX2D_LIB DeferredMatrix solve(const DeferredMatrix &A, const DeferredMatrix &B);
+}
+
+#endif // MATRIX2D_TASK_GRAPH
@@ -0,0 +1,189 @@
+/**
+* @file thread_pool.cpp
+* Contains implementations of the work-stealing thread pool and its runtime configuration.
+*/
+#include "stdafx.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <string>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		static thread_local ThreadPool *t_pool = nullptr; // pool owning the current thread, if it is a worker
+		static thread_local size_t t_worker_index = 0;
+
+		ThreadPool::ThreadPool(size_t count) {
+			if (count == 0) count = 1;
+			for (size_t i = 0; i < count; i++) queues.emplace_back(new Queue());
+			for (size_t i = 0; i + 1 < count; i++) workers.emplace_back(&ThreadPool::workerLoop, this, i);
+		}
+		ThreadPool::~ThreadPool() {
+			{
+				lock_guard<mutex> guard(sleep_lock);
+				stopping = true;
+			}
+			sleep_cv.notify_all();
+			for (thread &w : workers) w.join();
+		}
+
+		void ThreadPool::submit(function<void()> task) {
+			size_t target = (t_pool == this) ? t_worker_index : next_queue++ % queues.size();
+			{
+				lock_guard<mutex> guard(sleep_lock); // pairs with the predicate check in workerLoop
+				pending++; // counted before the push, so a thief never decrements below zero
+			}
+			{
+				lock_guard<mutex> guard(queues[target]->lock);
+				queues[target]->tasks.push_back(move(task));
+			}
+			sleep_cv.notify_one();
+		}
+
+		bool ThreadPool::popOwn(size_t index, function<void()> &task) {
+			Queue &q = *queues[index];
+			lock_guard<mutex> guard(q.lock);
+			if (q.tasks.empty()) return false;
+			task = move(q.tasks.back());
+			q.tasks.pop_back();
+			return true;
+		}
+		bool ThreadPool::steal(size_t thief, function<void()> &task) {
+			for (size_t offset = 1; offset <= queues.size(); offset++) {
+				Queue &q = *queues[(thief + offset) % queues.size()];
+				lock_guard<mutex> guard(q.lock);
+				if (q.tasks.empty()) continue;
+				task = move(q.tasks.front());
+				q.tasks.pop_front();
+				return true;
+			}
+			return false;
+		}
+
+		bool ThreadPool::runPendingTask() {
+			if (pending.load(memory_order_acquire) == 0) return false;
+			size_t home = (t_pool == this) ? t_worker_index : queues.size() - 1;
+			function<void()> task;
+			if (!popOwn(home, task) && !steal(home, task)) return false;
+			pending--;
+			task();
+			return true;
+		}
+
+		void ThreadPool::workerLoop(size_t index) {
+			t_pool = this;
+			t_worker_index = index;
+			for (;;) {
+				if (runPendingTask()) continue;
+				unique_lock<mutex> guard(sleep_lock);
+				sleep_cv.wait(guard, [this] { return stopping || pending.load() > 0; });
+				if (stopping) return;
+			}
+		}
+
+		// Runtime configuration
+		static atomic<bool> g_parallel_enabled{ true };
+		static mutex g_pool_lock;
+		// Deliberately never destroyed at exit: joining workers from static destructors deadlocks under the
+		// loader lock when the library is unloaded as a DLL. The OS reclaims the threads with the process.
+		static ThreadPool *g_pool = nullptr;
+		static atomic<ThreadPool*> g_pool_ptr{ nullptr };
+
+		static size_t ThreadCountFromEnvironment() {
+			string value;
+#ifdef _MSC_VER
+			char *buf = nullptr;
+			size_t len = 0;
+			if (_dupenv_s(&buf, &len, "M2D_NUM_THREADS") != 0 || buf == nullptr) return 0;
+			value = buf;
+			free(buf);
+#else
+			const char *buf = getenv("M2D_NUM_THREADS");
+			if (buf == nullptr) return 0;
+			value = buf;
+#endif
+			return static_cast<size_t>(strtoul(value.c_str(), nullptr, 10));
+		}
+		static size_t DefaultThreadCount() {
+			size_t count = ThreadCountFromEnvironment();
+			if (count == 0) count = thread::hardware_concurrency();
+			return count == 0 ? 1 : count;
+		}
+
+		ThreadPool &GetThreadPool() {
+			ThreadPool *pool = g_pool_ptr.load(memory_order_acquire);
+			if (pool) return *pool;
+			lock_guard<mutex> guard(g_pool_lock);
+			if (!g_pool) {
+				g_pool = new ThreadPool(DefaultThreadCount());
+				g_pool_ptr.store(g_pool, memory_order_release);
+			}
+			return *g_pool;
+		}
+
+		size_t ParallelWidth() {
+			return g_parallel_enabled.load(memory_order_relaxed) ? GetThreadPool().size() : 1;
+		}
+
+		void ParallelFor(size_t begin, size_t end, size_t grain, FunctionRef<void(size_t, size_t)> fn) {
+			if (end <= begin) return;
+			size_t n = end - begin;
+			if (grain == 0) grain = 1;
+			size_t width = (n <= grain) ? 1 : ParallelWidth();
+			if (width <= 1) {
+				fn(begin, end);
+				return;
+			}
+			// A few chunks per thread lets stealing even out uneven chunks.
+			size_t chunks = min((n + grain - 1) / grain, width * 4);
+			size_t step = (n + chunks - 1) / chunks;
+			chunks = (n + step - 1) / step;
+
+			atomic<size_t> remaining{ chunks };
+			mutex error_lock;
+			exception_ptr error;
+			auto run_chunk = [&](size_t c) {
+				size_t lo = begin + c * step, hi = min(end, lo + step);
+				try {
+					fn(lo, hi);
+				}
+				catch (...) {
+					lock_guard<mutex> guard(error_lock);
+					if (!error) error = current_exception();
+				}
+				remaining--; // last touch of this frame's state by the chunk
+			};
+			ThreadPool &pool = GetThreadPool();
+			for (size_t c = 1; c < chunks; c++) pool.submit([&run_chunk, c] { run_chunk(c); });
+			run_chunk(0);
+			while (remaining.load(memory_order_acquire) > 0) {
+				if (!pool.runPendingTask()) this_thread::yield();
+			}
+			if (error) rethrow_exception(error);
+		}
+	}
+
+	void SetThreadCount(size_t count) {
+		if (count == 0) {
+			count = thread::hardware_concurrency();
+			if (count == 0) count = 1;
+		}
+		lock_guard<mutex> guard(detail::g_pool_lock);
+		detail::g_pool_ptr.store(nullptr, memory_order_release);
+		delete detail::g_pool; // joins the old workers
+		detail::g_pool = new detail::ThreadPool(count);
+		detail::g_pool_ptr.store(detail::g_pool, memory_order_release);
+	}
+	size_t GetThreadCount() {
+		return detail::GetThreadPool().size();
+	}
+	void SetParallelEnabled(bool enabled) {
+		detail::g_parallel_enabled.store(enabled);
+	}
+	bool IsParallelEnabled() {
+		return detail::g_parallel_enabled.load();
+	}
+}
@@ -0,0 +1,123 @@
+/**
+ * @file thread_pool.h
+ * Interface to the library-owned work-stealing thread pool that Matrix2D operations run on.
+ */
+
+#ifndef MATRIX2D_THREAD_POOL
+#define MATRIX2D_THREAD_POOL
+
+#include "export_macros.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace m2d {
+	/** Sets the number of threads used by parallel Matrix2D operations, including the calling thread.
+	* Rebuilds the pool, so it must not be called while another thread is running a Matrix2D operation.
+	* @param count: Desired thread count. 0 selects the hardware concurrency.
+	*/
+	MATRIX2D_LIB void SetThreadCount(size_t count);
+	/** Returns the number of threads parallel operations will use, including the calling thread.
+	* Defaults to the M2D_NUM_THREADS environment variable if set, and to the hardware concurrency otherwise.
+	* @return The configured thread count, always at least 1.
+	*/
+	MATRIX2D_LIB size_t GetThreadCount();
+	/** Globally enables or disables parallel execution. When disabled, every operation runs on the calling thread.
+	* @param enabled: Whether operations may use the thread pool.
+	*/
+	MATRIX2D_LIB void SetParallelEnabled(bool enabled);
+	/** Checks whether parallel execution is enabled.
+	* @return True if operations may use the thread pool.
+	*/
+	MATRIX2D_LIB bool IsParallelEnabled();
+
+	namespace detail {
+		/** Work-stealing pool. Each worker owns a deque: it pushes and pops its own work at the back, and steals
+		* from the front of the others' when it runs dry. Threads waiting on a parallel region help run pending
+		* tasks instead of blocking, so regions can be nested freely.
+		*/
+		class ThreadPool {
+			struct Queue {
+				std::mutex lock;
+				std::deque<std::function<void()>> tasks;
+			};
+			std::vector<std::unique_ptr<Queue>> queues; /** One per worker, plus one shared by external threads. */
+			std::vector<std::thread> workers;
+			std::mutex sleep_lock;
+			std::condition_variable sleep_cv;
+			std::atomic<size_t> pending{ 0 };
+			std::atomic<size_t> next_queue{ 0 };
+			bool stopping = false;
+
+			void workerLoop(size_t index);
+			bool popOwn(size_t index, std::function<void()> &task);
+			bool steal(size_t thief, std::function<void()> &task);
+		public:
+			/** Starts count - 1 workers; the thread using the pool counts as the last one.
+			* @param count: Total thread count, at least 1.
+			*/
+			explicit ThreadPool(size_t count);
+			~ThreadPool();
+			ThreadPool(const ThreadPool&) = delete;
+			ThreadPool& operator=(const ThreadPool&) = delete;
+			/** @return Total thread count, including the thread using the pool. */
+			size_t size() const { return workers.size() + 1; }
+			/** Queues a task. Called from a worker, it lands on that worker's own deque.
+			* @param task: The task to run. It must not throw.
+			*/
+			void submit(std::function<void()> task);
+			/** Runs one pending task on the calling thread, if there is one.
+			* @return True if a task was run.
+			*/
+			bool runPendingTask();
+		};
+
+		/** Returns the shared pool, creating it on first use. */
+		ThreadPool &GetThreadPool();
+		/** Number of threads a parallel region may use right now: 1 when parallelism is disabled. */
+		MATRIX2D_LIB size_t ParallelWidth();
+		template <class Signature> class FunctionRef;
+		/** Non-owning reference to a callable, for parameters that are only called before the function returns.
+		* Unlike std::function it never allocates, whatever the size of a lambda's captures.
+		*/
+		template <class R, class... Args>
+		class FunctionRef<R(Args...)> {
+			void *obj;
+			R(*call)(void*, Args...);
+		public:
+			template <class F, class = std::enable_if_t<!std::is_same<std::decay_t<F>, FunctionRef>::value>>
+			FunctionRef(F &&f) : obj(const_cast<void*>(static_cast<const void*>(std::addressof(f)))),
+				call([](void *o, Args... args) -> R { return (*static_cast<std::remove_reference_t<F>*>(o))(std::forward<Args>(args)...); }) {}
+			R operator()(Args... args) const { return call(obj, std::forward<Args>(args)...); }
+		};
+
+		/** Splits [begin, end) into chunks of at least grain indices and runs fn(chunk_begin, chunk_end) on each,
+		* in parallel. Runs fn(begin, end) on the calling thread when the range is at most one grain or parallelism is off.
+		* Blocks until every chunk is done. If any chunk throws, the first exception is rethrown here.
+		* @param begin: First index.
+		* @param end: One past the last index.
+		* @param grain: Minimum chunk size. Pick it so that one chunk is worth at least a few microseconds.
+		* @param fn: Body, called with disjoint half-open sub-ranges.
+		*/
+		MATRIX2D_LIB void ParallelFor(size_t begin, size_t end, size_t grain, FunctionRef<void(size_t, size_t)> fn);
+		/** Grain, in rows, for element-wise loops over rows of the given length.
+		* Keeps each chunk at roughly 16K elements, so matrices below that size stay on the calling thread.
+		* @param row_length: Number of elements processed per row.
+		* @return Minimum number of rows per parallel chunk, at least 1.
+		*/
+		inline size_t RowGrain(size_t row_length) {
+			const size_t kElementsPerChunk = 16384;
+			return row_length >= kElementsPerChunk ? 1 : kElementsPerChunk / (row_length ? row_length : 1);
+		}
+	}
+}
+
+#endif // MATRIX2D_THREAD_POOL
@@ -0,0 +1,339 @@
+/**
+* @file tiled_matrix.cpp
+* Contains the file-backed tiled matrix and the out-of-core multiply and LU factorisation.
+*/
+#include "stdafx.h"
+#include "tiled_matrix.h"
+#include "aligned_memory.h"
+#include "gemm_kernel.h"
+#include "factor_kernels.h"
+#include <algorithm>
+#include <cstring>
+#include <future>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		/** On-disk header of a tiled matrix file, followed by the column panels. */
+		struct TiledHeader {
+			char magic[4];
+			uint16_t version;
+			uint16_t byte_order;
+			uint8_t dtype;
+			uint8_t reserved0[7];
+			uint64_t rows;
+			uint64_t cols;
+			uint64_t tile;
+			uint64_t reserved1[3];
+		};
+		static_assert(sizeof(TiledHeader) == 64, "The tiled header must be exactly 64 bytes.");
+
+		constexpr char kTiledMagic[4] = { 'M', '2', 'D', 'T' };
+		constexpr uint16_t kTiledVersion = 1;
+		constexpr uint16_t kTiledByteOrderMark = 0xFEFF;
+		constexpr uint8_t kTiledDtypeFloat64 = 1;
+		constexpr intptr_t kNoFile = -1;
+
+		// Positional file I/O, safe for concurrent use on different ranges of one file.
+		static intptr_t OpenFile(const char *path, bool create) {
+#ifdef _WIN32
+			HANDLE h = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+				create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (h == INVALID_HANDLE_VALUE) throw runtime_error(create ? "Cannot create tiled matrix file." : "Cannot open tiled matrix file.");
+			return (intptr_t)h;
+#else
+			int fd = create ? open(path, O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path, O_RDWR);
+			if (fd < 0) throw runtime_error(create ? "Cannot create tiled matrix file." : "Cannot open tiled matrix file.");
+			return fd;
+#endif
+		}
+		static void CloseFile(intptr_t f) noexcept {
+			if (f == kNoFile) return;
+#ifdef _WIN32
+			CloseHandle((HANDLE)f);
+#else
+			close((int)f);
+#endif
+		}
+		static void ResizeFile(intptr_t f, uint64_t bytes) {
+#ifdef _WIN32
+			LARGE_INTEGER size;
+			size.QuadPart = (LONGLONG)bytes;
+			if (!SetFilePointerEx((HANDLE)f, size, nullptr, FILE_BEGIN) || !SetEndOfFile((HANDLE)f))
+				throw runtime_error("Cannot resize tiled matrix file.");
+#else
+			if (ftruncate((int)f, (off_t)bytes) != 0) throw runtime_error("Cannot resize tiled matrix file.");
+#endif
+		}
+		static void ReadAt(intptr_t f, uint64_t offset, void *dst, size_t bytes) {
+			char *p = static_cast<char*>(dst);
+			while (bytes > 0) {
+				size_t chunk = min<size_t>(bytes, size_t(1) << 30);
+#ifdef _WIN32
+				OVERLAPPED ov = {};
+				ov.Offset = (DWORD)offset;
+				ov.OffsetHigh = (DWORD)(offset >> 32);
+				DWORD done = 0;
+				if (!ReadFile((HANDLE)f, p, (DWORD)chunk, &done, &ov) || done == 0)
+					throw runtime_error("Cannot read tiled matrix file.");
+#else
+				ssize_t done = pread((int)f, p, chunk, (off_t)offset);
+				if (done <= 0) throw runtime_error("Cannot read tiled matrix file.");
+#endif
+				p += done;
+				offset += (uint64_t)done;
+				bytes -= (size_t)done;
+			}
+		}
+		static void WriteAt(intptr_t f, uint64_t offset, const void *src, size_t bytes) {
+			const char *p = static_cast<const char*>(src);
+			while (bytes > 0) {
+				size_t chunk = min<size_t>(bytes, size_t(1) << 30);
+#ifdef _WIN32
+				OVERLAPPED ov = {};
+				ov.Offset = (DWORD)offset;
+				ov.OffsetHigh = (DWORD)(offset >> 32);
+				DWORD done = 0;
+				if (!WriteFile((HANDLE)f, p, (DWORD)chunk, &done, &ov) || done == 0)
+					throw runtime_error("Cannot write tiled matrix file.");
+#else
+				ssize_t done = pwrite((int)f, p, chunk, (off_t)offset);
+				if (done <= 0) throw runtime_error("Cannot write tiled matrix file.");
+#endif
+				p += done;
+				offset += (uint64_t)done;
+				bytes -= (size_t)done;
+			}
+		}
+
+		// Byte offset of row first_row of a column panel.
+		static uint64_t PanelOffset(size_t rows, size_t tile, size_t panel, size_t first_row) {
+			return sizeof(TiledHeader) + ((uint64_t)panel * rows + first_row) * tile * sizeof(double);
+		}
+	}
+
+	TiledMatrix::TiledMatrix(const char *path, size_t size_x, size_t size_y, size_t tile_size) :
+		file(detail::kNoFile), size_x(size_x), size_y(size_y), tile(detail::PaddedStride(max<size_t>(tile_size, 1))) {
+		file = detail::OpenFile(path, true);
+		try {
+			detail::TiledHeader h = {};
+			memcpy(h.magic, detail::kTiledMagic, sizeof(h.magic));
+			h.version = detail::kTiledVersion;
+			h.byte_order = detail::kTiledByteOrderMark;
+			h.dtype = detail::kTiledDtypeFloat64;
+			h.rows = size_x;
+			h.cols = size_y;
+			h.tile = tile;
+			detail::WriteAt(file, 0, &h, sizeof(h));
+			detail::ResizeFile(file, detail::PanelOffset(size_x, tile, getPanelCount(), 0)); // zero-filled, sparse where supported
+		}
+		catch (...) {
+			detail::CloseFile(file);
+			throw;
+		}
+	}
+	TiledMatrix::TiledMatrix(const char *path) : file(detail::kNoFile), size_x(0), size_y(0), tile(0) {
+		file = detail::OpenFile(path, false);
+		try {
+			detail::TiledHeader h;
+			detail::ReadAt(file, 0, &h, sizeof(h));
+			if (memcmp(h.magic, detail::kTiledMagic, sizeof(h.magic)) != 0 || h.byte_order != detail::kTiledByteOrderMark ||
+				h.version != detail::kTiledVersion || h.dtype != detail::kTiledDtypeFloat64 ||
+				h.tile == 0 || h.tile % detail::kDoublesPerAlignment != 0)
+				throw runtime_error("Not a Matrix2D tiled matrix file.");
+			size_x = (size_t)h.rows;
+			size_y = (size_t)h.cols;
+			tile = (size_t)h.tile;
+		}
+		catch (...) {
+			detail::CloseFile(file);
+			throw;
+		}
+	}
+	TiledMatrix::TiledMatrix(TiledMatrix&& src) noexcept : file(src.file), size_x(src.size_x), size_y(src.size_y), tile(src.tile) {
+		src.file = detail::kNoFile;
+		src.size_x = src.size_y = 0;
+	}
+	TiledMatrix& TiledMatrix::operator=(TiledMatrix&& src) noexcept {
+		swap(file, src.file);
+		swap(size_x, src.size_x);
+		swap(size_y, src.size_y);
+		swap(tile, src.tile);
+		return *this;
+	}
+	TiledMatrix::~TiledMatrix() {
+		detail::CloseFile(file);
+	}
+
+	void TiledMatrix::readPanel(size_t panel, size_t first_row, MatrixView dst) const {
+		size_t rows = dst.getSizeX();
+		if (dst.getSizeY() != tile) throw invalid_argument("A panel buffer must be exactly one tile wide.");
+		if (panel >= getPanelCount() || first_row > size_x || rows > size_x - first_row) throw range_error("Panel rows are out of bounds.");
+		if (dst.isStrided() && dst.getStride() == tile) {
+			detail::ReadAt(file, detail::PanelOffset(size_x, tile, panel, first_row), dst.data(), rows * tile * sizeof(double));
+			return;
+		}
+		Matrix2D buffer(rows, tile); // stride == tile, as tile is a multiple of 8
+		readPanel(panel, first_row, buffer);
+		dst = buffer;
+	}
+	void TiledMatrix::writePanel(size_t panel, size_t first_row, ConstMatrixView src) {
+		size_t rows = src.getSizeX();
+		if (src.getSizeY() != tile) throw invalid_argument("A panel buffer must be exactly one tile wide.");
+		if (panel >= getPanelCount() || first_row > size_x || rows > size_x - first_row) throw range_error("Panel rows are out of bounds.");
+		if (src.isStrided() && src.getStride() == tile) {
+			detail::WriteAt(file, detail::PanelOffset(size_x, tile, panel, first_row), src.data(), rows * tile * sizeof(double));
+			return;
+		}
+		writePanel(panel, first_row, Matrix2D(src));
+	}
+	void TiledMatrix::assign(ConstMatrixView src) {
+		if (src.getSizeX() != size_x || src.getSizeY() != size_y)
+			throw invalid_argument("Cannot assign a matrix of different dimensions to a tiled matrix.");
+		Matrix2D buffer(size_x, tile);
+		for (size_t p = 0; p < getPanelCount(); p++) {
+			size_t width = getPanelWidth(p);
+			buffer.subView(0, 0, size_x, width) = src.subView(0, p * tile, size_x, width); // padding columns stay zero
+			writePanel(p, 0, buffer);
+		}
+	}
+	Matrix2D TiledMatrix::toMatrix() const {
+		Matrix2D result(size_x, size_y), buffer(size_x, tile);
+		for (size_t p = 0; p < getPanelCount(); p++) {
+			readPanel(p, 0, buffer);
+			result.subView(0, p * tile, size_x, getPanelWidth(p)) = buffer.subView(0, 0, size_x, getPanelWidth(p));
+		}
+		return result;
+	}
+
+	void Multiply(const TiledMatrix &A, const TiledMatrix &B, TiledMatrix &C, size_t memory_budget) {
+		if (A.getSizeY() != B.getSizeX() || C.getSizeX() != A.getSizeX() || C.getSizeY() != B.getSizeY())
+			throw invalid_argument("Cannot multiply these matrices: incompatible dimensions.");
+		if (B.getTileSize() != A.getTileSize() || C.getTileSize() != A.getTileSize())
+			throw invalid_argument("Tiled matrices must share one tile size to be multiplied.");
+		const size_t T = A.getTileSize(), m = A.getSizeX(), k_panels = A.getPanelCount(), n_panels = C.getPanelCount();
+		if (m == 0 || n_panels == 0) return;
+
+		// A block of h rows by w panels of C stays in memory, alongside two buffers for the matching panel of A
+		// (h x T) and tiles of B (w of T x T): h*w*T + 2*h*T + 2*w*T*T doubles. Prefer full-height blocks.
+		const size_t budget = memory_budget / sizeof(double);
+		size_t h = m, w = 0;
+		if (budget > 2 * m * T) w = min(n_panels, (budget - 2 * m * T) / (m * T + 2 * T * T));
+		if (w == 0) {
+			w = 1;
+			h = budget > 2 * T * T ? min(m, (budget - 2 * T * T) / (3 * T)) : 0;
+			if (h == 0) throw invalid_argument("The memory budget is too small for a single tile of C and its operands.");
+		}
+
+		vector<Matrix2D> c_block(w, Matrix2D(h, T));
+		struct Stage { Matrix2D a; vector<Matrix2D> b; };
+		Stage stages[2] = { { Matrix2D(h, T), vector<Matrix2D>(w, Matrix2D(T, T)) },
+			{ Matrix2D(h, T), vector<Matrix2D>(w, Matrix2D(T, T)) } };
+		future<void> prefetch; // declared after the buffers so that unwinding waits for it first
+
+		for (size_t r0 = 0; r0 < m; r0 += h) {
+			size_t hb = min(h, m - r0);
+			for (size_t j0 = 0; j0 < n_panels; j0 += w) {
+				size_t wb = min(w, n_panels - j0);
+				auto load = [&, hb, j0, wb, r0](Stage &s, size_t k) {
+					A.readPanel(k, r0, s.a.subView(0, 0, hb, T));
+					for (size_t j = 0; j < wb; j++) B.readPanel(j0 + j, k * T, s.b[j].subView(0, 0, A.getPanelWidth(k), T));
+				};
+				if (k_panels == 0) {
+					for (size_t j = 0; j < wb; j++) memset(c_block[j].data(), 0, hb * T * sizeof(double));
+				}
+				else {
+					prefetch = async(launch::async, load, ref(stages[0]), 0);
+				}
+				for (size_t k = 0; k < k_panels; k++) {
+					prefetch.get();
+					if (k + 1 < k_panels) prefetch = async(launch::async, load, ref(stages[(k + 1) & 1]), k + 1);
+					const Stage &s = stages[k & 1];
+					for (size_t j = 0; j < wb; j++) { // padding columns of B are zero, so those of C stay zero
+						detail::Dgemm(false, false, hb, T, A.getPanelWidth(k), 1.0, s.a.data(), T,
+							s.b[j].data(), T, k == 0 ? 0.0 : 1.0, c_block[j].data(), T);
+					}
+				}
+				for (size_t j = 0; j < wb; j++) C.writePanel(j0 + j, r0, c_block[j].subView(0, 0, hb, T));
+			}
+		}
+	}
+
+	vector<size_t> LUFactorize(TiledMatrix &A, size_t memory_budget) {
+		if (A.getSizeX() != A.getSizeY()) throw invalid_argument("Cannot factorise a non-square matrix.");
+		const size_t T = A.getTileSize(), n = A.getSizeX(), panels = A.getPanelCount();
+		vector<size_t> piv(n);
+		if (n == 0) return piv;
+
+		// One panel holds L; two slots of w panels each take turns at being updated and at being written back
+		// and refilled in the background.
+		const size_t panel_bytes = n * T * sizeof(double);
+		if (memory_budget / panel_bytes < 3) throw invalid_argument("The memory budget must hold at least three column panels.");
+		const size_t w = max<size_t>(1, min(panels, (memory_budget / panel_bytes - 1) / 2));
+		Matrix2D L(n, T);
+		vector<Matrix2D> slots[2] = { vector<Matrix2D>(w, Matrix2D(n, T)), vector<Matrix2D>(w, Matrix2D(n, T)) };
+
+		for (size_t K = 0; K < panels; K++) {
+			const size_t r0 = K * T, rows = n - r0, wk = A.getPanelWidth(K);
+			MatrixView lv = L.subView(0, 0, rows, T);
+			A.readPanel(K, r0, lv);
+			vector<size_t> local(wk);
+			detail::Dgetrf(rows, wk, lv.data(), T, local.data());
+			for (size_t i = 0; i < wk; i++) piv[r0 + i] = r0 + local[i];
+			A.writePanel(K, r0, lv);
+
+			// Panels right of K, in groups of w: swap, solve for the U block row, then update the trailing rows.
+			const size_t first = K + 1, groups = (panels - first + w - 1) / w;
+			auto group_size = [&](size_t g) { return min(w, panels - first - g * w); };
+			auto load = [&](size_t s, size_t g) {
+				for (size_t j = 0; j < group_size(g); j++) A.readPanel(first + g * w + j, r0, slots[s][j].subView(0, 0, rows, T));
+			};
+			auto store = [&](size_t s, size_t g) {
+				for (size_t j = 0; j < group_size(g); j++) A.writePanel(first + g * w + j, r0, slots[s][j].subView(0, 0, rows, T));
+			};
+			future<void> pending[2];
+			if (groups > 0) pending[0] = async(launch::async, load, 0, 0);
+			if (groups > 1) pending[1] = async(launch::async, load, 1, 1);
+			for (size_t g = 0; g < groups; g++) {
+				const size_t s = g & 1;
+				pending[s].get();
+				for (size_t j = 0; j < group_size(g); j++) {
+					double *b = slots[s][j].data();
+					detail::Dlaswp(b, T, 0, T, local.data(), 0, wk);
+					detail::DtrsmLowerUnit(wk, T, lv.data(), T, b, T);
+					if (rows > wk) detail::Dgemm(false, false, rows - wk, T, wk, -1.0, lv.data() + wk * T, T, b, T, 1.0, b + wk * T, T);
+				}
+				pending[s] = async(launch::async, [&, s, g] {
+					store(s, g);
+					if (g + 2 < groups) load(s, g + 2);
+				});
+			}
+			for (auto &p : pending) if (p.valid()) p.get();
+		}
+
+		// Interchanges made by later panels have not reached the L panels to their left yet: apply them in one pass.
+		vector<size_t> rel(n);
+		for (size_t J = 0; J + 1 < panels; J++) {
+			const size_t r1 = (J + 1) * T, rows = n - r1;
+			bool swapped = false;
+			for (size_t k = r1; k < n; k++) {
+				rel[k - r1] = piv[k] - r1;
+				swapped |= piv[k] != k;
+			}
+			if (!swapped) continue;
+			MatrixView lv = L.subView(0, 0, rows, T);
+			A.readPanel(J, r1, lv);
+			detail::Dlaswp(lv.data(), T, 0, T, rel.data(), 0, rows);
+			A.writePanel(J, r1, lv);
+		}
+		return piv;
+	}
+}
@@ -0,0 +1,104 @@
+/**
+ * @file tiled_matrix.h
+ * Out-of-core matrices: file-backed, tiled storage with a multiply and an LU factorisation that stream tiles
+ * through a bounded memory budget.
+ *
+ * A TiledMatrix is stored as a sequence of column panels, each tile_size columns wide. Every panel is a row-major
+ * getSizeX() x tile_size block, so tile (i, j) is rows [i * tile_size, (i + 1) * tile_size) of panel j, and any run
+ * of tiles down a panel is one contiguous read. Columns past getSizeY() in the last panel are zero padding.
+ * The out-of-core routines load panels and tiles into aligned in-memory buffers and run the in-memory GEMM and LU
+ * kernels on them, prefetching the next tiles on a background thread while the current ones compute.
+ */
+
+#ifndef MATRIX2D_TILED
+#define MATRIX2D_TILED
+
+#include "matrix_2d.h"
+#include <cstdint>
+
+namespace m2d {
+	/** Dense matrix backed by a file on local disk, accessed a panel of tiles at a time. */
+	class MATRIX2D_LIB TiledMatrix {
+		intptr_t file; /** OS file handle or descriptor, or -1 once moved from. */
+		size_t size_x, size_y; /** Size of the matrix. */
+		size_t tile; /** Tile order, a multiple of 8. */
+	public:
+		/** Default tile order: a 1024 x 1024 tile holds 8 MiB. */
+		static constexpr size_t kDefaultTileSize = 1024;
+		/** Creates a new zero-filled matrix file, replacing the file if it exists.
+		* @param path: Path of the backing file.
+		* @param size_x: Row count.
+		* @param size_y: Column count.
+		* @param tile_size: Tile order, rounded up to a multiple of 8.
+		* @exception runtime_error() if the file cannot be created.
+		*/
+		TiledMatrix(const char *path, size_t size_x, size_t size_y, size_t tile_size = kDefaultTileSize);
+		/** Opens an existing matrix file for reading and writing.
+		* @param path: Path of the backing file.
+		* @exception runtime_error() if the file cannot be opened or is not a tiled matrix file.
+		*/
+		explicit TiledMatrix(const char *path);
+		TiledMatrix(const TiledMatrix&) = delete;
+		TiledMatrix& operator=(const TiledMatrix&) = delete;
+		/** Move constructor. The source is left closed, as an empty 0 x 0 matrix. */
+		TiledMatrix(TiledMatrix&& src) noexcept;
+		TiledMatrix& operator=(TiledMatrix&& src) noexcept;
+		/** Closes the backing file, which is kept on disk. */
+		~TiledMatrix();
+
+		size_t getSizeX() const { return size_x; }
+		size_t getSizeY() const { return size_y; }
+		size_t getTileSize() const { return tile; }
+		/** Number of column panels (and of tile columns). */
+		size_t getPanelCount() const { return (size_y + tile - 1) / tile; }
+		/** Number of columns of a panel that hold matrix columns rather than padding. */
+		size_t getPanelWidth(size_t panel) const { return panel + 1 < getPanelCount() ? tile : size_y - panel * tile; }
+
+		/** Reads a run of rows of one column panel. Safe to call from several threads at once.
+		* @param panel: Index of the column panel.
+		* @param first_row: First row to read.
+		* @param dst: Destination of getTileSize() columns; its row count gives the number of rows read.
+		* @exception range_error() if the rows or panel are out of range; runtime_error() if the read fails.
+		*/
+		void readPanel(size_t panel, size_t first_row, MatrixView dst) const;
+		/** Writes a run of rows of one column panel. Safe to call from several threads at once, on different rows.
+		* @param panel: Index of the column panel.
+		* @param first_row: First row to write.
+		* @param src: Source of getTileSize() columns; its row count gives the number of rows written.
+		* @exception range_error() if the rows or panel are out of range; runtime_error() if the write fails.
+		*/
+		void writePanel(size_t panel, size_t first_row, ConstMatrixView src);
+		/** Fills the matrix from an in-memory one of the same size, a panel at a time.
+		* @exception invalid_argument() if the sizes differ; runtime_error() if a write fails.
+		*/
+		void assign(ConstMatrixView src);
+		/** Loads the whole matrix into memory. Only sensible for matrices that fit.
+		* @exception runtime_error() if a read fails.
+		*/
+		Matrix2D toMatrix() const;
+	};
+
+	/** Out-of-core matrix product C = A * B. C is computed a block of rows and panels at a time, as large as the
+	* budget allows; the matching panels of A and tiles of B stream through double buffers, the next ones being read
+	* while the current ones multiply on the in-memory GEMM engine. Each finished block of C is written back once.
+	* @param A: Left operand, of size m x k.
+	* @param B: Right operand, of size k x n, with the same tile size as A.
+	* @param C: Output, of size m x n, with the same tile size as A. Must not share a file with A or B.
+	* @param memory_budget: Upper bound, in bytes, on the buffers used.
+	* @exception invalid_argument() if the sizes or tile sizes do not match, or the budget cannot hold one row of
+	* tiles of C with its operands; runtime_error() if an I/O operation fails.
+	*/
+	MATRIX2D_LIB void Multiply(const TiledMatrix &A, const TiledMatrix &B, TiledMatrix &C, size_t memory_budget);
+	/** Out-of-core, right-looking LU factorisation with partial pivoting, in place: P * A = L * U.
+	* Each column panel is factorised in memory by the blocked LU kernel, then the panels to its right are streamed
+	* through, a group at a time, to be swapped, solved and updated by GEMM while the next group is read and the
+	* previous one written back. Row interchanges are applied to the finished L panels in one pass at the end.
+	* @param A: The matrix to factorise, which must be square. Overwritten by L (unit diagonal not stored) and U.
+	* @param memory_budget: Upper bound, in bytes, on the buffers used. Must hold at least three column panels.
+	* @return The pivot vector, as for LUFactorize(MatrixView).
+	* @exception invalid_argument() if A is not square or the budget is too small; runtime_error() if an I/O operation fails.
+	*/
+	MATRIX2D_LIB vector<size_t> LUFactorize(TiledMatrix &A, size_t memory_budget);
+}
+
+#endif // MATRIX2D_TILED
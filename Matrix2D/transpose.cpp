@@ -0,0 +1,137 @@
+/**
+* @file transpose.cpp
+* Contains the tiled, SIMD transpose kernels.
+*
+* Both kernels walk the matrix in square tiles small enough that a source tile and its destination tile
+* sit in L1 together, so neither the row-wise reads nor the column-wise writes miss cache per element.
+* Inside a tile, 4 x 4 blocks are transposed in ymm registers when AVX2 is available.
+*/
+#include "stdafx.h"
+#include "transpose_kernel.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		constexpr size_t kTransposeTile = 32; // two 32 x 32 tiles of doubles take 16 KiB
+
+		// Scalar transpose of a small rows x cols block.
+		static void BlockScalar(size_t rows, size_t cols, const double *src, size_t lds, double *dst, size_t ldd) {
+			for (size_t i = 0; i < rows; i++)
+				for (size_t j = 0; j < cols; j++) dst[j * ldd + i] = src[i * lds + j];
+		}
+
+		// Tile transpose and tile swap-transpose, in a scalar and an AVX flavour with identical signatures.
+		typedef void(*TileKernel)(size_t rows, size_t cols, const double *src, size_t lds, double *dst, size_t ldd);
+		typedef void(*SwapKernel)(size_t rows, size_t cols, double *p, double *q, size_t ld);
+
+		static void TileScalar(size_t rows, size_t cols, const double *src, size_t lds, double *dst, size_t ldd) {
+			BlockScalar(rows, cols, src, lds, dst, ldd);
+		}
+		// Exchanges the rows x cols block at p with the cols x rows block at q, transposing both.
+		static void SwapScalar(size_t rows, size_t cols, double *p, double *q, size_t ld) {
+			for (size_t i = 0; i < rows; i++)
+				for (size_t j = 0; j < cols; j++) swap(p[i * ld + j], q[j * ld + i]);
+		}
+
+#ifdef M2D_X86
+		// Loads a 4 x 4 block into four registers and transposes it there.
+		M2D_TARGET_AVX2 static inline void Load4x4T(const double *s, size_t ld, __m256d &o0, __m256d &o1, __m256d &o2, __m256d &o3) {
+			__m256d r0 = _mm256_loadu_pd(s), r1 = _mm256_loadu_pd(s + ld);
+			__m256d r2 = _mm256_loadu_pd(s + 2 * ld), r3 = _mm256_loadu_pd(s + 3 * ld);
+			__m256d t0 = _mm256_unpacklo_pd(r0, r1); // a0 b0 a2 b2
+			__m256d t1 = _mm256_unpackhi_pd(r0, r1); // a1 b1 a3 b3
+			__m256d t2 = _mm256_unpacklo_pd(r2, r3); // c0 d0 c2 d2
+			__m256d t3 = _mm256_unpackhi_pd(r2, r3); // c1 d1 c3 d3
+			o0 = _mm256_permute2f128_pd(t0, t2, 0x20); // a0 b0 c0 d0
+			o1 = _mm256_permute2f128_pd(t1, t3, 0x20); // a1 b1 c1 d1
+			o2 = _mm256_permute2f128_pd(t0, t2, 0x31); // a2 b2 c2 d2
+			o3 = _mm256_permute2f128_pd(t1, t3, 0x31); // a3 b3 c3 d3
+		}
+		M2D_TARGET_AVX2 static inline void Store4x4(double *d, size_t ld, __m256d o0, __m256d o1, __m256d o2, __m256d o3) {
+			_mm256_storeu_pd(d, o0);
+			_mm256_storeu_pd(d + ld, o1);
+			_mm256_storeu_pd(d + 2 * ld, o2);
+			_mm256_storeu_pd(d + 3 * ld, o3);
+		}
+
+		M2D_TARGET_AVX2 static void TileAvx2(size_t rows, size_t cols, const double *src, size_t lds, double *dst, size_t ldd) {
+			size_t r4 = rows & ~size_t(3), c4 = cols & ~size_t(3);
+			for (size_t i = 0; i < r4; i += 4) {
+				for (size_t j = 0; j < c4; j += 4) {
+					__m256d o0, o1, o2, o3;
+					Load4x4T(src + i * lds + j, lds, o0, o1, o2, o3);
+					Store4x4(dst + j * ldd + i, ldd, o0, o1, o2, o3);
+				}
+			}
+			BlockScalar(r4, cols - c4, src + c4, lds, dst + c4 * ldd, ldd); // right edge
+			BlockScalar(rows - r4, cols, src + r4 * lds, lds, dst + r4, ldd); // bottom edge
+		}
+		M2D_TARGET_AVX2 static void SwapAvx2(size_t rows, size_t cols, double *p, double *q, size_t ld) {
+			size_t r4 = rows & ~size_t(3), c4 = cols & ~size_t(3);
+			for (size_t i = 0; i < r4; i += 4) {
+				for (size_t j = 0; j < c4; j += 4) {
+					__m256d p0, p1, p2, p3, q0, q1, q2, q3;
+					Load4x4T(p + i * ld + j, ld, p0, p1, p2, p3);
+					Load4x4T(q + j * ld + i, ld, q0, q1, q2, q3);
+					Store4x4(q + j * ld + i, ld, p0, p1, p2, p3);
+					Store4x4(p + i * ld + j, ld, q0, q1, q2, q3);
+				}
+			}
+			SwapScalar(r4, cols - c4, p + c4, q + c4 * ld, ld);
+			SwapScalar(rows - r4, cols, p + r4 * ld, q + r4, ld);
+		}
+#endif
+
+		static TileKernel SelectTileKernel() {
+#ifdef M2D_X86
+			if (CpuHasAvx2Fma()) return TileAvx2;
+#endif
+			return TileScalar;
+		}
+		static SwapKernel SelectSwapKernel() {
+#ifdef M2D_X86
+			if (CpuHasAvx2Fma()) return SwapAvx2;
+#endif
+			return SwapScalar;
+		}
+
+		void TransposeInto(size_t rows, size_t cols, const double *src, size_t lds, double *dst, size_t ldd) {
+			TileKernel tile = SelectTileKernel();
+			size_t tile_rows = (rows + kTransposeTile - 1) / kTransposeTile;
+			ParallelFor(0, tile_rows, RowGrain(cols) / kTransposeTile + 1, [&](size_t lo, size_t hi) {
+				for (size_t ti = lo; ti < hi; ti++) {
+					size_t i0 = ti * kTransposeTile, tr = min(kTransposeTile, rows - i0);
+					for (size_t j0 = 0; j0 < cols; j0 += kTransposeTile) {
+						size_t tc = min(kTransposeTile, cols - j0);
+						tile(tr, tc, src + i0 * lds + j0, lds, dst + j0 * ldd + i0, ldd);
+					}
+				}
+			});
+		}
+
+		void TransposeSquareInPlace(size_t n, double *A, size_t lda) {
+			SwapKernel swap_tile = SelectSwapKernel();
+			size_t tiles = (n + kTransposeTile - 1) / kTransposeTile;
+			// Tile row I swaps tiles (I, J > I) with their mirrors and transposes (I, I) in place.
+			// Row I touches only tiles in row I and column I, so rows are independent.
+			ParallelFor(0, tiles, RowGrain(n) / kTransposeTile + 1, [&](size_t lo, size_t hi) {
+				for (size_t ti = lo; ti < hi; ti++) {
+					size_t i0 = ti * kTransposeTile, tr = min(kTransposeTile, n - i0);
+					double *diag = A + i0 * lda + i0;
+					for (size_t i = 0; i < tr; i++) { // diagonal tile: swap each element above with its mirror
+						for (size_t j = i + 1; j < tr; j++) swap(diag[i * lda + j], diag[j * lda + i]);
+					}
+					for (size_t j0 = i0 + kTransposeTile; j0 < n; j0 += kTransposeTile) {
+						size_t tc = min(kTransposeTile, n - j0);
+						swap_tile(tr, tc, A + i0 * lda + j0, A + j0 * lda + i0, lda);
+					}
+				}
+			});
+		}
+	}
+}
@@ -0,0 +1,33 @@
+/**
+ * @file transpose_kernel.h
+ * Internal interface to the tiled transpose kernels.
+ * Not part of the public interface.
+ */
+
+#ifndef MATRIX2D_TRANSPOSE_KERNEL
+#define MATRIX2D_TRANSPOSE_KERNEL
+
+#include <cstddef>
+
+namespace m2d {
+	namespace detail {
+		/** Writes the transpose of a rows x cols block into a cols x rows block, out of place.
+		* Works in cache-sized tiles, each made of 4 x 4 register transposes, in parallel over tile rows.
+		* @param rows: Row count of the source.
+		* @param cols: Column count of the source.
+		* @param src: Pointer to element (0, 0) of the source.
+		* @param lds: Leading dimension of the source.
+		* @param dst: Pointer to element (0, 0) of the destination. Must not overlap the source.
+		* @param ldd: Leading dimension of the destination.
+		*/
+		void TransposeInto(size_t rows, size_t cols, const double *src, size_t lds, double *dst, size_t ldd);
+		/** Transposes an n x n block in place by swapping mirrored tiles, with no extra memory.
+		* @param n: Order of the block.
+		* @param A: Pointer to element (0, 0).
+		* @param lda: Leading dimension of A.
+		*/
+		void TransposeSquareInPlace(size_t n, double *A, size_t lda);
+	}
+}
+
+#endif // MATRIX2D_TRANSPOSE_KERNEL
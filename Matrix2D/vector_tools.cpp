@@ -0,0 +1,402 @@
+/**
+* @file vector_tools.cpp
+* Contains implementations of the BLAS level-1 and level-2 vector kernels.
+*/
+#include "stdafx.h"
+#include "vector_tools.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cfloat>
+
+using namespace std;
+
+namespace m2d {
+	namespace detail {
+		// Elements per parallel chunk of a level-1 operation: 512 KiB of doubles, well past the cost of a task.
+		constexpr size_t kVectorChunk = 1 << 16;
+
+		/** A vector as a base pointer, a length and a distance between consecutive elements. */
+		struct VectorRef {
+			const double *p;
+			size_t n, inc;
+			double *mut() const { return const_cast<double*>(p); }
+		};
+
+		static size_t VectorLength(ConstMatrixView v) {
+			if (v.getSizeX() != 1 && v.getSizeY() != 1)
+				throw invalid_argument("Expected a vector: a view with one row or one column.");
+			return v.getSizeX() * v.getSizeY();
+		}
+
+		// Describes a row or column view by its increment. Minors have no single increment, so they are rejected.
+		static bool Describe(ConstMatrixView v, VectorRef &r) {
+			r.n = VectorLength(v);
+			bool column = v.getSizeY() == 1 && v.getSizeX() != 1;
+			if (v.isStrided()) r.inc = column ? v.getStride() : 1;
+			else if (v.isTransposed() && v.transposed().isStrided()) r.inc = column ? 1 : v.getStride();
+			else return false;
+			r.p = v.data();
+			return true;
+		}
+
+		// Describes an input vector, copying a minor into holder first.
+		static VectorRef Input(ConstMatrixView v, Matrix2D &holder) {
+			VectorRef r;
+			if (!Describe(v, r)) {
+				holder = Matrix2D(v);
+				Describe(holder, r);
+			}
+			return r;
+		}
+
+		// Runs fn(lo, hi) over fixed chunks of [0, n) and adds the partial results in chunk order.
+		template <class F>
+		static double SumChunks(size_t n, F fn) {
+			size_t chunks = (n + kVectorChunk - 1) / kVectorChunk;
+			if (chunks <= 1) return fn(0, n);
+			vector<double> partial(chunks);
+			ParallelFor(0, chunks, 1, [&](size_t lo, size_t hi) {
+				for (size_t c = lo; c < hi; c++) partial[c] = fn(c * kVectorChunk, min(n, (c + 1) * kVectorChunk));
+			});
+			double sum = 0;
+			for (double p : partial) sum += p;
+			return sum;
+		}
+		template <class F>
+		static double MaxChunks(size_t n, F fn) {
+			size_t chunks = (n + kVectorChunk - 1) / kVectorChunk;
+			if (chunks <= 1) return fn(0, n);
+			vector<double> partial(chunks);
+			ParallelFor(0, chunks, 1, [&](size_t lo, size_t hi) {
+				for (size_t c = lo; c < hi; c++) partial[c] = fn(c * kVectorChunk, min(n, (c + 1) * kVectorChunk));
+			});
+			return *max_element(partial.begin(), partial.end());
+		}
+		template <class F>
+		static void ForChunks(size_t n, F fn) {
+			ParallelFor(0, n, kVectorChunk, fn);
+		}
+
+		// Portable unit-stride kernels, with independent accumulators to hide the add latency.
+		static double DotBase(size_t n, const double *x, const double *y) {
+			double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+			size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				s0 += x[i] * y[i];
+				s1 += x[i + 1] * y[i + 1];
+				s2 += x[i + 2] * y[i + 2];
+				s3 += x[i + 3] * y[i + 3];
+			}
+			for (; i < n; i++) s0 += x[i] * y[i];
+			return (s0 + s1) + (s2 + s3);
+		}
+		static double AsumBase(size_t n, const double *x) {
+			double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+			size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				s0 += fabs(x[i]);
+				s1 += fabs(x[i + 1]);
+				s2 += fabs(x[i + 2]);
+				s3 += fabs(x[i + 3]);
+			}
+			for (; i < n; i++) s0 += fabs(x[i]);
+			return (s0 + s1) + (s2 + s3);
+		}
+		static double AbsMaxBase(size_t n, const double *x) {
+			double m = 0;
+			for (size_t i = 0; i < n; i++) m = max(m, fabs(x[i]));
+			return m;
+		}
+		static void AxpyBase(size_t n, double alpha, const double *x, double *y) {
+			for (size_t i = 0; i < n; i++) y[i] += alpha * x[i];
+		}
+
+#ifdef M2D_X86
+		M2D_TARGET_AVX2 static double HorizontalSum(__m256d v) {
+			__m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+			return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+		}
+		// AVX2/FMA unit-stride kernels: four ymm accumulators, 16 doubles per iteration.
+		M2D_TARGET_AVX2 static double DotAvx2(size_t n, const double *x, const double *y) {
+			__m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd(), s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16) {
+				s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), s0);
+				s1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4), s1);
+				s2 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 8), _mm256_loadu_pd(y + i + 8), s2);
+				s3 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 12), _mm256_loadu_pd(y + i + 12), s3);
+			}
+			for (; i + 4 <= n; i += 4) s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), s0);
+			double s = HorizontalSum(_mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+			for (; i < n; i++) s += x[i] * y[i];
+			return s;
+		}
+		M2D_TARGET_AVX2 static double AsumAvx2(size_t n, const double *x) {
+			const __m256d sign = _mm256_set1_pd(-0.0);
+			__m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd(), s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16) {
+				s0 = _mm256_add_pd(s0, _mm256_andnot_pd(sign, _mm256_loadu_pd(x + i)));
+				s1 = _mm256_add_pd(s1, _mm256_andnot_pd(sign, _mm256_loadu_pd(x + i + 4)));
+				s2 = _mm256_add_pd(s2, _mm256_andnot_pd(sign, _mm256_loadu_pd(x + i + 8)));
+				s3 = _mm256_add_pd(s3, _mm256_andnot_pd(sign, _mm256_loadu_pd(x + i + 12)));
+			}
+			for (; i + 4 <= n; i += 4) s0 = _mm256_add_pd(s0, _mm256_andnot_pd(sign, _mm256_loadu_pd(x + i)));
+			double s = HorizontalSum(_mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+			for (; i < n; i++) s += fabs(x[i]);
+			return s;
+		}
+		M2D_TARGET_AVX2 static double AbsMaxAvx2(size_t n, const double *x) {
+			const __m256d sign = _mm256_set1_pd(-0.0);
+			__m256d m0 = _mm256_setzero_pd(), m1 = _mm256_setzero_pd();
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				m0 = _mm256_max_pd(m0, _mm256_andnot_pd(sign, _mm256_loadu_pd(x + i)));
+				m1 = _mm256_max_pd(m1, _mm256_andnot_pd(sign, _mm256_loadu_pd(x + i + 4)));
+			}
+			alignas(32) double lanes[4];
+			_mm256_store_pd(lanes, _mm256_max_pd(m0, m1));
+			double m = max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3]));
+			for (; i < n; i++) m = max(m, fabs(x[i]));
+			return m;
+		}
+		M2D_TARGET_AVX2 static void AxpyAvx2(size_t n, double alpha, const double *x, double *y) {
+			__m256d a = _mm256_set1_pd(alpha);
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				_mm256_storeu_pd(y + i, _mm256_fmadd_pd(a, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+				_mm256_storeu_pd(y + i + 4, _mm256_fmadd_pd(a, _mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+			}
+			for (; i < n; i++) y[i] += alpha * x[i];
+		}
+#endif
+
+		static bool UseAvx2() {
+#ifdef M2D_X86
+			static const bool avx2 = CpuHasAvx2Fma();
+			return avx2;
+#else
+			return false;
+#endif
+		}
+
+		// Dispatching kernels on described vectors. Unit strides take the SIMD path; other strides a scalar loop.
+		static double Dot(size_t n, const double *x, size_t incx, const double *y, size_t incy) {
+			if (incx == 1 && incy == 1) {
+#ifdef M2D_X86
+				if (UseAvx2()) return DotAvx2(n, x, y);
+#endif
+				return DotBase(n, x, y);
+			}
+			double s = 0;
+			for (size_t i = 0; i < n; i++) s += x[i * incx] * y[i * incy];
+			return s;
+		}
+		static double Asum(size_t n, const double *x, size_t inc) {
+			if (inc == 1) {
+#ifdef M2D_X86
+				if (UseAvx2()) return AsumAvx2(n, x);
+#endif
+				return AsumBase(n, x);
+			}
+			double s = 0;
+			for (size_t i = 0; i < n; i++) s += fabs(x[i * inc]);
+			return s;
+		}
+		static double AbsMax(size_t n, const double *x, size_t inc) {
+			if (inc == 1) {
+#ifdef M2D_X86
+				if (UseAvx2()) return AbsMaxAvx2(n, x);
+#endif
+				return AbsMaxBase(n, x);
+			}
+			double m = 0;
+			for (size_t i = 0; i < n; i++) m = max(m, fabs(x[i * inc]));
+			return m;
+		}
+		static void Axpy(size_t n, double alpha, const double *x, size_t incx, double *y, size_t incy) {
+			if (incx == 1 && incy == 1) {
+#ifdef M2D_X86
+				if (UseAvx2()) return AxpyAvx2(n, alpha, x, y);
+#endif
+				return AxpyBase(n, alpha, x, y);
+			}
+			for (size_t i = 0; i < n; i++) y[i * incy] += alpha * x[i * incx];
+		}
+	}
+
+	double dot(ConstMatrixView x, ConstMatrixView y) {
+		Matrix2D hx(0, 0), hy(0, 0);
+		detail::VectorRef a = detail::Input(x, hx), b = detail::Input(y, hy);
+		if (a.n != b.n) throw invalid_argument("Cannot compute the dot product of vectors of different lengths.");
+		return detail::SumChunks(a.n, [&](size_t lo, size_t hi) {
+			return detail::Dot(hi - lo, a.p + lo * a.inc, a.inc, b.p + lo * b.inc, b.inc);
+		});
+	}
+
+	void axpy(double alpha, ConstMatrixView x, MatrixView y) {
+		detail::VectorRef b;
+		if (!detail::Describe(y, b)) {
+			Matrix2D tmp(y);
+			axpy(alpha, x, tmp);
+			y = tmp;
+			return;
+		}
+		Matrix2D hx(0, 0);
+		detail::VectorRef a = detail::Input(x, hx);
+		if (a.n != b.n) throw invalid_argument("Cannot add vectors of different lengths.");
+		if (alpha == 0) return;
+		detail::ForChunks(a.n, [&](size_t lo, size_t hi) {
+			detail::Axpy(hi - lo, alpha, a.p + lo * a.inc, a.inc, b.mut() + lo * b.inc, b.inc);
+		});
+	}
+
+	void scal(double alpha, MatrixView x) {
+		detail::VectorRef a;
+		if (!detail::Describe(x, a)) {
+			Matrix2D tmp(x);
+			scal(alpha, tmp);
+			x = tmp;
+			return;
+		}
+		// A plain loop: GCC and MSVC vectorise it on their own, and the kernel is bound by memory anyway.
+		detail::ForChunks(a.n, [&](size_t lo, size_t hi) {
+			double *p = a.mut();
+			if (alpha == 0) for (size_t i = lo; i < hi; i++) p[i * a.inc] = 0;
+			else for (size_t i = lo; i < hi; i++) p[i * a.inc] *= alpha;
+		});
+	}
+
+	double nrm2(ConstMatrixView x) {
+		Matrix2D hx(0, 0);
+		detail::VectorRef a = detail::Input(x, hx);
+		double ss = detail::SumChunks(a.n, [&](size_t lo, size_t hi) {
+			const double *p = a.p + lo * a.inc;
+			return detail::Dot(hi - lo, p, a.inc, p, a.inc);
+		});
+		// Above DBL_MIN / DBL_EPSILON, squares that underflowed cannot have mattered; below it, or on overflow, rescale.
+		if (isnan(ss) || (ss >= DBL_MIN / DBL_EPSILON && ss <= DBL_MAX)) return sqrt(ss);
+		double scale = detail::MaxChunks(a.n, [&](size_t lo, size_t hi) {
+			return detail::AbsMax(hi - lo, a.p + lo * a.inc, a.inc);
+		});
+		if (scale == 0 || isinf(scale)) return scale;
+		double scaled = detail::SumChunks(a.n, [&](size_t lo, size_t hi) {
+			double s = 0;
+			for (size_t i = lo; i < hi; i++) {
+				double v = a.p[i * a.inc] / scale;
+				s += v * v;
+			}
+			return s;
+		});
+		return scale * sqrt(scaled);
+	}
+
+	double asum(ConstMatrixView x) {
+		Matrix2D hx(0, 0);
+		detail::VectorRef a = detail::Input(x, hx);
+		return detail::SumChunks(a.n, [&](size_t lo, size_t hi) {
+			return detail::Asum(hi - lo, a.p + lo * a.inc, a.inc);
+		});
+	}
+
+	size_t iamax(ConstMatrixView x) {
+		Matrix2D hx(0, 0);
+		detail::VectorRef a = detail::Input(x, hx);
+		// Find the largest magnitude with the SIMD kernel, then the first element that has it.
+		double m = detail::MaxChunks(a.n, [&](size_t lo, size_t hi) {
+			return detail::AbsMax(hi - lo, a.p + lo * a.inc, a.inc);
+		});
+		for (size_t i = 0; i < a.n; i++) {
+			if (fabs(a.p[i * a.inc]) == m) return i;
+		}
+		return 0;
+	}
+
+	void gemv(double alpha, ConstMatrixView A, ConstMatrixView x, double beta, MatrixView y) {
+		detail::VectorRef out;
+		if (!detail::Describe(y, out)) {
+			Matrix2D tmp(y);
+			gemv(alpha, A, x, beta, tmp);
+			y = tmp;
+			return;
+		}
+		size_t m = A.getSizeX(), n = A.getSizeY();
+		Matrix2D hx(0, 0);
+		detail::VectorRef in = detail::Input(x, hx);
+		if (in.n != n || out.n != m) throw invalid_argument("Cannot multiply these matrices: incompatible dimensions.");
+		bool trans = A.isTransposed();
+		ConstMatrixView src = trans ? A.transposed() : A;
+		if (!src.isStrided()) {
+			gemv(alpha, Matrix2D(A), x, beta, y);
+			return;
+		}
+		// The kernels want x contiguous; a strided x is gathered once.
+		vector<double> xs;
+		const double *xp = in.p;
+		if (in.inc != 1) {
+			xs.resize(n);
+			for (size_t i = 0; i < n; i++) xs[i] = in.p[i * in.inc];
+			xp = xs.data();
+		}
+		const double *a = src.data();
+		size_t lda = src.getStride();
+		double *yp = out.mut();
+		if (!trans) { // one dot product per row of A
+			detail::ParallelFor(0, m, detail::RowGrain(n), [&](size_t lo, size_t hi) {
+				for (size_t i = lo; i < hi; i++) {
+					double t = alpha * detail::Dot(n, a + i * lda, 1, xp, 1);
+					double &yi = yp[i * out.inc];
+					yi = beta == 0 ? t : t + beta * yi;
+				}
+			});
+			return;
+		}
+		// y = alpha * src^T * x: accumulate rows of src into y, each thread owning a slice of y.
+		vector<double> ys;
+		double *acc = yp;
+		if (out.inc != 1) {
+			ys.assign(m, 0.0);
+			acc = ys.data();
+		}
+		detail::ParallelFor(0, m, max<size_t>(512, detail::RowGrain(n) * 64), [&](size_t lo, size_t hi) {
+			if (acc == yp) {
+				for (size_t j = lo; j < hi; j++) yp[j] = beta == 0 ? 0 : beta * yp[j];
+			}
+			for (size_t i = 0; i < n; i++) {
+				if (xp[i] != 0) detail::Axpy(hi - lo, alpha * xp[i], a + i * lda + lo, 1, acc + lo, 1);
+			}
+			if (acc != yp) {
+				for (size_t j = lo; j < hi; j++) {
+					double &yj = yp[j * out.inc];
+					yj = beta == 0 ? acc[j] : acc[j] + beta * yj;
+				}
+			}
+		});
+	}
+
+	void ger(double alpha, ConstMatrixView x, ConstMatrixView y, MatrixView A) {
+		if (A.isTransposed()) { // A^T += alpha * y * x^T, in A's source
+			ger(alpha, y, x, A.transposed());
+			return;
+		}
+		if (!A.isStrided()) {
+			Matrix2D tmp(A);
+			ger(alpha, x, y, tmp);
+			A = tmp;
+			return;
+		}
+		Matrix2D hx(0, 0), hy(0, 0);
+		detail::VectorRef u = detail::Input(x, hx), v = detail::Input(y, hy);
+		size_t m = A.getSizeX(), n = A.getSizeY();
+		if (u.n != m || v.n != n) throw invalid_argument("Cannot apply the rank-1 update: incompatible dimensions.");
+		double *a = A.data();
+		size_t lda = A.getStride();
+		detail::ParallelFor(0, m, detail::RowGrain(n), [&](size_t lo, size_t hi) {
+			for (size_t i = lo; i < hi; i++) {
+				double s = alpha * u.p[i * u.inc];
+				if (s != 0) detail::Axpy(n, s, v.p, v.inc, a + i * lda, 1);
+			}
+		});
+	}
+}
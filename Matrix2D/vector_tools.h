@@ -1,6 +1,10 @@
 /**
  * @file vector_tools.h
  * Interface to methods specialised for processing one-dimensional vectors made from Matrix2D objects with size_y = 1.
+ * The BLAS level-1 and level-2 kernels below accept any vector: a column (n x 1) or row (1 x n) matrix, or a
+ * strided row or column slice of a larger matrix such as A.colView(j). Contiguous vectors run on AVX2/FMA kernels
+ * when the CPU supports them, and long vectors are split into fixed chunks that run on the thread pool; reductions
+ * add the chunks' partial results in order, so they do not depend on the thread count.
  */
 
 #ifndef MATRIX2D_1D_TOOLS
@@ -8,6 +12,41 @@
 
 #include "matrix_2d.h"
 
+namespace m2d {
+	/** Dot product of two vectors of the same length.
+	* @exception invalid_argument() if either operand is not a vector or the lengths differ.
+	*/
+	MATRIX2D_LIB double dot(ConstMatrixView x, ConstMatrixView y);
+	/** y = alpha * x + y, in place.
+	* @exception invalid_argument() if either operand is not a vector or the lengths differ.
+	*/
+	MATRIX2D_LIB void axpy(double alpha, ConstMatrixView x, MatrixView y);
+	/** x = alpha * x, in place.
+	* @exception invalid_argument() if x is not a vector.
+	*/
+	MATRIX2D_LIB void scal(double alpha, MatrixView x);
+	/** Euclidean norm. Computed directly when the sum of squares is safely in range, and by rescaling with the
+	* largest magnitude otherwise, so it neither overflows nor underflows for representable results.
+	* @exception invalid_argument() if x is not a vector.
+	*/
+	MATRIX2D_LIB double nrm2(ConstMatrixView x);
+	/** Sum of absolute values.
+	* @exception invalid_argument() if x is not a vector.
+	*/
+	MATRIX2D_LIB double asum(ConstMatrixView x);
+	/** Index of the first element of largest absolute value, counting from 0. Returns 0 for an empty vector.
+	* @exception invalid_argument() if x is not a vector.
+	*/
+	MATRIX2D_LIB size_t iamax(ConstMatrixView x);
+	/** Matrix-vector multiply-accumulate: y = alpha * A * x + beta * y. With beta = 0, y is overwritten.
+	* A may be a transposed view, as in gemv(1, A.transposed(), x, 0, y), which reads A in place.
+	* @exception invalid_argument() if x or y is not a vector or the sizes do not match.
+	*/
+	MATRIX2D_LIB void gemv(double alpha, ConstMatrixView A, ConstMatrixView x, double beta, MatrixView y);
+	/** Rank-1 update: A = alpha * x * y^T + A, in place.
+	* @exception invalid_argument() if x or y is not a vector or the sizes do not match.
+	*/
+	MATRIX2D_LIB void ger(double alpha, ConstMatrixView x, ConstMatrixView y, MatrixView A);
+}
 
-
-#endif // MATRIX2D_1D_TOOLS
\ No newline at end of file
+#endif // MATRIX2D_1D_TOOLS
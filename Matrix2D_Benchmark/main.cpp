@@ -0,0 +1,496 @@
+// Benchmark driver for the Matrix2D hot paths.
+// Sweeps matrix sizes and thread counts, reports latency percentiles, GFLOP/s, GB/s and heap allocations per call,
+// writes the results as JSON and compares them against a stored baseline to flag regressions.
+//
+// Usage: Matrix2D_Benchmark [--quick] [--sizes 64,256,1024] [--threads 1,4] [--filter name]
+//                           [--min-time seconds] [--min-samples n] [--json path|-]
+//                           [--baseline path] [--tolerance fraction] [--allocator heap|pool|arena]
+// The exit code is 1 if any case ran slower than its baseline by more than the tolerance, 2 on bad usage and 3 on
+// other errors. --allocator picks where matrix storage comes from: the heap, the recycling pool, or an arena made
+// current around every call and reset after it.
+#include "matrix_2d.h"
+#include "block_matrix.h"
+#include "matrix_allocator.h"
+#include "task_graph.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Allocation counting. Replacing the global operator new counts every heap allocation in the process, including
+// those made inside the Matrix2D shared library on ELF platforms. A Windows DLL keeps its own allocator, so there
+// only the benchmark's side is seen.
+static atomic<size_t> alloc_count{ 0 }, alloc_bytes{ 0 };
+
+static void *CountedAlloc(size_t size) {
+	alloc_count.fetch_add(1, memory_order_relaxed);
+	alloc_bytes.fetch_add(size, memory_order_relaxed);
+	if (void *p = malloc(size ? size : 1)) return p;
+	throw bad_alloc();
+}
+static void *CountedAlignedAlloc(size_t size, size_t align) {
+	alloc_count.fetch_add(1, memory_order_relaxed);
+	alloc_bytes.fetch_add(size, memory_order_relaxed);
+#ifdef _WIN32
+	if (void *p = _aligned_malloc(size ? size : 1, align)) return p;
+#else
+	void *p = nullptr;
+	if (posix_memalign(&p, max(align, sizeof(void*)), size ? size : 1) == 0) return p;
+#endif
+	throw bad_alloc();
+}
+static void AlignedRelease(void *p) noexcept {
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+void *operator new(size_t size) { return CountedAlloc(size); }
+void *operator new[](size_t size) { return CountedAlloc(size); }
+void *operator new(size_t size, const nothrow_t&) noexcept { try { return CountedAlloc(size); } catch (...) { return nullptr; } }
+void *operator new[](size_t size, const nothrow_t&) noexcept { try { return CountedAlloc(size); } catch (...) { return nullptr; } }
+void *operator new(size_t size, align_val_t align) { return CountedAlignedAlloc(size, (size_t)align); }
+void *operator new[](size_t size, align_val_t align) { return CountedAlignedAlloc(size, (size_t)align); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, align_val_t) noexcept { AlignedRelease(p); }
+void operator delete[](void *p, align_val_t) noexcept { AlignedRelease(p); }
+void operator delete(void *p, size_t, align_val_t) noexcept { AlignedRelease(p); }
+void operator delete[](void *p, size_t, align_val_t) noexcept { AlignedRelease(p); }
+
+namespace {
+	struct Options {
+		vector<size_t> sizes = { 64, 256, 1024 };
+		vector<size_t> threads; // empty: 1 and the hardware concurrency
+		string filter;
+		double min_time = 0.25; // seconds of timed samples per case
+		size_t min_samples = 5;
+		string json_path;
+		string baseline_path;
+		double tolerance = 0.10; // allowed slowdown of the median before a case counts as a regression
+		string allocator = "heap";
+	};
+
+	/** One benchmark: prepares its operands for a size, then returns the timed call. */
+	struct Case {
+		const char *name;
+		function<double(size_t)> flops; // floating-point operations per call
+		function<double(size_t)> bytes; // bytes necessarily read and written per call
+		// Builds the state for size n and returns { untimed preparation, timed call }.
+		function<pair<function<void()>, function<void()>>(size_t)> setup;
+	};
+
+	struct Result {
+		string name;
+		size_t n, threads, samples;
+		double min_ns, mean_ns, p50_ns, p90_ns, p99_ns;
+		double gflops, gbps, allocs_per_call, alloc_bytes_per_call;
+	};
+
+	m2d::Matrix2D RandomMatrix(size_t rows, size_t cols, unsigned seed) {
+		mt19937_64 rng(seed);
+		uniform_real_distribution<double> dist(-1, 1);
+		m2d::Matrix2D m(rows, cols);
+		for (size_t x = 0; x < rows; x++) {
+			double *r = m.row(x);
+			for (size_t y = 0; y < cols; y++) r[y] = dist(rng);
+		}
+		return m;
+	}
+	// Diagonally dominant, so the factorisations without pivoting are stable.
+	m2d::Matrix2D DominantMatrix(size_t n, unsigned seed) {
+		m2d::Matrix2D m = RandomMatrix(n, n, seed);
+		for (size_t i = 0; i < n; i++) m.row(i)[i] += (double)n;
+		return m;
+	}
+
+	// Symmetric and diagonally dominant with a positive diagonal, hence positive definite.
+	m2d::Matrix2D SpdMatrix(size_t n, unsigned seed) {
+		m2d::Matrix2D m = DominantMatrix(n, seed);
+		for (size_t x = 0; x < n; x++) {
+			for (size_t y = 0; y < x; y++) m.row(y)[x] = m.row(x)[y];
+		}
+		return m;
+	}
+
+	// Keeps results alive so that the optimiser cannot drop the timed work.
+	volatile double sink;
+
+	vector<Case> MakeCases(const string &scratch) {
+		auto none = [](size_t) { return 0.0; };
+		auto square_bytes = [](double matrices) { return [matrices](size_t n) { return matrices * n * n * sizeof(double); }; };
+		auto lu_flops = [](size_t n) { return 2.0 / 3.0 * n * n * n; };
+		vector<Case> cases;
+		cases.push_back({ "multiply", [](size_t n) { return 2.0 * n * n * n; }, square_bytes(3), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 1)), B = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 2));
+			return make_pair(function<void()>(), function<void()>([A, B] { m2d::Matrix2D C = *A * *B; sink = C.coeff(0, 0); }));
+		} });
+		cases.push_back({ "add", [](size_t n) { return 1.0 * n * n; }, square_bytes(3), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 1)), B = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 2));
+			return make_pair(function<void()>(), function<void()>([A, B] { m2d::Matrix2D C = *A + *B; sink = C.coeff(0, 0); }));
+		} });
+		cases.push_back({ "transpose", none, square_bytes(2), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(RandomMatrix(n, n + 1, 1));
+			return make_pair(function<void()>(), function<void()>([A] { A->transpose(); sink = A->coeff(0, 0); }));
+		} });
+		cases.push_back({ "det", lu_flops, square_bytes(2), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(DominantMatrix(n, 1));
+			// Marked modified before each call, so that every call factorises instead of reusing the last one.
+			return make_pair(function<void()>([A] { A->markModified(); }), function<void()>([A] { sink = A->det(); }));
+		} });
+		cases.push_back({ "det_after_setAt", none, square_bytes(1), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(DominantMatrix(n, 1));
+			auto step = make_shared<size_t>(0);
+			return make_pair(function<void()>(), function<void()>([A, step, n] {
+				size_t i = (*step)++ % n;
+				A->setAt(i, (i * 7) % n, A->coeff(i, (i * 7) % n) + 0.01); // one element changed: a rank-1 update
+				sink = A->det();
+			}));
+		} });
+		cases.push_back({ "lu_factorize", lu_flops, square_bytes(2), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(DominantMatrix(n, 1)), LU = make_shared<m2d::Matrix2D>(n, n);
+			return make_pair(function<void()>([A, LU] { *LU = *A; }),
+				function<void()>([LU] { sink = (double)m2d::LUFactorize(*LU).size(); }));
+		} });
+		cases.push_back({ "lu_doolittle", lu_flops, square_bytes(3), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(DominantMatrix(n, 1));
+			auto L = make_shared<m2d::Matrix2D>(n, n), U = make_shared<m2d::Matrix2D>(n, n);
+			return make_pair(function<void()>(), function<void()>([A, L, U] {
+				m2d::LUFactorizeDoolittle(*A, *L, *U);
+				sink = U->coeff(0, 0);
+			}));
+		} });
+		cases.push_back({ "lu_crout", lu_flops, square_bytes(3), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(DominantMatrix(n, 1));
+			auto L = make_shared<m2d::Matrix2D>(n, n), U = make_shared<m2d::Matrix2D>(n, n);
+			return make_pair(function<void()>(), function<void()>([A, L, U] {
+				m2d::LUFactorizeCrout(*A, *L, *U);
+				sink = L->coeff(0, 0);
+			}));
+		} });
+		cases.push_back({ "adjugate", [](size_t n) { return 2.0 * n * n * n; }, square_bytes(2), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(DominantMatrix(n, 1));
+			return make_pair(function<void()>(), function<void()>([A] { sink = A->adjugate().coeff(0, 0); }));
+		} });
+		cases.push_back({ "cholesky", [](size_t n) { return n * n * n / 3.0; }, square_bytes(1), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(SpdMatrix(n, 1)), L = make_shared<m2d::Matrix2D>(n, n);
+			return make_pair(function<void()>([A, L] { *L = *A; }),
+				function<void()>([L] { sink = m2d::CholeskyFactorize(*L); }));
+		} });
+		cases.push_back({ "qr_factorize", [](size_t n) { return 4.0 / 3.0 * n * n * n; }, square_bytes(2), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 1)), QR = make_shared<m2d::Matrix2D>(n, n);
+			return make_pair(function<void()>([A, QR] { *QR = *A; }),
+				function<void()>([QR] { sink = m2d::QRFactorize(*QR)[0]; }));
+		} });
+		cases.push_back({ "task_graph", [](size_t n) { return 4.0 * n * n * n; }, square_bytes(4), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 1)), B = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 2));
+			return make_pair(function<void()>(), function<void()>([A, B] {
+				// Two independent products, then one fused pass for the element-wise tail.
+				m2d::TaskGraph graph;
+				m2d::DeferredMatrix a = graph.input(*A), b = graph.input(*B);
+				m2d::DeferredMatrix C = a * b - 2.0 * (b * a) + a;
+				sink = C.get().coeff(0, 0);
+			}));
+		} });
+		cases.push_back({ "submatrix", none, [](size_t n) { return 2.0 * (n / 2) * (n / 2) * sizeof(double); }, [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 1));
+			return make_pair(function<void()>(), function<void()>([A, n] {
+				m2d::Matrix2D S = A->subMatrix(n / 4, n / 4, n / 2, n / 2);
+				sink = S.getSizeX() ? S.coeff(0, 0) : 0;
+			}));
+		} });
+		cases.push_back({ "concat_horizontal", none, square_bytes(4), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 1)), B = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 2));
+			return make_pair(function<void()>(), function<void()>([A, B] {
+				m2d::Matrix2D C = m2d::ConcatenateHorizontally(*A, *B);
+				sink = C.coeff(0, 0);
+			}));
+		} });
+		cases.push_back({ "concat_vertical", none, square_bytes(4), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 1)), B = make_shared<m2d::Matrix2D>(RandomMatrix(n, n, 2));
+			return make_pair(function<void()>(), function<void()>([A, B] {
+				m2d::Matrix2D C = m2d::ConcatenateVertically(*A, *B);
+				sink = C.coeff(0, 0);
+			}));
+		} });
+		cases.push_back({ "block_saddle_solve", [](size_t n) { return 2.0 / 3.0 * n * n * n + 1.5 * n * n * n; }, square_bytes(2), [](size_t n) {
+			auto A = make_shared<m2d::Matrix2D>(DominantMatrix(n, 1)), B = make_shared<m2d::Matrix2D>(RandomMatrix(n / 2, n, 2));
+			auto rhs = make_shared<m2d::Matrix2D>(RandomMatrix(n + n / 2, 1, 3));
+			return make_pair(function<void()>(), function<void()>([A, B, rhs, n] {
+				// [A B^T; B 0], solved through the Schur complement without assembling it.
+				m2d::BlockMatrix K({ n, n / 2 }, { n, n / 2 });
+				K.setBlock(0, 0, *A);
+				K.setBlock(0, 1, B->transposed());
+				K.setBlock(1, 0, *B);
+				sink = m2d::solve(K, *rhs).coeff(0, 0);
+			}));
+		} });
+		cases.push_back({ "input_matrix", none, [scratch](size_t n) {
+			ifstream probe(scratch + to_string(n) + ".txt", ios::binary | ios::ate);
+			return (double)probe.tellg() + n * n * sizeof(double);
+		}, [scratch](size_t n) {
+			string path = scratch + to_string(n) + ".txt";
+			{
+				m2d::Matrix2D A = RandomMatrix(n, n, 1);
+				ofstream out(path);
+				out.precision(17);
+				for (size_t x = 0; x < n; x++) {
+					for (size_t y = 0; y < n; y++) out << A.coeff(x, y) << ' ';
+					out << '\n';
+				}
+			}
+			auto in = make_shared<ifstream>(path);
+			auto M = make_shared<m2d::Matrix2D>(n, n);
+			return make_pair(function<void()>([in] { in->clear(); in->seekg(0); }),
+				function<void()>([in, M] { m2d::InputMatrix(*in, *M); sink = M->coeff(0, 0); }));
+		} });
+		return cases;
+	}
+
+	double Percentile(const vector<double> &sorted, double p) {
+		double pos = p * (sorted.size() - 1);
+		size_t lo = (size_t)pos;
+		size_t hi = min(lo + 1, sorted.size() - 1);
+		return sorted[lo] + (pos - lo) * (sorted[hi] - sorted[lo]);
+	}
+
+	Result Measure(const Case &c, size_t n, size_t threads, const Options &opt) {
+		m2d::SetThreadCount(threads);
+		auto fns = c.setup(n);
+		const function<void()> &prepare = fns.first, &call = fns.second;
+		unique_ptr<m2d::MatrixArena> arena;
+		if (opt.allocator == "arena") arena.reset(new m2d::MatrixArena());
+		auto run = [&] {
+			if (!arena) return call();
+			{
+				m2d::ScopedAllocator use(*arena);
+				call();
+			}
+			arena->reset();
+		};
+		if (prepare) prepare();
+		run(); // warm-up: page faults, pack buffers, thread pool start-up
+		vector<double> samples;
+		size_t allocs = 0, bytes = 0;
+		double total = 0;
+		while (samples.size() < opt.min_samples || total < opt.min_time) {
+			if (prepare) prepare();
+			size_t a0 = alloc_count.load(), b0 = alloc_bytes.load();
+			auto t0 = chrono::steady_clock::now();
+			run();
+			auto t1 = chrono::steady_clock::now();
+			allocs += alloc_count.load() - a0;
+			bytes += alloc_bytes.load() - b0;
+			double ns = chrono::duration<double, nano>(t1 - t0).count();
+			samples.push_back(ns);
+			total += ns * 1e-9;
+		}
+		vector<double> sorted = samples;
+		sort(sorted.begin(), sorted.end());
+		Result r;
+		r.name = c.name;
+		r.n = n;
+		r.threads = threads;
+		r.samples = samples.size();
+		r.min_ns = sorted.front();
+		r.mean_ns = total * 1e9 / samples.size();
+		r.p50_ns = Percentile(sorted, 0.50);
+		r.p90_ns = Percentile(sorted, 0.90);
+		r.p99_ns = Percentile(sorted, 0.99);
+		r.gflops = c.flops(n) / r.p50_ns;
+		r.gbps = c.bytes(n) / r.p50_ns;
+		r.allocs_per_call = (double)allocs / samples.size();
+		r.alloc_bytes_per_call = (double)bytes / samples.size();
+		return r;
+	}
+
+	void WriteJson(ostream &os, const vector<Result> &results) {
+		os << "{\n  \"schema\": 1,\n  \"library\": \"Matrix2D\",\n  \"hardware_threads\": "
+			<< thread::hardware_concurrency() << ",\n  \"results\": [\n";
+		os.precision(6);
+		for (size_t i = 0; i < results.size(); i++) {
+			const Result &r = results[i];
+			os << "    {\"name\": \"" << r.name << "\", \"n\": " << r.n << ", \"threads\": " << r.threads
+				<< ", \"samples\": " << r.samples << fixed
+				<< ", \"min_ns\": " << r.min_ns << ", \"mean_ns\": " << r.mean_ns << ", \"p50_ns\": " << r.p50_ns
+				<< ", \"p90_ns\": " << r.p90_ns << ", \"p99_ns\": " << r.p99_ns
+				<< ", \"gflops\": " << r.gflops << ", \"gbps\": " << r.gbps
+				<< ", \"allocs_per_call\": " << r.allocs_per_call << ", \"alloc_bytes_per_call\": " << r.alloc_bytes_per_call
+				<< defaultfloat << '}' << (i + 1 < results.size() ? ",\n" : "\n");
+		}
+		os << "  ]\n}\n";
+	}
+
+	// Reads the results back from a file written by WriteJson(). This is not a general JSON parser: it relies on
+	// every result being a flat object of string and number fields.
+	map<string, double> ReadBaseline(const string &path) {
+		ifstream in(path);
+		if (!in) throw runtime_error("Cannot open baseline " + path + ".");
+		stringstream ss;
+		ss << in.rdbuf();
+		string text = ss.str();
+		map<string, double> medians;
+		size_t pos = text.find("\"results\"");
+		if (pos == string::npos) throw runtime_error("Baseline " + path + " has no results.");
+		while ((pos = text.find('{', pos)) != string::npos) {
+			size_t end = text.find('}', pos);
+			if (end == string::npos) break;
+			map<string, string> fields;
+			size_t at = pos + 1;
+			while (true) {
+				size_t k0 = text.find('"', at);
+				if (k0 == string::npos || k0 > end) break;
+				size_t k1 = text.find('"', k0 + 1);
+				size_t colon = text.find(':', k1);
+				size_t v0 = text.find_first_not_of(" \t\r\n", colon + 1);
+				size_t v1;
+				string value;
+				if (text[v0] == '"') {
+					v1 = text.find('"', v0 + 1);
+					value = text.substr(v0 + 1, v1 - v0 - 1);
+					v1++;
+				}
+				else {
+					v1 = text.find_first_of(",}", v0);
+					value = text.substr(v0, v1 - v0);
+				}
+				fields[text.substr(k0 + 1, k1 - k0 - 1)] = value;
+				at = v1;
+			}
+			if (fields.count("name") && fields.count("n") && fields.count("threads") && fields.count("p50_ns"))
+				medians[fields["name"] + "/" + fields["n"] + "/" + fields["threads"]] = atof(fields["p50_ns"].c_str());
+			pos = end + 1;
+		}
+		return medians;
+	}
+
+	vector<size_t> ParseList(const char *arg) {
+		vector<size_t> values;
+		stringstream ss(arg);
+		string item;
+		while (getline(ss, item, ',')) {
+			if (!item.empty()) values.push_back((size_t)stoull(item));
+		}
+		return values;
+	}
+
+	int Usage() {
+		cerr << "Usage: Matrix2D_Benchmark [--quick] [--sizes 64,256,1024] [--threads 1,4] [--filter name]\n"
+			"                          [--min-time seconds] [--min-samples n] [--json path|-]\n"
+			"                          [--baseline path] [--tolerance fraction] [--allocator heap|pool|arena]\n";
+		return 2;
+	}
+}
+
+int main(int argc, char **argv) {
+	Options opt;
+	try {
+		for (int i = 1; i < argc; i++) {
+			string arg = argv[i];
+			bool has_value = i + 1 < argc;
+			if (arg == "--quick") {
+				opt.sizes = { 32, 96 };
+				opt.min_time = 0;
+				opt.min_samples = 3;
+			}
+			else if (arg == "--sizes" && has_value) opt.sizes = ParseList(argv[++i]);
+			else if (arg == "--threads" && has_value) opt.threads = ParseList(argv[++i]);
+			else if (arg == "--filter" && has_value) opt.filter = argv[++i];
+			else if (arg == "--min-time" && has_value) opt.min_time = stod(argv[++i]);
+			else if (arg == "--min-samples" && has_value) opt.min_samples = max<size_t>(1, stoull(argv[++i]));
+			else if (arg == "--json" && has_value) opt.json_path = argv[++i];
+			else if (arg == "--baseline" && has_value) opt.baseline_path = argv[++i];
+			else if (arg == "--tolerance" && has_value) opt.tolerance = stod(argv[++i]);
+			else if (arg == "--allocator" && has_value) {
+				opt.allocator = argv[++i];
+				if (opt.allocator != "heap" && opt.allocator != "pool" && opt.allocator != "arena") return Usage();
+			}
+			else return Usage();
+		}
+	}
+	catch (exception &) {
+		return Usage();
+	}
+	if (opt.allocator == "pool") m2d::SetDefaultAllocator(m2d::PoolAllocator());
+	if (opt.threads.empty()) {
+		opt.threads.push_back(1);
+		size_t hw = thread::hardware_concurrency();
+		if (hw > 1) opt.threads.push_back(hw);
+	}
+
+	try {
+		string scratch = "matrix2d_benchmark_input_";
+		vector<Case> cases = MakeCases(scratch);
+		vector<Result> results;
+		ostream &log = opt.json_path == "-" ? cerr : cout;
+		log << "case                 n  thr        p50        p90        p99   GFLOP/s     GB/s  allocs\n";
+		for (const Case &c : cases) {
+			if (!opt.filter.empty() && string(c.name).find(opt.filter) == string::npos) continue;
+			for (size_t n : opt.sizes) {
+				for (size_t t : opt.threads) {
+					Result r = Measure(c, n, t, opt);
+					results.push_back(r);
+					char line[160];
+					snprintf(line, sizeof(line), "%-18s %5zu %4zu %8.3f ms %8.3f ms %8.3f ms %9.2f %8.2f %7.1f\n",
+						r.name.c_str(), r.n, r.threads, r.p50_ns * 1e-6, r.p90_ns * 1e-6, r.p99_ns * 1e-6,
+						r.gflops, r.gbps, r.allocs_per_call);
+					log << line << flush;
+				}
+			}
+		}
+		for (size_t n : opt.sizes) remove((scratch + to_string(n) + ".txt").c_str());
+
+		if (opt.json_path == "-") WriteJson(cout, results);
+		else if (!opt.json_path.empty()) {
+			ofstream out(opt.json_path);
+			WriteJson(out, results);
+			if (!out) throw runtime_error("Cannot write " + opt.json_path + ".");
+		}
+
+		int status = 0;
+		if (!opt.baseline_path.empty()) {
+			map<string, double> baseline = ReadBaseline(opt.baseline_path);
+			size_t compared = 0, regressions = 0;
+			for (const Result &r : results) {
+				auto it = baseline.find(r.name + "/" + to_string(r.n) + "/" + to_string(r.threads));
+				if (it == baseline.end() || it->second <= 0) continue;
+				compared++;
+				double ratio = r.p50_ns / it->second;
+				if (ratio > 1 + opt.tolerance) {
+					regressions++;
+					char line[160];
+					snprintf(line, sizeof(line), "REGRESSION %s n=%zu threads=%zu: median %.3f ms vs baseline %.3f ms (%+.1f%%)\n",
+						r.name.c_str(), r.n, r.threads, r.p50_ns * 1e-6, it->second * 1e-6, (ratio - 1) * 100);
+					log << line;
+				}
+			}
+			log << "Compared " << compared << " cases against " << opt.baseline_path << ": "
+				<< regressions << " regression(s) beyond " << opt.tolerance * 100 << "%.\n";
+			if (regressions) status = 1;
+		}
+		return status;
+	}
+	catch (exception &e) {
+		cerr << e.what() << '\n';
+		return 3;
+	}
+}
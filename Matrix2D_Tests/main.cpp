@@ -0,0 +1,1032 @@
+// Correctness tests for Matrix2D.
+// Every check compares the library against a naive reference written here with plain loops, or against an identity
+// that must hold (A * X = B after a solve). Each test runs once on a single thread and once on four, so that the
+// parallel paths are exercised even on small inputs.
+//
+// Usage: Matrix2D_Tests [--filter name]
+// The exit code is the number of failed tests, capped at 100.
+#include "matrix_2d.h"
+#include "basic_matrix.h"
+#include "block_matrix.h"
+#include "fixed_matrix.h"
+#include "iterative_solvers.h"
+#include "matrix_allocator.h"
+#include "matrix_batch.h"
+#include "matrix_io.h"
+#include "profiler.h"
+#include "sparse_matrix.h"
+#include "task_graph.h"
+#include "thread_pool.h"
+#include "tiled_matrix.h"
+#include "vector_tools.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+	// Thrown by CHECK, caught per test.
+	struct CheckFailure : runtime_error {
+		using runtime_error::runtime_error;
+	};
+
+#define CHECK(condition) \
+	do { if (!(condition)) throw CheckFailure(string(__FILE__ ":") + to_string(__LINE__) + ": " #condition); } while (0)
+#define CHECK_CLOSE(actual, expected, tolerance) \
+	do { \
+		double check_error_ = MaxRelativeError(actual, expected); \
+		if (!(check_error_ <= (tolerance))) throw CheckFailure(string(__FILE__ ":") + to_string(__LINE__) + ": " \
+			#actual " vs " #expected ": relative error " + to_string(check_error_)); \
+	} while (0)
+
+	// Reference implementations. Deliberately naive: they only read coeff() and loop.
+
+	m2d::Matrix2D RandomMatrix(size_t rows, size_t cols, unsigned seed) {
+		mt19937 rng(seed);
+		uniform_real_distribution<double> dist(-1.0, 1.0);
+		m2d::Matrix2D m(rows, cols);
+		for (size_t x = 0; x < rows; x++)
+			for (size_t y = 0; y < cols; y++) m.setAt(x, y, dist(rng));
+		return m;
+	}
+	m2d::Matrix2D Identity(size_t n) {
+		m2d::Matrix2D m(n, n);
+		for (size_t i = 0; i < n; i++) m.setAt(i, i, 1);
+		return m;
+	}
+	m2d::Matrix2D NaiveProduct(m2d::ConstMatrixView A, m2d::ConstMatrixView B) {
+		m2d::Matrix2D C(A.getSizeX(), B.getSizeY());
+		for (size_t x = 0; x < A.getSizeX(); x++) {
+			for (size_t y = 0; y < B.getSizeY(); y++) {
+				double sum = 0;
+				for (size_t k = 0; k < A.getSizeY(); k++) sum += A.coeff(x, k) * B.coeff(k, y);
+				C.setAt(x, y, sum);
+			}
+		}
+		return C;
+	}
+	// Gaussian elimination with partial pivoting on a plain copy.
+	double NaiveDet(m2d::ConstMatrixView A) {
+		size_t n = A.getSizeX();
+		vector<vector<double>> a(n, vector<double>(n));
+		for (size_t x = 0; x < n; x++)
+			for (size_t y = 0; y < n; y++) a[x][y] = A.coeff(x, y);
+		double det = 1;
+		for (size_t k = 0; k < n; k++) {
+			size_t p = k;
+			for (size_t i = k + 1; i < n; i++) if (fabs(a[i][k]) > fabs(a[p][k])) p = i;
+			if (a[p][k] == 0) return 0;
+			if (p != k) {
+				swap(a[p], a[k]);
+				det = -det;
+			}
+			det *= a[k][k];
+			for (size_t i = k + 1; i < n; i++) {
+				double f = a[i][k] / a[k][k];
+				for (size_t j = k; j < n; j++) a[i][j] -= f * a[k][j];
+			}
+		}
+		return det;
+	}
+	// adj(A)(i, j) = (-1)^(i + j) det(minor(j, i)).
+	m2d::Matrix2D NaiveAdjugate(const m2d::Matrix2D &A) {
+		size_t n = A.getSizeX();
+		m2d::Matrix2D adj(n, n);
+		for (size_t i = 0; i < n; i++)
+			for (size_t j = 0; j < n; j++)
+				adj.setAt(i, j, ((i + j) % 2 ? -1 : 1) * NaiveDet(A.minorView(j, i)));
+		return adj;
+	}
+
+	// max |actual - expected| / max(1, max |expected|), so that tolerances read as relative to the data's scale.
+	double MaxRelativeError(m2d::ConstMatrixView actual, m2d::ConstMatrixView expected) {
+		if (actual.getSizeX() != expected.getSizeX() || actual.getSizeY() != expected.getSizeY())
+			return numeric_limits<double>::infinity();
+		double error = 0, scale = 1;
+		for (size_t x = 0; x < actual.getSizeX(); x++) {
+			for (size_t y = 0; y < actual.getSizeY(); y++) {
+				double d = fabs(actual.coeff(x, y) - expected.coeff(x, y));
+				if (!(d == d)) return numeric_limits<double>::infinity();
+				error = max(error, d);
+				scale = max(scale, fabs(expected.coeff(x, y)));
+			}
+		}
+		return error / scale;
+	}
+	double MaxRelativeError(double actual, double expected) {
+		double d = fabs(actual - expected);
+		return d == d ? d / max(1.0, fabs(expected)) : numeric_limits<double>::infinity();
+	}
+	// ||A * X - B|| relative to ||A|| * ||X||, in the max norm.
+	double Residual(m2d::ConstMatrixView A, m2d::ConstMatrixView X, m2d::ConstMatrixView B) {
+		m2d::Matrix2D AX = NaiveProduct(A, X);
+		double error = 0, a = 0, x = 0;
+		for (size_t i = 0; i < B.getSizeX(); i++)
+			for (size_t j = 0; j < B.getSizeY(); j++) error = max(error, fabs(AX.coeff(i, j) - B.coeff(i, j)));
+		for (size_t i = 0; i < A.getSizeX(); i++)
+			for (size_t j = 0; j < A.getSizeY(); j++) a = max(a, fabs(A.coeff(i, j)));
+		for (size_t i = 0; i < X.getSizeX(); i++)
+			for (size_t j = 0; j < X.getSizeY(); j++) x = max(x, fabs(X.coeff(i, j)));
+		return error / max(numeric_limits<double>::min(), a * x * A.getSizeY());
+	}
+
+	// Tests
+
+	void TestGemmViews() {
+		// Sizes straddle the packing block sizes, so edge tiles are covered.
+		m2d::Matrix2D A = RandomMatrix(97, 131, 1), B = RandomMatrix(131, 75, 2), Bt = RandomMatrix(75, 131, 3);
+		CHECK_CLOSE(A * B, NaiveProduct(A, B), 1e-13);
+		CHECK_CLOSE(A * Bt.transposed(), NaiveProduct(A, Bt.transposed()), 1e-13);
+		m2d::Matrix2D At = RandomMatrix(131, 97, 4);
+		CHECK_CLOSE(At.transposed() * B, NaiveProduct(At.transposed(), B), 1e-13);
+		CHECK_CLOSE(At.transposed() * Bt.transposed(), NaiveProduct(At.transposed(), Bt.transposed()), 1e-13);
+		// Minors and blocks of larger matrices.
+		m2d::Matrix2D S = RandomMatrix(60, 60, 5);
+		m2d::ConstMatrixView minor = S.minorView(17, 42), block = S.subView(3, 5, 40, 50);
+		CHECK_CLOSE(minor * minor, NaiveProduct(minor, minor), 1e-13);
+		CHECK_CLOSE(block.transposed() * minor.subView(0, 0, 40, 59), NaiveProduct(block.transposed(), minor.subView(0, 0, 40, 59)), 1e-13);
+		// Accumulation, and beta = 0 ignoring NaNs already in C.
+		m2d::Matrix2D C = RandomMatrix(97, 75, 6), expected = C;
+		m2d::gemm(-0.5, A, B, 2.0, C);
+		m2d::Matrix2D AB = NaiveProduct(A, B);
+		for (size_t x = 0; x < 97; x++)
+			for (size_t y = 0; y < 75; y++) expected.setAt(x, y, 2.0 * expected.coeff(x, y) - 0.5 * AB.coeff(x, y));
+		CHECK_CLOSE(C, expected, 1e-13);
+		C.setAt(0, 0, numeric_limits<double>::quiet_NaN());
+		m2d::gemm(1.0, A, B, 0.0, C);
+		CHECK_CLOSE(C, AB, 1e-13);
+	}
+
+	void TestLU() {
+		for (size_t n : { 1, 7, 64, 150 }) {
+			m2d::Matrix2D A = RandomMatrix(n, n, 10 + (unsigned)n), B = RandomMatrix(n, 3, 20 + (unsigned)n);
+			CHECK_CLOSE(A.det(), NaiveDet(A), 1e-10);
+			m2d::Matrix2D X = m2d::solve(m2d::ConstMatrixView(A), B);
+			CHECK(Residual(A, X, B) < 1e-13);
+			m2d::Matrix2D inv = A;
+			inv.invert();
+			CHECK_CLOSE(NaiveProduct(A, inv), Identity(n), 1e-10);
+		}
+		// Exact singularity: det is exactly 0 and solves refuse.
+		m2d::Matrix2D S = RandomMatrix(5, 5, 30);
+		for (size_t y = 0; y < 5; y++) S.setAt(4, y, S.coeff(0, y));
+		CHECK(fabs(S.det()) < 1e-14);
+		m2d::Matrix2D Z(4, 4);
+		CHECK(Z.det() == 0);
+		bool threw = false;
+		try { m2d::solve(m2d::ConstMatrixView(Z), Identity(4)); }
+		catch (const range_error&) { threw = true; }
+		CHECK(threw);
+	}
+
+	void TestFactorCacheUpdates() {
+		size_t n = 40;
+		m2d::Matrix2D A = RandomMatrix(n, n, 40), B = RandomMatrix(n, 2, 41);
+		A.det(); // builds the cache
+		A.setAt(3, 7, A.getAt(3, 7) + 2.5);
+		CHECK_CLOSE(A.det(), NaiveDet(A), 1e-10);
+		CHECK(Residual(A, m2d::solve(A, B), B) < 1e-12);
+		m2d::Matrix2D U = RandomMatrix(n, 3, 42), V = RandomMatrix(n, 3, 43);
+		A.rankUpdate(U, V);
+		m2d::Matrix2D fresh = A; // a copy with the same contents, factorised from scratch
+		fresh.releaseFactorization();
+		CHECK_CLOSE(A.det(), NaiveDet(fresh), 1e-9);
+		CHECK(Residual(fresh, m2d::solve(A, B), B) < 1e-11);
+		m2d::Matrix2D u = RandomMatrix(n, 1, 44), v = RandomMatrix(1, n, 45);
+		A.rankOneUpdate(u, v);
+		CHECK(Residual(A, m2d::solve(A, B), B) < 1e-11);
+	}
+
+	void TestFactorCacheViews() {
+		// Views made before the cache was built, then written through in every way a view allows.
+		m2d::Matrix2D A = RandomMatrix(30, 30, 46), B = RandomMatrix(30, 2, 47);
+		m2d::MatrixView block = A.subView(0, 0, 2, 2), row = A.rowView(5), transposed = A.transposed();
+		A.det();
+		block.setAt(0, 0, block.getAt(0, 0) + 100);
+		CHECK_CLOSE(A.det(), NaiveDet(A), 1e-10);
+		row.coeffRef(0, 3) -= 7;
+		row.markModified();
+		CHECK(Residual(A, m2d::solve(A, B), B) < 1e-12);
+		block = 2 * block;
+		CHECK_CLOSE(A.det(), NaiveDet(A), 1e-10);
+		transposed.subView(4, 9, 3, 3) += RandomMatrix(3, 3, 48);
+		CHECK_CLOSE(A.det(), NaiveDet(A), 1e-10);
+		// Raw writes through a view's data() are tracked once markModified() is called.
+		row.data()[1] += 3;
+		row.markModified();
+		CHECK_CLOSE(A.det(), NaiveDet(A), 1e-10);
+		// Text parsed into a transposed view, in several chunks on the pool (past 1 MiB of text), lands in the
+		// right places and moves the version on once.
+		m2d::Matrix2D big = RandomMatrix(300, 300, 49), parsed(300, 300);
+		string text;
+		char number[32];
+		for (size_t x = 0; x < 300; x++) {
+			for (size_t y = 0; y < 300; y++) {
+				snprintf(number, sizeof number, "%.17g ", big.coeff(x, y));
+				text += number;
+			}
+		}
+		m2d::MatrixView target = parsed.transposed();
+		parsed.det();
+		m2d::ParseText(text.data(), text.data() + text.size(), target);
+		CHECK_CLOSE(parsed.transposed(), big, 0);
+		CHECK_CLOSE(parsed.det(), NaiveDet(parsed), 1e-9);
+		block.setAt(1, 1, -4);
+		m2d::Matrix2D original = A;
+		A.invert(); // last, since it may replace the buffer the views refer to
+		CHECK_CLOSE(NaiveProduct(original, A), Identity(30), 1e-10);
+	}
+
+	void TestFloatSingleColumn() {
+		// An unpadded column of floats covers a fractional number of doubles: the buffer must still hold all of it,
+		// zeroed, even when recycled from a pool that last held nonzero data.
+		m2d::ScopedAllocator use(*m2d::PoolAllocator());
+		for (size_t n : { 1, 3, 5, 7, 17 }) {
+			{
+				m2d::Matrix2D dirty(1, 8);
+				for (size_t y = 0; y < 8; y++) dirty.setAt(0, y, 1.5);
+			}
+			m2d::MatrixF v(n, 1);
+			CHECK(v.data() != nullptr);
+			for (size_t x = 0; x < n; x++) CHECK(v.getAt(x, 0) == 0);
+			for (size_t x = 0; x < n; x++) v.setAt(x, 0, (float)x + 1);
+			m2d::MatrixF copy = v;
+			for (size_t x = 0; x < n; x++) CHECK(copy.getAt(x, 0) == (float)x + 1);
+		}
+		// The mixed-precision solver rounds into float matrices of exactly these shapes.
+		m2d::Matrix2D A(1, 1), b(1, 1);
+		A.setAt(0, 0, 4);
+		b.setAt(0, 0, 2);
+		CHECK_CLOSE(m2d::SolveMixedPrecision(A, b), m2d::solve(A, b), 1e-15);
+		for (size_t n : { 3, 9 }) {
+			m2d::Matrix2D M = RandomMatrix(n, n, 110 + (unsigned)n), r = RandomMatrix(n, 1, 120 + (unsigned)n);
+			for (size_t i = 0; i < n; i++) M.setAt(i, i, M.coeff(i, i) + n);
+			CHECK(Residual(M, m2d::SolveMixedPrecision(M, r), r) < 1e-14);
+		}
+	}
+
+	// Scratch file in the working directory, removed when the test is done.
+	struct ScratchFile {
+		string path;
+		explicit ScratchFile(const char *name) : path(string("Matrix2D_Tests_") + name) {}
+		~ScratchFile() { remove(path.c_str()); }
+	};
+
+	void TestBinaryIO() {
+		ScratchFile file("binary_io.m2d");
+		// Empty shapes have no buffer and no data section; the rest cover single columns, padding and views.
+		for (auto shape : vector<pair<size_t, size_t>>{ { 0, 0 }, { 0, 5 }, { 5, 0 }, { 1, 1 }, { 7, 1 }, { 3, 9 }, { 33, 17 } }) {
+			m2d::Matrix2D m = RandomMatrix(shape.first, shape.second, 130 + (unsigned)(shape.first * 40 + shape.second));
+			m2d::SaveBinary(file.path.c_str(), m);
+			m2d::Matrix2D loaded = m2d::LoadBinary(file.path.c_str());
+			CHECK_CLOSE(loaded, m, 0);
+			m2d::MappedMatrix mapped(file.path.c_str(), true);
+			CHECK_CLOSE(mapped.view(), m, 0);
+		}
+		m2d::Matrix2D big = RandomMatrix(20, 30, 140);
+		m2d::SaveBinary(file.path.c_str(), big.minorView(3, 4).transposed());
+		CHECK_CLOSE(m2d::LoadBinary(file.path.c_str()), big.minorView(3, 4).transposed(), 0);
+	}
+
+	void TestAdjugate() {
+		for (size_t n : { 1, 2, 6, 9 }) {
+			m2d::Matrix2D A = RandomMatrix(n, n, 50 + (unsigned)n);
+			CHECK_CLOSE(A.adjugate(), NaiveAdjugate(A), 1e-11);
+		}
+		// Rank n - 1, exactly and nearly: the LU route breaks down and the SVD fallback takes over.
+		m2d::Matrix2D R = RandomMatrix(7, 7, 60);
+		for (size_t y = 0; y < 7; y++) R.setAt(6, y, R.coeff(1, y) - 2 * R.coeff(4, y));
+		CHECK_CLOSE(R.adjugate(), NaiveAdjugate(R), 1e-11);
+		R.setAt(6, 6, R.coeff(6, 6) + 1e-13);
+		CHECK_CLOSE(R.adjugate(), NaiveAdjugate(R), 1e-11);
+		m2d::Matrix2D cof = R.cofactorMatrix(), adj = NaiveAdjugate(R);
+		adj.transpose();
+		CHECK_CLOSE(cof, adj, 1e-11);
+		// Rank n - 2: every cofactor vanishes.
+		m2d::Matrix2D D = RandomMatrix(6, 6, 61);
+		for (size_t y = 0; y < 6; y++) {
+			D.setAt(4, y, D.coeff(0, y));
+			D.setAt(5, y, D.coeff(1, y));
+		}
+		CHECK_CLOSE(D.adjugate(), m2d::Matrix2D(6, 6), 1e-12);
+	}
+
+	// Diagonally dominant, nonsymmetric, tridiagonal plus a few far entries.
+	m2d::SparseMatrix TestSparse(size_t n, bool symmetric) {
+		vector<m2d::Triplet> entries;
+		for (size_t i = 0; i < n; i++) {
+			entries.push_back({ i, i, 4.0 });
+			if (i > 0) entries.push_back({ i, i - 1, -1.0 });
+			if (i + 1 < n) entries.push_back({ i, i + 1, symmetric ? -1.0 : -1.5 });
+			if (i + 7 < n) {
+				entries.push_back({ i, i + 7, 0.5 });
+				entries.push_back({ i + 7, i, symmetric ? 0.5 : -0.25 });
+			}
+		}
+		return m2d::SparseMatrix(n, n, entries);
+	}
+
+	void TestSparseLU() {
+		m2d::SparseMatrix A = TestSparse(200, false);
+		m2d::Matrix2D dense = A.toDense(), B = RandomMatrix(200, 2, 70);
+		CHECK_CLOSE(A * B, NaiveProduct(dense, B), 1e-14);
+		for (m2d::SparseOrdering ordering : { m2d::SparseOrdering::Natural, m2d::SparseOrdering::ReverseCuthillMcKee }) {
+			m2d::SparseLU lu(A, ordering);
+			CHECK(Residual(dense, lu.solve(B), B) < 1e-13);
+		}
+	}
+
+	void TestKrylov() {
+		m2d::Matrix2D b = RandomMatrix(300, 1, 80);
+		m2d::SparseMatrix spd = TestSparse(300, true);
+		CHECK(spd.toDense().isSymmetric());
+		for (m2d::Preconditioner p : { m2d::Preconditioner::None, m2d::Preconditioner::Jacobi, m2d::Preconditioner::ILU0 }) {
+			m2d::Matrix2D x(300, 1);
+			m2d::IterativeResult result = m2d::ConjugateGradient(spd, b, x, m2d::IterativeOptions(), p);
+			CHECK(result.converged);
+			CHECK(Residual(spd.toDense(), x, b) < 1e-10);
+		}
+		m2d::SparseMatrix general = TestSparse(300, false);
+		for (m2d::Preconditioner p : { m2d::Preconditioner::None, m2d::Preconditioner::ILU0 }) {
+			m2d::Matrix2D x(300, 1);
+			m2d::IterativeResult result = m2d::GMRES(general, b, x, m2d::IterativeOptions(), p);
+			CHECK(result.converged);
+			CHECK(Residual(general.toDense(), x, b) < 1e-10);
+		}
+	}
+
+	void TestBlockMatrix() {
+		m2d::Matrix2D A = RandomMatrix(50, 50, 90), B = RandomMatrix(20, 50, 91), L = RandomMatrix(20, 20, 92);
+		for (size_t i = 0; i < 50; i++) A.setAt(i, i, A.coeff(i, i) + 10);
+		m2d::Matrix2D rhs = RandomMatrix(70, 3, 93);
+		// Saddle point [A B^T; B 0], through the Schur complement.
+		m2d::BlockMatrix K({ 50, 20 }, { 50, 20 });
+		K.setBlock(0, 0, A);
+		K.setBlock(0, 1, B.transposed());
+		K.setBlock(1, 0, B);
+		m2d::Matrix2D dense = K.toDense();
+		CHECK_CLOSE(dense, m2d::ConcatenateVertically(m2d::ConcatenateHorizontally(A, B.transposed()),
+			m2d::ConcatenateHorizontally(B, m2d::Matrix2D(20, 20))), 0);
+		CHECK_CLOSE(K * rhs, NaiveProduct(dense, rhs), 1e-14);
+		CHECK(Residual(dense, m2d::solve(K, rhs), rhs) < 1e-13);
+		// Block lower and upper triangular, with identity blocks.
+		m2d::BlockMatrix T({ 50, 20 }, { 50, 20 });
+		T.setBlock(0, 0, A);
+		T.setBlock(1, 0, B);
+		T.setIdentity(1, 1, -2.0);
+		CHECK(Residual(T.toDense(), m2d::solve(T, rhs), rhs) < 1e-13);
+		m2d::BlockMatrix U({ 50, 20 }, { 50, 20 });
+		U.setIdentity(0, 0, 3.0);
+		U.setBlock(0, 1, B.transposed());
+		U.setBlock(1, 1, L);
+		CHECK(Residual(U.toDense(), m2d::solve(U, rhs), rhs) < 1e-12);
+		// A leading block tiny next to its coupling: eliminating it first would lose everything to growth, so the
+		// solve must pivot across blocks, i.e. fall back to the dense solve.
+		m2d::Matrix2D tiny = RandomMatrix(20, 20, 94), A22 = RandomMatrix(20, 20, 95), b = RandomMatrix(40, 1, 96);
+		tiny *= 1e-12;
+		m2d::BlockMatrix P({ 20, 20 }, { 20, 20 });
+		P.setBlock(0, 0, tiny);
+		P.setIdentity(0, 1);
+		P.setIdentity(1, 0);
+		P.setBlock(1, 1, A22);
+		CHECK(Residual(P.toDense(), m2d::solve(P, b), b) < 1e-14);
+		// A partition that is not square falls back to the dense solve.
+		m2d::BlockMatrix G({ 50, 20 }, { 20, 50 });
+		G.setBlock(0, 1, A);
+		G.setIdentity(1, 0, 3.0);
+		CHECK(Residual(G.toDense(), m2d::solve(G, rhs), rhs) < 1e-13);
+	}
+
+	// Naive reference for alpha * P + beta * Q, reading both through coeff().
+	m2d::Matrix2D NaiveCombination(double alpha, m2d::ConstMatrixView P, double beta, m2d::ConstMatrixView Q) {
+		m2d::Matrix2D R(P.getSizeX(), P.getSizeY());
+		for (size_t x = 0; x < P.getSizeX(); x++)
+			for (size_t y = 0; y < P.getSizeY(); y++) R.setAt(x, y, alpha * P.coeff(x, y) + beta * Q.coeff(x, y));
+		return R;
+	}
+
+	// Overwrites the stack below the caller's frame, where temporaries of its previous statements lived.
+	void ClobberStack() {
+		volatile double junk[512];
+		for (size_t i = 0; i < 512; i++) junk[i] = -1e300;
+	}
+
+	void TestExpressionTemporaryViews() {
+		// The views are temporaries that die at the end of the first statement; the expression must have copied them.
+		m2d::Matrix2D A = RandomMatrix(6, 7, 105), B = RandomMatrix(6, 7, 106);
+		auto e = A.subView(1, 2, 3, 4) + 2 * B.transposed().subView(0, 1, 3, 4).transposed().transposed();
+		ClobberStack();
+		m2d::Matrix2D C = e;
+		CHECK_CLOSE(C, NaiveCombination(1, A.subView(1, 2, 3, 4), 2, B.transposed().subView(0, 1, 3, 4)), 1e-15);
+	}
+
+	void TestExpressionAliasing() {
+		// Each destination is also read transposed or through a minor: in place, it would see its own new values.
+		m2d::Matrix2D A = RandomMatrix(50, 50, 100), expected = NaiveCombination(1, A, 1, A.transposed());
+		A += A.transposed();
+		CHECK_CLOSE(A, expected, 1e-15);
+		m2d::Matrix2D C = RandomMatrix(150, 150, 101);
+		expected = NaiveCombination(2, C.transposed(), 0, C);
+		C = 2 * C.transposed();
+		CHECK_CLOSE(C, expected, 1e-15);
+		m2d::Matrix2D D = RandomMatrix(120, 120, 102);
+		expected = NaiveCombination(1, D, -1, D.transposed());
+		D -= D.transposed();
+		CHECK_CLOSE(D, expected, 1e-15);
+		// A minor of a larger matrix read into a block of the same matrix.
+		m2d::Matrix2D M = RandomMatrix(40, 40, 103);
+		m2d::MatrixView block = m2d::MatrixView(M).subView(0, 0, 39, 39);
+		expected = NaiveCombination(1, M.subView(0, 0, 39, 39), 3, M.minorView(0, 0));
+		block += 3 * M.minorView(0, 0);
+		CHECK_CLOSE(block, expected, 1e-15);
+		// The in-place path still applies, and still works, when the matrix is only read whole.
+		m2d::Matrix2D B = RandomMatrix(50, 50, 104);
+		expected = NaiveCombination(2, A, -1, B);
+		A = 2 * A - B;
+		CHECK_CLOSE(A, expected, 1e-15);
+	}
+
+	// Applies the row interchanges of an LU pivot vector to a copy of A, so that P * A can be compared with L * U.
+	m2d::Matrix2D PermuteRows(m2d::ConstMatrixView A, const vector<size_t> &piv) {
+		m2d::Matrix2D PA(A);
+		for (size_t k = 0; k < piv.size(); k++) {
+			if (piv[k] == k) continue;
+			for (size_t y = 0; y < PA.getSizeY(); y++) {
+				double t = PA.coeff(k, y);
+				PA.setAt(k, y, PA.coeff(piv[k], y));
+				PA.setAt(piv[k], y, t);
+			}
+		}
+		return PA;
+	}
+	// Multiplies the unit lower and upper triangles stored together in LU.
+	m2d::Matrix2D ExpandLU(m2d::ConstMatrixView LU) {
+		size_t n = LU.getSizeX();
+		m2d::Matrix2D L(n, n), U(n, n);
+		for (size_t x = 0; x < n; x++) {
+			for (size_t y = 0; y < n; y++) {
+				if (y < x) L.setAt(x, y, LU.coeff(x, y));
+				else U.setAt(x, y, LU.coeff(x, y));
+			}
+			L.setAt(x, x, 1);
+		}
+		return NaiveProduct(L, U);
+	}
+
+	void TestVectorTools() {
+		// Lengths 1 and 7 stay on the scalar tails; 100003 is split into chunks on the pool.
+		for (size_t n : { 1, 7, 100003 }) {
+			m2d::Matrix2D x = RandomMatrix(n, 1, 150), y = RandomMatrix(1, n, 151);
+			double dot = 0, sq = 0, abs_sum = 0;
+			size_t imax = 0;
+			for (size_t i = 0; i < n; i++) {
+				dot += x.coeff(i, 0) * y.coeff(0, i);
+				sq += x.coeff(i, 0) * x.coeff(i, 0);
+				abs_sum += fabs(x.coeff(i, 0));
+				if (fabs(x.coeff(i, 0)) > fabs(x.coeff(imax, 0))) imax = i;
+			}
+			CHECK_CLOSE(m2d::dot(x, y), dot, 1e-12);
+			CHECK_CLOSE(m2d::nrm2(x), sqrt(sq), 1e-14);
+			CHECK_CLOSE(m2d::asum(x), abs_sum, 1e-12);
+			CHECK(m2d::iamax(x) == imax);
+			m2d::Matrix2D z = x;
+			m2d::axpy(-2.5, y.transposed(), z);
+			CHECK_CLOSE(z, NaiveCombination(1, x, -2.5, y.transposed()), 1e-15);
+			m2d::scal(3, z);
+			CHECK_CLOSE(z, NaiveCombination(3, x, -7.5, y.transposed()), 1e-14);
+		}
+		// Strided slices of a matrix, and norms of values whose squares overflow or underflow.
+		m2d::Matrix2D M = RandomMatrix(40, 30, 152);
+		double dot = 0;
+		for (size_t i = 0; i < 30; i++) dot += M.coeff(3, i) * M.coeff(i, 7);
+		CHECK_CLOSE(m2d::dot(M.rowView(3), M.colView(7).subView(0, 0, 30, 1)), dot, 1e-14);
+		m2d::Matrix2D big(3, 1), tiny(3, 1);
+		for (size_t i = 0; i < 3; i++) {
+			big.setAt(i, 0, 1e200 * (i + 1));
+			tiny.setAt(i, 0, 1e-200 * (i + 1));
+		}
+		CHECK_CLOSE(m2d::nrm2(big) / 1e200, sqrt(14.0), 1e-15);
+		CHECK_CLOSE(m2d::nrm2(tiny) * 1e200, sqrt(14.0), 1e-15);
+		// gemv and ger, against products with the naive reference, including transposed A and a 1 x 1 case.
+		for (auto shape : vector<pair<size_t, size_t>>{ { 1, 1 }, { 9, 1 }, { 1, 9 }, { 300, 257 } }) {
+			size_t m = shape.first, n = shape.second;
+			m2d::Matrix2D A = RandomMatrix(m, n, 153), xv = RandomMatrix(n, 1, 154), xt = RandomMatrix(m, 1, 155);
+			m2d::Matrix2D y = RandomMatrix(m, 1, 156), yt = RandomMatrix(n, 1, 157);
+			m2d::Matrix2D expected = NaiveCombination(0.5, NaiveProduct(A, xv), -1, y);
+			m2d::gemv(0.5, A, xv, -1, y);
+			CHECK_CLOSE(y, expected, 1e-13);
+			expected = NaiveProduct(A.transposed(), xt);
+			yt.setAt(0, 0, numeric_limits<double>::quiet_NaN()); // beta = 0 must not read y
+			m2d::gemv(1, A.transposed(), xt, 0, yt);
+			CHECK_CLOSE(yt, expected, 1e-13);
+			expected = NaiveCombination(1, A, 2, NaiveProduct(xt, xv.transposed()));
+			m2d::ger(2, xt, xv, A);
+			CHECK_CLOSE(A, expected, 1e-14);
+		}
+		bool threw = false;
+		try { m2d::dot(RandomMatrix(3, 1, 0), RandomMatrix(4, 1, 0)); }
+		catch (const invalid_argument&) { threw = true; }
+		CHECK(threw);
+	}
+
+	void TestFixedMatrix() {
+		static_assert(m2d::Matrix<2, 2>(1, 2, 3, 4).det() == -2, "Fixed-size determinants are constant expressions.");
+		static_assert((m2d::Matrix<2, 2>::identity() * m2d::Matrix<2, 1>(5, 6)).coeff(1, 0) == 6, "So are products.");
+		auto fill = [](auto &m, unsigned seed) {
+			m2d::Matrix2D r = RandomMatrix(m.getSizeX(), m.getSizeY(), seed);
+			for (size_t x = 0; x < m.getSizeX(); x++)
+				for (size_t y = 0; y < m.getSizeY(); y++) m.setAt(x, y, r.coeff(x, y));
+		};
+		// Every closed form up to 4 x 4, then elimination at 5 x 5.
+		auto check_square = [&](auto m, unsigned seed) {
+			fill(m, seed);
+			m2d::Matrix2D dense = m.toMatrix();
+			CHECK_CLOSE(m.det(), NaiveDet(dense), 1e-13);
+			CHECK_CLOSE((m * m.inverse()).toMatrix(), Identity(m.getSizeX()), 1e-12);
+			CHECK_CLOSE((m * m).toMatrix(), NaiveProduct(dense, dense), 1e-15);
+			CHECK_CLOSE(m.transposed().toMatrix(), dense.transposed(), 0);
+			CHECK_CLOSE((2.0 * m - m).toMatrix(), dense, 1e-15);
+		};
+		check_square(m2d::Matrix<1, 1>(), 160);
+		check_square(m2d::Matrix<2, 2>(), 161);
+		check_square(m2d::Matrix<3, 3>(), 162);
+		check_square(m2d::Matrix<4, 4>(), 163);
+		check_square(m2d::Matrix<5, 5>(), 164);
+		m2d::Matrix<3, 4> P;
+		m2d::Matrix<4, 1> v;
+		fill(P, 165);
+		fill(v, 166);
+		CHECK_CLOSE((P * v).toMatrix(), NaiveProduct(P.toMatrix(), v.toMatrix()), 1e-15);
+		// Views of a fixed matrix feed the dynamic kernels.
+		CHECK_CLOSE(m2d::Matrix2D(P.view()) * v.view(), NaiveProduct(P.toMatrix(), v.toMatrix()), 1e-15);
+		bool threw = false;
+		try { P.getAt(3, 0); }
+		catch (const out_of_range&) { threw = true; }
+		CHECK(threw);
+	}
+
+	void TestMatrixBatch() {
+		// 13 matrices leave a partly padded block of lanes; sizes 1 to 3 use closed forms, 5 the batched LU.
+		for (size_t n : { 1, 2, 3, 5 }) {
+			size_t count = 13;
+			m2d::MatrixBatch A(count, n, n), B(count, n, n), C(count, n, n), rhs(count, n, 1);
+			vector<m2d::Matrix2D> a, b, r;
+			for (size_t i = 0; i < count; i++) {
+				a.push_back(RandomMatrix(n, n, 170 + (unsigned)(i * 10 + n)));
+				b.push_back(RandomMatrix(n, n, 370 + (unsigned)(i * 10 + n)));
+				r.push_back(RandomMatrix(n, 1, 570 + (unsigned)(i * 10 + n)));
+				A.set(i, a[i]);
+				B.set(i, b[i]);
+				rhs.set(i, r[i]);
+			}
+			m2d::BatchMultiply(A, B, C);
+			vector<double> det = m2d::BatchDet(A);
+			CHECK(det.size() == count);
+			m2d::MatrixBatch X = rhs, inv = A;
+			m2d::BatchSolve(A, X);
+			m2d::BatchInvert(inv);
+			for (size_t i = 0; i < count; i++) {
+				CHECK_CLOSE(C.get(i), NaiveProduct(a[i], b[i]), 1e-15);
+				CHECK_CLOSE(det[i], NaiveDet(a[i]), 1e-13);
+				CHECK(Residual(a[i], X.get(i), r[i]) < 1e-14);
+				CHECK_CLOSE(NaiveProduct(a[i], inv.get(i)), Identity(n), 1e-11);
+			}
+		}
+		bool threw = false;
+		try { m2d::MatrixBatch(2, 2, 2).set(2, Identity(2)); }
+		catch (const out_of_range&) { threw = true; }
+		CHECK(threw);
+	}
+
+	// Naive references for the other element types.
+	template <class T>
+	m2d::BasicMatrix<T> RandomMatrixOf(size_t rows, size_t cols, unsigned seed) {
+		m2d::Matrix2D re = RandomMatrix(rows, cols, seed), im = RandomMatrix(rows, cols, seed + 1000);
+		m2d::BasicMatrix<T> m(rows, cols);
+		for (size_t x = 0; x < rows; x++) {
+			for (size_t y = 0; y < cols; y++) {
+				if constexpr (is_same<T, float>::value) m.setAt(x, y, (float)re.coeff(x, y));
+				else m.setAt(x, y, T((typename T::value_type)re.coeff(x, y), (typename T::value_type)im.coeff(x, y)));
+			}
+		}
+		return m;
+	}
+	template <class T>
+	m2d::BasicMatrix<T> NaiveProductOf(const m2d::BasicMatrix<T> &A, const m2d::BasicMatrix<T> &B) {
+		m2d::BasicMatrix<T> C(A.getSizeX(), B.getSizeY());
+		for (size_t x = 0; x < A.getSizeX(); x++) {
+			for (size_t y = 0; y < B.getSizeY(); y++) {
+				T sum = 0;
+				for (size_t k = 0; k < A.getSizeY(); k++) sum += A.coeff(x, k) * B.coeff(k, y);
+				C.setAt(x, y, sum);
+			}
+		}
+		return C;
+	}
+	template <class T>
+	double MaxRelativeErrorOf(const m2d::BasicMatrix<T> &actual, const m2d::BasicMatrix<T> &expected) {
+		if (actual.getSizeX() != expected.getSizeX() || actual.getSizeY() != expected.getSizeY())
+			return numeric_limits<double>::infinity();
+		double error = 0, scale = 1;
+		for (size_t x = 0; x < actual.getSizeX(); x++) {
+			for (size_t y = 0; y < actual.getSizeY(); y++) {
+				double d = (double)abs(actual.coeff(x, y) - expected.coeff(x, y));
+				if (!(d == d)) return numeric_limits<double>::infinity();
+				error = max(error, d);
+				scale = max(scale, (double)abs(expected.coeff(x, y)));
+			}
+		}
+		return error / scale;
+	}
+	template <class T>
+	T NaiveDetOf(m2d::BasicMatrix<T> a) {
+		size_t n = a.getSizeX();
+		T det = 1;
+		for (size_t k = 0; k < n; k++) {
+			size_t p = k;
+			for (size_t i = k + 1; i < n; i++) if (abs(a.coeff(i, k)) > abs(a.coeff(p, k))) p = i;
+			if (p != k) {
+				for (size_t j = 0; j < n; j++) swap(a.coeffRef(p, j), a.coeffRef(k, j));
+				det = -det;
+			}
+			det *= a.coeff(k, k);
+			for (size_t i = k + 1; i < n; i++) {
+				T f = a.coeff(i, k) / a.coeff(k, k);
+				for (size_t j = k; j < n; j++) a.coeffRef(i, j) -= f * a.coeff(k, j);
+			}
+		}
+		return det;
+	}
+	template <class T>
+	void CheckElementType(double tolerance) {
+		for (size_t n : { 1, 3, 70 }) {
+			m2d::BasicMatrix<T> A = RandomMatrixOf<T>(n, n, 180 + (unsigned)n), B = RandomMatrixOf<T>(n, 1, 190 + (unsigned)n);
+			for (size_t i = 0; i < n; i++) A.coeffRef(i, i) += T((float)n);
+			CHECK(MaxRelativeErrorOf(A * B, NaiveProductOf(A, B)) < tolerance);
+			if (n < 20) { // the determinant of the largest one overflows float
+				T det = A.det(), expected = NaiveDetOf(A);
+				CHECK((double)abs(det - expected) <= tolerance * (double)abs(expected) * n);
+			}
+			m2d::BasicMatrix<T> X = m2d::solve(A, B);
+			CHECK(MaxRelativeErrorOf(NaiveProductOf(A, X), B) < tolerance * n);
+			m2d::BasicMatrix<T> inv = A, I(n, n);
+			inv.invert();
+			for (size_t i = 0; i < n; i++) I.setAt(i, i, 1);
+			CHECK(MaxRelativeErrorOf(NaiveProductOf(A, inv), I) < tolerance * n);
+			m2d::BasicMatrix<T> At = A;
+			At.transpose();
+			for (size_t x = 0; x < n; x++)
+				for (size_t y = 0; y < n; y++) CHECK(At.coeff(x, y) == A.coeff(y, x));
+			CHECK(MaxRelativeErrorOf(A + A - A * T(2), m2d::BasicMatrix<T>(n, n)) < tolerance);
+		}
+	}
+
+	void TestElementTypes() {
+		CheckElementType<float>(1e-5);
+		CheckElementType<complex<float>>(1e-5);
+		CheckElementType<complex<double>>(1e-13);
+		m2d::Matrix2D D = RandomMatrix(5, 1, 195);
+		m2d::MatrixF F = m2d::MatrixCast<float>(D);
+		for (size_t x = 0; x < 5; x++) CHECK(F.coeff(x, 0) == (float)D.coeff(x, 0));
+		// Mixed precision refines a float LU to double accuracy, and falls back on what float cannot hold.
+		for (size_t n : { 1, 2, 60 }) {
+			m2d::Matrix2D A = RandomMatrix(n, n, 196 + (unsigned)n), b = RandomMatrix(n, 3, 197);
+			for (size_t i = 0; i < n; i++) A.setAt(i, i, A.coeff(i, i) + 4);
+			int iterations = 0;
+			CHECK(Residual(A, m2d::SolveMixedPrecision(A, b, &iterations), b) < 1e-15);
+			CHECK(iterations >= 0);
+			A.setAt(0, 0, 1e300);
+			CHECK(Residual(A, m2d::SolveMixedPrecision(A, b, &iterations), b) < 1e-15);
+			CHECK(iterations == -1);
+		}
+	}
+
+	void TestTextIO() {
+		// The serial path, single values, single columns and views as targets.
+		for (auto shape : vector<pair<size_t, size_t>>{ { 1, 1 }, { 6, 1 }, { 1, 6 }, { 8, 9 } }) {
+			m2d::Matrix2D m = RandomMatrix(shape.first, shape.second, 200), parsed(shape.first, shape.second);
+			string text = "  ";
+			char number[32];
+			for (size_t x = 0; x < m.getSizeX(); x++) {
+				for (size_t y = 0; y < m.getSizeY(); y++) {
+					snprintf(number, sizeof number, "%.17g%s", m.coeff(x, y), y + 1 < m.getSizeY() ? "\t" : "\n");
+					text += number;
+				}
+			}
+			text += "trailing";
+			const char *end = m2d::ParseText(text.data(), text.data() + text.size(), parsed);
+			CHECK_CLOSE(parsed, m, 0);
+			CHECK(string(end) == "\ntrailing" || string(end) == "trailing");
+		}
+		m2d::Matrix2D target(2, 2);
+		const char good[] = "1 -2.5e3 inf 4", short_text[] = "1 2 3", bad[] = "1 2 x 4";
+		m2d::ParseText(good, good + strlen(good), target);
+		CHECK(target.coeff(0, 1) == -2500 && isinf(target.coeff(1, 0)) && target.coeff(1, 1) == 4);
+		for (const char *text : { short_text, bad }) {
+			bool threw = false;
+			try { m2d::ParseText(text, text + strlen(text), target); }
+			catch (const invalid_argument&) { threw = true; }
+			CHECK(threw);
+		}
+	}
+
+	void TestTiledMatrix() {
+		ScratchFile fa("tiled_a.m2d"), fb("tiled_b.m2d"), fc("tiled_c.m2d");
+		// Shapes that leave partial tiles on both edges, and a single column.
+		for (auto shape : vector<array<size_t, 3>>{ { 37, 45, 29 }, { 9, 1, 5 }, { 1, 1, 1 } }) {
+			m2d::Matrix2D a = RandomMatrix(shape[0], shape[1], 210), b = RandomMatrix(shape[1], shape[2], 211);
+			m2d::TiledMatrix A(fa.path.c_str(), shape[0], shape[1], 8), B(fb.path.c_str(), shape[1], shape[2], 8);
+			m2d::TiledMatrix C(fc.path.c_str(), shape[0], shape[2], 8);
+			A.assign(a);
+			B.assign(b);
+			CHECK_CLOSE(A.toMatrix(), a, 0);
+			m2d::Multiply(A, B, C, 1 << 16);
+			CHECK_CLOSE(C.toMatrix(), NaiveProduct(a, b), 1e-14);
+		}
+		// Reopening the file gives the same matrix.
+		{
+			m2d::TiledMatrix C(fc.path.c_str());
+			CHECK(C.getSizeX() == 1 && C.getSizeY() == 1 && C.getTileSize() == 8);
+		}
+		for (size_t n : { 1, 40 }) {
+			m2d::Matrix2D a = RandomMatrix(n, n, 212);
+			m2d::TiledMatrix A(fa.path.c_str(), n, n, 8);
+			A.assign(a);
+			vector<size_t> piv = m2d::LUFactorize(A, 1 << 16);
+			CHECK_CLOSE(ExpandLU(A.toMatrix()), PermuteRows(a, piv), 1e-14);
+		}
+	}
+
+	void TestStationaryIterations() {
+		m2d::SparseMatrix general = TestSparse(200, false), spd = TestSparse(200, true);
+		m2d::Matrix2D b = RandomMatrix(200, 1, 220);
+		CHECK(general.isDiagonallyDominant());
+		m2d::IterativeOptions options;
+		options.max_iterations = 2000;
+		for (const m2d::SparseMatrix *A : { &general, &spd }) {
+			m2d::Matrix2D x(200, 1);
+			m2d::IterativeResult result = m2d::Jacobi(*A, b, x, options);
+			CHECK(result.converged);
+			CHECK(Residual(A->toDense(), x, b) < 1e-10);
+			m2d::Matrix2D y(200, 1);
+			result = m2d::GaussSeidel(*A, b, y, options);
+			CHECK(result.converged);
+			CHECK(Residual(A->toDense(), y, b) < 1e-10);
+		}
+		options.relaxation = 1.3; // SOR, which converges for any SPD matrix
+		m2d::Matrix2D x(200, 1);
+		CHECK(m2d::GaussSeidel(spd, b, x, options).converged);
+		CHECK(Residual(spd.toDense(), x, b) < 1e-10);
+		// A 1 x 1 system converges in one step.
+		m2d::SparseMatrix one(1, 1, vector<m2d::Triplet>{ { 0, 0, 4.0 } });
+		m2d::Matrix2D b1(1, 1), x1(1, 1);
+		b1.setAt(0, 0, 2);
+		CHECK(m2d::Jacobi(one, b1, x1).converged && x1.coeff(0, 0) == 0.5);
+		bool threw = false;
+		options.relaxation = 2.0;
+		try { m2d::GaussSeidel(spd, b, x, options); }
+		catch (const invalid_argument&) { threw = true; }
+		CHECK(threw);
+	}
+
+	void TestSymmetricAndQR() {
+		for (size_t n : { 1, 5, 130 }) {
+			m2d::Matrix2D M = RandomMatrix(n, n, 230 + (unsigned)n), B = RandomMatrix(n, 2, 231);
+			m2d::Matrix2D A = NaiveProduct(M, M.transposed());
+			for (size_t i = 0; i < n; i++) A.setAt(i, i, A.coeff(i, i) + 1);
+			// Cholesky: L * L^T = A, with a zeroed upper triangle, then a solve.
+			m2d::Matrix2D L = A;
+			CHECK(m2d::CholeskyFactorize(L));
+			for (size_t x = 0; x < n; x++)
+				for (size_t y = x + 1; y < n; y++) CHECK(L.coeff(x, y) == 0);
+			CHECK_CLOSE(NaiveProduct(L, L.transposed()), A, 1e-13);
+			m2d::Matrix2D X = B;
+			m2d::CholeskySolve(L, X);
+			CHECK(Residual(A, X, B) < 1e-14);
+			// LDL^T of a quasi-definite matrix [A C; C^T -A]: L * D * L^T = K.
+			m2d::Matrix2D K = m2d::ConcatenateVertically(m2d::ConcatenateHorizontally(A, M),
+				m2d::ConcatenateHorizontally(M.transposed(), m2d::Matrix2D(-1.0 * A)));
+			m2d::Matrix2D LD = K;
+			CHECK(m2d::LDLFactorize(LD));
+			m2d::Matrix2D Lu(2 * n, 2 * n), D(2 * n, 2 * n);
+			for (size_t x = 0; x < 2 * n; x++) {
+				for (size_t y = 0; y < x; y++) Lu.setAt(x, y, LD.coeff(x, y));
+				Lu.setAt(x, x, 1);
+				D.setAt(x, x, LD.coeff(x, x));
+			}
+			CHECK_CLOSE(NaiveProduct(NaiveProduct(Lu, D), Lu.transposed()), K, 1e-12);
+			m2d::Matrix2D KB = RandomMatrix(2 * n, 1, 232), Y = KB;
+			m2d::LDLSolve(LD, Y);
+			CHECK(Residual(K, Y, KB) < 1e-13);
+			// Not positive definite.
+			m2d::Matrix2D N = -1.0 * A;
+			CHECK(!m2d::CholeskyFactorize(N));
+		}
+		// QR of tall, square, single-column and wide matrices: Q orthogonal and Q * R = A.
+		for (auto shape : vector<pair<size_t, size_t>>{ { 1, 1 }, { 5, 1 }, { 150, 70 }, { 40, 40 }, { 6, 9 } }) {
+			size_t m = shape.first, n = shape.second;
+			m2d::Matrix2D A = RandomMatrix(m, n, 240 + (unsigned)m), QR = A;
+			vector<double> tau = m2d::QRFactorize(QR);
+			CHECK(tau.size() == min(m, n));
+			m2d::Matrix2D Q = Identity(m), R(m, n);
+			m2d::QRMultiply(QR, tau, Q, false);
+			for (size_t x = 0; x < m; x++)
+				for (size_t y = x; y < n; y++) R.setAt(x, y, QR.coeff(x, y));
+			CHECK_CLOSE(NaiveProduct(Q.transposed(), Q), Identity(m), 1e-13);
+			CHECK_CLOSE(NaiveProduct(Q, R), A, 1e-13);
+			m2d::Matrix2D Qt = Q;
+			m2d::QRMultiply(QR, tau, Qt, true);
+			CHECK_CLOSE(Qt, Identity(m), 1e-13);
+		}
+		// Least squares against the normal equations, on a well-conditioned system where both are accurate.
+		m2d::Matrix2D A = RandomMatrix(90, 12, 250), b = RandomMatrix(90, 2, 251);
+		m2d::Matrix2D normal = m2d::solve(m2d::ConstMatrixView(NaiveProduct(A.transposed(), A)), NaiveProduct(A.transposed(), b));
+		CHECK_CLOSE(m2d::LeastSquares(A, b), normal, 1e-12);
+		m2d::Matrix2D QR = A;
+		vector<double> tau = m2d::QRFactorize(QR);
+		CHECK_CLOSE(m2d::QRSolve(QR, tau, b), normal, 1e-12);
+		// A rank-deficient A.
+		for (size_t x = 0; x < 90; x++) A.setAt(x, 11, A.coeff(x, 0));
+		bool threw = false;
+		try { m2d::LeastSquares(A, b); }
+		catch (const range_error&) { threw = true; }
+		CHECK(threw);
+	}
+
+	void TestTaskGraph() {
+		m2d::Matrix2D a = RandomMatrix(60, 60, 260), b = RandomMatrix(60, 60, 261), r = RandomMatrix(60, 1, 262);
+		for (size_t i = 0; i < 60; i++) a.setAt(i, i, a.coeff(i, i) + 8);
+		m2d::TaskGraph graph;
+		m2d::DeferredMatrix A = graph.input(a), B = graph.input(b), R = graph.input(m2d::Matrix2D(r));
+		m2d::DeferredMatrix C = A * B + B * A - 2.0 * A;
+		m2d::DeferredMatrix X = m2d::solve(A, R);
+		m2d::DeferredMatrix H = m2d::ConcatenateHorizontally(A.transposed(), B.subMatrix(0, 0, 60, 1));
+		m2d::DeferredMatrix I = A.inverse();
+		m2d::DeferredScalar d = (A + B).det();
+		CHECK(!C.isReady() && !d.isReady());
+		{
+			m2d::DeferredMatrix dead = A * A * A; // unreachable by evaluation time: never computed
+		}
+		graph.evaluate();
+		CHECK(C.isReady() && d.isReady());
+		m2d::Matrix2D AB = NaiveProduct(a, b), BA = NaiveProduct(b, a), expected(60, 60);
+		for (size_t x = 0; x < 60; x++)
+			for (size_t y = 0; y < 60; y++) expected.setAt(x, y, AB.coeff(x, y) + BA.coeff(x, y) - 2 * a.coeff(x, y));
+		CHECK_CLOSE(C.get(), expected, 1e-14);
+		CHECK(Residual(a, X.get(), r) < 1e-14);
+		CHECK_CLOSE(H.get(), m2d::ConcatenateHorizontally(a.transposed(), b.subView(0, 0, 60, 1)), 0);
+		CHECK_CLOSE(NaiveProduct(a, I.get()), Identity(60), 1e-12);
+		m2d::Matrix2D sum = NaiveCombination(1, a, 1, b);
+		CHECK_CLOSE(d.get(), NaiveDet(sum), 1e-9);
+		// The + and - chain fuses into one pass, and the dead product is skipped.
+		CHECK(graph.lastScheduled() < graph.size() - 3);
+		// A 1 x 1 graph, evaluated lazily by get().
+		m2d::TaskGraph small;
+		m2d::Matrix2D one(1, 1);
+		one.setAt(0, 0, 3);
+		m2d::DeferredMatrix O = small.input(one);
+		CHECK((O * O - O).get().coeff(0, 0) == 6);
+		bool threw = false;
+		try { A + R; }
+		catch (const invalid_argument&) { threw = true; }
+		CHECK(threw);
+	}
+
+	void TestAllocators() {
+		m2d::Matrix2D a = RandomMatrix(70, 50, 270), b = RandomMatrix(50, 40, 271);
+		m2d::Matrix2D expected = NaiveProduct(a, b);
+		{
+			// A freed buffer is recycled by the next allocation of its size class on this thread, zeroed again.
+			m2d::ScopedAllocator use(*m2d::PoolAllocator());
+			const double *first;
+			{
+				m2d::Matrix2D m = a * b;
+				CHECK_CLOSE(m, expected, 1e-14);
+				first = m.data();
+			}
+			m2d::Matrix2D again(70, 40);
+			CHECK(again.data() == first);
+			CHECK_CLOSE(again, m2d::Matrix2D(70, 40), 0);
+			m2d::Matrix2D column(3, 1);
+			for (size_t x = 0; x < 3; x++) CHECK(column.coeff(x, 0) == 0);
+		}
+		m2d::MatrixArena arena(1 << 12);
+		for (int round = 0; round < 3; round++) {
+			{
+				m2d::ScopedAllocator use(arena);
+				m2d::Matrix2D m = a * b, c(1, 1);
+				CHECK(arena.liveBlocks() >= 2);
+				CHECK_CLOSE(m, expected, 1e-14);
+				CHECK(c.coeff(0, 0) == 0);
+				bool threw = false;
+				try { arena.reset(); }
+				catch (const logic_error&) { threw = true; }
+				CHECK(threw);
+			}
+			CHECK(arena.liveBlocks() == 0);
+			arena.reset();
+		}
+	}
+
+	void TestProfiler() {
+		bool was_enabled = m2d::IsProfilingEnabled();
+		m2d::ResetProfile();
+		m2d::SetProfilingEnabled(true);
+		m2d::Matrix2D a = RandomMatrix(30, 20, 280), b = RandomMatrix(20, 10, 281);
+		m2d::Matrix2D c = a * b;
+		c = a * b;
+		m2d::SetProfilingEnabled(was_enabled);
+		m2d::Matrix2D ignored = a * b;
+		const m2d::OperationProfile *multiply = nullptr;
+		vector<m2d::OperationProfile> snapshot = m2d::GetProfileSnapshot();
+		for (const m2d::OperationProfile &p : snapshot) if (!strcmp(p.name, "multiply")) multiply = &p;
+		CHECK(multiply != nullptr);
+		CHECK(multiply->calls == 2);
+		CHECK(multiply->flops == 2 * 2.0 * 30 * 20 * 10);
+		CHECK(multiply->min_ns <= multiply->max_ns && multiply->max_ns <= multiply->total_ns);
+		uint64_t counted = 0;
+		for (uint64_t h : multiply->histogram) counted += h;
+		CHECK(counted == 2);
+		CHECK(multiply->allocations >= 2);
+		ScratchFile trace("trace.json");
+		m2d::WriteChromeTrace(trace.path.c_str());
+		FILE *f = fopen(trace.path.c_str(), "rb");
+		CHECK(f != nullptr);
+		string json;
+		char buffer[4096];
+		for (size_t got; (got = fread(buffer, 1, sizeof buffer, f)) > 0; ) json.append(buffer, got);
+		fclose(f);
+		CHECK(json.find("\"multiply\"") != string::npos);
+		m2d::ResetProfile();
+		CHECK(m2d::GetProfileSnapshot().empty());
+	}
+
+	struct Test {
+		const char *name;
+		void (*run)();
+	};
+	const Test kTests[] = {
+		{ "gemm_views", TestGemmViews },
+		{ "lu", TestLU },
+		{ "factor_cache_updates", TestFactorCacheUpdates },
+		{ "factor_cache_views", TestFactorCacheViews },
+		{ "float_single_column", TestFloatSingleColumn },
+		{ "binary_io", TestBinaryIO },
+		{ "adjugate", TestAdjugate },
+		{ "sparse_lu", TestSparseLU },
+		{ "krylov", TestKrylov },
+		{ "block_matrix", TestBlockMatrix },
+		{ "expression_aliasing", TestExpressionAliasing },
+		{ "expression_temporary_views", TestExpressionTemporaryViews },
+		{ "vector_tools", TestVectorTools },
+		{ "fixed_matrix", TestFixedMatrix },
+		{ "matrix_batch", TestMatrixBatch },
+		{ "element_types", TestElementTypes },
+		{ "text_io", TestTextIO },
+		{ "tiled_matrix", TestTiledMatrix },
+		{ "stationary_iterations", TestStationaryIterations },
+		{ "symmetric_and_qr", TestSymmetricAndQR },
+		{ "task_graph", TestTaskGraph },
+		{ "allocators", TestAllocators },
+		{ "profiler", TestProfiler },
+	};
+}
+
+int main(int argc, char **argv) {
+	string filter;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--filter") && i + 1 < argc) filter = argv[++i];
+		else {
+			fprintf(stderr, "Usage: %s [--filter name]\n", argv[0]);
+			return 100;
+		}
+	}
+	int failed = 0, run = 0;
+	for (size_t threads : { 1, 4 }) {
+		m2d::SetThreadCount(threads);
+		for (const Test &test : kTests) {
+			if (!filter.empty() && string(test.name).find(filter) == string::npos) continue;
+			run++;
+			try {
+				test.run();
+				printf("PASS %s (%zu threads)\n", test.name, threads);
+			}
+			catch (const exception &e) {
+				failed++;
+				printf("FAIL %s (%zu threads): %s\n", test.name, threads, e.what());
+			}
+		}
+	}
+	printf("%d of %d passed\n", run - failed, run);
+	return min(failed, 100);
+}